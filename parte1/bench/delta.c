@@ -0,0 +1,169 @@
+// benchmark de la subida delta (include/delta.h). Parte de un archivo
+// "viejo" sintético, le aplica ediciones típicas de una re-subida y hace lo
+// que hacen servidor y cliente: firmar el viejo, buscar sus bloques en el
+// nuevo, armar la receta de cada DATA y reconstruir el bloque con ella. Cada
+// bloque reconstruido se compara con el original. Salida en CSV:
+//   escenario,bytes,coincidentes_pct,cable_pct,firmar_MBps,buscar_MBps,aplicar_MBps
+// (cable_pct = payloads de los DATA / tamaño del archivo nuevo)
+//
+// uso: make micro && build/bench_delta [MB_del_archivo]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/common.h"
+#include "../include/delta.h"
+
+
+uint64_t ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// bytes pseudoaleatorios (splitmix64): el byte bajo de rand_r se repite cada
+// 16 MB, y el archivo viejo no puede tener bloques repetidos por casualidad
+uint8_t aleatorio(uint64_t* estado) {
+    uint64_t z = (*estado += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (z ^ (z >> 31)) >> 56;
+}
+
+
+// nuevo = viejo con `cambios` ediciones (reemplazos, inserciones y borrados
+// de hasta `largo` bytes) en lugares al azar. Devuelve el tamaño del nuevo
+size_t editar(const uint8_t* viejo, size_t tam, uint8_t* nuevo, int cambios, int largo, uint64_t* semilla) {
+    size_t n = 0;
+    size_t pos = 0;
+    for (int c = 0; c < cambios; c++) {
+        size_t hasta = pos + ((uint64_t)aleatorio(semilla) << 24 | aleatorio(semilla) << 16 |
+                              aleatorio(semilla) << 8 | aleatorio(semilla)) % (2 * tam / cambios + 1);
+        if (hasta > tam) {
+            hasta = tam;
+        }
+        memcpy(nuevo + n, viejo + pos, hasta - pos);
+        n += hasta - pos;
+        pos = hasta;
+        int l = 1 + (aleatorio(semilla) << 8 | aleatorio(semilla)) % largo;
+        int tipo = aleatorio(semilla) % 3;
+        if (tipo != 2) {            // reemplazo o inserción: bytes nuevos
+            for (int i = 0; i < l; i++) {
+                nuevo[n++] = aleatorio(semilla);
+            }
+        }
+        if (tipo != 1) {            // reemplazo o borrado: se saltean bytes viejos
+            pos = (pos + l < tam) ? pos + l : tam;
+        }
+    }
+    memcpy(nuevo + n, viejo + pos, tam - pos);
+    return n + tam - pos;
+}
+
+
+int medir(const char* escenario, const uint8_t* viejo, size_t tam_viejo, const uint8_t* nuevo, size_t tam) {
+    ArchivoPrevio p;
+    memset(&p, 0, sizeof(p));
+    p.mapa = (const char*)viejo;
+    p.tam = tam_viejo;
+    p.bloque = delta_bloque_firma(tam_viejo);
+    p.largo = (tam_viejo + p.bloque - 1) / p.bloque * DELTA_FIRMA;
+    p.firmas = malloc(p.largo);
+
+    uint64_t t0 = ahora_ns();
+    delta_firmar(&p);
+    uint64_t t1 = ahora_ns();
+
+    Delta d;
+    memset(&d, 0, sizeof(d));
+    d.bloque = p.bloque;
+    d.tam_viejo = tam_viejo;
+    if (!p.firmas || delta_buscar(&d, (const char*)nuevo, tam, p.firmas) != 0) {
+        perror("malloc");
+        return -1;
+    }
+    uint64_t t2 = ahora_ns();
+
+    // los DATA de la subida, como en el cliente y el servidor
+    char receta[V2_DATA_SIZE];
+    char armado[V2_DATA_SIZE];
+    uint64_t cable = 0;
+    uint64_t ns_aplicar = 0;
+    for (size_t off = 0; off < tam; off += V2_DATA_SIZE) {
+        int n = (tam - off < V2_DATA_SIZE) ? (int)(tam - off) : V2_DATA_SIZE;
+        int r = delta_receta(&d, off, (const char*)nuevo + off, n, receta);
+        if (r == 0) {
+            cable += n;
+            continue;
+        }
+        cable += r;
+        uint64_t a = ahora_ns();
+        int len = delta_aplicar(receta, r, armado, V2_DATA_SIZE, &p);
+        ns_aplicar += ahora_ns() - a;
+        if (len != n || memcmp(armado, nuevo + off, n) != 0) {
+            fprintf(stderr, "%s: bloque en %zu mal reconstruido (%d de %d bytes)\n", escenario, off, len, n);
+            return -1;
+        }
+    }
+
+    printf("%s,%zu,%.1f,%.2f,%.0f,%.0f,%.0f\n", escenario, tam, 100.0 * d.coincidentes / tam,
+           100.0 * cable / tam, tam_viejo * 1e3 / (t1 - t0), tam * 1e3 / (t2 - t1),
+           ns_aplicar ? tam * 1e3 / ns_aplicar : 0.0);
+    delta_free(&d);
+    free(p.firmas);
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t tam = (size_t)(argc > 1 ? atoi(argv[1]) : 64) << 20;
+    uint8_t* viejo = malloc(tam);
+    uint8_t* nuevo = malloc(2 * tam + (1 << 20));
+    if (!viejo || !nuevo) {
+        perror("malloc");
+        return 1;
+    }
+    uint64_t semilla = 1;
+    for (size_t i = 0; i < tam; i++) {
+        viejo[i] = aleatorio(&semilla);
+    }
+
+    printf("escenario,bytes,coincidentes_pct,cable_pct,firmar_MBps,buscar_MBps,aplicar_MBps\n");
+    if (medir("igual", viejo, tam, viejo, tam) != 0) {
+        return 1;
+    }
+    struct {
+        const char* nombre;
+        int cambios;
+        int largo;
+    } escenarios[] = {
+        {"1 cambio", 1, 100},
+        {"10 cambios", 10, 100},
+        {"1000 cambios", 1000, 100},
+        {"10000 cambios", 10000, 20},
+    };
+    for (size_t i = 0; i < sizeof(escenarios) / sizeof(escenarios[0]); i++) {
+        size_t n = editar(viejo, tam, nuevo, escenarios[i].cambios, escenarios[i].largo, &semilla);
+        if (medir(escenarios[i].nombre, viejo, tam, nuevo, n) != 0) {
+            return 1;
+        }
+    }
+
+    // un byte insertado al principio: todo corrido, lo encuentra el checksum rodante
+    nuevo[0] = 0x55;
+    memcpy(nuevo + 1, viejo, tam);
+    if (medir("corrido 1 byte", viejo, tam, nuevo, tam + 1) != 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < tam; i++) {
+        nuevo[i] = aleatorio(&semilla);
+    }
+    if (medir("distinto", viejo, tam, nuevo, tam) != 0) {
+        return 1;
+    }
+
+    free(viejo);
+    free(nuevo);
+    return 0;
+}
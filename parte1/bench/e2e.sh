@@ -0,0 +1,189 @@
+#!/bin/bash
+# benchmark de punta a punta en loopback: subidas, descargas y subidas delta
+# reales entre cliente y servidor sobre una matriz de tamaños de archivo x
+# clientes simultáneos x pérdida x sentido. La pérdida se emula con el proxy
+# de la parte 2 (pérdida aleatoria con semilla fija en ambos sentidos); sin
+# pérdida los clientes van directo al servidor. Cada celda levanta un
+# servidor nuevo en un directorio vacío y verifica con cmp cada archivo
+# subido o bajado.
+#
+# casos de borde: el tamaño de 3 bytes deja el último bloque (el único) más
+# corto que 5 bytes, el caso en que el CRC del DATA no se puede armar con una
+# constante de salto (ver crc32c_salto). Las subidas delta (el servidor ya
+# tiene el mismo archivo) van con bloque de 4095 (MODO_DELTA): las firmas de
+# 1M y 8M (8 y 16 KB, ver delta_bloque_firma) le bajan al cliente con un
+# último bloque de 2 y 4 bytes
+#
+# salida en CSV por stdout, una línea por celda:
+#   commit,servidor,modo,sentido,bytes,clientes,perdida_pct,fallos,goodput_MBps,p50_s,p99_s,cpu_s_por_GB,retransmisiones
+#  - commit: HEAD del repo (con + si hay cambios sin commitear), para comparar corridas
+#  - goodput: bytes de archivo de todos los clientes / tiempo de pared de la celda
+#  - p50/p99: tiempo de cada transferencia (percentil por rango más cercano)
+#  - cpu por GB: user + sys de servidor y clientes (no del proxy) por GiB transferido
+#  - retransmisiones: las que informan los clientes (solo las transferencias que terminan)
+#  - una transferencia que no termina en TIMEOUT segundos cuenta como fallo
+#
+# variables de entorno (con sus defaults):
+#   TAMANOS="3 64K 1M 8M"  CLIENTES="1 4 16"  PERDIDAS="0 1 5"  SENTIDOS="subida descarga delta"
+#   MODO="-w 64"  MODO_DELTA="-D -m 4111"  SERVIDOR="servidorN -t 0"  SEMILLA=1  TIMEOUT=120
+# las descargas son MODO más -d y las delta MODO más MODO_DELTA (solo
+# servidorN; ninguna de las dos va con -1, -P ni -r)
+#
+# uso: make bench   o   TAMANOS=1M CLIENTES=8 MODO="-w 64 -z" bench/e2e.sh >> resultados.csv
+
+set -e
+
+TAMANOS=${TAMANOS:-"3 64K 1M 8M"}
+CLIENTES=${CLIENTES:-"1 4 16"}
+PERDIDAS=${PERDIDAS:-"0 1 5"}
+SENTIDOS=${SENTIDOS:-"subida descarga delta"}
+MODO_DELTA=${MODO_DELTA:-"-D -m 4111"}
+MODO=${MODO:-"-w 64"}
+SERVIDOR=${SERVIDOR:-"servidorN -t 0"}
+SEMILLA=${SEMILLA:-1}
+TIMEOUT=${TIMEOUT:-120}
+PUERTO_PROXY=20253
+
+RAIZ=$(cd "$(dirname "$0")/.." && pwd)
+BIN="$RAIZ/build"
+TMP=$(mktemp -d)
+SERVIDOR_PID=
+PROXY_PID=
+trap 'detener; rm -rf "$TMP"' EXIT
+
+make -s -C "$RAIZ" all build/proxy >&2
+
+COMMIT=$(git -C "$RAIZ" rev-parse --short HEAD 2>/dev/null || echo "-")
+if [ "$COMMIT" != "-" ] && ! git -C "$RAIZ" diff --quiet HEAD -- . 2>/dev/null; then
+    COMMIT="$COMMIT+"
+fi
+TICKS=$(getconf CLK_TCK)
+
+
+detener() {
+    for pid in $PROXY_PID $SERVIDOR_PID; do
+        kill "$pid" 2>/dev/null || true
+        wait "$pid" 2>/dev/null || true
+    done
+    PROXY_PID=
+    SERVIDOR_PID=
+    return 0
+}
+
+
+# 64K, 1M, 8M -> bytes
+bytes() {
+    case "$1" in
+        *K) echo $(( ${1%K} * 1024 )) ;;
+        *M) echo $(( ${1%M} * 1024 * 1024 )) ;;
+        *G) echo $(( ${1%G} * 1024 * 1024 * 1024 )) ;;
+        *)  echo "$1" ;;
+    esac
+}
+
+
+# segundos de CPU (user + sys) que lleva un proceso vivo
+cpu_proceso() {
+    awk -v hz="$TICKS" '{ printf "%.3f", ($14 + $15) / hz }' "/proc/$1/stat"
+}
+
+
+# archivo que deja la transferencia N: el subido en el servidor o el bajado
+destino() {
+    if [ "$1" = descarga ]; then
+        echo "$TMP/bajada_$2"
+    else
+        echo "$TMP/srv/$(printf 'e2e%05d' "$2")"
+    fi
+}
+
+
+# una transferencia cronometrada: deja "real user sys" en tiempo_N y el código de salida en rc_N.
+# Las descargas bajan todas el mismo archivo del servidor (e2e_orig)
+transferir() {
+    local i=$1 origen=$2 puerto=$3 sentido=$4
+    local TIMEFORMAT='%3R %3U %3S'
+    local rc=0
+    local args="$origen $(printf 'e2e%05d' "$i")"
+    if [ "$sentido" = descarga ]; then
+        args="-d $(destino descarga "$i") e2e_orig"
+    elif [ "$sentido" = delta ]; then
+        args="$MODO_DELTA $args"
+    fi
+    { time timeout "$TIMEOUT" "$BIN/cliente" $MODO $puerto 127.0.0.1 $args \
+          > "$TMP/cli_$i.log" 2>&1 || rc=$?; } 2> "$TMP/tiempo_$i"
+    echo "$rc" > "$TMP/rc_$i"
+}
+
+
+celda() {
+    local tam=$1 clientes=$2 perdida=$3 sentido=$4
+    local origen="$TMP/origen_$tam.bin"
+    local srv="$TMP/srv"
+    local puerto=
+
+    rm -rf "$srv" "$TMP"/cli_* "$TMP"/tiempo_* "$TMP"/rc_* "$TMP"/bajada_*
+    mkdir -p "$srv"
+    if [ "$sentido" = descarga ]; then
+        cp "$origen" "$srv/e2e_orig"
+    elif [ "$sentido" = delta ]; then
+        for i in $(seq 1 "$clientes"); do
+            cp "$origen" "$srv/$(printf 'e2e%05d' "$i")"
+        done
+    fi
+    (cd "$srv" && exec "$BIN"/$SERVIDOR > "$TMP/servidor.log" 2>&1) &
+    SERVIDOR_PID=$!
+    if [ "$perdida" != 0 ]; then
+        "$BIN/proxy" -u -l "$PUERTO_PROXY" -s 127.0.0.1 -L "$perdida" -S "$SEMILLA" > "$TMP/proxy.log" 2>&1 &
+        PROXY_PID=$!
+        puerto="-p $PUERTO_PROXY"
+    fi
+    sleep 0.3
+
+    local inicio=$(date +%s.%N)
+    local pids=
+    for i in $(seq 1 "$clientes"); do
+        transferir "$i" "$origen" "$puerto" "$sentido" &
+        pids="$pids $!"
+    done
+    wait $pids
+    local fin=$(date +%s.%N)
+    local cpu_servidor=$(cpu_proceso "$SERVIDOR_PID")
+    detener
+
+    local fallos=0
+    for i in $(seq 1 "$clientes"); do
+        if [ "$(cat "$TMP/rc_$i")" != 0 ] || ! cmp -s "$origen" "$(destino "$sentido" "$i")"; then
+            fallos=$((fallos + 1))
+        fi
+    done
+    local retx=$(cat "$TMP"/cli_*.log | awk '/^Retransmisiones:/ { s += $2 } END { print s + 0 }')
+
+    cat "$TMP"/tiempo_* | sort -n | awk -v commit="$COMMIT" -v servidor="$SERVIDOR" -v modo="$MODO" -v sentido="$sentido" \
+        -v bytes="$(bytes "$tam")" -v c="$clientes" -v p="$perdida" -v fallos="$fallos" \
+        -v i="$inicio" -v f="$fin" -v cpu_srv="$cpu_servidor" -v retx="$retx" '
+        { real[NR] = $1; cpu += $2 + $3 }
+        END {
+            total = bytes * c
+            p50 = real[int((NR * 50 + 99) / 100)]
+            p99 = real[int((NR * 99 + 99) / 100)]
+            printf "%s,%s,%s,%s,%d,%d,%s,%d,%.1f,%.3f,%.3f,%.2f,%d\n", commit, servidor, modo, sentido, bytes, c, p,
+                   fallos, total / 1048576 / (f - i), p50, p99, (cpu + cpu_srv) / (total / 1073741824), retx
+        }'
+}
+
+
+for tam in $TAMANOS; do
+    head -c "$(bytes "$tam")" /dev/urandom > "$TMP/origen_$tam.bin"
+done
+
+echo "commit,servidor,modo,sentido,bytes,clientes,perdida_pct,fallos,goodput_MBps,p50_s,p99_s,cpu_s_por_GB,retransmisiones"
+for sentido in $SENTIDOS; do
+    for tam in $TAMANOS; do
+        for clientes in $CLIENTES; do
+            for perdida in $PERDIDAS; do
+                celda "$tam" "$clientes" "$perdida" "$sentido"
+            done
+        done
+    done
+done
@@ -0,0 +1,57 @@
+#!/bin/sh
+# benchmark de escalado de servidorN con la cantidad de workers (-t).
+# levanta el servidor en loopback, lanza C clientes en modo ventana que suben
+# M MB cada uno en paralelo y mide el throughput agregado. Salida en CSV:
+#   workers,clientes,bytes,segundos,MBps
+#
+# uso: bench/escalado.sh [clientes] [MB_por_cliente] [workers ...]
+# ej:  bench/escalado.sh 16 20 1 2 4 8
+
+set -e
+
+CLIENTES=${1:-8}
+MB=${2:-20}
+[ $# -gt 2 ] && shift 2 || set --
+WORKERS=${*:-"1 2 4 $(nproc)"}
+
+RAIZ=$(cd "$(dirname "$0")/.." && pwd)
+TMP=$(mktemp -d)
+SERVIDOR_PID=
+trap '[ -n "$SERVIDOR_PID" ] && kill $SERVIDOR_PID 2>/dev/null; rm -rf "$TMP"' EXIT
+
+make -s -C "$RAIZ" build/servidorN build/cliente >&2
+head -c $((MB * 1024 * 1024)) /dev/urandom > "$TMP/origen.bin"
+
+echo "workers,clientes,bytes,segundos,MBps"
+
+for t in $WORKERS; do
+    mkdir -p "$TMP/srv_$t"
+    (cd "$TMP/srv_$t" && exec "$RAIZ/build/servidorN" -t "$t" > /dev/null) &
+    SERVIDOR_PID=$!
+    sleep 0.5
+
+    inicio=$(date +%s.%N)
+    pids=
+    for i in $(seq 1 "$CLIENTES"); do
+        "$RAIZ/build/cliente" -w 64 127.0.0.1 "$TMP/origen.bin" "$(printf 'up%04d' "$i")" > /dev/null &
+        pids="$pids $!"
+    done
+    fallos=0
+    for p in $pids; do
+        wait "$p" || fallos=$((fallos + 1))
+    done
+    fin=$(date +%s.%N)
+
+    kill "$SERVIDOR_PID"
+    wait "$SERVIDOR_PID" 2>/dev/null || true
+    SERVIDOR_PID=
+    rm -rf "$TMP/srv_$t"
+
+    if [ "$fallos" -gt 0 ]; then
+        echo "workers=$t: $fallos clientes fallaron" >&2
+    fi
+    awk -v t="$t" -v c="$CLIENTES" -v mb="$MB" -v i="$inicio" -v f="$fin" 'BEGIN {
+        bytes = c * mb * 1048576; seg = f - i;
+        printf "%d,%d,%d,%.3f,%.1f\n", t, c, bytes, seg, bytes / 1048576 / seg
+    }'
+done
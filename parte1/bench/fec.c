@@ -0,0 +1,206 @@
+// benchmark del FEC del modo ventana (include/fec.h).
+//
+// primero verifica que los kernels acelerados de producto por constante den lo
+// mismo que la tabla, y que con hasta m pérdidas (entre DATA y paridades) de
+// grupos de distintos k y m el receptor reconstruya exactamente los DATA
+// faltantes; después mide el throughput de cada kernel y el de codificar un
+// grupo entero (lo que el cliente agrega por DATA). Salida en CSV:
+//   implementacion,bytes_por_bloque,GBps,ns_por_bloque
+//
+// uso: make micro && build/bench_fec [MB_por_medicion]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/common.h"
+#include "../include/fec.h"
+
+
+uint64_t ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+int verificar_kernel(const char* nombre, void (*f)(uint8_t*, const uint8_t*, uint8_t, size_t),
+                     const uint8_t* buf, size_t max) {
+    uint8_t* a = malloc(max + 8);
+    uint8_t* b = malloc(max + 8);
+    for (int c = 0; c < 256; c += (c < 4) ? 1 : 37) {
+        for (size_t n = 0; n <= max; n += (n < 128) ? 1 : 331) {
+            for (size_t alineacion = 0; alineacion < 8; alineacion += 3) {
+                memcpy(a, buf + max, n + 8);
+                memcpy(b, buf + max, n + 8);
+                gf_mul_sumar_sw(a + alineacion, buf + alineacion, c, n);
+                f(b + alineacion, buf + alineacion, c, n);
+                if (memcmp(a, b, n + 8) != 0) {
+                    fprintf(stderr, "%s: producto distinto con c=%d n=%zu\n", nombre, c, n);
+                    free(a);
+                    free(b);
+                    return -1;
+                }
+            }
+        }
+    }
+    free(a);
+    free(b);
+    return 0;
+}
+
+
+// codifica un grupo de n DATA con largos variados, pierde e de ellos y m - e
+// paridades como mucho, y comprueba lo reconstruido
+int verificar_grupo(const uint8_t* buf, int k, int m, int n, int bloque, unsigned* semilla) {
+    FecEmisor emisor;
+    FecReceptor* receptor = fec_receptor_nuevo(k, m, bloque, 4 * k);
+    if (fec_emisor_init(&emisor, k, m, bloque) != 0 || !receptor) {
+        perror("malloc");
+        return -1;
+    }
+    uint32_t g = 1 + rand_r(semilla) % 1000;
+    int largos[FEC_K_MAX];
+    const uint8_t* payloads[FEC_K_MAX];
+    for (int i = 0; i < n; i++) {
+        largos[i] = (i == n - 1) ? 1 + rand_r(semilla) % bloque : bloque - rand_r(semilla) % 3;
+        payloads[i] = buf + rand_r(semilla) % 4096;
+        fec_emisor_agregar(&emisor, g * k + i, i & 1, payloads[i], largos[i]);
+    }
+
+    // e DATA perdidos y p paridades recibidas, con e <= p <= m
+    int e = rand_r(semilla) % (m + 1);
+    if (e > n) {
+        e = n;
+    }
+    int p = e + rand_r(semilla) % (m - e + 1);
+    uint32_t perdidos = 0;
+    while (__builtin_popcount(perdidos) < e) {
+        perdidos |= 1U << (rand_r(semilla) % n);
+    }
+    for (int i = 0; i < n; i++) {
+        if (!(perdidos & (1U << i))) {
+            fec_receptor_data(receptor, g * k + i, i & 1, payloads[i], largos[i]);
+        }
+    }
+    int recibidas = 0;
+    for (int j = m - 1; j >= 0 && recibidas < p; j--) {
+        int len;
+        const uint8_t* paridad = fec_emisor_paridad(&emisor, j, &len);
+        if (fec_receptor_paridad(receptor, g, paridad, len) != 0) {
+            fprintf(stderr, "paridad %d rechazada (k=%d m=%d)\n", j, k, m);
+            return -1;
+        }
+        recibidas++;
+    }
+
+    uint32_t seqs[FEC_M_MAX];
+    int res = fec_receptor_recuperar(receptor, g, seqs);
+    int error = (res != e);
+    for (int y = 0; y < res && !error; y++) {
+        int i = seqs[y] - g * k;
+        uint8_t flags;
+        int len;
+        const char* d = fec_recuperado(receptor, y, &flags, &len);
+        error = i < 0 || i >= n || !(perdidos & (1U << i)) || !d || len != largos[i] ||
+                flags != (i & 1) || memcmp(d, payloads[i], len) != 0;
+    }
+    if (error) {
+        fprintf(stderr, "reconstrucción incorrecta: k=%d m=%d n=%d, %d perdidos, %d paridades, %d recuperados\n",
+                k, m, n, e, p, res);
+    }
+    fec_emisor_free(&emisor);
+    fec_receptor_free(receptor);
+    return error ? -1 : 0;
+}
+
+
+void medir(const char* nombre, void (*f)(uint8_t*, const uint8_t*, uint8_t, size_t),
+           const uint8_t* buf, size_t bloque, size_t total) {
+    size_t vueltas = total / bloque;
+    uint8_t* dst = calloc(1, bloque);
+
+    f(dst, buf, 0x53, bloque);      // calentar
+    uint64_t t0 = ahora_ns();
+    for (size_t i = 0; i < vueltas; i++) {
+        f(dst, buf + (i * bloque) % (total - bloque + 1), 0x53 + (i & 0x7F), bloque);
+    }
+    uint64_t ns = ahora_ns() - t0;
+
+    printf("%s,%zu,%.2f,%.1f\n", nombre, bloque, (double)vueltas * bloque / ns, (double)ns / vueltas);
+    free(dst);
+}
+
+
+// lo que cuesta en el cliente sumar cada DATA a las m paridades del grupo
+void medir_emisor(int k, int m, const uint8_t* buf, int bloque, size_t total) {
+    FecEmisor emisor;
+    if (fec_emisor_init(&emisor, k, m, bloque) != 0) {
+        perror("malloc");
+        return;
+    }
+    size_t vueltas = total / bloque;
+    uint64_t t0 = ahora_ns();
+    for (size_t i = 0; i < vueltas; i++) {
+        fec_emisor_agregar(&emisor, i, 0, buf + (i * bloque) % (total - bloque + 1), bloque);
+    }
+    uint64_t ns = ahora_ns() - t0;
+
+    char nombre[64];
+    snprintf(nombre, sizeof(nombre), "emisor k=%d m=%d", k, m);
+    printf("%s,%d,%.2f,%.1f\n", nombre, bloque, (double)vueltas * bloque / ns, (double)ns / vueltas);
+    fec_emisor_free(&emisor);
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+    uint8_t* buf = malloc(total + 8);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    for (size_t i = 0; i < total + 8; i++) {
+        buf[i] = (uint8_t)(i * 2654435761U >> 13);
+    }
+
+    fprintf(stderr, "implementacion activa: %s\n", gf_nombre);
+#if defined(__x86_64__)
+    if ((__builtin_cpu_supports("ssse3") && verificar_kernel("ssse3", gf_mul_sumar_ssse3, buf, 3000) != 0) ||
+        (__builtin_cpu_supports("avx2") && verificar_kernel("avx2", gf_mul_sumar_avx2, buf, 3000) != 0)) {
+        return 1;
+    }
+#endif
+    unsigned semilla = 1;
+    int ks[] = {1, 2, 3, 8, 16, 32};
+    for (size_t x = 0; x < sizeof(ks) / sizeof(ks[0]); x++) {
+        for (int m = 1; m <= FEC_M_MAX; m++) {
+            for (int prueba = 0; prueba < 200; prueba++) {
+                int n = (prueba % 4 == 0) ? 1 + rand_r(&semilla) % ks[x] : ks[x];
+                int bloque = (prueba & 1) ? V2_BLOQUE_MIN : V2_DATA_SIZE;
+                if (verificar_grupo(buf, ks[x], m, n, bloque, &semilla) != 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    size_t bloques[] = {64, V2_DATA_SIZE, 65536};
+    printf("implementacion,bytes_por_bloque,GBps,ns_por_bloque\n");
+    for (size_t i = 0; i < sizeof(bloques) / sizeof(bloques[0]); i++) {
+        medir("tabla", gf_mul_sumar_sw, buf, bloques[i], total);
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("ssse3")) {
+            medir("ssse3", gf_mul_sumar_ssse3, buf, bloques[i], total);
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            medir("avx2", gf_mul_sumar_avx2, buf, bloques[i], total);
+        }
+#endif
+    }
+    medir_emisor(8, 1, buf, V2_DATA_SIZE, total);
+    medir_emisor(8, 2, buf, V2_DATA_SIZE, total);
+    medir_emisor(16, 4, buf, V2_DATA_SIZE, total);
+
+    free(buf);
+    return 0;
+}
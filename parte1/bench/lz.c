@@ -0,0 +1,122 @@
+// benchmark de la compresión por bloque (include/lz.h) tal como la usa el
+// cliente: cada archivo se parte en DATA de V2_DATA_SIZE bytes y un bloque
+// se envía comprimido solo si achica. Mide cuántos bytes salen al cable y lo
+// que cuesta en CPU comprimir (cliente) y descomprimir (servidor), y con eso
+// estima el throughput neto de un enlace de cada velocidad: el archivo llega
+// a ratio x la velocidad del enlace, hasta que manda la CPU del compresor.
+// Salida en CSV:
+//   archivo,bytes,comprimidos_pct,ratio,comp_MBps,descomp_MBps,neto_100Mbps,neto_1Gbps,neto_10Gbps
+// (neto_* en Mbit/s de archivo: sin comprimir serían 100, 1000 y 10000)
+//
+// uso: make micro && build/bench_lz data/dumps/* data/g23.data
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../include/common.h"
+#include "../include/lz.h"
+
+#define VUELTAS_MIN_BYTES (64 << 20)     // se repite cada archivo hasta procesar al menos esto
+
+
+uint64_t ahora_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+double neto_mbps(double enlace_mbps, double ratio, double comp_MBps) {
+    double por_enlace = enlace_mbps * ratio;
+    double por_cpu = comp_MBps * 8;
+    return (por_enlace < por_cpu) ? por_enlace : por_cpu;
+}
+
+
+int medir(const char* ruta) {
+    FILE* f = fopen(ruta, "rb");
+    if (!f) {
+        perror(ruta);
+        return -1;
+    }
+    struct stat st;
+    fstat(fileno(f), &st);
+    size_t n = st.st_size;
+    char* datos = malloc(n + 1);
+    char* salida = malloc(((n + V2_DATA_SIZE - 1) / V2_DATA_SIZE + 1) * V2_DATA_SIZE);
+    if (!datos || !salida || fread(datos, 1, n, f) != n) {
+        perror("lectura");
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    // una pasada para ver qué sale al cable (y verificar la ida y vuelta)
+    size_t bloques = 0, comprimidos = 0, cable = 0;
+    size_t largos[(n + V2_DATA_SIZE - 1) / V2_DATA_SIZE + 1];
+    char* p = salida;
+    for (size_t off = 0; off < n; off += V2_DATA_SIZE, bloques++) {
+        int largo = (n - off < V2_DATA_SIZE) ? (int)(n - off) : V2_DATA_SIZE;
+        int c = lz_comprimir(datos + off, largo, p, largo - 1);
+        char vuelta[V2_DATA_SIZE];
+        if (c > 0 && (lz_descomprimir(p, c, vuelta, V2_DATA_SIZE) != largo ||
+                      memcmp(vuelta, datos + off, largo) != 0)) {
+            fprintf(stderr, "%s: el bloque %zu no vuelve igual\n", ruta, bloques);
+            return -1;
+        }
+        largos[bloques] = (c > 0) ? (size_t)c : 0;
+        comprimidos += (c > 0);
+        cable += (c > 0) ? (size_t)c : (size_t)largo;
+        p += V2_DATA_SIZE;
+    }
+
+    size_t vueltas = VUELTAS_MIN_BYTES / (n ? n : 1) + 1;
+    volatile int sumidero = 0;
+
+    uint64_t t0 = ahora_ns();
+    for (size_t v = 0; v < vueltas; v++) {
+        for (size_t off = 0; off < n; off += V2_DATA_SIZE) {
+            int largo = (n - off < V2_DATA_SIZE) ? (int)(n - off) : V2_DATA_SIZE;
+            char tmp[V2_DATA_SIZE];
+            sumidero += lz_comprimir(datos + off, largo, tmp, largo - 1);
+        }
+    }
+    double comp_MBps = (double)vueltas * n / 1e6 / ((ahora_ns() - t0) / 1e9);
+
+    t0 = ahora_ns();
+    for (size_t v = 0; v < vueltas; v++) {
+        for (size_t b = 0; b < bloques; b++) {
+            char tmp[V2_DATA_SIZE];
+            if (largos[b]) {
+                sumidero += lz_descomprimir(salida + b * V2_DATA_SIZE, largos[b], tmp, V2_DATA_SIZE);
+            }
+        }
+    }
+    double descomp_MBps = (double)vueltas * n / 1e6 / ((ahora_ns() - t0) / 1e9);
+
+    double ratio = cable ? (double)n / cable : 1;
+    printf("%s,%zu,%.0f,%.2f,%.0f,%.0f,%.0f,%.0f,%.0f\n", ruta, n,
+           bloques ? 100.0 * comprimidos / bloques : 0, ratio, comp_MBps, descomp_MBps,
+           neto_mbps(100, ratio, comp_MBps), neto_mbps(1000, ratio, comp_MBps),
+           neto_mbps(10000, ratio, comp_MBps));
+
+    free(datos);
+    free(salida);
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "uso: %s archivo...\n", argv[0]);
+        return 1;
+    }
+
+    printf("archivo,bytes,comprimidos_pct,ratio,comp_MBps,descomp_MBps,neto_100Mbps,neto_1Gbps,neto_10Gbps\n");
+    int error = 0;
+    for (int i = 1; i < argc; i++) {
+        error |= medir(argv[i]);
+    }
+    return error ? 1 : 0;
+}
@@ -1,3 +1,6 @@
+#ifndef COMMON_H
+#define COMMON_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +12,11 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <stdint.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/random.h>
+#include "crc32c.h"
+#include "log.h"
 
 
 #define SERVER_PORT "20252"
@@ -20,6 +28,79 @@
 #define DATA  3
 #define ACK   4
 #define FIN   5
+#define SONDA 6     // v2: sonda del camino, el servidor la confirma con un ACK del mismo seq
+#define RRQ   7     // v2: pedido de descarga, el servidor envía los DATA y el FIN (ver descarga.h)
+#define PARIDAD 8   // v2: paridad de un grupo de DATA (seq = grupo), sin ACK (ver fec.h)
+
+// protocolo v2: se negocia en el HELLO con OPT_VERSION. Todo lo que sigue al
+// HELLO (WRQ, DATA, FIN y sus ACKs) usa PDU_v2. Los DATA van en modo ventana
+// (Selective Repeat) con hasta OPT_VENTANA PDUs en vuelo
+#define V2_VERSION 2
+#define V2_FLAG 0x80             // bit alto del 2do byte: un App_PDU v1 solo usa seq 0 o 1
+#define V2_HEADER_SIZE 16
+#define V2_DATA_SIZE (PDU_HEADER_SIZE + MAX_DATA_SIZE - V2_HEADER_SIZE)   // mismo datagrama máximo que v1
+#define DATAGRAMA_MAX 65507      // payload UDP máximo de un datagrama IPv4
+#define V2_BLOQUE_MAX (DATAGRAMA_MAX - V2_HEADER_SIZE)
+#define V2_BLOQUE_MIN (576 - 28 - V2_HEADER_SIZE)       // datagrama que todo camino IPv4 transporta
+#define BUFFER_SOCKET (8 << 20)  // SO_RCVBUF que piden los servidores: entra una ventana de bloques grandes
+#define V2_SEQ_WRQ 0xFFFFFFFF    // seq del WRQ: no se confunde con el ACK de ningún DATA
+#define V2_SEQ_SONDA 0x80000000  // | largo del datagrama: seq de una SONDA, tampoco se confunde
+#define VENTANA_MAX 256          // máximo de PDUs en vuelo que acepta el servidor
+
+// opciones de negociación (TLV: tag, largo, valor) que viajan detrás del '\0' de la credencial
+// en el HELLO, y detrás de un '\0' inicial en el ACK del HELLO (y del WRQ de una subida
+// reanudable). Un servidor v1 las ignora porque solo compara la credencial con strcmp.
+// tag 0 = fin de la lista
+#define OPT_FIN     0
+#define OPT_VENTANA 1   // uint16_t (network order): PDUs en vuelo
+#define OPT_TAMANO  2   // uint64_t (big endian): tamaño del archivo, en el WRQ detrás del '\0' del nombre
+#define OPT_VERSION 3   // uint8_t: versión del protocolo para el resto de la sesión
+#define OPT_SESION  4   // uint32_t (network order): id de sesión v2 asignado por el servidor
+#define OPT_RANGO   5   // OptRango: en el WRQ v2 de cada sesión de una subida en paralelo
+#define OPT_REANUDAR 6  // uint64_t (big endian): id de la transferencia, en el WRQ de una subida reanudable
+#define OPT_DESDE   7   // uint64_t (big endian): en el ACK del WRQ, offset desde el que sigue el cliente
+#define OPT_DIGEST  8   // uint32_t (network order): en el FIN, CRC32C de lo subido (ver fin_con_digest)
+#define OPT_COMPRESION 9    // uint8_t: códec de los DATA, pedido en el HELLO y aceptado en su ACK
+#define OPT_BLOQUE  10  // uint16_t (network order): payload de los DATA v2 (ver abajo)
+#define OPT_SACK    11  // HELLO: uint8_t 1 = pedirlo/aceptarlo. ACK de un DATA: ver abajo
+#define OPT_FEC     12  // HELLO: uint8_t k + uint8_t m, DATA por grupo y paridades (ver fec.h)
+#define OPT_DELTA   13  // WRQ: uint8_t 1 = subida delta. ACK del WRQ: uint32_t bloque de firma + uint64_t tamaño previo (ver delta.h)
+#define OPT_TICKET  14  // HELLO: uint8_t 1 = pedirlo. ACK del HELLO y WRQ de una sesión sin HELLO: el ticket (ver ticket.h)
+#define OPT_WRQ     15  // HELLO v2: el payload entero del WRQ (nombre '\0' + opciones), que el servidor
+                        // procesa detrás del HELLO; su ACK v2 sale detrás del del HELLO. ACK del HELLO: uint8_t 1 = tomado
+
+// tamaño de bloque v2: en el HELLO el cliente pide un máximo y el servidor
+// responde con el que acepta (sin la opción: V2_DATA_SIZE). El cliente sondea
+// el camino hasta ese máximo con PDUs SONDA de tamaño creciente (seq =
+// V2_SEQ_SONDA | largo del datagrama) y manda en el WRQ el bloque elegido.
+// Cada DATA lleva un bloque lleno salvo el último: offset = seq * bloque
+
+// SACK (modo ventana): si se aceptó en el HELLO, cada ACK de un DATA lleva
+// además, como opción, el estado de la ventana del servidor: uint32_t base
+// (network order: primer seq sin confirmar, todo lo anterior ya está) y un
+// mapa de bits de [base + 1, base + ventana): bit i (byte i / 8, bit i % 8) =
+// seq base + 1 + i confirmado. Los bytes en cero del final no se mandan. Con
+// eso un ACK perdido no obliga a reenviar su DATA, y el cliente ve los huecos
+// sin esperar su timer
+#define SACK_MAPA_MAX ((VENTANA_MAX + 7) / 8)
+
+// compresión por bloque (include/lz.h): cada DATA se comprime por separado y
+// solo si achica. Uno comprimido lleva V2_COMPRIMIDO en flags (v2) o
+// V1_COMPRIMIDO en seq_num (v1, que solo usa seq 0 o 1); su offset y su seq
+// son los del bloque sin comprimir
+#define COMPRESION_LZ 1
+#define V2_COMPRIMIDO 0x40
+#define V1_COMPRIMIDO 0x40
+
+// subida delta (include/delta.h): un DATA v2 con V2_DELTA lleva la receta de
+// su bloque (copias del archivo que el servidor ya tenía + literales). Mismo
+// seq y offset que el bloque armado
+#define V2_DELTA 0x20
+
+// sesión sin HELLO (include/ticket.h): DATA y PARIDAD enviados antes del ACK
+// del WRQ con el ticket. Si llegan de otra dirección que la de la sesión se
+// descartan en vez de tomarse como un cambio de NAT
+#define V2_TEMPRANO 0x10
 
 
 typedef struct {
@@ -29,6 +110,31 @@ typedef struct {
 } __attribute__((packed)) App_PDU;  // packed para evitar padding
 
 
+// PDU v2: todos los campos multibyte en network order. Un ACK es solo el
+// header (len = 0); si trae payload es un mensaje de error del servidor, salvo
+// que empiece con '\0': entonces son opciones TLV, como en el ACK del HELLO
+typedef struct {
+    uint8_t type;              // WRQ, RRQ, DATA, PARIDAD, ACK o FIN
+    uint8_t flags;             // V2_FLAG | versión, más V2_COMPRIMIDO o V2_DELTA en un DATA
+    uint16_t len;              // bytes de payload
+    uint32_t sesion;           // id asignado en el ACK del HELLO: sobrevive a un cambio de IP/puerto
+    uint32_t seq;              // DATA: nro de bloque (offset = seq * bloque), FIN: total de bloques
+    uint32_t crc;              // CRC32C de header (con crc = 0) + payload
+    char data[V2_DATA_SIZE];   // los DATA pueden ser más largos (OPT_BLOQUE): se arman con iovec
+} __attribute__((packed)) PDU_v2;
+
+
+// valor de OPT_RANGO (multibyte en network order). Las N sesiones de una
+// subida en paralelo comparten grupo y nombre de archivo; cada una sube los
+// bytes desde `desde` y sus DATA van a desde + seq * bloque
+typedef struct {
+    uint32_t grupo;            // elegido al azar por el cliente
+    uint16_t indice;           // 0 .. total-1
+    uint16_t total;            // rangos en los que se partió el archivo
+    uint64_t desde;
+} __attribute__((packed)) OptRango;
+
+
 // debugging
 const char* type_to_string(uint8_t type) {
     switch(type) {
@@ -37,14 +143,195 @@ const char* type_to_string(uint8_t type) {
         case DATA:  return "DATA";
         case ACK:   return "ACK";
         case FIN:   return "FIN";
+        case SONDA: return "SONDA";
+        case RRQ:   return "RRQ";
+        case PARIDAD: return "PARIDAD";
         default:    return "UNKNOWN";
     }
 }
 
 // debugging
 void print_pdu(const char* prefix, App_PDU* pdu) {
-    printf("%s [Type=%s, Seq=%d]\n", 
+    LOG(LOG_DETALLE, "%s [Type=%s, Seq=%d]\n", 
             prefix, 
             type_to_string(pdu->type), 
             pdu->seq_num);
-}
\ No newline at end of file
+}
+
+
+// tiempo monotónico en microsegundos (para timers, no se ve afectado por cambios de hora)
+uint64_t get_monotonic_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+// completa el header v2 y calcula el CRC sobre header + payload, que puede
+// estar en otro lado (se envía con un iovec aparte). Devuelve el largo total
+int v2_sellar_flags(PDU_v2* pdu, uint8_t type, uint8_t flags, uint32_t sesion, uint32_t seq,
+                    const void* payload, int len) {
+    pdu->type = type;
+    pdu->flags = V2_FLAG | V2_VERSION | flags;
+    pdu->len = htons(len);
+    pdu->sesion = htonl(sesion);
+    pdu->seq = htonl(seq);
+    pdu->crc = 0;
+    pdu->crc = htonl(crc32c(crc32c(0, pdu, V2_HEADER_SIZE), payload, len));
+    return V2_HEADER_SIZE + len;
+}
+
+
+int v2_sellar_con(PDU_v2* pdu, uint8_t type, uint32_t sesion, uint32_t seq, const void* payload, int len) {
+    return v2_sellar_flags(pdu, type, 0, sesion, seq, payload, len);
+}
+
+
+// igual, con el CRC32C del payload ya calculado (salto = crc32c_salto(len), o
+// 0 con un len que no tiene la constante: crc32c_salto pide len >= 5): para
+// reenviar o sellar un payload sin volver a recorrerlo
+int v2_sellar_crc(PDU_v2* pdu, uint8_t type, uint8_t flags, uint32_t sesion, uint32_t seq,
+                  uint32_t crc_payload, uint32_t salto, int len) {
+    pdu->type = type;
+    pdu->flags = V2_FLAG | V2_VERSION | flags;
+    pdu->len = htons(len);
+    pdu->sesion = htonl(sesion);
+    pdu->seq = htonl(seq);
+    pdu->crc = 0;
+    uint32_t crc_header = crc32c(0, pdu, V2_HEADER_SIZE);
+    pdu->crc = htonl(salto ? crc32c_combinar_salto(crc_header, crc_payload, salto)
+                           : crc32c_combinar(crc_header, crc_payload, len));
+    return V2_HEADER_SIZE + len;
+}
+
+
+// igual, con el payload ya copiado en pdu->data
+int v2_sellar(PDU_v2* pdu, uint8_t type, uint32_t sesion, uint32_t seq, int len) {
+    return v2_sellar_con(pdu, type, sesion, seq, pdu->data, len);
+}
+
+
+// valida un datagrama v2 recibido. Devuelve el largo del payload o -1 si
+// está truncado, el largo no coincide o el CRC no da (se trata como pérdida)
+int v2_verificar(PDU_v2* pdu, int recibido) {
+    if (recibido < V2_HEADER_SIZE || !(pdu->flags & V2_FLAG)) {
+        return -1;
+    }
+    int len = ntohs(pdu->len);
+    if (len != recibido - V2_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint32_t crc = pdu->crc;
+    pdu->crc = 0;
+    uint32_t calculado = htonl(crc32c(0, pdu, recibido));
+    pdu->crc = crc;
+    return (calculado == crc) ? len : -1;
+}
+
+
+// id de sesión v2: lo único que identifica a una sesión una vez que cambia de
+// dirección, así que sale del generador del kernel (getrandom) y no de un
+// PRNG que se pueda reconstruir a partir de otros ids. -1 si getrandom falla
+int id_sesion_aleatorio(uint32_t* id) {
+    return (getrandom(id, sizeof(*id), 0) == sizeof(*id)) ? 0 : -1;
+}
+
+
+// agranda el buffer de recepción del socket (el kernel lo limita a
+// net.core.rmem_max). Devuelve el tamaño efectivo, que limita el bloque v2
+int agrandar_buffer_rx(int socket) {
+    int tam = BUFFER_SOCKET;
+    socklen_t largo = sizeof(tam);
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVBUF, &tam, sizeof(tam)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &tam, &largo) < 0) {
+        return 0;
+    }
+    return tam;
+}
+
+
+// bloque v2 que acepta el servidor en el HELLO: el pedido, sin pasar su
+// máximo ni lo que deja el buffer de recepción con la ventana entera en
+// vuelo (la mitad se va en overhead del kernel por datagrama). Nunca menos
+// que V2_DATA_SIZE por esto último: es el bloque de siempre
+uint16_t bloque_aceptado(int pedido, int maximo, int buffer_rx, int ventana) {
+    int por_buffer = buffer_rx / 2 / ventana;
+    int bloque = (pedido < maximo) ? pedido : maximo;
+    if (por_buffer < V2_DATA_SIZE) {
+        por_buffer = V2_DATA_SIZE;
+    }
+    return (bloque < por_buffer) ? bloque : por_buffer;
+}
+
+
+// agrega una opción TLV en buf a partir de off. Devuelve el nuevo offset o -1 si no entra
+int opt_agregar(char* buf, int off, int max, uint8_t tag, const void* valor, uint8_t largo) {
+    if (off + 2 + largo > max) {
+        return -1;
+    }
+    buf[off] = tag;
+    buf[off + 1] = largo;
+    memcpy(buf + off + 2, valor, largo);
+    return off + 2 + largo;
+}
+
+
+// busca una opción de largo variable en una lista TLV. Devuelve puntero al
+// valor (y su largo en *largo) o NULL si no está
+const uint8_t* opt_buscar_variable(const char* buf, int total, uint8_t tag, int* largo) {
+    int off = 0;
+    while (off + 2 <= total && buf[off] != OPT_FIN) {
+        uint8_t t = buf[off];
+        uint8_t l = buf[off + 1];
+        if (off + 2 + l > total) {
+            break;
+        }
+        if (t == tag) {
+            *largo = l;
+            return (const uint8_t*)(buf + off + 2);
+        }
+        off += 2 + l;
+    }
+    return NULL;
+}
+
+
+// busca una opción en una lista TLV. Devuelve puntero al valor o NULL si no está
+// o si su largo no coincide con el esperado
+const uint8_t* opt_buscar(const char* buf, int total, uint8_t tag, uint8_t largo) {
+    int l;
+    const uint8_t* valor = opt_buscar_variable(buf, total, tag, &l);
+    return (valor && l == largo) ? valor : NULL;
+}
+
+
+// payload del FIN con el digest de la subida: '\0' + OPT_DIGEST. El digest es
+// el CRC32C de todos los bytes desde el inicio de la sesión hasta su fin: el
+// archivo entero (también si se reanudó) o el rango de una subida en paralelo.
+// El servidor lo compara con el que fue armando con lo recibido antes de
+// confirmar el FIN. Para un servidor v1 el data sigue siendo un string vacío
+int fin_con_digest(char* buf, int max, uint32_t digest) {
+    uint32_t valor = htonl(digest);
+    buf[0] = '\0';
+    return opt_agregar(buf, 1, max, OPT_DIGEST, &valor, sizeof(valor));
+}
+
+
+// devuelve 1 y deja en *digest el del FIN si lo trae (un cliente viejo no lo manda)
+int fin_digest(const char* datos, int largo, uint32_t* digest) {
+    if (largo < 2 || datos[0] != '\0') {
+        return 0;
+    }
+    const uint8_t* d = opt_buscar(datos + 1, largo - 1, OPT_DIGEST, 4);
+    if (!d) {
+        return 0;
+    }
+    memcpy(digest, d, 4);
+    *digest = ntohl(*digest);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include "common.h"
+
+
+// control de congestión del modo ventana (-C). La ventana negociada en el
+// HELLO es solo un tope (lo que el servidor puede reensamblar); cuántos PDUs
+// se mandan de verdad lo decide cwnd, que sube mientras la red acompaña y
+// baja ante pérdidas (o, en vegas, cuando el RTT empieza a crecer porque se
+// llena una cola). Los algoritmos se enchufan con una tabla de callbacks:
+//
+//   reno:  AIMD a la NewReno. Slow start (+1 por ACK) hasta ssthresh, después
+//          +1/cwnd por ACK (un PDU por RTT). Una pérdida parte la ventana a la
+//          mitad, una sola vez por ventana: las pérdidas de PDUs enviados antes
+//          de la reducción son de la misma ráfaga y no vuelven a reducir
+//   vegas: por delay (TCP Vegas). Una vez por RTT compara el RTT mínimo de la
+//          ronda con el mínimo histórico: diff = cwnd * (rtt - base) / rtt son
+//          los PDUs que hay en colas. Con menos de VEGAS_ALFA sube uno, con
+//          más de VEGAS_BETA baja uno. Las pérdidas reducen a 3/4
+//   fijo:  cwnd = ventana negociada y sin pacing (el comportamiento anterior)
+//
+// en todos, si se pierde también una retransmisión es un timeout de verdad
+// (la red dejó de entregar): cwnd vuelve a CC_VENTANA_MIN y slow start
+//
+// la pérdida se detecta por los huecos que muestran los ACK (SACK) o, si no
+// hay nada posterior confirmado, por el timer de cada PDU; cwnd se mide en PDUs, no en bytes: todos los DATA salvo el
+// último llevan un bloque entero
+#define CC_VENTANA_INICIAL 10    // RFC 6928
+#define CC_VENTANA_MIN 2
+#define VEGAS_ALFA 2
+#define VEGAS_BETA 4
+#define VEGAS_GAMA 1             // diff que termina el slow start de vegas
+
+
+struct ControlCongestion;
+
+typedef struct {
+    const char* nombre;
+    void (*al_ack)(struct ControlCongestion* cc, uint32_t seq, uint64_t rtt_us);   // rtt_us = 0: sin muestra (Karn)
+    void (*al_perdida)(struct ControlCongestion* cc, uint32_t seq);
+    int pacing;              // 0 = los PDUs salen en ráfaga, como sin control
+} AlgoritmoCC;
+
+
+typedef struct ControlCongestion {
+    const AlgoritmoCC* algoritmo;
+    double cwnd;             // PDUs
+    double ssthresh;
+    uint16_t maximo;         // ventana negociada
+    uint32_t next_seq;       // próximo seq a enviar: lo actualiza el emisor
+    uint32_t recuperar;      // pérdidas de seqs anteriores a este no vuelven a reducir
+    int en_recuperacion;
+
+    // vegas: RTT mínimo histórico y de la ronda, que termina con el ACK de fin_ronda
+    uint64_t rtt_base_us;
+    uint64_t rtt_ronda_us;
+    uint32_t fin_ronda;
+
+    uint64_t reducciones;
+    uint64_t timeouts;
+} ControlCongestion;
+
+
+void cc_acotar(ControlCongestion* cc) {
+    if (cc->cwnd > cc->maximo) cc->cwnd = cc->maximo;
+    if (cc->cwnd < CC_VENTANA_MIN) cc->cwnd = (cc->maximo < CC_VENTANA_MIN) ? cc->maximo : CC_VENTANA_MIN;
+}
+
+
+// devuelve 1 si la pérdida de seq abre una reducción nueva (no es de la
+// ráfaga de la anterior)
+int cc_reduccion_nueva(ControlCongestion* cc, uint32_t seq) {
+    if (cc->en_recuperacion && (int32_t)(seq - cc->recuperar) < 0) {
+        return 0;
+    }
+    cc->en_recuperacion = 1;
+    cc->recuperar = cc->next_seq;
+    cc->reducciones++;
+    return 1;
+}
+
+
+void cc_salir_recuperacion(ControlCongestion* cc, uint32_t seq) {
+    if (cc->en_recuperacion && (int32_t)(seq - cc->recuperar) >= 0) {
+        cc->en_recuperacion = 0;
+    }
+}
+
+
+void reno_ack(ControlCongestion* cc, uint32_t seq, uint64_t rtt_us) {
+    (void)rtt_us;
+    cc_salir_recuperacion(cc, seq);
+    if (cc->en_recuperacion && cc->cwnd >= cc->ssthresh) {
+        return;     // no crece hasta recuperar lo perdido (después de un timeout sí: slow start)
+    }
+    cc->cwnd += (cc->cwnd < cc->ssthresh) ? 1.0 : 1.0 / cc->cwnd;
+    cc_acotar(cc);
+}
+
+
+void reno_perdida(ControlCongestion* cc, uint32_t seq) {
+    if (cc_reduccion_nueva(cc, seq)) {
+        cc->cwnd = cc->cwnd / 2;
+        cc_acotar(cc);
+        cc->ssthresh = cc->cwnd;
+    }
+}
+
+
+void vegas_ack(ControlCongestion* cc, uint32_t seq, uint64_t rtt_us) {
+    cc_salir_recuperacion(cc, seq);
+    if (rtt_us > 0) {
+        if (cc->rtt_base_us == 0 || rtt_us < cc->rtt_base_us) cc->rtt_base_us = rtt_us;
+        if (cc->rtt_ronda_us == 0 || rtt_us < cc->rtt_ronda_us) cc->rtt_ronda_us = rtt_us;
+    }
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += 1.0;
+    }
+
+    // fin de ronda: ya volvió el ACK de lo que se envió al empezarla
+    if ((int32_t)(seq - cc->fin_ronda) >= 0) {
+        if (cc->rtt_ronda_us > 0) {
+            double diff = cc->cwnd * (double)(cc->rtt_ronda_us - cc->rtt_base_us) / cc->rtt_ronda_us;
+            if (cc->cwnd < cc->ssthresh) {
+                if (diff > VEGAS_GAMA) {
+                    cc->ssthresh = cc->cwnd;     // las colas empiezan a llenarse
+                }
+            } else if (diff < VEGAS_ALFA) {
+                cc->cwnd += 1.0;
+            } else if (diff > VEGAS_BETA) {
+                cc->cwnd -= 1.0;
+            }
+        }
+        cc->rtt_ronda_us = 0;
+        cc->fin_ronda = cc->next_seq;
+    }
+    cc_acotar(cc);
+}
+
+
+void vegas_perdida(ControlCongestion* cc, uint32_t seq) {
+    if (cc_reduccion_nueva(cc, seq)) {
+        cc->cwnd = cc->cwnd * 3 / 4;
+        cc_acotar(cc);
+        cc->ssthresh = cc->cwnd;
+    }
+}
+
+
+void fijo_ack(ControlCongestion* cc, uint32_t seq, uint64_t rtt_us) {
+    (void)cc; (void)seq; (void)rtt_us;
+}
+
+
+void fijo_perdida(ControlCongestion* cc, uint32_t seq) {
+    (void)cc; (void)seq;
+}
+
+
+const AlgoritmoCC cc_reno  = { "reno",  reno_ack,  reno_perdida,  1 };
+const AlgoritmoCC cc_vegas = { "vegas", vegas_ack, vegas_perdida, 1 };
+const AlgoritmoCC cc_fijo  = { "fijo",  fijo_ack,  fijo_perdida,  0 };
+
+const AlgoritmoCC* algoritmos_cc[] = { &cc_reno, &cc_vegas, &cc_fijo, NULL };
+
+
+// NULL si no existe
+const AlgoritmoCC* cc_buscar(const char* nombre) {
+    for (int i = 0; algoritmos_cc[i]; i++) {
+        if (strcmp(algoritmos_cc[i]->nombre, nombre) == 0) {
+            return algoritmos_cc[i];
+        }
+    }
+    return NULL;
+}
+
+
+void cc_init(ControlCongestion* cc, const AlgoritmoCC* algoritmo, uint16_t maximo) {
+    memset(cc, 0, sizeof(ControlCongestion));
+    cc->algoritmo = algoritmo;
+    cc->maximo = maximo;
+    cc->ssthresh = maximo;
+    cc->cwnd = (algoritmo->pacing) ? CC_VENTANA_INICIAL : maximo;
+    cc_acotar(cc);
+}
+
+
+// PDUs que se pueden tener en vuelo
+uint32_t cc_ventana(const ControlCongestion* cc) {
+    return (uint32_t)cc->cwnd;
+}
+
+
+void cc_ack(ControlCongestion* cc, uint32_t seq, uint64_t rtt_us) {
+    cc->algoritmo->al_ack(cc, seq, rtt_us);
+}
+
+
+// seq se dio por perdido. retransmision = 1 si lo perdido ya era un reenvío
+void cc_perdida(ControlCongestion* cc, uint32_t seq, int retransmision) {
+    if (!retransmision || !cc->algoritmo->pacing) {
+        cc->algoritmo->al_perdida(cc, seq);
+        return;
+    }
+    cc->timeouts++;
+    cc->ssthresh = (cc->cwnd / 2 > CC_VENTANA_MIN) ? cc->cwnd / 2 : CC_VENTANA_MIN;
+    cc->cwnd = CC_VENTANA_MIN;
+    cc->en_recuperacion = 1;
+    cc->recuperar = cc->next_seq;
+    cc_acotar(cc);
+}
+
+
+// tasa de envío para el pacing en bytes/s: cwnd por RTT, con margen para
+// que el pacing no sea lo que limita (el doble en slow start, como Linux).
+// 0 = sin pacing (sin RTT medido todavía o algoritmo sin pacing)
+double cc_tasa(const ControlCongestion* cc, uint64_t srtt_us, int datagrama) {
+    if (!cc->algoritmo->pacing || srtt_us == 0) {
+        return 0;
+    }
+    double ganancia = (cc->cwnd < cc->ssthresh) ? 2.0 : 1.25;
+    return ganancia * cc->cwnd * datagrama * 1e6 / srtt_us;
+}
+
+
+// ---------------------------------------------------------------------------
+// traza de cwnd y tasa (-T): CSV con una línea por evento de pérdida y, entre
+// pérdidas, como mucho una cada TRAZA_CADA_US, para ajustar los algoritmos
+// ---------------------------------------------------------------------------
+
+#define TRAZA_CADA_US 1000
+
+typedef struct {
+    FILE* f;
+    uint64_t inicio_us;
+    uint64_t ultima_us;
+} Traza;
+
+
+int traza_abrir(Traza* t, const char* ruta) {
+    memset(t, 0, sizeof(Traza));
+    if (!ruta) {
+        return 0;
+    }
+    t->f = fopen(ruta, "w");
+    if (!t->f) {
+        perror(ruta);
+        return -1;
+    }
+    t->inicio_us = get_monotonic_us();
+    fprintf(t->f, "t_ms,evento,cwnd,ssthresh,en_vuelo,srtt_us,tasa_Bps\n");
+    return 0;
+}
+
+
+// evento: "ack", "sack" (hueco), "perdida" (timer), "timeout" o "fin". Los "ack" se muestrean
+void traza_anotar(Traza* t, const char* evento, const ControlCongestion* cc, uint32_t en_vuelo,
+                  uint64_t srtt_us, double tasa) {
+    if (!t->f) {
+        return;
+    }
+    uint64_t ahora = get_monotonic_us();
+    if (evento[0] == 'a' && ahora - t->ultima_us < TRAZA_CADA_US) {
+        return;
+    }
+    t->ultima_us = ahora;
+    fprintf(t->f, "%.3f,%s,%.2f,%.2f,%u,%llu,%.0f\n", (ahora - t->inicio_us) / 1000.0, evento,
+            cc->cwnd, cc->ssthresh, en_vuelo, (unsigned long long)srtt_us, tasa);
+}
+
+
+void traza_cerrar(Traza* t) {
+    if (t->f && fclose(t->f) != 0) {
+        perror("fclose(traza)");
+    }
+    t->f = NULL;
+}
+
+#endif
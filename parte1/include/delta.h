@@ -0,0 +1,429 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+
+
+// subida delta (-D), al estilo de rsync: volver a subir un archivo que el
+// servidor ya tiene parecido manda solo lo que cambió.
+//
+//  1. el WRQ lleva OPT_DELTA. Si el destino existe, el servidor lo mapea, lo
+//     parte en bloques de S bytes (S ~ raíz del tamaño) y un hilo escritor
+//     calcula la firma de cada uno: checksum rodante de 32 bits (el de rsync)
+//     y CRC32C. El ACK del WRQ sale con las firmas listas: OPT_DELTA = S y el
+//     tamaño del archivo previo, y detrás las firmas como una descarga (los
+//     mismos DATA, timers y FIN con digest que un RRQ, ver descarga.h)
+//  2. el cliente indexa las firmas por checksum débil y recorre su archivo
+//     con la ventana rodante de S bytes: donde el débil coincide y el CRC32C
+//     del tramo también, ese tramo está en el archivo viejo (Coincidencia)
+//  3. la subida es la de siempre (DATA seq = bloque seq del archivo nuevo, con
+//     ventana, SACK, FEC...), pero un DATA puede llevar V2_DELTA: su payload
+//     es una receta que arma el bloque con copias de rangos del archivo viejo
+//     y literales. Se usa solo si ocupa menos que el bloque
+//  4. el servidor escribe en ".<nombre>.delta" (el viejo tiene que seguir
+//     entero hasta el final) y en el FIN, con el digest del archivo completo
+//     verificado, lo renombra sobre el destino. Si la subida no termina el
+//     temporal se borra y el destino queda como estaba
+//
+// 64 bits de firma por bloque (débil + CRC32C) alcanzan para un archivo que
+// se sube de nuevo, no contra alguien que fabrique colisiones; el digest del
+// FIN igual rechaza un archivo mal armado
+#define DELTA_FIRMA_MIN 1024
+#define DELTA_FIRMA_MAX 65536
+#define DELTA_FIRMA 8            // bytes por bloque en la lista: débil y CRC32C (network order)
+
+// operaciones de una receta (todo big endian)
+#define DELTA_COPIA   1          // uint64_t offset en el archivo viejo + uint16_t largo
+#define DELTA_LITERAL 2          // uint16_t largo + los bytes
+#define DELTA_COPIA_TAM 11
+#define DELTA_LITERAL_TAM 3
+
+
+// checksum débil de rsync: a = suma de los bytes, b = suma de las sumas
+// parciales, los dos módulo 2^16. Se puede correr un byte en O(1)
+uint32_t delta_debil(const uint8_t* p, int n) {
+    uint32_t a = 0, b = 0;
+    for (int i = 0; i < n; i++) {
+        a += p[i];
+        b += (uint32_t)(n - i) * p[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+
+// la ventana de n bytes avanza uno: sale `sale` y entra `entra`
+uint32_t delta_rodar(uint32_t debil, uint8_t sale, uint8_t entra, int n) {
+    uint32_t a = (debil - sale + entra) & 0xFFFF;
+    uint32_t b = ((debil >> 16) - (uint32_t)n * sale + a) & 0xFFFF;
+    return a | (b << 16);
+}
+
+
+// bloque de firma para un archivo previo de tam bytes: ~sqrt(tam), múltiplo de 64
+uint32_t delta_bloque_firma(uint64_t tam) {
+    uint64_t s = 1;
+    while (s * s < tam) {
+        s <<= 1;
+    }
+    while ((s >> 1) * (s >> 1) >= tam && s > 1) {
+        s >>= 1;
+    }
+    s &= ~63ULL;
+    return (s < DELTA_FIRMA_MIN) ? DELTA_FIRMA_MIN : (s > DELTA_FIRMA_MAX) ? DELTA_FIRMA_MAX : s;
+}
+
+
+// ---------------------------------------------------------------------------
+// servidor: el archivo previo mapeado, sus firmas y el temporal
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char* mapa;
+    uint64_t tam;
+    uint32_t bloque;         // S
+    char* firmas;            // ceil(tam / S) x DELTA_FIRMA (las calcula delta_firmar)
+    size_t largo;
+    char temporal[300];      // ".<nombre>.delta", donde se escribe el archivo nuevo
+} ArchivoPrevio;
+
+
+void delta_temporal(char* ruta, size_t max, const char* filename) {
+    snprintf(ruta, max, ".%s.delta", filename);
+}
+
+
+// mapea el destino actual de una subida delta. NULL si no hay nada que
+// aprovechar (no existe, no es un archivo regular, está vacío) o no se puede
+ArchivoPrevio* previo_abrir(const char* filename) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    ArchivoPrevio* p = calloc(1, sizeof(ArchivoPrevio));
+    if (!p || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        free(p);
+        close(fd);
+        return NULL;
+    }
+    void* mapa = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);      // el mapa sigue valiendo
+    p->tam = st.st_size;
+    p->bloque = delta_bloque_firma(p->tam);
+    p->largo = (p->tam + p->bloque - 1) / p->bloque * DELTA_FIRMA;
+    p->firmas = malloc(p->largo);
+    if (mapa == MAP_FAILED || !p->firmas) {
+        if (mapa != MAP_FAILED) {
+            munmap(mapa, p->tam);
+        }
+        free(p->firmas);
+        free(p);
+        return NULL;
+    }
+    madvise(mapa, p->tam, MADV_SEQUENTIAL);
+    p->mapa = mapa;
+    delta_temporal(p->temporal, sizeof(p->temporal), filename);
+    return p;
+}
+
+
+// calcula las firmas (lee el archivo entero: va en un hilo escritor)
+void delta_firmar(void* arg) {
+    ArchivoPrevio* p = arg;
+    char* f = p->firmas;
+    for (uint64_t off = 0; off < p->tam; off += p->bloque, f += DELTA_FIRMA) {
+        int n = (p->tam - off < p->bloque) ? (int)(p->tam - off) : (int)p->bloque;
+        uint32_t debil = htonl(delta_debil((const uint8_t*)p->mapa + off, n));
+        uint32_t fuerte = htonl(crc32c(0, p->mapa + off, n));
+        memcpy(f, &debil, 4);
+        memcpy(f + 4, &fuerte, 4);
+    }
+}
+
+
+// completo: el archivo nuevo reemplaza al destino; si no, se descarta
+void previo_cerrar(ArchivoPrevio* p, const char* filename, int completo) {
+    if (!p) {
+        return;
+    }
+    if (completo) {
+        if (rename(p->temporal, filename) < 0) {
+            perror("rename");
+        }
+    } else {
+        unlink(p->temporal);
+    }
+    munmap((void*)p->mapa, p->tam);
+    free(p->firmas);
+    free(p);
+}
+
+
+// arma en buf el bloque que describe la receta. Devuelve su largo o -1 si
+// la receta no es válida (la entrada viene de la red: se valida cada rango)
+int delta_aplicar(const char* receta, int len, char* buf, int max, const ArchivoPrevio* p) {
+    const uint8_t* r = (const uint8_t*)receta;
+    const uint8_t* fin = r + len;
+    int escrito = 0;
+
+    while (r < fin) {
+        if (*r == DELTA_COPIA && fin - r >= DELTA_COPIA_TAM) {
+            uint64_t offset;
+            uint16_t largo;
+            memcpy(&offset, r + 1, 8);
+            memcpy(&largo, r + 9, 2);
+            offset = be64toh(offset);
+            largo = ntohs(largo);
+            if (offset > p->tam || largo > p->tam - offset || largo > max - escrito) {
+                return -1;
+            }
+            memcpy(buf + escrito, p->mapa + offset, largo);
+            escrito += largo;
+            r += DELTA_COPIA_TAM;
+        } else if (*r == DELTA_LITERAL && fin - r >= DELTA_LITERAL_TAM) {
+            uint16_t largo;
+            memcpy(&largo, r + 1, 2);
+            largo = ntohs(largo);
+            if (largo > fin - r - DELTA_LITERAL_TAM || largo > max - escrito) {
+                return -1;
+            }
+            memcpy(buf + escrito, r + DELTA_LITERAL_TAM, largo);
+            escrito += largo;
+            r += DELTA_LITERAL_TAM + largo;
+        } else {
+            return -1;
+        }
+    }
+    return escrito;
+}
+
+
+// ---------------------------------------------------------------------------
+// cliente: búsqueda de los bloques del archivo viejo en el nuevo y recetas
+// ---------------------------------------------------------------------------
+
+// el tramo [nuevo, nuevo + largo) del archivo local es [viejo, viejo + largo)
+// del archivo del servidor
+typedef struct {
+    uint64_t nuevo;
+    uint64_t viejo;
+    uint64_t largo;
+} Coincidencia;
+
+
+typedef struct {
+    uint32_t bloque;         // S que eligió el servidor (0 = sin delta)
+    uint64_t tam_viejo;
+    Coincidencia* v;         // ordenadas por nuevo, sin solaparse; las contiguas en los dos archivos van juntas
+    size_t n;
+    size_t cap;
+    uint64_t coincidentes;   // bytes del archivo nuevo que ya están en el viejo
+} Delta;
+
+
+int delta_agregar(Delta* d, uint64_t nuevo, uint64_t viejo, uint64_t largo) {
+    d->coincidentes += largo;
+    if (d->n > 0) {
+        Coincidencia* u = &d->v[d->n - 1];
+        if (u->nuevo + u->largo == nuevo && u->viejo + u->largo == viejo) {
+            u->largo += largo;
+            return 0;
+        }
+    }
+    if (d->n == d->cap) {
+        size_t cap = d->cap ? 2 * d->cap : 1024;
+        Coincidencia* v = realloc(d->v, cap * sizeof(Coincidencia));
+        if (!v) {
+            return -1;
+        }
+        d->v = v;
+        d->cap = cap;
+    }
+    d->v[d->n].nuevo = nuevo;
+    d->v[d->n].viejo = viejo;
+    d->v[d->n].largo = largo;
+    d->n++;
+    return 0;
+}
+
+
+uint32_t delta_hash(uint32_t debil, int bits) {
+    return (debil * 0x9E3779B1u) >> (32 - bits);
+}
+
+
+// firma i de la lista recibida
+void delta_firma(const char* firmas, uint32_t i, uint32_t* debil, uint32_t* fuerte) {
+    memcpy(debil, firmas + (size_t)i * DELTA_FIRMA, 4);
+    memcpy(fuerte, firmas + (size_t)i * DELTA_FIRMA + 4, 4);
+    *debil = ntohl(*debil);
+    *fuerte = ntohl(*fuerte);
+}
+
+
+// ¿el bloque i del viejo es el tramo de n bytes en p (con checksum débil)?
+// El CRC del tramo se calcula una vez por posición, solo si el débil coincide
+int delta_es(const char* firmas, uint32_t i, uint32_t debil, const uint8_t* p, int n, int64_t* crc) {
+    uint32_t d, f;
+    delta_firma(firmas, i, &d, &f);
+    if (d != debil) {
+        return 0;
+    }
+    if (*crc < 0) {
+        *crc = crc32c(0, p, n);
+    }
+    return f == *crc;
+}
+
+
+// recorre el archivo nuevo (mapeado) buscando los bloques del viejo. Tabla
+// de hash por checksum débil con cadenas; los bloques repetidos (mismo débil
+// y CRC, p.ej. ceros) entran una sola vez. En cada posición primero se prueba
+// el bloque que sigue a la última coincidencia: así los tramos sin cambios
+// quedan en una sola copia aunque el viejo tenga bloques iguales
+int delta_buscar(Delta* d, const char* nuevo, uint64_t tam, const char* firmas) {
+    uint32_t S = d->bloque;
+    uint32_t completos = d->tam_viejo / S;
+    uint32_t resto = d->tam_viejo % S;
+    // 8 baldes por bloque: en una posición sin coincidencia (casi todas, si
+    // el archivo cambió mucho) el balde suele estar vacío y no hay nada que comparar
+    int bits = 10;
+    while ((1U << bits) < 8 * completos && bits < 30) {
+        bits++;
+    }
+    int32_t* cabeza = malloc(sizeof(int32_t) << bits);
+    int32_t* siguiente = malloc(sizeof(int32_t) * (completos + 1));
+    if (!cabeza || !siguiente) {
+        free(cabeza);
+        free(siguiente);
+        return -1;
+    }
+    memset(cabeza, 0xFF, sizeof(int32_t) << bits);
+
+    for (uint32_t i = 0; i < completos; i++) {
+        uint32_t debil, fuerte;
+        delta_firma(firmas, i, &debil, &fuerte);
+        uint32_t h = delta_hash(debil, bits);
+        int32_t j = cabeza[h];
+        while (j >= 0) {
+            uint32_t dj, fj;
+            delta_firma(firmas, j, &dj, &fj);
+            if (dj == debil && fj == fuerte) {
+                break;
+            }
+            j = siguiente[j];
+        }
+        if (j < 0) {
+            siguiente[i] = cabeza[h];
+            cabeza[h] = i;
+        }
+    }
+
+    const uint8_t* p = (const uint8_t*)nuevo;
+    uint64_t pos = 0;
+    int64_t esperado = -1;       // bloque que sigue a la última coincidencia
+    uint32_t debil = (tam >= S) ? delta_debil(p, S) : 0;
+    int error = 0;
+
+    while (completos > 0 && pos + S <= tam && !error) {
+        int64_t crc = -1;
+        int32_t encontrado = -1;
+        if (esperado >= 0 && esperado < completos && delta_es(firmas, esperado, debil, p + pos, S, &crc)) {
+            encontrado = esperado;
+        }
+        for (int32_t j = cabeza[delta_hash(debil, bits)]; j >= 0 && encontrado < 0; j = siguiente[j]) {
+            if (delta_es(firmas, j, debil, p + pos, S, &crc)) {
+                encontrado = j;
+            }
+        }
+
+        if (encontrado >= 0) {
+            error = delta_agregar(d, pos, (uint64_t)encontrado * S, S);
+            esperado = encontrado + 1;
+            pos += S;
+            if (pos + S <= tam) {
+                debil = delta_debil(p + pos, S);
+            }
+        } else {
+            if (pos + S < tam) {
+                debil = delta_rodar(debil, p[pos], p[pos + S], S);
+            }
+            pos++;
+        }
+    }
+
+    // el último bloque del viejo es más corto: solo puede estar al final del nuevo
+    if (!error && resto > 0 && tam >= resto && tam - resto >= pos) {
+        int64_t crc = -1;
+        if (delta_es(firmas, completos, delta_debil(p + tam - resto, resto), p + tam - resto, resto, &crc)) {
+            error = delta_agregar(d, tam - resto, (uint64_t)completos * S, resto);
+        }
+    }
+
+    free(cabeza);
+    free(siguiente);
+    return error;
+}
+
+
+// receta del bloque [offset, offset + n) del archivo nuevo (datos = sus bytes)
+// en buf. Devuelve su largo, o 0 si no achica: el bloque va tal cual
+int delta_receta(const Delta* d, uint64_t offset, const char* datos, int n, char* buf) {
+    // primera coincidencia que termina después de offset
+    size_t lo = 0, hi = d->n;
+    while (lo < hi) {
+        size_t mitad = (lo + hi) / 2;
+        if (d->v[mitad].nuevo + d->v[mitad].largo <= offset) {
+            lo = mitad + 1;
+        } else {
+            hi = mitad;
+        }
+    }
+    if (lo == d->n || d->v[lo].nuevo >= offset + n) {
+        return 0;       // nada del viejo en este bloque
+    }
+
+    uint64_t pos = offset;
+    uint64_t fin = offset + n;
+    int largo = 0;
+    for (size_t i = lo; pos < fin; ) {
+        uint64_t hasta = (i < d->n && d->v[i].nuevo < fin) ? d->v[i].nuevo : fin;
+        if (pos < hasta) {
+            uint16_t l = htons(hasta - pos);
+            if (largo + DELTA_LITERAL_TAM + (int)(hasta - pos) >= n) {
+                return 0;
+            }
+            buf[largo] = DELTA_LITERAL;
+            memcpy(buf + largo + 1, &l, 2);
+            memcpy(buf + largo + DELTA_LITERAL_TAM, datos + (pos - offset), hasta - pos);
+            largo += DELTA_LITERAL_TAM + (hasta - pos);
+            pos = hasta;
+            continue;
+        }
+
+        const Coincidencia* c = &d->v[i++];
+        uint64_t c_fin = (c->nuevo + c->largo < fin) ? c->nuevo + c->largo : fin;
+        uint64_t viejo = htobe64(c->viejo + (pos - c->nuevo));
+        uint16_t l = htons(c_fin - pos);
+        if (largo + DELTA_COPIA_TAM >= n) {
+            return 0;
+        }
+        buf[largo] = DELTA_COPIA;
+        memcpy(buf + largo + 1, &viejo, 8);
+        memcpy(buf + largo + 9, &l, 2);
+        largo += DELTA_COPIA_TAM;
+        pos = c_fin;
+    }
+    return largo;
+}
+
+
+void delta_free(Delta* d) {
+    free(d->v);
+    memset(d, 0, sizeof(Delta));
+}
+
+#endif
@@ -0,0 +1,338 @@
+#ifndef DESCARGA_H
+#define DESCARGA_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "rtt.h"
+#include "congestion.h"
+#include "pacing.h"
+
+
+// descargas (RRQ, solo v2): el servidor es el que envía. El archivo se mapea
+// entero y cada DATA sale con un iovec para el header (del lote de salida del
+// worker) y otro que apunta al mapa: los bytes del archivo no pasan por
+// ningún buffer del servidor. Igual que en la subida, hasta `ventana` DATA
+// en vuelo (Selective Repeat), cada uno con su timer, y el cliente confirma
+// cada uno con un ACK de su seq. Cuando todos están confirmados sale el FIN
+// con el digest del archivo, que también se retransmite hasta su ACK.
+//
+// el CRC de cada bloque se calcula una sola vez, al enviarlo por primera vez
+// (en orden): con él se sella el PDU (combinándolo con el del header) y se
+// arma el digest. Las retransmisiones reenvían el header guardado en el slot
+//
+// timers: cada descarga tiene un vencimiento, el más próximo de sus PDUs sin
+// confirmar, en un heap de mínimos del worker (Plazos). El poll del worker
+// duerme hasta el primero. Los ACK no tocan el heap: si el vencimiento llega
+// y ya no hay nada vencido se recalcula y se vuelve a programar. Como en la
+// subida, un DATA sin ACK se reenvía sin esperar su timer cuando ya se
+// confirmaron DESCARGA_SACK_UMBRAL enviados después de él
+//
+// cuánto se manda lo deciden el control de congestión y el pacer del modo
+// ventana del cliente (congestion.h, pacing.h): la ventana negociada es solo
+// el tope y los DATA salen espaciados, no en ráfaga. Cuando el pacer frena, la
+// descarga se programa para cuando haya tokens. En una ronda de vencimientos
+// se reenvían como mucho cwnd PDUs (también con pacing); los demás quedan
+// diferidos para un RTT después, sin otro backoff ni otra pérdida
+#define DESCARGA_REINTENTOS 8    // como MAX_RETRIES del cliente
+#define DESCARGA_SACK_UMBRAL 3   // como SACK_UMBRAL del cliente
+
+
+typedef struct {
+    char header[V2_HEADER_SIZE];     // DATA ya sellado (el payload está en el mapa)
+    uint64_t enviado_us;
+    uint64_t vence_us;
+    uint32_t siguiente;      // next_seq cuando se (re)envió: lo enviado desde ahí es posterior
+    uint8_t intentos;
+    uint8_t confirmado;
+    uint8_t diferido;        // venció, pero su reenvío quedó para otra ronda
+} SlotDescarga;
+
+
+typedef struct Descarga {
+    const char* mapa;        // NULL si el archivo está vacío
+    uint64_t tam;
+    int mapeado;             // 0: mapa es un buffer ajeno (descarga_memoria)
+    uint16_t bloque;
+    uint16_t ventana;
+    uint32_t total;          // DATA de la descarga: el FIN lleva seq = total
+    uint32_t base;           // DATA más viejo sin confirmar
+    uint32_t next_seq;       // próximo DATA nuevo
+    uint32_t mayor;          // DATA más alto confirmado
+    uint32_t digest;         // CRC32C de los bloques [0, next_seq)
+    uint32_t salto;          // crc32c_salto(bloque)
+    SlotDescarga* slots;
+    SlotDescarga fin_slot;   // timer e intentos del FIN (fin_pdu tiene los bytes)
+    PDU_v2 fin_pdu;
+    int fin_len;             // 0 = todavía no se envió
+    EstimadorRTT rtt;
+    ControlCongestion cc;
+    Pacer pacer;
+    int retransmisiones;
+    uint64_t inicio_us;
+
+    uint64_t vence_us;       // clave en el heap
+    int plazo;               // índice en el heap, -1 si no está
+    void* dueno;             // ClientState
+} Descarga;
+
+
+// lo común a un archivo mapeado y a un buffer en memoria
+Descarga* descarga_nueva(const char* mapa, uint64_t tam, int mapeado, uint16_t bloque, uint16_t ventana) {
+    Descarga* d = calloc(1, sizeof(Descarga));
+    SlotDescarga* slots = calloc(ventana, sizeof(SlotDescarga));
+    if (!d || !slots) {
+        free(d);
+        free(slots);
+        errno = ENOMEM;
+        return NULL;
+    }
+    d->mapa = mapa;
+    d->tam = tam;
+    d->mapeado = mapeado;
+    d->bloque = bloque;
+    d->ventana = ventana;
+    d->total = (d->tam + bloque - 1) / bloque;
+    d->salto = crc32c_salto(bloque);
+    d->slots = slots;
+    d->mayor = UINT32_MAX;   // base - 1
+    d->plazo = -1;
+    rtt_init(&d->rtt);
+    cc_init(&d->cc, &cc_reno, ventana);
+    pacer_init(&d->pacer);
+    d->inicio_us = get_monotonic_us();
+    return d;
+}
+
+
+// mapea el archivo. NULL (y errno) si no se puede abrir
+Descarga* descarga_abrir(const char* nombre, uint16_t bloque, uint16_t ventana) {
+    int fd = open(nombre, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    int fallo = (fstat(fd, &st) != 0);
+    if (fallo || !S_ISREG(st.st_mode)) {
+        int err = fallo ? errno : EISDIR;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    void* mapa = NULL;
+    if (st.st_size > 0) {
+        mapa = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapa == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return NULL;
+        }
+        madvise(mapa, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);      // el mapa sigue valiendo
+
+    Descarga* d = descarga_nueva(mapa, st.st_size, 1, bloque, ventana);
+    if (!d && mapa) {
+        munmap(mapa, st.st_size);
+    }
+    return d;
+}
+
+
+// descarga de un buffer que es de otro (las firmas de una subida delta): tiene
+// que seguir vivo hasta descarga_free, que no lo toca
+Descarga* descarga_memoria(const char* buf, uint64_t tam, uint16_t bloque, uint16_t ventana) {
+    return descarga_nueva(tam > 0 ? buf : NULL, tam, 0, bloque, ventana);
+}
+
+
+void descarga_free(Descarga* d) {
+    if (d->mapa && d->mapeado) {
+        munmap((void*)d->mapa, d->tam);
+    }
+    free(d->slots);
+    free(d);
+}
+
+
+// payload del DATA seq dentro del mapa
+const char* descarga_bloque(const Descarga* d, uint32_t seq, int* len) {
+    uint64_t off = (uint64_t)seq * d->bloque;
+    *len = (d->tam - off < d->bloque) ? (int)(d->tam - off) : d->bloque;
+    return d->mapa + off;
+}
+
+
+// sella el DATA seq en su slot y suma su bloque al digest. Se llama una vez
+// por seq, en orden
+SlotDescarga* descarga_sellar(Descarga* d, uint32_t sesion, uint32_t seq) {
+    SlotDescarga* s = &d->slots[seq % d->ventana];
+    int len;
+    const char* payload = descarga_bloque(d, seq, &len);
+    uint32_t crc = crc32c(0, payload, len);
+
+    // solo se escribe el header: el payload no se copia al slot. El último
+    // bloque puede ser más corto (hasta de 1 byte, sin constante de salto): se
+    // combina con la potencia de su largo, como en reensamblado_completar
+    uint32_t salto = (len == d->bloque) ? d->salto : 0;
+    v2_sellar_crc((PDU_v2*)s->header, DATA, 0, sesion, seq, crc, salto, len);
+    d->digest = salto ? crc32c_combinar_salto(d->digest, crc, salto) : crc32c_combinar(d->digest, crc, len);
+    s->intentos = 0;
+    s->confirmado = 0;
+    s->diferido = 0;
+    return s;
+}
+
+
+// datagrama más grande de la descarga
+int descarga_datagrama(const Descarga* d) {
+    return V2_HEADER_SIZE + d->bloque;
+}
+
+
+// tasa del pacer según cwnd y el RTT medido (sin muestras todavía, sin pacing)
+void descarga_tasa(Descarga* d) {
+    double tasa = cc_tasa(&d->cc, d->rtt.con_muestras ? d->rtt.srtt_us : 0, descarga_datagrama(d));
+    pacer_tasa(&d->pacer, tasa, descarga_datagrama(d));
+}
+
+
+// vencimiento más próximo de lo que falta confirmar (UINT64_MAX si nada)
+uint64_t descarga_proximo(const Descarga* d) {
+    uint64_t proximo = (d->fin_len > 0) ? d->fin_slot.vence_us : UINT64_MAX;
+    for (uint32_t seq = d->base; seq != d->next_seq; seq++) {
+        const SlotDescarga* s = &d->slots[seq % d->ventana];
+        if (!s->confirmado && s->vence_us < proximo) {
+            proximo = s->vence_us;
+        }
+    }
+    return proximo;
+}
+
+
+// ---------------------------------------------------------------------------
+// heap de mínimos de vencimientos. Cada descarga guarda su índice, así se
+// puede adelantar o sacar en O(log n)
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    Descarga** v;
+    int n;
+    int cap;
+} Plazos;
+
+
+int plazos_init(Plazos* p, int cap) {
+    p->v = malloc(cap * sizeof(Descarga*));
+    p->n = 0;
+    p->cap = cap;
+    return p->v ? 0 : -1;
+}
+
+
+void plazos_free(Plazos* p) {
+    free(p->v);
+    memset(p, 0, sizeof(Plazos));
+}
+
+
+void plazos_poner(Plazos* p, int i, Descarga* d) {
+    p->v[i] = d;
+    d->plazo = i;
+}
+
+
+void plazos_subir(Plazos* p, int i) {
+    Descarga* d = p->v[i];
+    while (i > 0 && p->v[(i - 1) / 2]->vence_us > d->vence_us) {
+        plazos_poner(p, i, p->v[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    plazos_poner(p, i, d);
+}
+
+
+void plazos_bajar(Plazos* p, int i) {
+    Descarga* d = p->v[i];
+    while (2 * i + 1 < p->n) {
+        int hijo = 2 * i + 1;
+        if (hijo + 1 < p->n && p->v[hijo + 1]->vence_us < p->v[hijo]->vence_us) {
+            hijo++;
+        }
+        if (p->v[hijo]->vence_us >= d->vence_us) {
+            break;
+        }
+        plazos_poner(p, i, p->v[hijo]);
+        i = hijo;
+    }
+    plazos_poner(p, i, d);
+}
+
+
+// programa la descarga para `vence`, o lo adelanta si ya estaba para más tarde
+int plazos_adelantar(Plazos* p, Descarga* d, uint64_t vence) {
+    if (d->plazo >= 0) {
+        if (vence < d->vence_us) {
+            d->vence_us = vence;
+            plazos_subir(p, d->plazo);
+        }
+        return 0;
+    }
+    if (p->n == p->cap) {
+        Descarga** v = realloc(p->v, 2 * p->cap * sizeof(Descarga*));
+        if (!v) {
+            return -1;
+        }
+        p->v = v;
+        p->cap *= 2;
+    }
+    d->vence_us = vence;
+    plazos_poner(p, p->n++, d);
+    plazos_subir(p, d->plazo);
+    return 0;
+}
+
+
+void plazos_quitar(Plazos* p, Descarga* d) {
+    int i = d->plazo;
+    if (i < 0) {
+        return;
+    }
+    d->plazo = -1;
+    if (--p->n == i) {
+        return;
+    }
+    plazos_poner(p, i, p->v[p->n]);
+    plazos_subir(p, i);
+    plazos_bajar(p, p->v[i]->plazo);
+}
+
+
+// saca y devuelve una descarga vencida, o NULL si no hay
+Descarga* plazos_vencido(Plazos* p, uint64_t ahora) {
+    if (p->n == 0 || p->v[0]->vence_us > ahora) {
+        return NULL;
+    }
+    Descarga* d = p->v[0];
+    plazos_quitar(p, d);
+    return d;
+}
+
+
+// ms hasta el primer vencimiento, sin pasar de `tope`
+int plazos_espera_ms(const Plazos* p, uint64_t ahora, int tope) {
+    if (p->n == 0) {
+        return tope;
+    }
+    uint64_t vence = p->v[0]->vence_us;
+    if (vence <= ahora) {
+        return 0;
+    }
+    uint64_t ms = (vence - ahora + 999) / 1000;
+    return (tope >= 0 && ms > (uint64_t)tope) ? tope : (int)ms;
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef DIARIO_H
+#define DIARIO_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "escritor.h"
+
+
+// subidas reanudables (OPT_REANUDAR en el WRQ). Junto a cada archivo en curso
+// queda un diario ".<nombre>.diario" con el id de la transferencia, el tamaño
+// anunciado, el offset hasta el que el archivo está en disco sin huecos y el
+// digest (CRC32C) de esos bytes. Si el cliente abandona (o el servidor se
+// reinicia) y vuelve con el mismo id y tamaño, el servidor no trunca el archivo,
+// le contesta desde dónde seguir y sigue armando el digest desde el guardado.
+//
+// el diario se graba desde el pipeline de escritura con un trabajo de
+// checkpoint: fdatasync() del archivo y recién después el registro (y su
+// fdatasync), así el diario nunca dice más de lo que está en disco. El loop
+// solo lo encola con la sesión sin escrituras en vuelo (todo lo encolado ya
+// llegó al archivo), cada DIARIO_CADA bytes y antes de soltar una sesión
+// abandonada. Se borra cuando el FIN cierra el archivo completo
+#define DIARIO_MAGIC 0x52414944     // "DIAR"
+#define DIARIO_CADA (8 << 20)       // bytes entre checkpoints
+
+
+// todo en big endian
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;                   // CRC32C del registro con crc = 0: detecta escrituras a medias
+    uint64_t id;
+    uint64_t tamano;
+    uint64_t offset;
+    uint32_t digest;                // CRC32C de [0, offset)
+} __attribute__((packed)) RegistroDiario;
+
+
+void diario_ruta(char* ruta, size_t max, const char* filename) {
+    snprintf(ruta, max, ".%s.diario", filename);
+}
+
+
+int diario_registro(char* buf, uint64_t id, uint64_t tamano, uint64_t offset, uint32_t digest) {
+    RegistroDiario r;
+    r.magic = htonl(DIARIO_MAGIC);
+    r.crc = 0;
+    r.id = htobe64(id);
+    r.tamano = htobe64(tamano);
+    r.offset = htobe64(offset);
+    r.digest = htonl(digest);
+    r.crc = htonl(crc32c(0, &r, sizeof(r)));
+    memcpy(buf, &r, sizeof(r));
+    return sizeof(r);
+}
+
+
+// abre el archivo destino de una subida reanudable y su diario. Si el diario
+// es de la misma transferencia (id y tamaño) el archivo se abre sin truncar y
+// *desde queda en el offset a partir del cual seguir y *digest en el de los
+// bytes anteriores; si no, se empieza de cero. Devuelve el fd del archivo (y en *diario el del diario, -1 si no se
+// pudo abrir: la subida sigue, pero no se va a poder reanudar)
+int abrir_reanudable(const char* filename, uint64_t id, uint64_t tamano, uint64_t* desde,
+                     uint32_t* digest, int* diario) {
+    char ruta[300];
+    diario_ruta(ruta, sizeof(ruta), filename);
+    *desde = 0;
+    *digest = 0;
+
+    *diario = open(ruta, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (*diario < 0) {
+        perror("open(diario)");
+    } else {
+        RegistroDiario r;
+        if (pread(*diario, &r, sizeof(r), 0) == sizeof(r)) {
+            uint32_t crc = r.crc;
+            r.crc = 0;
+            if (ntohl(r.magic) == DIARIO_MAGIC && htonl(crc32c(0, &r, sizeof(r))) == crc &&
+                be64toh(r.id) == id && be64toh(r.tamano) == tamano) {
+                *desde = be64toh(r.offset);
+                *digest = ntohl(r.digest);
+            }
+        }
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_CLOEXEC | (*desde > 0 ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        if (*diario >= 0) {
+            close(*diario);
+            *diario = -1;
+        }
+        return -1;
+    }
+
+    // el archivo pudo cambiar por fuera del servidor: si no llega hasta el
+    // offset del diario no se puede confiar en él
+    struct stat st;
+    if (*desde > 0 && (fstat(fd, &st) != 0 || (uint64_t)st.st_size < *desde || *desde > tamano)) {
+        *desde = 0;
+        *digest = 0;
+        if (ftruncate(fd, 0) < 0) {
+            perror("ftruncate");
+        }
+    }
+    return fd;
+}
+
+
+// arma en t un checkpoint del archivo fd hasta offset
+void diario_trabajo(Trabajo* t, int fd, int diario, uint64_t id, uint64_t tamano,
+                    uint64_t offset, uint32_t digest) {
+    t->fd = fd;
+    t->diario = diario;
+    t->offset = 0;
+    t->len = diario_registro(t->buf, id, tamano, offset, digest);
+}
+
+
+// FIN del archivo completo (o con un digest que no coincide): el diario ya no sirve
+void diario_cerrar(int diario, const char* filename, int borrar) {
+    if (diario < 0) {
+        return;
+    }
+    close(diario);
+    if (borrar) {
+        char ruta[300];
+        diario_ruta(ruta, sizeof(ruta), filename);
+        unlink(ruta);
+    }
+}
+
+#endif
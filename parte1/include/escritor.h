@@ -0,0 +1,325 @@
+#ifndef ESCRITOR_H
+#define ESCRITOR_H
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include "common.h"
+#include "metricas.h"
+#include "slab.h"
+
+
+// pipeline de escritura a disco desacoplado del camino de los ACKs.
+//
+// el event loop (un worker de servidorN o el loop de servidor) toma un trabajo
+// de su pool de buffers, copia el payload y lo encola con su offset en el
+// archivo. Un pool de hilos escritores hace pwrite() en ese offset y devuelve
+// el trabajo a la cola de completados del loop, que se entera por un eventfd.
+//
+//  - el pool de buffers de cada loop es fijo: si se agota, el DATA se descarta
+//    sin ACK (backpressure: el cliente retransmite cuando vence su timer).
+//    Los buffers se reciclan sin limpiarlos y cada uno empieza en una línea
+//    de cache: el memcpy del payload no parte líneas con el buffer vecino
+//  - con ACK "al encolar" el loop confirma apenas encola; con ACK "durable"
+//    confirma cuando vuelve el trabajo, después de pwrite() + fdatasync().
+//    El fdatasync se hace una vez por archivo por tanda de trabajos (group commit)
+//  - un trabajo también puede ser un cálculo que no conviene hacer en el loop
+//    (las firmas de una subida delta, ver delta.h): el escritor llama a
+//    calculo(arg) y lo devuelve como cualquier otro
+//  - el pool y los completados son de un solo loop: solo la cola de entrada
+//    de los escritores y la de completados tienen lock, y se toman una vez por tanda
+
+
+typedef struct Trabajo {
+    int fd;
+    off_t offset;
+    int len;
+    char* buf;
+    void* sesion;               // dueño (ClientState) para procesar el completado
+    uint32_t seq;               // a confirmar cuando termine (modo durable)
+    int es_v2;                  // tipo de ACK a enviar
+    int error;                  // errno de pwrite/fdatasync, 0 si salió bien
+    int diario;                 // >= 0: checkpoint (ver diario.h), buf se graba en este fd
+    void (*calculo)(void*);     // != NULL: no se escribe nada, se llama calculo(arg)
+    void* arg;
+    uint64_t recibido;          // metricas_reloj() del lote en que llegó el DATA (latencia del ACK)
+    struct Completados* destino;
+    struct Trabajo* sig;
+} Trabajo;
+
+
+// trabajos terminados que vuelven a un event loop
+typedef struct Completados {
+    pthread_mutex_t mutex;
+    Trabajo* lista;
+    int eventfd;                // se vuelve legible cuando hay completados
+} Completados;
+
+
+// buffers preasignados de un event loop (sin lock: solo lo usa su loop)
+typedef struct {
+    Trabajo* trabajos;
+    char* buffers;
+    Trabajo* libres;
+    int capacidad;
+    int en_uso;
+    uint64_t rechazos;          // DATA descartados por falta de buffers
+} PoolTrabajos;
+
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_trabajo;
+    Trabajo* cabeza;
+    Trabajo* cola;
+    int durable;
+    int n_hilos;
+    pthread_t* hilos;
+} Escritor;
+
+
+int pool_init(PoolTrabajos* p, int capacidad, int tam_buffer) {
+    memset(p, 0, sizeof(PoolTrabajos));
+    p->trabajos = calloc(capacidad, sizeof(Trabajo));
+    size_t paso = linea_redondear(tam_buffer);
+    p->buffers = linea_alloc((size_t)capacidad * paso);
+    if (!p->trabajos || !p->buffers) {
+        free(p->trabajos);
+        free(p->buffers);
+        return -1;
+    }
+
+    p->capacidad = capacidad;
+    for (int i = capacidad - 1; i >= 0; i--) {
+        p->trabajos[i].buf = p->buffers + (size_t)i * paso;
+        p->trabajos[i].sig = p->libres;
+        p->libres = &p->trabajos[i];
+    }
+    return 0;
+}
+
+
+void pool_free(PoolTrabajos* p) {
+    free(p->trabajos);
+    free(p->buffers);
+    memset(p, 0, sizeof(PoolTrabajos));
+}
+
+
+// NULL si no quedan buffers
+Trabajo* pool_tomar(PoolTrabajos* p) {
+    Trabajo* t = p->libres;
+    if (!t) {
+        p->rechazos++;
+        return NULL;
+    }
+    p->libres = t->sig;
+    t->sig = NULL;
+    t->error = 0;
+    t->diario = -1;
+    t->calculo = NULL;
+    p->en_uso++;
+    return t;
+}
+
+
+void pool_devolver(PoolTrabajos* p, Trabajo* t) {
+    t->sig = p->libres;
+    p->libres = t;
+    p->en_uso--;
+}
+
+
+int completados_init(Completados* c) {
+    pthread_mutex_init(&c->mutex, NULL);
+    c->lista = NULL;
+    c->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return (c->eventfd < 0) ? -1 : 0;
+}
+
+
+// devuelve todos los trabajos terminados (en cualquier orden) y rearma el eventfd
+Trabajo* completados_drenar(Completados* c) {
+    uint64_t cuenta;
+    if (read(c->eventfd, &cuenta, sizeof(cuenta)) < 0 && errno != EAGAIN) {
+        perror("read(eventfd)");
+    }
+
+    pthread_mutex_lock(&c->mutex);
+    Trabajo* lista = c->lista;
+    c->lista = NULL;
+    pthread_mutex_unlock(&c->mutex);
+    return lista;
+}
+
+
+void completados_agregar(Completados* c, Trabajo* lista, Trabajo* ultimo) {
+    pthread_mutex_lock(&c->mutex);
+    ultimo->sig = c->lista;
+    c->lista = lista;
+    pthread_mutex_unlock(&c->mutex);
+
+    uint64_t uno = 1;
+    if (write(c->eventfd, &uno, sizeof(uno)) < 0) {
+        perror("write(eventfd)");
+    }
+}
+
+
+// entrega una tanda de trabajos encadenados por sig a los escritores
+void escritor_encolar(Escritor* e, Trabajo* lista) {
+    if (!lista) {
+        return;
+    }
+    Trabajo* ultimo = lista;
+    while (ultimo->sig) {
+        ultimo = ultimo->sig;
+    }
+
+    pthread_mutex_lock(&e->mutex);
+    if (e->cola) {
+        e->cola->sig = lista;
+    } else {
+        e->cabeza = lista;
+    }
+    e->cola = ultimo;
+    pthread_cond_signal(&e->hay_trabajo);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+
+#define TANDA_ESCRITOR 64
+
+
+void* escritor_loop(void* arg) {
+    Escritor* e = arg;
+    Trabajo* tanda[TANDA_ESCRITOR];
+
+    while (1) {
+        pthread_mutex_lock(&e->mutex);
+        while (!e->cabeza) {
+            pthread_cond_wait(&e->hay_trabajo, &e->mutex);
+        }
+        int n = 0;
+        while (e->cabeza && n < TANDA_ESCRITOR) {
+            tanda[n++] = e->cabeza;
+            e->cabeza = e->cabeza->sig;
+        }
+        if (!e->cabeza) {
+            e->cola = NULL;
+        } else {
+            pthread_cond_signal(&e->hay_trabajo);   // que otro hilo tome el resto
+        }
+        pthread_mutex_unlock(&e->mutex);
+
+        for (int i = 0; i < n; i++) {
+            Trabajo* t = tanda[i];
+
+            if (t->calculo) {
+                t->calculo(t->arg);
+                continue;
+            }
+
+            uint64_t inicio = metricas_reloj();
+
+            // checkpoint: primero los datos a disco, después el registro que los describe
+            if (t->diario >= 0) {
+                if (fdatasync(t->fd) < 0 || pwrite(t->diario, t->buf, t->len, 0) != t->len ||
+                    fdatasync(t->diario) < 0) {
+                    t->error = errno;
+                }
+                metrica_latencia(H_LATENCIA_SYNC, inicio);
+                continue;
+            }
+
+            int escrito = 0;
+            while (escrito < t->len) {
+                ssize_t r = pwrite(t->fd, t->buf + escrito, t->len - escrito, t->offset + escrito);
+                if (r < 0) {
+                    if (errno == EINTR) continue;
+                    t->error = errno;
+                    break;
+                }
+                escrito += r;
+            }
+            metrica_latencia(H_LATENCIA_ESCRITURA, inicio);
+        }
+
+        // group commit: un fdatasync por archivo distinto de la tanda
+        if (e->durable) {
+            for (int i = 0; i < n; i++) {
+                int repetido = (tanda[i]->calculo != NULL);
+                for (int j = 0; j < i && !repetido; j++) {
+                    repetido = (tanda[j]->fd == tanda[i]->fd);
+                }
+                if (repetido) {
+                    continue;
+                }
+                uint64_t inicio = metricas_reloj();
+                int err = (fdatasync(tanda[i]->fd) < 0) ? errno : 0;
+                metrica_latencia(H_LATENCIA_SYNC, inicio);
+                if (err) {
+                    for (int j = i; j < n; j++) {
+                        if (tanda[j]->fd == tanda[i]->fd && !tanda[j]->error) {
+                            tanda[j]->error = err;
+                        }
+                    }
+                }
+            }
+        }
+
+        // devolver cada trabajo a su loop, una sola vez por destino
+        for (int i = 0; i < n; i++) {
+            if (!tanda[i]) {
+                continue;
+            }
+            Completados* destino = tanda[i]->destino;
+            Trabajo* lista = NULL;
+            Trabajo* ultimo = NULL;
+            for (int j = n - 1; j >= i; j--) {
+                if (tanda[j] && tanda[j]->destino == destino) {
+                    if (!ultimo) {
+                        ultimo = tanda[j];
+                    }
+                    tanda[j]->sig = lista;
+                    lista = tanda[j];
+                    tanda[j] = NULL;
+                }
+            }
+            completados_agregar(destino, lista, ultimo);
+        }
+    }
+
+    return NULL;
+}
+
+
+int escritor_init(Escritor* e, int n_hilos, int durable) {
+    memset(e, 0, sizeof(Escritor));
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->hay_trabajo, NULL);
+    e->durable = durable;
+    e->n_hilos = n_hilos;
+    e->hilos = calloc(n_hilos, sizeof(pthread_t));
+    if (!e->hilos) {
+        return -1;
+    }
+
+    for (int i = 0; i < n_hilos; i++) {
+        if (pthread_create(&e->hilos[i], NULL, escritor_loop, e) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// reserva el tamaño final del archivo de una vez (menos fragmentación y
+// sin extender el archivo en cada pwrite). Si el filesystem no lo soporta se sigue igual
+void preasignar_archivo(int fd, uint64_t tam) {
+    if (tam > 0 && fallocate(fd, 0, 0, tam) < 0 && errno != EOPNOTSUPP) {
+        perror("fallocate");
+    }
+}
+
+#endif
@@ -0,0 +1,502 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+// FEC del modo ventana (-F k:m): por cada grupo de k DATA consecutivos
+// (grupo = seq / k) el cliente manda m PDUs PARIDAD. Con hasta m DATA del
+// grupo perdidos el servidor los reconstruye con los que llegaron y las
+// paridades, sin esperar la retransmisión (un RTO, o un RTT con SACK).
+//
+// código: Reed-Solomon sistemático sobre GF(256) (polinomio 0x11D) con una
+// matriz de Cauchy: paridad j = sum_i c(j, i) * D_i con c(j, i) = y_i / (j ^ y_i),
+// y_i = FEC_M_MAX + i. Toda submatriz cuadrada de una de Cauchy es invertible
+// (se dividió cada columna por su fila 0, que no cambia eso), así que cualquier
+// combinación de hasta m pérdidas entre DATA y paridades se puede resolver. La
+// fila 0 queda en unos: con m = 1 la paridad es el XOR del grupo.
+//
+// cada DATA entra al código como un símbolo de FEC_SIMBOLO + bloque bytes:
+// largo del payload (2 bytes, network order), flags del PDU (V2_COMPRIMIDO, V2_DELTA) y
+// el payload tal como viajó, completado con ceros. Payload de una PARIDAD:
+// índice j, cantidad de DATA del grupo (el último puede tener menos de k) y
+// el símbolo hasta el largo más grande del grupo. Por eso con FEC el cliente
+// manda bloques de FEC_CABECERA bytes menos: la paridad entra en el datagrama
+// sondeado.
+//
+// el servidor no guarda los DATA: por cada grupo abierto acumula las m sumas
+// (paridad j menos lo recibido) al recibir cada PDU. Con e DATA faltantes y
+// e paridades, esas sumas son un sistema de e x e que se invierte y da los
+// faltantes. Memoria: m símbolos por grupo que puede estar abierto en la ventana
+//
+// producto de una región por una constante (lo que cuesta): tabla de 256x256
+// (un acceso por byte) o, en x86-64 con SSSE3 / AVX2, de a 16 / 32 bytes con
+// pshufb sobre dos tablas de 16 (producto del nibble bajo y del alto). Se
+// elige una vez al arrancar, como el CRC32C
+#define FEC_K_MAX 32
+#define FEC_M_MAX 4
+#define FEC_SIMBOLO 3            // largo + flags delante del payload
+#define FEC_CABECERA (2 + FEC_SIMBOLO)   // lo que la paridad agrega al bloque
+
+
+uint8_t gf_exp[512];
+uint8_t gf_log[256];
+uint8_t gf_tabla[256][256];
+
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return gf_tabla[a][b];
+}
+
+
+// a != 0
+uint8_t gf_inv(uint8_t a) {
+    return gf_exp[255 - gf_log[a]];
+}
+
+
+// dst ^= c * src, n bytes
+void gf_mul_sumar_sw(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    if (c == 0) {
+        return;
+    }
+    size_t i = 0;
+    if (c == 1) {
+        for (; i + 8 <= n; i += 8) {
+            uint64_t a, b;
+            memcpy(&a, dst + i, 8);
+            memcpy(&b, src + i, 8);
+            a ^= b;
+            memcpy(dst + i, &a, 8);
+        }
+        for (; i < n; i++) {
+            dst[i] ^= src[i];
+        }
+        return;
+    }
+    const uint8_t* fila = gf_tabla[c];
+    for (; i < n; i++) {
+        dst[i] ^= fila[src[i]];
+    }
+}
+
+
+#if defined(__x86_64__)
+
+__attribute__((target("ssse3")))
+void gf_mul_sumar_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    if (c <= 1) {
+        gf_mul_sumar_sw(dst, src, c, n);
+        return;
+    }
+    uint8_t bajo[16], alto[16];
+    for (int x = 0; x < 16; x++) {
+        bajo[x] = gf_tabla[c][x];
+        alto[x] = gf_tabla[c][x << 4];
+    }
+    __m128i tb = _mm_loadu_si128((const __m128i*)bajo);
+    __m128i ta = _mm_loadu_si128((const __m128i*)alto);
+    __m128i mascara = _mm_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i l = _mm_shuffle_epi8(tb, _mm_and_si128(v, mascara));
+        __m128i h = _mm_shuffle_epi8(ta, _mm_and_si128(_mm_srli_epi64(v, 4), mascara));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    gf_mul_sumar_sw(dst + i, src + i, c, n - i);
+}
+
+
+__attribute__((target("avx2")))
+void gf_mul_sumar_avx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t n) {
+    if (c <= 1) {
+        gf_mul_sumar_sw(dst, src, c, n);
+        return;
+    }
+    uint8_t bajo[16], alto[16];
+    for (int x = 0; x < 16; x++) {
+        bajo[x] = gf_tabla[c][x];
+        alto[x] = gf_tabla[c][x << 4];
+    }
+    __m256i tb = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)bajo));
+    __m256i ta = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)alto));
+    __m256i mascara = _mm256_set1_epi8(0x0F);
+
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i l = _mm256_shuffle_epi8(tb, _mm256_and_si256(v, mascara));
+        __m256i h = _mm256_shuffle_epi8(ta, _mm256_and_si256(_mm256_srli_epi64(v, 4), mascara));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(l, h)));
+    }
+    gf_mul_sumar_sw(dst + i, src + i, c, n - i);
+}
+
+#endif
+
+
+// implementación elegida en gf_init
+void (*gf_mul_sumar)(uint8_t*, const uint8_t*, uint8_t, size_t) = gf_mul_sumar_sw;
+const char* gf_nombre = "tabla 256x256";
+
+
+__attribute__((constructor))
+void gf_init() {
+    int x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf_exp[i] = x;
+        gf_log[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11D;
+        }
+    }
+    for (int i = 255; i < 512; i++) {
+        gf_exp[i] = gf_exp[i - 255];
+    }
+    for (int a = 1; a < 256; a++) {
+        for (int b = 1; b < 256; b++) {
+            gf_tabla[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+        }
+    }
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        gf_mul_sumar = gf_mul_sumar_avx2;
+        gf_nombre = "avx2 (pshufb)";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        gf_mul_sumar = gf_mul_sumar_ssse3;
+        gf_nombre = "ssse3 (pshufb)";
+    }
+#endif
+}
+
+
+// coeficiente de la paridad j para el DATA i del grupo
+uint8_t fec_coef(int j, int i) {
+    uint8_t y = FEC_M_MAX + i;
+    return gf_mul(y, gf_inv(j ^ y));
+}
+
+
+// invierte en el lugar una matriz de n x n (n <= FEC_M_MAX). -1 si es singular
+int gf_invertir(uint8_t a[FEC_M_MAX][FEC_M_MAX], int n) {
+    uint8_t inv[FEC_M_MAX][FEC_M_MAX];
+    memset(inv, 0, sizeof(inv));
+    for (int i = 0; i < n; i++) {
+        inv[i][i] = 1;
+    }
+    for (int col = 0; col < n; col++) {
+        int piv = col;
+        while (piv < n && a[piv][col] == 0) {
+            piv++;
+        }
+        if (piv == n) {
+            return -1;
+        }
+        for (int k = 0; k < n; k++) {
+            uint8_t t = a[col][k]; a[col][k] = a[piv][k]; a[piv][k] = t;
+            t = inv[col][k]; inv[col][k] = inv[piv][k]; inv[piv][k] = t;
+        }
+        uint8_t f = gf_inv(a[col][col]);
+        for (int k = 0; k < n; k++) {
+            a[col][k] = gf_mul(a[col][k], f);
+            inv[col][k] = gf_mul(inv[col][k], f);
+        }
+        for (int fila = 0; fila < n; fila++) {
+            uint8_t g = a[fila][col];
+            if (fila == col || g == 0) {
+                continue;
+            }
+            for (int k = 0; k < n; k++) {
+                a[fila][k] ^= gf_mul(g, a[col][k]);
+                inv[fila][k] ^= gf_mul(g, inv[col][k]);
+            }
+        }
+    }
+    memcpy(a, inv, sizeof(inv));
+    return 0;
+}
+
+
+// suma c(j, i) * símbolo del DATA (largo, flags, payload) a dst
+void fec_sumar_data(uint8_t* dst, uint8_t c, uint8_t flags, const void* payload, int len) {
+    uint8_t cabecera[FEC_SIMBOLO] = { len >> 8, len & 0xFF, flags };
+    gf_mul_sumar(dst, cabecera, c, FEC_SIMBOLO);
+    gf_mul_sumar(dst + FEC_SIMBOLO, payload, c, len);
+}
+
+
+// ---------------------------------------------------------------------------
+// emisor (cliente): las m paridades del grupo en curso, acumuladas a medida
+// que salen sus DATA. Cada fila tiene 2 bytes delante para j y n: es el
+// payload de la PARIDAD tal cual
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int k;
+    int m;
+    int simbolo;             // FEC_SIMBOLO + bloque
+    uint8_t* filas;          // m x (2 + simbolo)
+    int n;                   // DATA del grupo en curso ya sumados
+    int largo;               // símbolo más largo del grupo (sin los ceros del final)
+    uint64_t paridades;      // PARIDAD enviadas
+} FecEmisor;
+
+
+int fec_emisor_init(FecEmisor* e, int k, int m, int bloque) {
+    memset(e, 0, sizeof(FecEmisor));
+    e->k = k;
+    e->m = m;
+    e->simbolo = FEC_SIMBOLO + bloque;
+    e->filas = calloc(m, 2 + e->simbolo);
+    return e->filas ? 0 : -1;
+}
+
+
+void fec_emisor_free(FecEmisor* e) {
+    free(e->filas);
+    e->filas = NULL;
+}
+
+
+uint8_t* fec_emisor_fila(FecEmisor* e, int j) {
+    return e->filas + (size_t)j * (2 + e->simbolo);
+}
+
+
+// suma el DATA seq (primer envío, en orden). Devuelve 1 si completó su grupo
+int fec_emisor_agregar(FecEmisor* e, uint32_t seq, uint8_t flags, const void* payload, int len) {
+    int i = seq % e->k;
+    if (i == 0) {
+        for (int j = 0; j < e->m; j++) {
+            memset(fec_emisor_fila(e, j) + 2, 0, e->largo);
+        }
+        e->largo = 0;
+    }
+    for (int j = 0; j < e->m; j++) {
+        fec_sumar_data(fec_emisor_fila(e, j) + 2, fec_coef(j, i), flags, payload, len);
+    }
+    e->n = i + 1;
+    if (FEC_SIMBOLO + len > e->largo) {
+        e->largo = FEC_SIMBOLO + len;
+    }
+    return e->n == e->k;
+}
+
+
+// payload de la paridad j del grupo en curso (que tiene e->n DATA)
+const uint8_t* fec_emisor_paridad(FecEmisor* e, int j, int* len) {
+    uint8_t* fila = fec_emisor_fila(e, j);
+    fila[0] = j;
+    fila[1] = e->n;
+    *len = 2 + e->largo;
+    return fila;
+}
+
+
+// ---------------------------------------------------------------------------
+// receptor (servidor): un anillo con los grupos que pueden estar abiertos en
+// la ventana (ventana / k + 2: la ventana empieza y termina a mitad de grupo)
+// ---------------------------------------------------------------------------
+
+#define FEC_LIBRE     0
+#define FEC_ABIERTO   1
+#define FEC_RESUELTO  2      // completo o ya reconstruido: se ignora lo que llegue
+
+typedef struct {
+    uint32_t grupo;
+    uint32_t recibidos;      // bit i = DATA i del grupo sumado
+    uint8_t paridades;       // bit j = paridad j sumada
+    uint8_t n;               // DATA del grupo (lo dice la paridad; 0 = todavía no)
+    uint8_t estado;
+    int largo;               // paridad más larga: hasta ahí llegan los símbolos
+} FecGrupo;
+
+
+typedef struct {
+    int k;
+    int m;
+    int simbolo;
+    int bloque;
+    int n_grupos;
+    FecGrupo* grupos;
+    uint8_t* sumas;          // n_grupos x m x simbolo
+    uint8_t* salida;         // m x simbolo: los DATA reconstruidos
+    uint64_t recuperados;
+} FecReceptor;
+
+
+FecReceptor* fec_receptor_nuevo(int k, int m, int bloque, int ventana) {
+    FecReceptor* r = calloc(1, sizeof(FecReceptor));
+    if (!r) {
+        return NULL;
+    }
+    r->k = k;
+    r->m = m;
+    r->bloque = bloque;
+    r->simbolo = FEC_SIMBOLO + bloque;
+    r->n_grupos = ventana / k + 2;
+    r->grupos = calloc(r->n_grupos, sizeof(FecGrupo));
+    r->sumas = malloc((size_t)r->n_grupos * m * r->simbolo);
+    r->salida = malloc((size_t)m * r->simbolo);
+    if (!r->grupos || !r->sumas || !r->salida) {
+        free(r->grupos);
+        free(r->sumas);
+        free(r->salida);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+
+void fec_receptor_free(FecReceptor* r) {
+    if (r) {
+        free(r->grupos);
+        free(r->sumas);
+        free(r->salida);
+        free(r);
+    }
+}
+
+
+uint8_t* fec_suma(FecReceptor* r, int indice, int j) {
+    return r->sumas + ((size_t)indice * r->m + j) * r->simbolo;
+}
+
+
+// entrada del grupo g, abriéndola si hace falta. NULL si el anillo ya pasó a
+// un grupo posterior (g es viejo)
+FecGrupo* fec_grupo(FecReceptor* r, uint32_t g) {
+    int indice = g % r->n_grupos;
+    FecGrupo* grp = &r->grupos[indice];
+    if (grp->estado != FEC_LIBRE && grp->grupo == g) {
+        return grp;
+    }
+    if (grp->estado != FEC_LIBRE && (int32_t)(g - grp->grupo) < 0) {
+        return NULL;
+    }
+    memset(grp, 0, sizeof(FecGrupo));
+    grp->grupo = g;
+    grp->estado = FEC_ABIERTO;
+    memset(fec_suma(r, indice, 0), 0, (size_t)r->m * r->simbolo);
+    return grp;
+}
+
+
+// un DATA nuevo (aceptado por primera vez)
+void fec_receptor_data(FecReceptor* r, uint32_t seq, uint8_t flags, const void* payload, int len) {
+    uint32_t g = seq / r->k;
+    int i = seq % r->k;
+    FecGrupo* grp = fec_grupo(r, g);
+    if (!grp || grp->estado == FEC_RESUELTO || (grp->recibidos & (1U << i))) {
+        return;
+    }
+    grp->recibidos |= 1U << i;
+    int indice = g % r->n_grupos;
+    for (int j = 0; j < r->m; j++) {
+        fec_sumar_data(fec_suma(r, indice, j), fec_coef(j, i), flags, payload, len);
+    }
+}
+
+
+// una PARIDAD del grupo g. -1 si está mal formada
+int fec_receptor_paridad(FecReceptor* r, uint32_t g, const uint8_t* payload, int len) {
+    if (len < 2 + FEC_SIMBOLO || len > 2 + r->simbolo || payload[0] >= r->m ||
+        payload[1] == 0 || payload[1] > r->k) {
+        return -1;
+    }
+    int j = payload[0];
+    FecGrupo* grp = fec_grupo(r, g);
+    if (!grp || grp->estado == FEC_RESUELTO || (grp->paridades & (1 << j))) {
+        return 0;
+    }
+    grp->paridades |= 1 << j;
+    grp->n = payload[1];
+    if (len - 2 > grp->largo) {
+        grp->largo = len - 2;
+    }
+    gf_mul_sumar(fec_suma(r, g % r->n_grupos, j), payload + 2, 1, len - 2);
+    return 0;
+}
+
+
+// si el grupo g ya se puede resolver, reconstruye sus DATA faltantes en
+// r->salida (uno por fila) y deja sus seqs en seqs[]. Devuelve cuántos
+int fec_receptor_recuperar(FecReceptor* r, uint32_t g, uint32_t* seqs) {
+    FecGrupo* grp = &r->grupos[g % r->n_grupos];
+    if (grp->estado != FEC_ABIERTO || grp->grupo != g || grp->n == 0) {
+        return 0;
+    }
+    int faltan[FEC_M_MAX + 1];
+    int e = 0;
+    for (int i = 0; i < grp->n && e <= r->m; i++) {
+        if (!(grp->recibidos & (1U << i))) {
+            faltan[e++] = i;
+        }
+    }
+    int filas[FEC_M_MAX];
+    int p = 0;
+    for (int j = 0; j < r->m; j++) {
+        if (grp->paridades & (1 << j)) {
+            filas[p++] = j;
+        }
+    }
+    if (e == 0) {
+        grp->estado = FEC_RESUELTO;
+        return 0;
+    }
+    if (e > p) {
+        return 0;
+    }
+
+    // sumas[filas[x]] = sum_y c(filas[x], faltan[y]) * D_faltan[y]
+    uint8_t a[FEC_M_MAX][FEC_M_MAX];
+    for (int x = 0; x < e; x++) {
+        for (int y = 0; y < e; y++) {
+            a[x][y] = fec_coef(filas[x], faltan[y]);
+        }
+    }
+    if (gf_invertir(a, e) != 0) {
+        return 0;       // no pasa con una matriz de Cauchy
+    }
+    int indice = g % r->n_grupos;
+    for (int y = 0; y < e; y++) {
+        uint8_t* d = r->salida + (size_t)y * r->simbolo;
+        memset(d, 0, r->simbolo);
+        for (int x = 0; x < e; x++) {
+            gf_mul_sumar(d, fec_suma(r, indice, filas[x]), a[y][x], grp->largo);
+        }
+        seqs[y] = g * r->k + faltan[y];
+    }
+    grp->estado = FEC_RESUELTO;
+    r->recuperados += e;
+    return e;
+}
+
+
+// payload y flags del DATA reconstruido número y. NULL si el símbolo no tiene
+// sentido (paridades de otro contenido: el digest del FIN lo habría rechazado igual)
+const char* fec_recuperado(FecReceptor* r, int y, uint8_t* flags, int* len) {
+    const uint8_t* d = r->salida + (size_t)y * r->simbolo;
+    *len = (d[0] << 8) | d[1];
+    *flags = d[2];
+    if (*len > r->bloque) {
+        return NULL;
+    }
+    return (const char*)d + FEC_SIMBOLO;
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef GRUPOS_H
+#define GRUPOS_H
+
+#include <pthread.h>
+#include <fcntl.h>
+#include "common.h"
+#include "escritor.h"
+
+
+// subidas en paralelo (OPT_RANGO): las sesiones de un grupo pueden caer en
+// workers distintos, así que el registro es global y tiene lock. Se toma solo
+// en el WRQ y al terminar cada rango, nunca por DATA: todas las sesiones
+// escriben con pwrite() en el mismo fd, cada una en su rango.
+//
+// el archivo está completo cuando terminaron todos los rangos; recién ahí se
+// recorta al tamaño final. Un grupo sin sesiones al que le faltan rangos se
+// conserva `retencion_us` (una sesión puede terminar antes de que otra haga su
+// WRQ: si el grupo se borrara, el siguiente lo recrearía truncando el archivo)
+
+
+typedef struct Grupo {
+    uint32_t id;
+    char filename[256];
+    int fd;
+    uint16_t total;
+    uint16_t terminados;
+    uint8_t* terminado;         // por rango
+    uint64_t tam_final;         // fin del último byte escrito por cualquier rango
+    int refs;                   // sesiones unidas que todavía no se liberaron
+    uint64_t sin_uso_desde;     // get_monotonic_us() cuando refs llegó a 0
+    struct Grupo* sig;
+} Grupo;
+
+
+typedef struct {
+    pthread_mutex_t mutex;
+    Grupo* lista;
+    uint64_t retencion_us;
+} RegistroGrupos;
+
+
+void grupos_init(RegistroGrupos* r, uint64_t retencion_us) {
+    pthread_mutex_init(&r->mutex, NULL);
+    r->lista = NULL;
+    r->retencion_us = retencion_us;
+}
+
+
+// con el lock tomado
+void grupo_destruir(RegistroGrupos* r, Grupo* g) {
+    for (Grupo** p = &r->lista; *p; p = &(*p)->sig) {
+        if (*p == g) {
+            *p = g->sig;
+            break;
+        }
+    }
+    if (g->terminados < g->total) {
+        LOG(LOG_ERROR, "  [ERROR] %s quedo incompleto: %u de %u rangos\n", g->filename, g->terminados, g->total);
+    }
+    close(g->fd);
+    free(g->terminado);
+    free(g);
+}
+
+
+// con el lock tomado: libera los grupos abandonados
+void grupos_barrer(RegistroGrupos* r) {
+    uint64_t ahora = get_monotonic_us();
+    Grupo* g = r->lista;
+    while (g) {
+        Grupo* sig = g->sig;
+        if (g->refs == 0 && ahora - g->sin_uso_desde > r->retencion_us) {
+            grupo_destruir(r, g);
+        }
+        g = sig;
+    }
+}
+
+
+// une una sesión al grupo (lo crea y abre el archivo si es la primera).
+// Devuelve NULL y el motivo en *error si no se pudo
+Grupo* grupo_unirse(RegistroGrupos* r, const OptRango* rango, const char* filename,
+                    uint64_t tam, const char** error) {
+    uint32_t id = ntohl(rango->grupo);
+    uint16_t total = ntohs(rango->total);
+    if (total == 0 || ntohs(rango->indice) >= total) {
+        *error = "Rango invalido";
+        return NULL;
+    }
+
+    pthread_mutex_lock(&r->mutex);
+    grupos_barrer(r);
+
+    Grupo* g = r->lista;
+    while (g && (g->id != id || strcmp(g->filename, filename) != 0)) {
+        g = g->sig;
+    }
+
+    if (g) {
+        if (g->total != total) {
+            pthread_mutex_unlock(&r->mutex);
+            *error = "Rango invalido";
+            return NULL;
+        }
+        g->refs++;
+        pthread_mutex_unlock(&r->mutex);
+        return g;
+    }
+
+    g = calloc(1, sizeof(Grupo));
+    if (g) {
+        g->terminado = calloc(total, 1);
+    }
+    if (!g || !g->terminado) {
+        pthread_mutex_unlock(&r->mutex);
+        free(g);
+        *error = "Servidor sin memoria";
+        return NULL;
+    }
+
+    g->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (g->fd < 0) {
+        perror("  [ERROR] open");
+        pthread_mutex_unlock(&r->mutex);
+        free(g->terminado);
+        free(g);
+        *error = "Error abriendo archivo";
+        return NULL;
+    }
+    preasignar_archivo(g->fd, tam);
+
+    g->id = id;
+    snprintf(g->filename, sizeof(g->filename), "%s", filename);
+    g->total = total;
+    g->refs = 1;
+    g->sig = r->lista;
+    r->lista = g;
+    pthread_mutex_unlock(&r->mutex);
+
+    LOG(LOG_INFO, "  [OK] Subida en paralelo %08x: %s en %u rangos\n", id, filename, total);
+    return g;
+}
+
+
+// marca un rango terminado. Devuelve 1 si con este el archivo quedó completo
+int grupo_terminar(RegistroGrupos* r, Grupo* g, uint16_t indice, uint64_t tam_final) {
+    int completo = 0;
+
+    pthread_mutex_lock(&r->mutex);
+    if (tam_final > g->tam_final) {
+        g->tam_final = tam_final;
+    }
+    if (!g->terminado[indice]) {
+        g->terminado[indice] = 1;
+        g->terminados++;
+        if (g->terminados == g->total) {
+            if (ftruncate(g->fd, g->tam_final) < 0) {
+                perror("  [ERROR] ftruncate");
+            }
+            completo = 1;
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+    return completo;
+}
+
+
+// la sesión deja el grupo (FIN o expiración). Sin escrituras pendientes
+void grupo_soltar(RegistroGrupos* r, Grupo* g) {
+    pthread_mutex_lock(&r->mutex);
+    if (--g->refs == 0) {
+        g->sin_uso_desde = get_monotonic_us();
+        if (g->terminados == g->total) {
+            grupo_destruir(r, g);
+        }
+    }
+    pthread_mutex_unlock(&r->mutex);
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef GSO_H
+#define GSO_H
+
+#include <netinet/udp.h>
+#include "common.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+
+// segmentation offload de UDP (-g). Del lado que envía, varios PDU del mismo
+// largo van en un solo sendmsg con UDP_SEGMENT = largo: el buffer recorre el
+// stack una vez y el kernel (o la placa) lo corta en datagramas recién al
+// final. Todos los segmentos miden lo mismo salvo el último, que puede ser
+// más corto. Del lado que recibe, con UDP_GRO el kernel entrega juntos los
+// datagramas seguidos del mismo flujo en un solo buffer, y avisa en un cmsg
+// el largo de cada uno para volver a separarlos.
+//
+// en loopback y veth el super-buffer llega entero al socket si este tiene
+// UDP_GRO activo (si no, el kernel lo segmenta antes de entregarlo)
+#define GSO_MAX_SEGMENTOS 64        // UDP_MAX_SEGMENTS del kernel
+#define GSO_MAX_BYTES DATAGRAMA_MAX
+#define GRO_BUFFER (GSO_MAX_BYTES + 1)
+
+
+// PDUs acumulados para un envío con UDP_SEGMENT. Cada uno aporta dos iovec:
+// header y payload (que puede estar en el archivo mapeado, como en enviar())
+typedef struct {
+    struct iovec iov[2 * GSO_MAX_SEGMENTOS];
+    int n;
+    int segmento;            // largo de cada PDU (el del primero)
+    int bytes;
+    int primer_slot;         // slot del primer PDU (los siguientes son consecutivos)
+} LoteGSO;
+
+
+// 0 si el kernel acepta UDP_SEGMENT en este socket
+int gso_disponible(int socket) {
+    int cero = 0;
+    if (setsockopt(socket, SOL_UDP, UDP_SEGMENT, &cero, sizeof(cero)) < 0) {
+        perror("setsockopt(UDP_SEGMENT)");
+        return -1;
+    }
+    return 0;
+}
+
+
+// agrega un PDU al lote. Devuelve -1 si no entra (hay que enviar el lote y
+// volver a agregarlo), 1 si entró y cerró el lote (lleno o más corto que los
+// anteriores: hay que enviarlo ya) y 0 si entró y todavía admite más
+int gso_agregar(LoteGSO* l, const void* header, int header_len, const void* payload, int len, int slot) {
+    int total = header_len + len;
+    if (l->n > 0 && (total > l->segmento || l->bytes + total > GSO_MAX_BYTES)) {
+        return -1;
+    }
+    if (l->n == 0) {
+        l->segmento = total;
+        l->bytes = 0;
+        l->primer_slot = slot;
+    }
+
+    l->iov[2 * l->n].iov_base = (void*)header;
+    l->iov[2 * l->n].iov_len = header_len;
+    l->iov[2 * l->n + 1].iov_base = (void*)payload;
+    l->iov[2 * l->n + 1].iov_len = len;
+    l->n++;
+    l->bytes += total;
+
+    return (total < l->segmento || l->n == GSO_MAX_SEGMENTOS ||
+            l->bytes + l->segmento > GSO_MAX_BYTES) ? 1 : 0;
+}
+
+
+// arma el sendmsg del lote: con un solo PDU es un datagrama común. control
+// tiene que tener al menos CMSG_SPACE(sizeof(uint16_t)) bytes
+void gso_mensaje(LoteGSO* l, struct msghdr* msg, char* control) {
+    memset(msg, 0, sizeof(struct msghdr));
+    msg->msg_iov = l->iov;
+    msg->msg_iovlen = 2 * l->n;
+    if (l->n < 2) {
+        return;
+    }
+
+    msg->msg_control = control;
+    msg->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    struct cmsghdr* c = CMSG_FIRSTHDR(msg);
+    c->cmsg_level = SOL_UDP;
+    c->cmsg_type = UDP_SEGMENT;
+    c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segmento = l->segmento;
+    memcpy(CMSG_DATA(c), &segmento, sizeof(segmento));
+}
+
+
+// activa la recepción agrupada. Los buffers de recepción tienen que ser de
+// GRO_BUFFER bytes: lo que no entra se pierde (MSG_TRUNC)
+int gro_activar(int socket) {
+    int uno = 1;
+    if (setsockopt(socket, SOL_UDP, UDP_GRO, &uno, sizeof(uno)) < 0) {
+        perror("setsockopt(UDP_GRO)");
+        return -1;
+    }
+    return 0;
+}
+
+
+// largo de cada datagrama de un buffer recibido con UDP_GRO, o 0 si vino uno solo
+int gro_segmento(struct msghdr* msg) {
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO) {
+            int segmento;
+            memcpy(&segmento, CMSG_DATA(c), sizeof(segmento));
+            return segmento;
+        }
+    }
+    return 0;
+}
+
+#endif
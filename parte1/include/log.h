@@ -0,0 +1,395 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+// log asíncrono. LOG(nivel, fmt, ...) no formatea ni escribe: guarda un
+// registro binario (el puntero al formato, que tiene que ser un literal, y
+// los argumentos tal cual, los strings copiados) en un anillo propio del
+// hilo, sin locks: un solo productor (el hilo) y un solo consumidor. Un hilo
+// de fondo recorre los anillos, formatea con printf y escribe a stdout por
+// tandas. Si el anillo de un hilo está lleno el registro se descarta y se
+// cuenta: el que loguea nunca espera al que escribe.
+//
+// el orden se respeta dentro de cada hilo, no entre hilos. Antes de
+// log_iniciar() (o sin él) LOG escribe directo, como un printf.
+//
+// niveles: el de ejecución lo elige cada programa (-v); al compilar con
+// -DLOG_NIVEL_MAX=LOG_INFO los LOG de nivel más alto desaparecen del
+// binario, argumentos incluidos
+#define LOG_ERROR 0
+#define LOG_AVISO 1
+#define LOG_INFO 2
+#define LOG_DETALLE 3        // uno o más por PDU
+
+#ifndef LOG_NIVEL_MAX
+#define LOG_NIVEL_MAX LOG_DETALLE
+#endif
+
+#define LOG_SLOTS 1024       // registros por anillo (potencia de 2)
+#define LOG_REGISTRO 256     // bytes por registro: lo que no entra de los strings se trunca
+#define LOG_ESPERA_US 2000   // el hilo de fondo duerme esto cuando no hay nada
+
+
+// para armar argumentos caros (inet_ntop) solo si el registro va a salir
+#define LOG_ACTIVO(nivel) ((nivel) <= LOG_NIVEL_MAX && (nivel) <= log_nivel)
+
+#define LOG(nivel, ...) do { \
+        if (LOG_ACTIVO(nivel)) { \
+            log_registrar(__VA_ARGS__); \
+        } \
+    } while (0)
+
+
+typedef struct {
+    const char* fmt;
+    uint16_t largo;          // bytes usados de args
+    char args[LOG_REGISTRO - sizeof(const char*) - sizeof(uint16_t)];
+} RegistroLog;
+
+
+typedef struct AnilloLog {
+    RegistroLog slots[LOG_SLOTS];
+    _Atomic uint32_t escrito;    // próximo slot del productor
+    _Atomic uint32_t leido;      // próximo slot del consumidor
+    _Atomic uint64_t descartados;
+    _Atomic int en_uso;          // tiene un hilo dueño (al terminar, otro lo reutiliza)
+    struct AnilloLog* siguiente;
+} AnilloLog;
+
+
+int log_nivel = LOG_INFO;
+
+_Atomic(AnilloLog*) log_anillos;     // lista de todos los anillos, solo crece
+pthread_mutex_t log_consumo = PTHREAD_MUTEX_INITIALIZER;     // un solo consumidor a la vez
+pthread_key_t log_clave;
+__thread AnilloLog* log_propio;
+pthread_t log_hilo;
+_Atomic int log_activo;
+uint64_t log_descartes_informados;
+
+
+// --- registro: recorre el formato y guarda cada argumento según su conversión ---
+
+// lee un especificador de printf desde p (apuntando al '%'). Deja en *conv la
+// conversión, en *mod el modificador de largo ('H' = hh, 'L' = ll, 0 si no
+// tiene) y cuántos '*' (ancho o precisión por argumento) lleva. Devuelve el
+// puntero al carácter siguiente
+const char* log_especificador(const char* p, char* conv, char* mod, int* asteriscos) {
+    p++;
+    *asteriscos = 0;
+    *mod = 0;
+    while (*p && strchr("-+ #0123456789.*", *p)) {
+        *asteriscos += (*p == '*');
+        p++;
+    }
+    if (*p == 'h' || *p == 'l') {
+        *mod = *p++;
+        if (*p == *mod) {
+            *mod = (*mod == 'h') ? 'H' : 'L';
+            p++;
+        }
+    } else if (*p == 'z' || *p == 'j' || *p == 't' || *p == 'L') {
+        *mod = 'L';      // size_t, intmax_t, ptrdiff_t, long double: 8 bytes (no se usa long double)
+        p++;
+    }
+    *conv = *p;
+    return *p ? p + 1 : p;
+}
+
+
+int log_guardar(RegistroLog* r, const void* valor, int n) {
+    if (r->largo + n > (int)sizeof(r->args)) {
+        return -1;
+    }
+    memcpy(r->args + r->largo, valor, n);
+    r->largo += n;
+    return 0;
+}
+
+
+void log_capturar(RegistroLog* r, const char* fmt, va_list ap) {
+    r->fmt = fmt;
+    r->largo = 0;
+    for (const char* p = fmt; *p; ) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        char conv, mod;
+        int asteriscos, precision = -1;
+        p = log_especificador(p, &conv, &mod, &asteriscos);
+        for (int i = 0; i < asteriscos; i++) {
+            precision = va_arg(ap, int);     // el último '*' es la precisión si hay dos
+            log_guardar(r, &precision, sizeof(int));
+        }
+
+        if (conv == '\0') {
+            break;
+        }
+        if (strchr("diouxXc", conv)) {
+            long long v = (mod == 'L') ? va_arg(ap, long long)
+                        : (mod == 'l') ? va_arg(ap, long) : va_arg(ap, int);
+            log_guardar(r, &v, sizeof(v));
+        } else if (strchr("fFeEgGaA", conv)) {
+            double v = va_arg(ap, double);
+            log_guardar(r, &v, sizeof(v));
+        } else if (conv == 'p') {
+            void* v = va_arg(ap, void*);
+            log_guardar(r, &v, sizeof(v));
+        } else if (conv == 's') {
+            // se copia hasta el '\0' (o la precisión, para %.*s de un buffer sin
+            // terminar); lo que no entra se trunca
+            const char* s = va_arg(ap, const char*);
+            int libre = (int)sizeof(r->args) - r->largo - 1;
+            int n = 0;
+            if (s && libre > 0) {
+                n = strnlen(s, (precision >= 0 && precision < libre) ? precision : libre);
+            }
+            if (libre >= 0) {
+                memcpy(r->args + r->largo, s ? s : "", n);
+                r->args[r->largo + n] = '\0';
+                r->largo += n + 1;
+            }
+        }
+    }
+}
+
+
+// formatea un registro en buf (hasta max). Devuelve los bytes escritos
+int log_formatear(const RegistroLog* r, char* buf, int max) {
+    int escrito = 0;
+    int pos = 0;
+    const char* p = r->fmt;
+
+    while (*p && escrito < max - 1) {
+        if (*p != '%') {
+            const char* fin = strchr(p, '%');
+            int n = fin ? (int)(fin - p) : (int)strlen(p);
+            n = (n < max - 1 - escrito) ? n : max - 1 - escrito;
+            memcpy(buf + escrito, p, n);
+            escrito += n;
+            p += n;
+            continue;
+        }
+
+        // se rearma el especificador sin el modificador de largo y con los '*'
+        // reemplazados por sus valores. Los enteros se guardaron como long long:
+        // se formatean con "ll" después de recortarlos al tipo original
+        const char* inicio = p;
+        char conv, mod;
+        int asteriscos;
+        p = log_especificador(p, &conv, &mod, &asteriscos);
+        char spec[48];
+        int s = 0;
+        for (const char* q = inicio; q < p - 1 && s < (int)sizeof(spec) - 16; q++) {
+            if (*q == '*') {
+                int v = 0;
+                if (pos + (int)sizeof(int) <= r->largo) {
+                    memcpy(&v, r->args + pos, sizeof(int));
+                }
+                pos += sizeof(int);
+                s += snprintf(spec + s, sizeof(spec) - s, "%d", v);
+            } else if (!strchr("hlzjtL", *q)) {
+                spec[s++] = *q;
+            }
+        }
+        if (conv == '\0') {
+            break;
+        }
+        int entero = (strchr("diouxX", conv) != NULL);
+        if (entero) {
+            spec[s++] = 'l';
+            spec[s++] = 'l';
+        }
+        spec[s++] = conv;
+        spec[s] = '\0';
+
+        int n = 0;
+        int libre = max - escrito;
+        if (conv == '%') {
+            n = snprintf(buf + escrito, libre, "%%");
+        } else if ((entero || conv == 'c') && pos + 8 <= r->largo) {
+            long long v;
+            memcpy(&v, r->args + pos, 8);
+            pos += 8;
+            int con_signo = (conv == 'd' || conv == 'i');
+            if (mod == 'H') {
+                v = con_signo ? (long long)(signed char)v : (long long)(unsigned char)v;
+            } else if (mod == 'h') {
+                v = con_signo ? (long long)(short)v : (long long)(unsigned short)v;
+            } else if (mod != 'l' && mod != 'L') {
+                v = con_signo ? (long long)(int)v : (long long)(unsigned int)v;
+            }
+            n = (conv == 'c') ? snprintf(buf + escrito, libre, spec, (int)v)
+                              : snprintf(buf + escrito, libre, spec, v);
+        } else if (strchr("fFeEgGaA", conv) && pos + 8 <= r->largo) {
+            double v;
+            memcpy(&v, r->args + pos, 8);
+            pos += 8;
+            n = snprintf(buf + escrito, libre, spec, v);
+        } else if (conv == 'p' && pos + (int)sizeof(void*) <= r->largo) {
+            void* v;
+            memcpy(&v, r->args + pos, sizeof(void*));
+            pos += sizeof(void*);
+            n = snprintf(buf + escrito, libre, spec, v);
+        } else if (conv == 's' && pos < r->largo) {
+            const char* v = r->args + pos;
+            pos += strlen(v) + 1;
+            n = snprintf(buf + escrito, libre, spec, v);
+        }
+        escrito += (n < libre) ? n : libre - 1;
+    }
+    buf[escrito] = '\0';
+    return escrito;
+}
+
+
+// --- productores ---
+
+void log_soltar(void* anillo) {
+    atomic_store_explicit(&((AnilloLog*)anillo)->en_uso, 0, memory_order_release);
+}
+
+
+// anillo del hilo: uno libre de un hilo que terminó o uno nuevo (una vez por hilo)
+AnilloLog* log_anillo() {
+    if (log_propio) {
+        return log_propio;
+    }
+    for (AnilloLog* a = atomic_load(&log_anillos); a; a = a->siguiente) {
+        int libre = 0;
+        if (atomic_compare_exchange_strong(&a->en_uso, &libre, 1)) {
+            log_propio = a;
+            break;
+        }
+    }
+    if (!log_propio) {
+        AnilloLog* a = calloc(1, sizeof(AnilloLog));
+        if (!a) {
+            return NULL;
+        }
+        a->en_uso = 1;
+        a->siguiente = atomic_load(&log_anillos);
+        while (!atomic_compare_exchange_weak(&log_anillos, &a->siguiente, a)) {
+        }
+        log_propio = a;
+    }
+    pthread_setspecific(log_clave, log_propio);
+    return log_propio;
+}
+
+
+__attribute__((format(printf, 1, 2)))
+void log_registrar(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    AnilloLog* a = atomic_load_explicit(&log_activo, memory_order_acquire) ? log_anillo() : NULL;
+    if (!a) {
+        vprintf(fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    uint32_t escrito = atomic_load_explicit(&a->escrito, memory_order_relaxed);
+    if (escrito - atomic_load_explicit(&a->leido, memory_order_acquire) >= LOG_SLOTS) {
+        atomic_fetch_add_explicit(&a->descartados, 1, memory_order_relaxed);
+    } else {
+        log_capturar(&a->slots[escrito % LOG_SLOTS], fmt, ap);
+        atomic_store_explicit(&a->escrito, escrito + 1, memory_order_release);
+    }
+    va_end(ap);
+}
+
+
+// --- consumidor ---
+
+// formatea y escribe todo lo pendiente de todos los anillos. Devuelve cuántos registros había
+int log_drenar() {
+    static char salida[64 << 10];
+    int usado = 0, registros = 0;
+    uint64_t descartados = 0;
+
+    pthread_mutex_lock(&log_consumo);
+    for (AnilloLog* a = atomic_load(&log_anillos); a; a = a->siguiente) {
+        uint32_t leido = atomic_load_explicit(&a->leido, memory_order_relaxed);
+        uint32_t escrito = atomic_load_explicit(&a->escrito, memory_order_acquire);
+        for (; leido != escrito; leido++, registros++) {
+            if (usado > (int)sizeof(salida) - 1024) {
+                fwrite(salida, 1, usado, stdout);
+                usado = 0;
+            }
+            usado += log_formatear(&a->slots[leido % LOG_SLOTS], salida + usado, sizeof(salida) - usado);
+            atomic_store_explicit(&a->leido, leido + 1, memory_order_release);
+        }
+        descartados += atomic_load_explicit(&a->descartados, memory_order_relaxed);
+    }
+    if (descartados > log_descartes_informados) {
+        usado += snprintf(salida + usado, sizeof(salida) - usado,
+                          "[LOG] %llu registros descartados (anillo lleno)\n",
+                          (unsigned long long)(descartados - log_descartes_informados));
+        log_descartes_informados = descartados;
+    }
+    if (usado > 0) {
+        fwrite(salida, 1, usado, stdout);
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&log_consumo);
+    return registros;
+}
+
+
+void* log_loop(void* arg) {
+    (void)arg;
+    struct timespec espera = {0, LOG_ESPERA_US * 1000};
+    while (atomic_load(&log_activo)) {
+        if (log_drenar() == 0) {
+            nanosleep(&espera, NULL);
+        }
+    }
+    return NULL;
+}
+
+
+// arranca el hilo de fondo: desde acá LOG solo encola
+int log_iniciar() {
+    if (pthread_key_create(&log_clave, log_soltar) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    atomic_store(&log_activo, 1);
+    if (pthread_create(&log_hilo, NULL, log_loop, NULL) != 0) {
+        atomic_store(&log_activo, 0);
+        return -1;
+    }
+    return 0;
+}
+
+
+// escribe lo pendiente, p.ej. antes de un reporte con printf
+void log_vaciar() {
+    if (atomic_load(&log_activo)) {
+        log_drenar();
+    }
+}
+
+
+// detiene el hilo de fondo después de escribir todo; LOG vuelve a escribir directo
+void log_cerrar() {
+    if (!atomic_load(&log_activo)) {
+        return;
+    }
+    atomic_store(&log_activo, 0);
+    pthread_join(log_hilo, NULL);
+    log_drenar();
+}
+
+#endif
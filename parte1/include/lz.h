@@ -0,0 +1,190 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <string.h>
+
+
+// compresor LZ77 de la familia LZ4 para bloques chicos (un DATA). Sin
+// entropía: la salida es una lista de secuencias
+//
+//   token | [largo de literales extra] | literales | offset | [largo de match extra]
+//
+//  - token: 4 bits altos = literales, 4 bajos = largo del match - LZ_MIN_MATCH.
+//    Un 15 sigue en bytes extra que se suman hasta uno distinto de 255
+//  - offset: 2 bytes little endian, distancia hacia atrás del match (> 0)
+//  - la última secuencia lleva solo literales (termina la entrada)
+//
+// el compresor busca matches de 4 bytes con una tabla de hash de posiciones,
+// sin cadenas (un solo candidato por hash) y saltando cada vez más rápido en
+// las zonas sin matches, así los datos que no comprimen cuestan poco. El
+// descompresor valida cada largo y offset: la entrada viene de la red
+#define LZ_MIN_MATCH 4
+#define LZ_BITS_HASH 10
+#define LZ_MAX_BLOQUE 65535     // offsets y posiciones de 16 bits
+
+
+uint32_t lz_leer32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+
+// largo extendido: los 15 del nibble ya se cuentan en el token
+uint8_t* lz_largo_extra(uint8_t* d, int resto) {
+    while (resto >= 255) {
+        *d++ = 255;
+        resto -= 255;
+    }
+    *d++ = resto;
+    return d;
+}
+
+
+// emite una secuencia (offset = 0: la final, sin match). NULL si no entra
+uint8_t* lz_secuencia(uint8_t* d, const uint8_t* fin, const uint8_t* literales, int n_lit,
+                      int offset, int largo) {
+    int match = largo - LZ_MIN_MATCH;
+    int necesario = 1 + n_lit / 255 + 1 + n_lit + (offset ? 2 + match / 255 + 1 : 0);
+    if (necesario > fin - d) {
+        return NULL;
+    }
+
+    uint8_t* token = d++;
+    *token = (n_lit < 15 ? n_lit : 15) << 4;
+    if (n_lit >= 15) {
+        d = lz_largo_extra(d, n_lit - 15);
+    }
+    memcpy(d, literales, n_lit);
+    d += n_lit;
+
+    if (offset) {
+        *token |= (match < 15 ? match : 15);
+        *d++ = offset & 0xFF;
+        *d++ = offset >> 8;
+        if (match >= 15) {
+            d = lz_largo_extra(d, match - 15);
+        }
+    }
+    return d;
+}
+
+
+// comprime n bytes de origen en destino. Devuelve el largo comprimido o -1 si
+// no entra en max (el llamador pasa max < n para quedarse solo con lo que achica)
+int lz_comprimir(const void* origen, int n, void* destino, int max) {
+    const uint8_t* src = origen;
+    uint8_t* d = destino;
+    const uint8_t* fin = d + max;
+    uint16_t tabla[1 << LZ_BITS_HASH];
+
+    if (n > LZ_MAX_BLOQUE) {
+        return -1;
+    }
+    memset(tabla, 0, sizeof(tabla));
+
+    int ancla = 0;      // primer literal sin emitir
+    int i = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        uint32_t v = lz_leer32(src + i);
+        uint32_t h = (v * 2654435761U) >> (32 - LZ_BITS_HASH);
+        int candidato = tabla[h];
+        tabla[h] = i;
+
+        if (candidato >= i || lz_leer32(src + candidato) != v) {
+            // sin match: cuanto más larga la racha de literales, más grande el salto
+            i += 1 + ((i - ancla) >> 5);
+            if (i - ancla >= max) {
+                return -1;      // solo los literales ya no entran
+            }
+            continue;
+        }
+
+        int largo = LZ_MIN_MATCH;
+        while (i + largo < n && src[candidato + largo] == src[i + largo]) {
+            largo++;
+        }
+        d = lz_secuencia(d, fin, src + ancla, i - ancla, i - candidato, largo);
+        if (!d) {
+            return -1;
+        }
+        i += largo;
+        ancla = i;
+    }
+
+    d = lz_secuencia(d, fin, src + ancla, n - ancla, 0, 0);
+    return d ? (int)(d - (uint8_t*)destino) : -1;
+}
+
+
+// largo extendido de la entrada. -1 si se termina antes
+int lz_leer_largo(const uint8_t** p, const uint8_t* fin, int largo) {
+    if (largo < 15) {
+        return largo;
+    }
+    uint8_t b;
+    do {
+        if (*p >= fin) {
+            return -1;
+        }
+        b = *(*p)++;
+        largo += b;
+    } while (b == 255);
+    return largo;
+}
+
+
+// descomprime n bytes de origen en destino (hasta max). Devuelve el largo
+// descomprimido o -1 si la entrada no es válida o no entra
+int lz_descomprimir(const void* origen, int n, void* destino, int max) {
+    const uint8_t* p = origen;
+    const uint8_t* fin = p + n;
+    uint8_t* d = destino;
+    uint8_t* d_fin = d + max;
+
+    while (p < fin) {
+        uint8_t token = *p++;
+
+        int n_lit = lz_leer_largo(&p, fin, token >> 4);
+        if (n_lit < 0 || n_lit > fin - p || n_lit > d_fin - d) {
+            return -1;
+        }
+        memcpy(d, p, n_lit);
+        d += n_lit;
+        p += n_lit;
+        if (p == fin) {
+            break;      // secuencia final: solo literales
+        }
+
+        if (fin - p < 2) {
+            return -1;
+        }
+        int offset = p[0] | (p[1] << 8);
+        p += 2;
+        int largo = lz_leer_largo(&p, fin, token & 15);
+        if (largo < 0 || offset == 0 || offset > d - (uint8_t*)destino) {
+            return -1;
+        }
+        largo += LZ_MIN_MATCH;
+        if (largo > d_fin - d) {
+            return -1;
+        }
+
+        const uint8_t* m = d - offset;
+        if (offset >= largo) {
+            memcpy(d, m, largo);
+        } else {
+            // se solapa: repite un patrón de `offset` bytes. Cada copia duplica
+            // lo ya repetido (siempre un múltiplo del patrón, sin pisar el origen)
+            for (int c = 0, k; c < largo; c += k) {
+                k = (c + offset < largo - c) ? c + offset : largo - c;
+                memcpy(d + c, m, k);
+            }
+        }
+        d += largo;
+    }
+    return (int)(d - (uint8_t*)destino);
+}
+
+#endif
@@ -0,0 +1,277 @@
+#ifndef METRICAS_H
+#define METRICAS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+
+// métricas del servidor: contadores e histogramas de latencia por hilo. Cada
+// hilo (worker o escritor) suma en su propio bloque sin locks ni instrucciones
+// atómicas de lectura-modificación: es el único que escribe ahí, así que un
+// load + store relajado alcanza. Un hilo de fondo suma los bloques de todos
+// y reescribe cada METRICAS_INTERVALO_MS un archivo de texto en el formato de
+// exposición de Prometheus (lo levanta el textfile collector de node_exporter,
+// o un script con grep). Se escribe en ruta.tmp y se renombra: quien lo lee
+// nunca ve un archivo a medias.
+//
+// sin metricas_iniciar() no se cuenta nada ni se lee el reloj: metrica_sumar
+// y metricas_reloj cuestan una comparación
+//
+// histogramas: cubeta b = latencias menores a 2^b µs (la última no tiene tope)
+#define METRICAS_INTERVALO_MS 1000
+#define HISTO_CUBETAS 26         // 2^24 µs ≈ 16 s, después +Inf
+
+
+enum {
+    M_SESIONES_ABIERTAS,
+    M_SESIONES_CERRADAS,
+    M_DATAGRAMAS,
+    M_BYTES_ESCRITOS,
+    M_DATA_DUPLICADOS,       // retransmisiones de algo ya recibido ("Seq incorrecto" en v1)
+    M_SERVIDOR_LLENO,
+    M_SIN_BUFFERS,           // DATA descartados por backpressure del pipeline de escritura
+    M_ERRORES_ESCRITURA,
+    M_BYTES_DESCARGADOS,     // DATA de descargas enviados por primera vez
+    M_RETRANSMISIONES,       // DATA y FIN de descargas reenviados por timeout
+    M_FEC_RECUPERADOS,       // DATA reconstruidos con las paridades (sin retransmisión)
+    M_SESIONES_TICKET,       // sesiones abiertas por un WRQ con ticket, sin HELLO
+    M_TICKETS_RECHAZADOS,    // vencidos, de otra clave o de otro worker: el cliente hace el HELLO
+    M_CONTADORES
+};
+
+enum {
+    H_LATENCIA_ACK,          // DATA recibido -> su ACK sale en el lote (con -d incluye el disco)
+    H_LATENCIA_ESCRITURA,    // pwrite de un DATA
+    H_LATENCIA_SYNC,         // fdatasync (ACK durable y checkpoints)
+    M_HISTOGRAMAS
+};
+
+
+const char* metricas_contadores[M_CONTADORES] = {
+    "servidor_sesiones_abiertas_total",
+    "servidor_sesiones_cerradas_total",
+    "servidor_datagramas_total",
+    "servidor_bytes_escritos_total",
+    "servidor_data_duplicados_total",
+    "servidor_rechazos_lleno_total",
+    "servidor_descartes_sin_buffers_total",
+    "servidor_errores_escritura_total",
+    "servidor_bytes_descargados_total",
+    "servidor_retransmisiones_total",
+    "servidor_fec_recuperados_total",
+    "servidor_sesiones_ticket_total",
+    "servidor_tickets_rechazados_total",
+};
+
+const char* metricas_histogramas[M_HISTOGRAMAS] = {
+    "servidor_latencia_ack_us",
+    "servidor_latencia_escritura_us",
+    "servidor_latencia_sync_us",
+};
+
+
+typedef struct {
+    _Atomic uint64_t cubetas[HISTO_CUBETAS];
+    _Atomic uint64_t suma_us;
+} Histograma;
+
+
+typedef struct Metricas {
+    _Atomic uint64_t contador[M_CONTADORES];
+    Histograma histo[M_HISTOGRAMAS];
+    struct Metricas* siguiente;
+} Metricas;
+
+
+_Atomic(Metricas*) metricas_hilos;      // bloques de todos los hilos, la lista solo crece
+__thread Metricas* metricas_propias;
+Metricas metricas_sin_memoria;          // si calloc falla el hilo cuenta acá (compartido, aproximado)
+int metricas_activas = 0;
+const char* metricas_ruta;
+pthread_t metricas_hilo;
+
+
+// bloque del hilo actual: se crea en el primer uso. Los hilos del servidor
+// no terminan, así que los bloques no se reciclan
+Metricas* metricas_del_hilo() {
+    Metricas* m = metricas_propias;
+    if (m) {
+        return m;
+    }
+
+    m = calloc(1, sizeof(Metricas));
+    if (!m) {
+        return metricas_propias = &metricas_sin_memoria;
+    }
+    m->siguiente = atomic_load(&metricas_hilos);
+    while (!atomic_compare_exchange_weak(&metricas_hilos, &m->siguiente, m)) {
+    }
+    return metricas_propias = m;
+}
+
+
+// un solo escritor por bloque: no hace falta fetch_add
+void metricas_incrementar(_Atomic uint64_t* c, uint64_t n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+
+void metrica_sumar(int contador, uint64_t n) {
+    if (metricas_activas) {
+        metricas_incrementar(&metricas_del_hilo()->contador[contador], n);
+    }
+}
+
+
+// reloj para medir latencias: 0 si las métricas están apagadas
+uint64_t metricas_reloj() {
+    if (!metricas_activas) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void metrica_observar(int histograma, uint64_t ns) {
+    if (!metricas_activas) {
+        return;
+    }
+    uint64_t us = ns / 1000;
+    int b = us ? 64 - __builtin_clzll(us) : 0;
+    Histograma* h = &metricas_del_hilo()->histo[histograma];
+    metricas_incrementar(&h->cubetas[b < HISTO_CUBETAS ? b : HISTO_CUBETAS - 1], 1);
+    metricas_incrementar(&h->suma_us, us);
+}
+
+
+// latencia desde `desde` (de metricas_reloj) hasta ahora. No hace nada si
+// `desde` es 0: la medición empezó con las métricas apagadas
+void metrica_latencia(int histograma, uint64_t desde) {
+    if (desde) {
+        metrica_observar(histograma, metricas_reloj() - desde);
+    }
+}
+
+
+// --- lectura: suma los bloques de todos los hilos ---
+
+typedef struct {
+    uint64_t contador[M_CONTADORES];
+    uint64_t cubetas[M_HISTOGRAMAS][HISTO_CUBETAS];
+    uint64_t suma_us[M_HISTOGRAMAS];
+} Totales;
+
+
+void metricas_totales(Totales* t) {
+    memset(t, 0, sizeof(Totales));
+    for (Metricas* m = atomic_load(&metricas_hilos); m; m = m->siguiente) {
+        for (int c = 0; c < M_CONTADORES; c++) {
+            t->contador[c] += atomic_load_explicit(&m->contador[c], memory_order_relaxed);
+        }
+        for (int h = 0; h < M_HISTOGRAMAS; h++) {
+            for (int b = 0; b < HISTO_CUBETAS; b++) {
+                t->cubetas[h][b] += atomic_load_explicit(&m->histo[h].cubetas[b], memory_order_relaxed);
+            }
+            t->suma_us[h] += atomic_load_explicit(&m->histo[h].suma_us, memory_order_relaxed);
+        }
+    }
+}
+
+
+// los contadores de cada hilo se leen en momentos algo distintos: una
+// sesión puede verse cerrada antes que abierta. Las derivadas se recortan a 0
+void metricas_escribir(FILE* f, Totales* t, double datagramas_por_seg) {
+    for (int c = 0; c < M_CONTADORES; c++) {
+        fprintf(f, "# TYPE %s counter\n%s %llu\n", metricas_contadores[c], metricas_contadores[c],
+                (unsigned long long)t->contador[c]);
+    }
+
+    uint64_t abiertas = t->contador[M_SESIONES_ABIERTAS];
+    uint64_t cerradas = t->contador[M_SESIONES_CERRADAS];
+    fprintf(f, "# TYPE servidor_sesiones_activas gauge\nservidor_sesiones_activas %llu\n",
+            (unsigned long long)(abiertas > cerradas ? abiertas - cerradas : 0));
+    fprintf(f, "# TYPE servidor_datagramas_por_segundo gauge\nservidor_datagramas_por_segundo %.0f\n",
+            datagramas_por_seg);
+
+    for (int h = 0; h < M_HISTOGRAMAS; h++) {
+        const char* nombre = metricas_histogramas[h];
+        uint64_t acumulado = 0;
+        fprintf(f, "# TYPE %s histogram\n", nombre);
+        for (int b = 0; b < HISTO_CUBETAS - 1; b++) {
+            acumulado += t->cubetas[h][b];
+            fprintf(f, "%s_bucket{le=\"%llu\"} %llu\n", nombre, 1ULL << b, (unsigned long long)acumulado);
+        }
+        acumulado += t->cubetas[h][HISTO_CUBETAS - 1];
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", nombre, (unsigned long long)acumulado);
+        fprintf(f, "%s_sum %llu\n%s_count %llu\n", nombre, (unsigned long long)t->suma_us[h],
+                nombre, (unsigned long long)acumulado);
+    }
+}
+
+
+int metricas_volcar(Totales* t, double datagramas_por_seg) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metricas_ruta);
+    FILE* f = fopen(tmp, "w");
+    if (!f) {
+        perror(tmp);
+        return -1;
+    }
+    metricas_escribir(f, t, datagramas_por_seg);
+    if (fclose(f) != 0 || rename(tmp, metricas_ruta) != 0) {
+        perror(metricas_ruta);
+        return -1;
+    }
+    return 0;
+}
+
+
+void* metricas_loop(void* arg) {
+    (void)arg;
+    Totales t;
+    uint64_t datagramas_antes = 0;
+    uint64_t antes = metricas_reloj();
+    struct timespec espera = { METRICAS_INTERVALO_MS / 1000, (METRICAS_INTERVALO_MS % 1000) * 1000000L };
+
+    while (1) {
+        nanosleep(&espera, NULL);
+        uint64_t ahora = metricas_reloj();
+        metricas_totales(&t);
+
+        double segundos = (ahora - antes) / 1e9;
+        uint64_t datagramas = t.contador[M_DATAGRAMAS];
+        metricas_volcar(&t, segundos > 0 ? (datagramas - datagramas_antes) / segundos : 0);
+        datagramas_antes = datagramas;
+        antes = ahora;
+    }
+    return NULL;
+}
+
+
+// activa las mediciones y arranca el hilo que reescribe `ruta`
+int metricas_iniciar(const char* ruta) {
+    metricas_ruta = ruta;
+    metricas_activas = 1;
+
+    Totales t;
+    metricas_totales(&t);
+    if (metricas_volcar(&t, 0) != 0) {
+        metricas_activas = 0;
+        return -1;
+    }
+    if (pthread_create(&metricas_hilo, NULL, metricas_loop, NULL) != 0) {
+        perror("pthread_create");
+        metricas_activas = 0;
+        return -1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <poll.h>
+#include "common.h"
+
+
+// pacing: en vez de mandar la ventana en ráfaga (que llena la cola del
+// primer enlace lento, o el buffer del socket del otro lado, y se pierde
+// junta) los datagramas salen espaciados a la tasa que calcula el control de
+// congestión. Balde de tokens en bytes: se llena a `tasa` hasta `capacidad`
+// y cada envío consume lo que mide. La capacidad es PACING_RAFAGA_US de
+// tasa, nunca menos de PACING_RAFAGA_MIN datagramas: alcanza para que los
+// lotes de GSO sigan teniendo varios PDUs sin volver a la ráfaga entera.
+//
+// la espera es con ppoll (timespec en ns): el kernel la resuelve con hrtimers,
+// sin redondear al ms como poll. tasa = 0 desactiva el pacing
+#define PACING_RAFAGA_US 1000
+#define PACING_RAFAGA_MIN 2
+
+
+typedef struct {
+    double tasa;             // bytes por µs
+    double tokens;           // bytes que se pueden enviar ya (negativo: deuda)
+    double capacidad;
+    uint64_t ultimo_us;
+    uint64_t esperas;        // veces que el pacing frenó un envío
+} Pacer;
+
+
+void pacer_init(Pacer* p) {
+    memset(p, 0, sizeof(Pacer));
+}
+
+
+// tasa en bytes/s; datagrama = el más grande que se envía
+void pacer_tasa(Pacer* p, double bytes_por_seg, int datagrama) {
+    p->tasa = bytes_por_seg / 1e6;
+    p->capacidad = p->tasa * PACING_RAFAGA_US;
+    if (p->capacidad < PACING_RAFAGA_MIN * datagrama) {
+        p->capacidad = PACING_RAFAGA_MIN * datagrama;
+    }
+}
+
+
+void pacer_llenar(Pacer* p, uint64_t ahora) {
+    if (p->ultimo_us) {
+        p->tokens += (ahora - p->ultimo_us) * p->tasa;
+    }
+    if (p->tokens > p->capacidad) {
+        p->tokens = p->capacidad;
+    }
+    p->ultimo_us = ahora;
+}
+
+
+// µs hasta que se puedan enviar `bytes` (0 = ya)
+uint64_t pacer_espera_us(Pacer* p, int bytes, uint64_t ahora) {
+    if (p->tasa <= 0) {
+        return 0;
+    }
+    pacer_llenar(p, ahora);
+    if (p->tokens >= bytes) {
+        return 0;
+    }
+    return (uint64_t)((bytes - p->tokens) / p->tasa) + 1;
+}
+
+
+// un envío (las retransmisiones también cuentan, aunque no esperen)
+void pacer_consumir(Pacer* p, int bytes) {
+    if (p->tasa > 0) {
+        p->tokens -= bytes;
+    }
+}
+
+
+// poll con timeout en µs
+int poll_us(struct pollfd* fds, nfds_t n, uint64_t espera_us) {
+    struct timespec ts = { espera_us / 1000000, (espera_us % 1000000) * 1000 };
+    return ppoll(fds, n, &ts, NULL);
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include "common.h"
+
+
+// estimación de RTT y timeout de retransmisión adaptativo (RFC 6298):
+//   SRTT   <- 7/8 SRTT + 1/8 R
+//   RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R|
+//   RTO    <- SRTT + 4 RTTVAR, acotado a [RTO_MIN_MS, RTO_MAX_MS]
+// regla de Karn: solo se toman muestras de PDUs que se enviaron una única vez
+// (con un reenvío no se sabe a cuál de las copias corresponde el ACK).
+// ante un timeout el RTO se duplica (backoff exponencial) hasta la próxima muestra válida
+#define RTO_INICIAL_MS 1000
+#define RTO_MIN_MS     100
+#define RTO_MAX_MS     60000
+
+#define RTT_BUCKETS 32   // histograma en potencias de 2: bucket i = [2^i, 2^(i+1)) µs
+
+
+typedef struct {
+    int64_t srtt_us;
+    int64_t rttvar_us;
+    int64_t rto_us;
+    int con_muestras;
+
+    // distribución de las muestras, para el reporte del final
+    uint64_t muestras;
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t suma_us;
+    uint64_t hist[RTT_BUCKETS];
+    uint64_t backoffs;
+} EstimadorRTT;
+
+
+void rtt_init(EstimadorRTT* e) {
+    memset(e, 0, sizeof(EstimadorRTT));
+    e->rto_us = RTO_INICIAL_MS * 1000LL;
+    e->min_us = UINT64_MAX;
+}
+
+
+int64_t rtt_acotar(int64_t rto_us) {
+    if (rto_us < RTO_MIN_MS * 1000LL) return RTO_MIN_MS * 1000LL;
+    if (rto_us > RTO_MAX_MS * 1000LL) return RTO_MAX_MS * 1000LL;
+    return rto_us;
+}
+
+
+void rtt_muestra(EstimadorRTT* e, uint64_t rtt_us) {
+    int64_t r = rtt_us;
+
+    if (!e->con_muestras) {
+        e->srtt_us = r;
+        e->rttvar_us = r / 2;
+        e->con_muestras = 1;
+    } else {
+        int64_t diff = e->srtt_us - r;
+        if (diff < 0) diff = -diff;
+        e->rttvar_us = (3 * e->rttvar_us + diff) / 4;
+        e->srtt_us = (7 * e->srtt_us + r) / 8;
+    }
+    e->rto_us = rtt_acotar(e->srtt_us + 4 * e->rttvar_us);
+
+    int bucket = 0;
+    while (bucket < RTT_BUCKETS - 1 && (rtt_us >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    e->hist[bucket]++;
+    e->muestras++;
+    e->suma_us += rtt_us;
+    if (rtt_us < e->min_us) e->min_us = rtt_us;
+    if (rtt_us > e->max_us) e->max_us = rtt_us;
+}
+
+
+void rtt_backoff(EstimadorRTT* e) {
+    e->rto_us = rtt_acotar(e->rto_us * 2);
+    e->backoffs++;
+}
+
+
+int rtt_rto_ms(const EstimadorRTT* e) {
+    return (int)((e->rto_us + 999) / 1000);
+}
+
+
+// percentil aproximado: límite superior del bucket donde cae (en µs)
+uint64_t rtt_percentil(const EstimadorRTT* e, double p) {
+    uint64_t objetivo = (uint64_t)(p * e->muestras);
+    uint64_t acumulado = 0;
+
+    for (int i = 0; i < RTT_BUCKETS; i++) {
+        acumulado += e->hist[i];
+        if (acumulado > objetivo) {
+            uint64_t limite = 2ULL << i;
+            return (limite < e->max_us) ? limite : e->max_us;
+        }
+    }
+    return e->max_us;
+}
+
+
+void rtt_reporte(const EstimadorRTT* e) {
+    printf("\n----- RTT (%llu muestras) -----\n", (unsigned long long)e->muestras);
+    if (e->muestras == 0) {
+        printf("Sin muestras válidas\n");
+        return;
+    }
+
+    printf("min/prom/max: %.3f / %.3f / %.3f ms\n",
+            e->min_us / 1000.0, e->suma_us / 1000.0 / e->muestras, e->max_us / 1000.0);
+    printf("p50 <= %.3f ms, p90 <= %.3f ms, p99 <= %.3f ms\n",
+            rtt_percentil(e, 0.50) / 1000.0, rtt_percentil(e, 0.90) / 1000.0,
+            rtt_percentil(e, 0.99) / 1000.0);
+    printf("SRTT=%.3f ms RTTVAR=%.3f ms RTO=%d ms (backoffs: %llu)\n",
+            e->srtt_us / 1000.0, e->rttvar_us / 1000.0, rtt_rto_ms(e),
+            (unsigned long long)e->backoffs);
+
+    for (int i = 0; i < RTT_BUCKETS; i++) {
+        if (e->hist[i] == 0) {
+            continue;
+        }
+        printf("  [%8llu, %8llu) us: %llu\n",
+                (unsigned long long)(i == 0 ? 0 : 1ULL << i), (unsigned long long)(2ULL << i),
+                (unsigned long long)e->hist[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef SESIONES_H
+#define SESIONES_H
+
+#include "common.h"
+
+
+// ---------------------------------------------------------------------------
+// tabla hash de sesiones: direccionamiento abierto con sondeo lineal, clave
+// (IP, puerto) del cliente. La capacidad es potencia de 2 y se duplica al
+// superar 70% de ocupación, así el lookup por datagrama es O(1) esperado sin
+// importar cuántas sesiones haya. El borrado corre hacia atrás los elementos
+// del mismo cluster (backward shift), así no quedan lápidas que alarguen los sondeos
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    uint64_t clave;
+    void* valor;            // NULL = entrada vacía
+} EntradaTabla;
+
+
+typedef struct {
+    EntradaTabla* v;
+    uint32_t cap;           // potencia de 2
+    uint32_t n;
+    uint64_t semilla;       // aleatoria: un cliente no puede elegir puertos que colisionen a propósito
+} TablaSesiones;
+
+
+uint64_t clave_sesion(const struct sockaddr_in* addr) {
+    return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+
+// las sesiones v2 también se indexan por su id. La clave por dirección usa
+// 48 bits, así que el bit 48 separa los dos espacios de claves
+uint64_t clave_id_sesion(uint32_t id) {
+    return (1ULL << 48) | id;
+}
+
+
+// finalizador de splitmix64: mezcla todos los bits de la clave
+uint32_t tabla_hash(const TablaSesiones* t, uint64_t clave) {
+    uint64_t x = clave ^ t->semilla;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (uint32_t)x & (t->cap - 1);
+}
+
+
+int tabla_init(TablaSesiones* t, uint32_t cap) {
+    uint32_t c = 16;
+    while (c < cap) {
+        c <<= 1;
+    }
+
+    t->v = calloc(c, sizeof(EntradaTabla));
+    if (!t->v) {
+        return -1;
+    }
+    t->cap = c;
+    t->n = 0;
+    t->semilla = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ get_monotonic_us();
+    return 0;
+}
+
+
+void tabla_free(TablaSesiones* t) {
+    free(t->v);
+    memset(t, 0, sizeof(TablaSesiones));
+}
+
+
+void* tabla_buscar(const TablaSesiones* t, uint64_t clave) {
+    uint32_t i = tabla_hash(t, clave);
+
+    while (t->v[i].valor) {
+        if (t->v[i].clave == clave) {
+            return t->v[i].valor;
+        }
+        i = (i + 1) & (t->cap - 1);
+    }
+    return NULL;
+}
+
+
+int tabla_crecer(TablaSesiones* t) {
+    EntradaTabla* viejo = t->v;
+    uint32_t cap_vieja = t->cap;
+
+    t->v = calloc((size_t)cap_vieja * 2, sizeof(EntradaTabla));
+    if (!t->v) {
+        t->v = viejo;
+        return -1;
+    }
+    t->cap = cap_vieja * 2;
+
+    for (uint32_t j = 0; j < cap_vieja; j++) {
+        if (!viejo[j].valor) {
+            continue;
+        }
+        uint32_t i = tabla_hash(t, viejo[j].clave);
+        while (t->v[i].valor) {
+            i = (i + 1) & (t->cap - 1);
+        }
+        t->v[i] = viejo[j];
+    }
+
+    free(viejo);
+    return 0;
+}
+
+
+// la clave no debe estar en la tabla. Devuelve -1 si no hay memoria para crecer
+int tabla_insertar(TablaSesiones* t, uint64_t clave, void* valor) {
+    if ((uint64_t)(t->n + 1) * 10 > (uint64_t)t->cap * 7 && tabla_crecer(t) != 0) {
+        return -1;
+    }
+
+    uint32_t i = tabla_hash(t, clave);
+    while (t->v[i].valor) {
+        i = (i + 1) & (t->cap - 1);
+    }
+    t->v[i].clave = clave;
+    t->v[i].valor = valor;
+    t->n++;
+    return 0;
+}
+
+
+void tabla_borrar(TablaSesiones* t, uint64_t clave) {
+    uint32_t mask = t->cap - 1;
+    uint32_t i = tabla_hash(t, clave);
+
+    while (t->v[i].valor && t->v[i].clave != clave) {
+        i = (i + 1) & mask;
+    }
+    if (!t->v[i].valor) {
+        return;
+    }
+
+    // backward shift: se mueve hacia el hueco todo elemento del cluster cuya
+    // posición ideal no quede "entre" el hueco y su posición actual
+    uint32_t hueco = i;
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (!t->v[j].valor) {
+            break;
+        }
+        uint32_t ideal = tabla_hash(t, t->v[j].clave);
+        if (((j - ideal) & mask) >= ((j - hueco) & mask)) {
+            t->v[hueco] = t->v[j];
+            hueco = j;
+        }
+    }
+    t->v[hueco].valor = NULL;
+    t->n--;
+}
+
+
+// ---------------------------------------------------------------------------
+// rueda de timers para expirar sesiones inactivas. Cada sesión está en el slot
+// de su vencimiento; actualizar la actividad por datagrama es solo guardar el
+// tick actual en la sesión (sin tocar listas). Cuando el slot vence se revisa
+// la actividad real y, si hubo tráfico, la sesión se reprograma
+// ---------------------------------------------------------------------------
+
+typedef struct NodoRueda {
+    struct NodoRueda* prev;
+    struct NodoRueda* next;
+    uint64_t vence_tick;
+    void* dueno;
+} NodoRueda;
+
+
+typedef struct {
+    NodoRueda* slots;       // centinelas de listas circulares doblemente enlazadas
+    uint32_t n;             // potencia de 2
+    uint32_t tick_ms;
+    uint64_t tick_actual;   // último tick procesado
+} Rueda;
+
+
+uint64_t rueda_tick(const Rueda* r) {
+    return get_monotonic_us() / 1000 / r->tick_ms;
+}
+
+
+int rueda_init(Rueda* r, uint32_t n, uint32_t tick_ms) {
+    r->slots = malloc(n * sizeof(NodoRueda));
+    if (!r->slots) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        r->slots[i].prev = &r->slots[i];
+        r->slots[i].next = &r->slots[i];
+    }
+    r->n = n;
+    r->tick_ms = tick_ms;
+    r->tick_actual = rueda_tick(r);
+    return 0;
+}
+
+
+void rueda_free(Rueda* r) {
+    free(r->slots);
+    memset(r, 0, sizeof(Rueda));
+}
+
+
+void rueda_agregar(Rueda* r, NodoRueda* nodo, uint64_t vence_tick) {
+    if (vence_tick <= r->tick_actual) {
+        vence_tick = r->tick_actual + 1;
+    }
+    NodoRueda* cabeza = &r->slots[vence_tick & (r->n - 1)];
+
+    nodo->vence_tick = vence_tick;
+    nodo->prev = cabeza->prev;
+    nodo->next = cabeza;
+    cabeza->prev->next = nodo;
+    cabeza->prev = nodo;
+}
+
+
+void rueda_quitar(NodoRueda* nodo) {
+    if (!nodo->next) {
+        return;
+    }
+    nodo->prev->next = nodo->next;
+    nodo->next->prev = nodo->prev;
+    nodo->prev = NULL;
+    nodo->next = NULL;
+}
+
+
+// avanza la rueda hasta el tick actual y llama a vencido(dueno, ctx) por cada
+// nodo cuyo vencimiento pasó. El nodo ya está fuera de la rueda cuando se llama:
+// el callback puede volver a agregarlo o liberar al dueño
+void rueda_avanzar(Rueda* r, void (*vencido)(void* dueno, void* ctx), void* ctx) {
+    uint64_t ahora = rueda_tick(r);
+    uint64_t desde = r->tick_actual + 1;
+
+    // después de una pausa larga alcanza con recorrer cada slot una vez
+    if (ahora - r->tick_actual > r->n) {
+        desde = ahora - r->n + 1;
+    }
+    r->tick_actual = ahora;
+
+    for (uint64_t t = desde; t <= ahora; t++) {
+        NodoRueda* cabeza = &r->slots[t & (r->n - 1)];
+
+        // se desengancha la lista entera: lo que se reprograme no se vuelve a visitar ahora
+        NodoRueda lista;
+        if (cabeza->next == cabeza) {
+            continue;
+        }
+        lista.next = cabeza->next;
+        lista.prev = cabeza->prev;
+        lista.next->prev = &lista;
+        lista.prev->next = &lista;
+        cabeza->next = cabeza;
+        cabeza->prev = cabeza;
+
+        while (lista.next != &lista) {
+            NodoRueda* nodo = lista.next;
+            rueda_quitar(nodo);
+            if (nodo->vence_tick <= ahora) {
+                vencido(nodo->dueno, ctx);
+            } else {
+                rueda_agregar(r, nodo, nodo->vence_tick);   // es de otra vuelta de la rueda
+            }
+        }
+    }
+}
+
+
+// milisegundos hasta el próximo tick (timeout para poll)
+int rueda_espera_ms(const Rueda* r) {
+    uint64_t ahora_ms = get_monotonic_us() / 1000;
+    uint64_t proximo_ms = (r->tick_actual + 1) * r->tick_ms;
+    return (proximo_ms > ahora_ms) ? (int)(proximo_ms - ahora_ms) : 0;
+}
+
+#endif
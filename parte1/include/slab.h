@@ -0,0 +1,109 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "common.h"
+
+
+// slab de objetos de tamaño fijo (las sesiones de servidorN). Cada objeto
+// ocupa un múltiplo de LINEA_CACHE y empieza alineado a una línea: dos
+// sesiones nunca comparten línea y los campos calientes del principio caen
+// siempre en la primera. Los objetos se piden al sistema de a SLAB_POR_BLOQUE
+// y los que se devuelven quedan en una lista de libres para la próxima
+// sesión: con decenas de miles de sesiones que van y vienen la memoria no
+// crece ni se fragmenta, se queda en el pico. Nada vuelve al sistema hasta
+// slab_free
+//
+// sin locks: cada worker tiene el suyo
+#define LINEA_CACHE 64
+#define SLAB_POR_BLOQUE 256
+
+
+typedef struct NodoSlab {
+    struct NodoSlab* sig;
+} NodoSlab;
+
+
+typedef struct {
+    size_t tam;              // por objeto, redondeado a LINEA_CACHE
+    NodoSlab* libres;
+    void** bloques;          // lo pedido al sistema, para slab_free
+    int n_bloques;
+    int cap_bloques;
+    uint32_t en_uso;
+    uint32_t reservados;     // objetos en todos los bloques
+} Slab;
+
+
+size_t linea_redondear(size_t n) {
+    return (n + LINEA_CACHE - 1) & ~(size_t)(LINEA_CACHE - 1);
+}
+
+
+// n bytes alineados a línea (n se redondea): para buffers que se reparten
+// de a pedazos de tamaño linea_redondear()
+void* linea_alloc(size_t n) {
+    return aligned_alloc(LINEA_CACHE, linea_redondear(n));
+}
+
+
+void slab_init(Slab* s, size_t tam) {
+    memset(s, 0, sizeof(Slab));
+    s->tam = linea_redondear(tam < sizeof(NodoSlab) ? sizeof(NodoSlab) : tam);
+}
+
+
+void slab_free(Slab* s) {
+    for (int i = 0; i < s->n_bloques; i++) {
+        free(s->bloques[i]);
+    }
+    free(s->bloques);
+    memset(s, 0, sizeof(Slab));
+}
+
+
+int slab_agrandar(Slab* s) {
+    if (s->n_bloques == s->cap_bloques) {
+        int cap = s->cap_bloques ? 2 * s->cap_bloques : 16;
+        void** v = realloc(s->bloques, cap * sizeof(void*));
+        if (!v) {
+            return -1;
+        }
+        s->bloques = v;
+        s->cap_bloques = cap;
+    }
+    char* bloque = aligned_alloc(LINEA_CACHE, SLAB_POR_BLOQUE * s->tam);
+    if (!bloque) {
+        return -1;
+    }
+    s->bloques[s->n_bloques++] = bloque;
+    for (int i = SLAB_POR_BLOQUE - 1; i >= 0; i--) {
+        NodoSlab* n = (NodoSlab*)(bloque + (size_t)i * s->tam);
+        n->sig = s->libres;
+        s->libres = n;
+    }
+    s->reservados += SLAB_POR_BLOQUE;
+    return 0;
+}
+
+
+// un objeto en cero (como calloc), o NULL si no hay memoria
+void* slab_tomar(Slab* s) {
+    if (!s->libres && slab_agrandar(s) != 0) {
+        return NULL;
+    }
+    NodoSlab* n = s->libres;
+    s->libres = n->sig;
+    s->en_uso++;
+    memset(n, 0, s->tam);
+    return n;
+}
+
+
+void slab_devolver(Slab* s, void* obj) {
+    NodoSlab* n = obj;
+    n->sig = s->libres;
+    s->libres = n;
+    s->en_uso--;
+}
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef TICKET_H
+#define TICKET_H
+
+#include "common.h"
+
+
+// tickets de sesión (solo servidorN). Después de un HELLO v2 con la credencial
+// válida, si el cliente lo pide con OPT_TICKET, el ACK trae un ticket con lo
+// negociado y un vencimiento, sellado con una clave aleatoria que el servidor
+// elige al arrancar. En las subidas siguientes el cliente no manda HELLO: pone
+// el ticket en el WRQ de una sesión cuyo id elige él (con el byte bajo del id
+// que le dio ese HELLO, que es el del worker) y el servidor crea la sesión con
+// lo que dice el ticket, sin comparar la credencial. El servidor no guarda nada
+// por ticket: verificarlo es recalcular su MAC (SipHash-2-4 con la clave)
+//
+// un ticket vale hasta que vence o hasta que el servidor se reinicia (cambia
+// la clave). Con uno que no sirve el WRQ vuelve con error y el cliente hace
+// el HELLO. No está atado a la dirección del cliente, igual que la credencial
+//
+// el id que elige el cliente (24 bits al azar) puede ser el de una sesión
+// viva. Un WRQ con ticket solo cae en una sesión existente si la abrió ese
+// mismo ticket (es el WRQ repetido); si no, vuelve TICKET_ID_EN_USO y el
+// cliente prueba con otro id. Lo que el cliente manda antes del ACK de ese
+// WRQ (el primer DATA, sus PARIDAD) lleva V2_TEMPRANO: nunca se toma como un
+// cambio de dirección de la sesión que tenga el id
+//
+// formato (TICKET_LARGO bytes, opaco para el cliente):
+//   uint32_t vencimiento, segundos desde epoch (network order)
+//   uint16_t ventana aceptada (network order)
+//   uint8_t  sack, fec_k, fec_m
+//   uint64_t SipHash-2-4 de los TICKET_DATOS bytes anteriores
+#define TICKET_DATOS 9
+#define TICKET_LARGO (TICKET_DATOS + 8)
+#define TICKET_VIDA_SEG (12 * 3600)
+#define TICKET_ID_EN_USO "Id de sesion en uso"
+
+
+typedef struct {
+    uint32_t vence;
+    uint16_t ventana;
+    uint8_t sack;
+    uint8_t fec_k;
+    uint8_t fec_m;
+} Ticket;
+
+
+uint64_t sip_rotar(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+
+void sip_ronda(uint64_t v[4]) {
+    v[0] += v[1]; v[1] = sip_rotar(v[1], 13); v[1] ^= v[0]; v[0] = sip_rotar(v[0], 32);
+    v[2] += v[3]; v[3] = sip_rotar(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = sip_rotar(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = sip_rotar(v[1], 17); v[1] ^= v[2]; v[2] = sip_rotar(v[2], 32);
+}
+
+
+// SipHash-2-4 (Aumasson y Bernstein) con una clave de 16 bytes
+uint64_t siphash(const uint8_t clave[16], const uint8_t* datos, size_t largo) {
+    uint64_t k0, k1;
+    memcpy(&k0, clave, 8);
+    memcpy(&k1, clave + 8, 8);
+    k0 = le64toh(k0);
+    k1 = le64toh(k1);
+    uint64_t v[4] = { k0 ^ 0x736f6d6570736575ULL, k1 ^ 0x646f72616e646f6dULL,
+                      k0 ^ 0x6c7967656e657261ULL, k1 ^ 0x7465646279746573ULL };
+
+    size_t i = 0;
+    for (; i + 8 <= largo; i += 8) {
+        uint64_t m;
+        memcpy(&m, datos + i, 8);
+        m = le64toh(m);
+        v[3] ^= m;
+        sip_ronda(v);
+        sip_ronda(v);
+        v[0] ^= m;
+    }
+    uint64_t m = (uint64_t)largo << 56;
+    for (int j = 0; i + j < largo; j++) {
+        m |= (uint64_t)datos[i + j] << (8 * j);
+    }
+    v[3] ^= m;
+    sip_ronda(v);
+    sip_ronda(v);
+    v[0] ^= m;
+
+    v[2] ^= 0xFF;
+    for (int r = 0; r < 4; r++) {
+        sip_ronda(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+
+void ticket_emitir(const uint8_t clave[16], const Ticket* t, uint8_t buf[TICKET_LARGO]) {
+    uint32_t vence = htonl(t->vence);
+    uint16_t ventana = htons(t->ventana);
+    memcpy(buf, &vence, 4);
+    memcpy(buf + 4, &ventana, 2);
+    buf[6] = t->sack;
+    buf[7] = t->fec_k;
+    buf[8] = t->fec_m;
+    uint64_t mac = htobe64(siphash(clave, buf, TICKET_DATOS));
+    memcpy(buf + TICKET_DATOS, &mac, 8);
+}
+
+
+// 0 si el ticket es de esta clave y no venció a la hora `ahora` (segundos desde epoch)
+int ticket_verificar(const uint8_t clave[16], const uint8_t buf[TICKET_LARGO], uint32_t ahora, Ticket* t) {
+    uint64_t mac;
+    memcpy(&mac, buf + TICKET_DATOS, 8);
+    if (be64toh(mac) != siphash(clave, buf, TICKET_DATOS)) {
+        return -1;
+    }
+    memcpy(&t->vence, buf, 4);
+    memcpy(&t->ventana, buf + 4, 2);
+    t->vence = ntohl(t->vence);
+    t->ventana = ntohs(t->ventana);
+    t->sack = buf[6];
+    t->fec_k = buf[7];
+    t->fec_m = buf[8];
+    return (ahora < t->vence) ? 0 : -1;
+}
+
+#endif
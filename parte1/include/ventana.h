@@ -0,0 +1,117 @@
+#ifndef VENTANA_H
+#define VENTANA_H
+
+#include "common.h"
+
+
+// estado de recepción del modo ventana (Selective Repeat). Cada DATA se
+// escribe directo en su offset (seq * bloque: el cliente manda bloques
+// llenos salvo el último) por el pipeline de escritura, así que no se guardan
+// payloads: solo qué seqs de [base, base + tam) llegaron y cuáles ya se escribieron.
+//
+// de cada DATA se guarda además el CRC32C de su payload, y al avanzar base se
+// combinan en orden en el digest de la subida (el que el cliente manda en el FIN)
+#define SLOT_LIBRE    0
+#define SLOT_EN_CURSO 1      // recibido, con la escritura en curso (ACK durable pendiente)
+#define SLOT_LISTO    2      // escrito, o encolado si se confirma al encolar
+
+typedef struct {
+    uint32_t base;       // primer seq que todavía no está LISTO
+    uint16_t tam;        // tamaño de ventana negociado
+    uint8_t* estado;     // SLOT_* de cada seq de la ventana
+    uint32_t* crc;       // CRC32C del payload de cada seq recibido
+    uint16_t* largo;
+    uint16_t bloque;     // payload de un DATA lleno (OPT_BLOQUE)
+    uint32_t digest;     // CRC32C de todo lo anterior a base
+    uint32_t salto;      // crc32c_salto(bloque): todos los bloques salvo el último
+} Reensamblado;
+
+
+int reensamblado_init(Reensamblado* r, uint16_t tam, uint16_t bloque) {
+    memset(r, 0, sizeof(Reensamblado));
+    // los tres arreglos en una sola asignación: crc, largo y estado
+    r->crc = calloc(tam, sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t));
+    if (!r->crc) {
+        return -1;
+    }
+    r->largo = (uint16_t*)(r->crc + tam);
+    r->estado = (uint8_t*)(r->largo + tam);
+    r->tam = tam;
+    r->bloque = bloque;
+    r->salto = crc32c_salto(bloque);
+    return 0;
+}
+
+
+void reensamblado_free(Reensamblado* r) {
+    free(r->crc);
+    memset(r, 0, sizeof(Reensamblado));
+}
+
+
+// registra un DATA recibido. Devuelve:
+//   1  si es nuevo: queda EN_CURSO y hay que escribirlo
+//   0  si es un duplicado de algo ya LISTO (hay que re-ACKearlo, el ACK anterior se perdió)
+//   2  si es un duplicado de algo que se está escribiendo (el ACK sale al completar)
+//  -1  si cae fuera de la ventana (se descarta sin ACK)
+int reensamblado_recibir(Reensamblado* r, uint32_t seq) {
+    uint32_t dist = seq - r->base;   // aritmética modular: funciona con wrap-around
+
+    if (dist < r->tam) {
+        uint8_t* e = &r->estado[seq % r->tam];
+        if (*e == SLOT_LIBRE) {
+            *e = SLOT_EN_CURSO;
+            return 1;
+        }
+        return (*e == SLOT_LISTO) ? 0 : 2;
+    }
+
+    if (r->base - seq <= r->tam) {
+        return 0;
+    }
+
+    return -1;
+}
+
+
+// CRC del payload de un seq nuevo (recién aceptado por reensamblado_recibir)
+void reensamblado_anotar(Reensamblado* r, uint32_t seq, const char* data, int len) {
+    r->crc[seq % r->tam] = crc32c(0, data, len);
+    r->largo[seq % r->tam] = len;
+}
+
+
+// marca un seq como escrito y avanza base sobre los slots LISTO contiguos
+void reensamblado_completar(Reensamblado* r, uint32_t seq) {
+    r->estado[seq % r->tam] = SLOT_LISTO;
+
+    while (r->estado[r->base % r->tam] == SLOT_LISTO) {
+        int i = r->base % r->tam;
+        r->digest = (r->largo[i] == r->bloque)
+                    ? crc32c_combinar_salto(r->digest, r->crc[i], r->salto)
+                    : crc32c_combinar(r->digest, r->crc[i], r->largo[i]);
+        r->estado[i] = SLOT_LIBRE;
+        r->base++;
+    }
+}
+
+
+
+// valor de OPT_SACK para el ACK de un DATA: base + mapa de los seqs LISTO
+// de [base + 1, base + tam). buf de 4 + SACK_MAPA_MAX bytes. Devuelve el largo
+int reensamblado_sack(const Reensamblado* r, uint8_t* buf) {
+    uint32_t base = htonl(r->base);
+    memcpy(buf, &base, 4);
+    uint8_t* mapa = buf + 4;
+    int largo = 0;
+    memset(mapa, 0, SACK_MAPA_MAX);
+    for (uint32_t i = 0; i + 1 < r->tam; i++) {
+        if (r->estado[(r->base + 1 + i) % r->tam] == SLOT_LISTO) {
+            mapa[i / 8] |= 1 << (i % 8);
+            largo = i / 8 + 1;
+        }
+    }
+    return 4 + largo;
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <poll.h>
+#include <linux/errqueue.h>
+#include "common.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+
+// envíos con MSG_ZEROCOPY: el kernel no copia los buffers del sendmsg, los
+// lee más tarde, y avisa por la cola de errores del socket (POLLERR) cuando
+// terminó con ellos. Cada envío exitoso recibe un id correlativo (desde 0) y
+// las notificaciones llegan como rangos [ee_info, ee_data] de ids.
+//
+// el llamador agrupa sus buffers en slots (un slot por PDU en vuelo) y antes
+// de reescribir el buffer de un slot espera con zc_esperar() a que el kernel
+// haya soltado todos los envíos de ese slot.
+//
+// si el kernel avisa que igual copió (SO_EE_CODE_ZEROCOPY_COPIED, p.ej. en
+// loopback o si la placa no soporta scatter-gather) se deja de usar
+// MSG_ZEROCOPY: fijar las páginas cuesta más que la copia y los skb cuentan
+// páginas enteras en el buffer de recepción del otro lado, que se llena antes.
+// Lo mismo si un datagrama no entra en un skb sin copiar (EMSGSIZE)
+#define ZC_IDS 4096         // envíos sin completar como máximo (después se copia)
+#define ZC_ESPERA_MAX_MS 5000
+
+
+typedef struct {
+    int activo;
+    int copiando;               // el kernel copió igual: se envía sin MSG_ZEROCOPY
+    uint32_t proximo_id;        // id que el kernel le asigna al próximo envío
+    uint16_t slot_de[ZC_IDS];   // id % ZC_IDS -> slot
+    int* en_vuelo;              // por slot: envíos cuyos buffers el kernel todavía puede leer
+    int n_slots;
+    uint32_t sin_completar;
+    uint64_t envios;            // con MSG_ZEROCOPY
+    uint64_t copiados;          // el kernel igual copió (p.ej. loopback): no hubo ganancia
+} ZeroCopy;
+
+
+// devuelve -1 si el kernel no soporta SO_ZEROCOPY (el ZeroCopy queda inactivo
+// y zc_enviar hace sendmsg común)
+int zc_init(ZeroCopy* zc, int socket, int n_slots) {
+    memset(zc, 0, sizeof(ZeroCopy));
+    zc->en_vuelo = calloc(n_slots, sizeof(int));
+    if (!zc->en_vuelo) {
+        return -1;
+    }
+    zc->n_slots = n_slots;
+
+    int uno = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_ZEROCOPY, &uno, sizeof(uno)) < 0) {
+        perror("setsockopt(SO_ZEROCOPY)");
+        return -1;
+    }
+    zc->activo = 1;
+    return 0;
+}
+
+
+void zc_free(ZeroCopy* zc) {
+    free(zc->en_vuelo);
+    memset(zc, 0, sizeof(ZeroCopy));
+}
+
+
+// slot < 0: el buffer no se puede retener (p.ej. está en el stack), se copia
+ssize_t zc_enviar(ZeroCopy* zc, int socket, struct msghdr* msg, int slot) {
+    if (zc->activo && !zc->copiando && slot >= 0 && zc->sin_completar < ZC_IDS) {
+        ssize_t n = sendmsg(socket, msg, MSG_ZEROCOPY);
+        if (n >= 0) {
+            zc->slot_de[zc->proximo_id % ZC_IDS] = slot;
+            zc->proximo_id++;
+            zc->en_vuelo[slot]++;
+            zc->sin_completar++;
+            zc->envios++;
+            return n;
+        }
+        if (errno == EMSGSIZE) {
+            // el datagrama ocupa más páginas que los fragmentos de un skb
+            // (bloques v2 grandes): con este bloque ninguno va a poder ir sin copia
+            zc->copiando = 1;
+        } else if (errno != ENOBUFS) {
+            return n;
+        }
+        // ENOBUFS: sin memoria para fijar las páginas (optmem_max), se envía copiando
+    }
+    return sendmsg(socket, msg, 0);
+}
+
+
+// procesa las notificaciones pendientes de la cola de errores. Devuelve -1
+// si además hay un error real en el socket (p.ej. ICMP port unreachable)
+int zc_procesar(ZeroCopy* zc, int socket) {
+    char control[128];
+
+    while (zc->activo) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+                  (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            struct sock_extended_err* ee = (struct sock_extended_err*)CMSG_DATA(c);
+            if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            for (uint32_t id = ee->ee_info; id != ee->ee_data + 1; id++) {
+                int slot = zc->slot_de[id % ZC_IDS];
+                zc->en_vuelo[slot]--;
+                zc->sin_completar--;
+                if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    zc->copiados++;
+                    zc->copiando = 1;
+                }
+            }
+        }
+    }
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+
+// espera a que el kernel suelte los buffers de un slot (-1 = de todos)
+int zc_esperar(ZeroCopy* zc, int socket, int slot) {
+    if (!zc->activo) {
+        return 0;
+    }
+    struct pollfd pfd;
+    pfd.fd = socket;
+    pfd.events = 0;     // POLLERR se reporta siempre
+    uint64_t limite = get_monotonic_us() + ZC_ESPERA_MAX_MS * 1000ULL;
+
+    while (slot >= 0 ? zc->en_vuelo[slot] > 0 : zc->sin_completar > 0) {
+        if (get_monotonic_us() > limite) {
+            fprintf(stderr, "MSG_ZEROCOPY: el kernel no devolvió %u buffers\n", zc->sin_completar);
+            return -1;
+        }
+        if (poll(&pfd, 1, 100) < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (zc_procesar(zc, socket) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -1,37 +1,306 @@
+#define _GNU_SOURCE     // ppoll()
 #include <poll.h>
-#include <sys/time.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <limits.h>
+#include <pthread.h>
 #include "../include/common.h"
+#include "../include/rtt.h"
+#include "../include/ventana.h"
+#include "../include/zerocopy.h"
+#include "../include/gso.h"
+#include "../include/lz.h"
+#include "../include/congestion.h"
+#include "../include/pacing.h"
+#include "../include/fec.h"
+#include "../include/delta.h"
+#include "../include/ticket.h"
 
 
-#define MAX_RETRIES 3
-#define TIMEOUT_MSEC 3000
+#define MAX_RETRIES 8   // con backoff exponencial desde RTO_MIN_MS son ~25 s antes de abandonar
+#define SONDA_RONDAS 2  // envíos de cada SONDA sin confirmar antes de dar su tamaño por perdido
+#define INACTIVIDAD_MS 30000    // descarga: sin ningún PDU del servidor en este tiempo se abandona
+#define SACK_UMBRAL 3   // PDUs enviados después de uno que tienen que confirmarse para darlo por perdido
+#define SUBIDA_CHICA (64 * 1024)    // hasta acá el sondeo del bloque cuesta más de lo que ahorra
+#define TICKET_REINTENTOS 3     // ids al azar que se prueban con un ticket antes de volver al HELLO
+
+
+// estado de la sesión con el servidor
+typedef struct {
+    int socket;
+    EstimadorRTT rtt;        // RTO adaptativo, compartido por todas las fases
+    int retransmisiones;
+    int v2;                  // 1 si el servidor aceptó el protocolo v2 en el HELLO
+    uint32_t sesion;         // id de sesión v2 (va en cada PDU)
+    int con_ticket;          // ticket tiene uno: del ACK del HELLO (-k) o el guardado
+    uint8_t ticket[TICKET_LARGO];
+    int sin_hello;           // sesión retomada con el ticket: el WRQ lo lleva
+    int wrq_en_hello;        // el servidor tomó el WRQ que iba dentro del HELLO: su ACK ya viene
+    PDU_v2* wrq;             // sesión sin HELLO: WRQ que sale con el primer DATA, hasta su ACK
+    int wrq_len;
+    char rechazo[64];        // texto del último ACK de error del servidor
+    int mapear;              // -z: los DATA salen directo del archivo mapeado
+    ZeroCopy zc;             // -Z: además MSG_ZEROCOPY (un slot por PDU en vuelo)
+    int comprimir;           // -c: el servidor aceptó DATA comprimidos
+    uint64_t bytes_datos;    // con -c: bytes del archivo enviados
+    uint64_t bytes_cable;    // y lo que ocuparon sus payloads
+    uint32_t bloques_comprimidos;
+    int gso;                 // -g: los DATA nuevos salen en lotes con UDP_SEGMENT
+    uint64_t envios_gso;     // lotes enviados
+    uint64_t pdus_gso;       // y los PDUs que llevaron
+    int bloque_max;          // bloque v2 máximo que aceptó el servidor (0 = sin OPT_BLOQUE)
+    int bloque;              // payload de cada DATA v2: V2_DATA_SIZE o el que confirmó el sondeo
+    int sack;                // el servidor aceptó OPT_SACK: los ACK de DATA traen su ventana
+    uint64_t rapidas;        // retransmisiones por huecos del SACK (sin esperar el timer)
+    int fec_k;               // -F aceptado: m PARIDAD cada k DATA (0 = sin FEC)
+    int fec_m;
+    uint64_t paridades;
+    Delta* delta;            // -D: coincidencias con el archivo del servidor (NULL = sin delta)
+    uint64_t delta_datos;    // con -D: bytes del archivo de los bloques con coincidencias
+    uint64_t delta_cable;    // y lo que ocuparon sus payloads
+    uint32_t bloques_delta;
+    const AlgoritmoCC* algoritmo_cc;    // -C (modo ventana)
+    ControlCongestion cc;
+    Pacer pacer;
+    const char* traza;       // -T: CSV de cwnd y tasa de la fase DATA (NULL = sin traza)
+} Sesion;
+
+
+// origen de los bloques de la fase DATA: fread a un buffer propio o, en modo
+// zero-copy, punteros al archivo mapeado (sin copias en espacio de usuario).
+// Se lee de pos a fin: el archivo entero o el rango de una subida en paralelo.
+// Lo leído se va acumulando en el digest que viaja en el FIN
+typedef struct {
+    FILE* file;
+    int mapeado;
+    const char* mapa;        // NULL si el archivo está vacío
+    size_t tam;
+    size_t pos;
+    size_t fin;
+    uint32_t digest;         // CRC32C de lo leído (más el valor inicial que ponga el llamador)
+} Origen;
+
+
+int origen_abrir(Origen* o, const char* path, int mapear) {
+    memset(o, 0, sizeof(Origen));
+    o->file = fopen(path, "rb");
+    if (!o->file) {
+        perror("Error en fopen()");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fileno(o->file), &st) != 0) {
+        perror("Error en fstat()");
+        fclose(o->file);
+        return -1;
+    }
+    o->tam = st.st_size;
+    o->fin = o->tam;
+    if (!mapear) {
+        return 0;
+    }
+    o->mapeado = 1;
+    if (o->tam == 0) {
+        return 0;       // no se puede mapear un archivo vacío: no hay bloques
+    }
+
+    o->mapa = mmap(NULL, o->tam, PROT_READ, MAP_PRIVATE, fileno(o->file), 0);
+    if (o->mapa == MAP_FAILED) {
+        perror("Error en mmap()");
+        fclose(o->file);
+        return -1;
+    }
+    madvise((void*)o->mapa, o->tam, MADV_SEQUENTIAL);
+    return 0;
+}
+
+
+// limita la lectura a [desde, desde + largo)
+int origen_rango(Origen* o, uint64_t desde, uint64_t largo) {
+    if (desde > o->tam) {
+        desde = o->tam;
+    }
+    o->pos = desde;
+    o->fin = (largo < o->tam - desde) ? desde + largo : o->tam;
+    if (!o->mapeado && fseeko(o->file, desde, SEEK_SET) != 0) {
+        perror("Error en fseeko()");
+        return -1;
+    }
+    return 0;
+}
+
+
+// próximo bloque de hasta max bytes. *datos queda apuntando al payload
+// (dentro del mapa o a buf). Devuelve los bytes del bloque, 0 al final
+int origen_leer(Origen* o, char* buf, int max, const char** datos) {
+    size_t n = (o->fin - o->pos < (size_t)max) ? o->fin - o->pos : (size_t)max;
+    if (!o->mapeado) {
+        *datos = buf;
+        n = fread(buf, 1, n, o->file);
+    } else {
+        *datos = o->mapa + o->pos;
+    }
+    o->pos += n;
+    o->digest = crc32c(o->digest, *datos, n);
+    return n;
+}
+
+
+void origen_cerrar(Origen* o) {
+    if (o->mapa) {
+        munmap((void*)o->mapa, o->tam);
+    }
+    fclose(o->file);
+    memset(o, 0, sizeof(Origen));
+}
+
+
+// CRC32C de los primeros `hasta` bytes del archivo: al reanudar, lo que el
+// servidor ya tiene también entra en el digest del FIN
+int digest_prefijo(const char* path, uint64_t hasta, uint32_t* digest) {
+    Origen o;
+    if (origen_abrir(&o, path, 0) != 0) {
+        return -1;
+    }
+    if (origen_rango(&o, 0, hasta) != 0) {
+        origen_cerrar(&o);
+        return -1;
+    }
+
+    char buf[65536];
+    const char* datos;
+    while (origen_leer(&o, buf, sizeof(buf), &datos) > 0) {
+    }
+    *digest = o.digest;
+    int completo = (o.pos == hasta);
+    origen_cerrar(&o);
+    return completo ? 0 : -1;
+}
+
+
+// comprime un bloque en buf si la sesión negoció compresión y el bloque
+// achica. Devuelve el largo comprimido, o 0 si se envía tal cual (p.ej. datos
+// aleatorios o ya comprimidos: el compresor abandona rápido)
+int comprimir_bloque(Sesion* ses, const char* datos, int largo, char* buf) {
+    if (!ses->comprimir || largo == 0) {
+        return 0;
+    }
+    int c = lz_comprimir(datos, largo, buf, largo - 1);
+    ses->bytes_datos += largo;
+    ses->bytes_cable += (c > 0) ? c : largo;
+    if (c <= 0) {
+        return 0;
+    }
+    ses->bloques_comprimidos++;
+    return c;
+}
+
+
+// receta del bloque [offset, offset + largo) en buf si la subida es delta y
+// el bloque tiene algo del archivo del servidor. Devuelve su largo, o 0 si
+// no achica (el bloque va tal cual o comprimido)
+int delta_bloque(Sesion* ses, uint64_t offset, const char* datos, int largo, char* buf) {
+    if (!ses->delta || largo == 0) {
+        return 0;
+    }
+    int r = delta_receta(ses->delta, offset, datos, largo, buf);
+    if (r <= 0) {
+        return 0;
+    }
+    ses->delta_datos += largo;
+    ses->delta_cable += r;
+    ses->bloques_delta++;
+    return r;
+}
+
+
+// header y payload en un solo datagrama con sendmsg: el payload puede estar
+// en el archivo mapeado. slot = buffer a seguir si el envío es con MSG_ZEROCOPY
+// (-1 para copiar siempre)
+int enviar(Sesion* ses, const void* header, int header_len, const void* payload, int len, int slot) {
+    struct iovec iov[2];
+    iov[0].iov_base = (void*)header;
+    iov[0].iov_len = header_len;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len > 0) ? 2 : 1;
+    return zc_enviar(&ses->zc, ses->socket, &msg, slot);
+}
+
+
+// envía los PDUs acumulados en un solo sendmsg con UDP_SEGMENT (ver gso.h) y
+// vacía el lote. Si el camino no lo soporta (EIO: la placa no calcula los
+// checksums; EINVAL: segmento más grande que la MTU) se envían de a uno y la
+// sesión sigue sin -g. Un lote siempre se copia: con MSG_ZEROCOPY cada iovec
+// es un fragmento del skb y un lote tiene más de los que admite (EMSGSIZE)
+int enviar_lote(Sesion* ses, LoteGSO* lote, uint16_t ventana) {
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    int n = lote->n;
+
+    gso_mensaje(lote, &msg, control);
+    lote->n = 0;
+    if (zc_enviar(&ses->zc, ses->socket, &msg, (n > 1) ? -1 : lote->primer_slot) >= 0) {
+        ses->envios_gso++;
+        ses->pdus_gso += n;
+        return 0;
+    }
+    if (n < 2 || (errno != EIO && errno != EINVAL)) {
+        return -1;
+    }
+
+    perror("sendmsg(UDP_SEGMENT)");
+    fprintf(stderr, "Sin segmentation offload, se sigue enviando de a un PDU\n");
+    ses->gso = 0;
+    for (int i = 0; i < n; i++) {
+        struct iovec* iov = &lote->iov[2 * i];
+        if (enviar(ses, iov[0].iov_base, iov[0].iov_len, iov[1].iov_base, iov[1].iov_len,
+                   (lote->primer_slot + i) % ventana) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
 
 // envia PDU y espera ACK (con poll)
-// ignora ACKs incorrectos sin reiniciar el timer
-int send_and_wait(int socket, App_PDU* pdu, uint8_t expected_seq, int data_size) {
+// ignora ACKs incorrectos sin reiniciar el timer.
+// si respuesta != NULL se copia ahí el ACK correcto (para leer las opciones del HELLO).
+// payload = NULL si los datos están en pdu->data; si no, se envían de ahí sin
+// copiarlos (con -Z el kernel los retiene: slot 0 hasta que avise que terminó)
+int send_and_wait(Sesion* ses, App_PDU* pdu, const char* payload, uint8_t expected_seq,
+                  int data_size, App_PDU* respuesta) {
     App_PDU ack;
     int attempts = 0;
     
     while (attempts < MAX_RETRIES) {
         print_pdu("Enviando pdu", pdu);
         
-        int sent = send(socket, pdu, PDU_HEADER_SIZE + data_size, 0);
+        int sent = enviar(ses, pdu, PDU_HEADER_SIZE, payload ? payload : pdu->data, data_size,
+                          payload ? 0 : -1);
         if (sent < 0) {
             perror("Error en send()");
             return -1;
         }
 
-        int current_timeout_ms = TIMEOUT_MSEC; 
+        int timeout_ms = rtt_rto_ms(&ses->rtt);
+        int current_timeout_ms = timeout_ms;
         
-        // necesitamos registrar el tiempo de inicio para calcular el tiempo restante
-        struct timeval start_time, current_time, elapsed_time;
-        gettimeofday(&start_time, NULL);
+        // necesitamos registrar el tiempo de inicio para calcular el tiempo restante y medir el RTT
+        uint64_t start_us = get_monotonic_us();
         
-        printf("Esperando ACK (max %d ms)...\n", TIMEOUT_MSEC);
+        LOG(LOG_DETALLE, "Esperando ACK (max %d ms)...\n", timeout_ms);
 
         struct pollfd pfd;   // solo queremos monitorear 1 fd, el de nuestro unico socket
-        pfd.fd = socket;
+        pfd.fd = ses->socket;
         pfd.events = POLLIN;     // el poll despierta con el evento "IN" (llegaron datos para leer)
 
         // bucle para esperar y procesar paquetes dentro del timer total
@@ -45,70 +314,91 @@ int send_and_wait(int socket, App_PDU* pdu, uint8_t expected_seq, int data_size)
                 return -1;
 
             } else if (poll_res == 0) {
-                printf("poll=0");
+                LOG(LOG_DETALLE, "poll=0");
                 break;
 
             } else {
-                if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {     // -> poll despertó debido a eventos de error
-                    if (pfd.revents & POLLERR)
-                        printf("POLLERR: hubo un problema con el socket del servidor\n");
+                // POLLERR también avisa que hay notificaciones de MSG_ZEROCOPY: solo
+                // es un error si queda un error pendiente en el socket
+                if ((pfd.revents & POLLERR) && zc_procesar(&ses->zc, ses->socket) < 0) {
+                    LOG(LOG_ERROR, "POLLERR: hubo un problema con el socket del servidor\n");
+                    return -1;
+                }
+                if (pfd.revents & (POLLHUP | POLLNVAL)) {     // -> poll despertó debido a eventos de error
                     if (pfd.revents & POLLHUP)
-                        printf("POLLHUP: se detectó socket cerrado del servidor\n");
+                        LOG(LOG_ERROR, "POLLHUP: se detectó socket cerrado del servidor\n");
                     if (pfd.revents & POLLNVAL)
-                        printf("POLLNVAL\n");
+                        LOG(LOG_ERROR, "POLLNVAL\n");
                     return -1;
                 }
+                if (!(pfd.revents & POLLIN)) {
+                    long elapsed_ms = (get_monotonic_us() - start_us) / 1000;
+                    current_timeout_ms = timeout_ms - (int)elapsed_ms;
+                    continue;
+                }
                 if (pfd.revents & POLLIN) {                   // POLLIN -> poll despertó debido a evento IN
                     memset(&ack, 0, sizeof(App_PDU));
-                    int received = recv(socket, &ack, sizeof(App_PDU), 0);
+                    int received = recv(ses->socket, &ack, sizeof(App_PDU), 0);
 
                     if (received < 0) {
                         perror("Error en recv() después de poll");
                         return -1;
                     }
                     
-                    printf("Se esperaba recibir seq=%d. Recibido type=%d, seq=%d\n", 
+                    LOG(LOG_DETALLE, "Se esperaba recibir seq=%d. Recibido type=%d, seq=%d\n", 
                             expected_seq, ack.type, ack.seq_num);
 
                     if (ack.type == ACK && ack.seq_num == expected_seq) {
+                        // regla de Karn: solo se mide el RTT si el PDU se envió una sola vez
+                        if (attempts == 0) {
+                            rtt_muestra(&ses->rtt, get_monotonic_us() - start_us);
+                        }
+
                         size_t data_len = strnlen(ack.data, MAX_DATA_SIZE);
                         if (data_len > 0) {
-                            printf("Servidor dice: %s\n", ack.data);
+                            LOG(LOG_ERROR, "Servidor dice: %s\n", ack.data);
                             return -2;
                         } else {
-                            printf("ACK correcto (seq=%d) recibido.\n\n", ack.seq_num);
+                            LOG(LOG_DETALLE, "ACK correcto (seq=%d) recibido.\n\n", ack.seq_num);
+                            if (respuesta) {
+                                memcpy(respuesta, &ack, received);
+                            }
                             return 0;
                         }
 
                     } else {
-                        printf("ACK incorrecto. Se ignora y se recalcula el tiempo restante...\n");
+                        LOG(LOG_AVISO, "ACK incorrecto. Se ignora y se recalcula el tiempo restante...\n");
                         
                         // recalcular el tiempo restante
-                        gettimeofday(&current_time, NULL);
+                        long elapsed_ms = (get_monotonic_us() - start_us) / 1000;
                         
-                        // Calcular tiempo transcurrido en milisegundos
-                        elapsed_time.tv_sec = current_time.tv_sec - start_time.tv_sec;
-                        elapsed_time.tv_usec = current_time.tv_usec - start_time.tv_usec;
-                        long elapsed_ms = (elapsed_time.tv_sec * 1000) + (elapsed_time.tv_usec / 1000);
-                        
-                        current_timeout_ms = TIMEOUT_MSEC - (int)elapsed_ms;
-                        printf("current timeout ms: %i",current_timeout_ms);
+                        current_timeout_ms = timeout_ms - (int)elapsed_ms;
+                        LOG(LOG_DETALLE, "current timeout ms: %i",current_timeout_ms);
                     }
                 }
             }
         }
 
         attempts++;
-        printf("TIMEOUT (calculado) - Reintento %d/%d\n", attempts, MAX_RETRIES);
+        rtt_backoff(&ses->rtt);
+        ses->retransmisiones++;
+        LOG(LOG_AVISO, "TIMEOUT (RTO=%d ms) - Reintento %d/%d\n", timeout_ms, attempts, MAX_RETRIES);
     }
     
-    printf("FALLO después de %d intentos\n", MAX_RETRIES);
+    LOG(LOG_ERROR, "FALLO después de %d intentos\n", MAX_RETRIES);
     return -1;
 }
 
 
-int fase_hello(int socket, const char* credencial) {
-    printf("\n===== FASE 1: HELLO =====\n");
+// pide v2 (salvo que pedir_v2 sea 0) y la ventana. *ventana: entrada = ventana
+// pedida (0 = la que elija el servidor), salida = ventana aceptada (0 = servidor v1).
+// max_datagrama acota el bloque que se pide (OPT_BLOQUE): el camino se sondea después.
+// fec = {k, m} pedidos (NULL = sin FEC). Con pedir_ticket se pide un ticket de
+// sesión (ver ticket.h). wrq = payload de un WRQ v2 que va en el mismo datagrama
+// (NULL = se manda después): si el servidor lo toma, ses->wrq_en_hello queda en 1
+int fase_hello(Sesion* ses, const char* credencial, int pedir_v2, int comprimir, int max_datagrama,
+               const uint8_t* fec, int pedir_ticket, const char* wrq, int wrq_len, uint16_t* ventana) {
+    LOG(LOG_INFO, "\n===== FASE 1: HELLO =====\n");
     
     App_PDU pdu;
     memset(&pdu, 0, sizeof(App_PDU));
@@ -116,14 +406,138 @@ int fase_hello(int socket, const char* credencial) {
     pdu.seq_num = 0;
     strncpy(pdu.data, credencial, MAX_DATA_SIZE - 1);
 
-    size_t data_size = strlen(credencial) + 1;  // +1 para null terminator
-    
-    return send_and_wait(socket, &pdu, 0,data_size);
+    int data_size = strlen(credencial) + 1;  // +1 para null terminator
+
+    // opciones de negociación detrás de la credencial (un servidor v1 las ignora)
+    if (pedir_v2) {
+        uint8_t version = V2_VERSION;
+        data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_VERSION, &version, 1);
+        if (*ventana > 0) {
+            uint16_t v = htons(*ventana);
+            data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_VENTANA, &v, 2);
+        }
+        if (max_datagrama - V2_HEADER_SIZE != V2_DATA_SIZE) {
+            uint16_t b = htons(max_datagrama - V2_HEADER_SIZE);
+            data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_BLOQUE, &b, 2);
+        }
+        uint8_t sack = 1;
+        data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_SACK, &sack, 1);
+        if (fec) {
+            data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_FEC, fec, 2);
+        }
+        if (pedir_ticket) {
+            uint8_t uno = 1;
+            data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_TICKET, &uno, 1);
+        }
+    }
+    if (comprimir) {
+        uint8_t codec = COMPRESION_LZ;
+        data_size = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_COMPRESION, &codec, 1);
+    }
+    // el WRQ va último: si no entra, sale después como siempre
+    int con_wrq = (pedir_v2 && wrq && wrq_len <= 0xFF && data_size > 0)
+                  ? opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_WRQ, wrq, wrq_len) : -1;
+    if (con_wrq > 0) {
+        data_size = con_wrq;
+    }
+
+    App_PDU ack;
+    memset(&ack, 0, sizeof(App_PDU));
+    int res = send_and_wait(ses, &pdu, NULL, 0, data_size, &ack);
+    if (res != 0) {
+        return res;
+    }
+
+    // el ACK trae '\0' + opciones aceptadas; si no las trae, el servidor es v1
+    const uint8_t* version = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_VERSION, 1);
+    const uint8_t* id = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_SESION, 4);
+    const uint8_t* v = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_VENTANA, 2);
+    const uint8_t* codec = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_COMPRESION, 1);
+    const uint8_t* b = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_BLOQUE, 2);
+
+    ses->comprimir = (comprimir && codec && *codec == COMPRESION_LZ);
+    if (comprimir) {
+        LOG(LOG_INFO, "Compresión de los DATA: %s\n", ses->comprimir ? "aceptada" : "el servidor no la soporta");
+    }
+
+    *ventana = 0;
+    if (version && *version == V2_VERSION && id) {
+        ses->v2 = 1;
+        memcpy(&ses->sesion, id, 4);
+        ses->sesion = ntohl(ses->sesion);
+        *ventana = 1;
+        if (v) {
+            uint16_t aceptada;
+            memcpy(&aceptada, v, 2);
+            *ventana = ntohs(aceptada) ? ntohs(aceptada) : 1;
+        }
+        if (b) {
+            uint16_t bloque;
+            memcpy(&bloque, b, 2);
+            ses->bloque_max = ntohs(bloque);
+        }
+        ses->sack = (opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_SACK, 1) != NULL);
+        const uint8_t* km = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_FEC, 2);
+        if (fec && km && km[0] > 0 && km[1] > 0) {
+            ses->fec_k = km[0];
+            ses->fec_m = km[1];
+            LOG(LOG_INFO, "FEC: %d paridades cada %d DATA\n", ses->fec_m, ses->fec_k);
+        } else if (fec) {
+            LOG(LOG_INFO, "FEC: el servidor no lo soporta\n");
+        }
+        const uint8_t* ticket = opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_TICKET, TICKET_LARGO);
+        if (pedir_ticket && ticket) {
+            memcpy(ses->ticket, ticket, TICKET_LARGO);
+            ses->con_ticket = 1;
+        }
+        ses->wrq_en_hello = (wrq && opt_buscar(ack.data + 1, MAX_DATA_SIZE - 1, OPT_WRQ, 1) != NULL);
+        LOG(LOG_INFO, "Protocolo v2 aceptado: sesión %08x, %d PDUs en vuelo%s\n", ses->sesion, *ventana,
+               ses->wrq_en_hello ? ", WRQ en el mismo vuelo" : "");
+    } else {
+        LOG(LOG_INFO, "Servidor v1: stop & wait\n");
+    }
+
+    return 0;
+}
+
+
+// agrega al WRQ el id de una subida reanudable (si id != 0)
+int opt_reanudar(char* buf, int off, int max, uint64_t id) {
+    if (id == 0) {
+        return off;
+    }
+    uint64_t id_be = htobe64(id);
+    int con_id = opt_agregar(buf, off, max, OPT_REANUDAR, &id_be, sizeof(id_be));
+    return (con_id > 0) ? con_id : off;
+}
+
+
+// offset desde el que sigue una subida reanudable, según el ACK del WRQ.
+// opciones = lo que sigue al '\0' inicial del ACK
+uint64_t leer_desde(const char* opciones, int largo, uint64_t tamano) {
+    const uint8_t* d = (largo > 0) ? opt_buscar(opciones, largo, OPT_DESDE, 8) : NULL;
+    if (!d) {
+        return 0;
+    }
+    uint64_t desde;
+    memcpy(&desde, d, 8);
+    desde = be64toh(desde);
+    if (desde > tamano) {
+        return 0;
+    }
+    if (desde > 0) {
+        LOG(LOG_INFO, "El servidor ya tiene %llu de %llu bytes: se reanuda desde ahí\n",
+               (unsigned long long)desde, (unsigned long long)tamano);
+    }
+    return desde;
 }
 
 
-int fase_wrq(int socket, const char* filename) {
-    printf("\n===== FASE 2: WRQ =====\n");
+// el tamaño viaja como opción detrás del '\0' del nombre: el servidor reserva
+// el archivo entero de una vez. Un servidor v1 lo ignora (solo hace strlen).
+// Con id_reanudar != 0 el servidor contesta en *desde cuánto del archivo ya tiene
+int fase_wrq(Sesion* ses, const char* filename, uint64_t tamano, uint64_t id_reanudar, uint64_t* desde) {
+    LOG(LOG_INFO, "\n===== FASE 2: WRQ =====\n");
     
     App_PDU pdu;
     memset(&pdu, 0, sizeof(App_PDU));
@@ -131,39 +545,69 @@ int fase_wrq(int socket, const char* filename) {
     pdu.seq_num = 1;
     strncpy(pdu.data, filename, MAX_DATA_SIZE - 1);
 
-    size_t data_size = strlen(filename) + 1;  // +1 para null terminator
+    int data_size = strlen(filename) + 1;  // +1 para null terminator
+    uint64_t tam_be = htobe64(tamano);
+    int con_opciones = opt_agregar(pdu.data, data_size, MAX_DATA_SIZE, OPT_TAMANO, &tam_be, sizeof(tam_be));
+    if (con_opciones > 0) {
+        data_size = con_opciones;
+    }
+    data_size = opt_reanudar(pdu.data, data_size, MAX_DATA_SIZE, id_reanudar);
     
-    return send_and_wait(socket, &pdu, 1,data_size);
+    App_PDU ack;
+    memset(&ack, 0, sizeof(App_PDU));
+    int res = send_and_wait(ses, &pdu, NULL, 1,data_size, &ack);
+    if (res == 0) {
+        *desde = leer_desde(ack.data + 1, MAX_DATA_SIZE - 1, tamano);
+    }
+    return res;
 }
 
 
-int fase_data(int socket, const char* filepath, uint8_t* last_seq_out) {
-    printf("\n===== FASE 3: DATA =====\n");
+// sube el archivo desde el byte `desde` (0 salvo al reanudar). *digest entra
+// con el de los bytes anteriores a desde y sale con el del archivo completo
+int fase_data(Sesion* ses, const char* filepath, uint64_t desde, uint32_t* digest, uint8_t* last_seq_out) {
+    LOG(LOG_INFO, "\n===== FASE 3: DATA =====\n");
     
-    FILE* file = fopen(filepath, "rb");
-    if (!file) {
-        perror("Error en fopen()");
+    Origen origen;
+    if (origen_abrir(&origen, filepath, ses->mapear) != 0) {
         return -1;
     }
+    if (origen_rango(&origen, desde, UINT64_MAX) != 0) {
+        origen_cerrar(&origen);
+        return -1;
+    }
+    origen.digest = *digest;
     
     App_PDU pdu;
     int seq = 0;  // en la fase DATA seq empieza en 0
     int paquetes_enviados = 0;
-    size_t bytes_leidos;
-    
-    char data_buffer[MAX_DATA_SIZE];
+    int bytes_leidos;
+    const char* datos;
+    char comprimido[MAX_DATA_SIZE];
 
-    while ((bytes_leidos = fread(data_buffer, 1, MAX_DATA_SIZE, file)) > 0) {
-        memset(&pdu, 0, sizeof(App_PDU));  // es necesario resetear la pdu para que no le quede basura accidental en el campo data
+    // se lee directo en pdu.data (o se apunta al mapa): solo se envían bytes_leidos,
+    // así que no hace falta limpiar el resto del PDU
+    while ((bytes_leidos = origen_leer(&origen, pdu.data, MAX_DATA_SIZE, &datos)) > 0) {
         pdu.type = DATA;
         pdu.seq_num = seq;
-        memcpy(pdu.data, data_buffer, bytes_leidos);  // copiar datos leídos desde data_buffer a pdu.data
         
-        printf("\n--- Paquete #%d (seq=%d, %zu bytes) ---\n", 
+        LOG(LOG_DETALLE, "\n--- Paquete #%d (seq=%d, %d bytes) ---\n", 
                 paquetes_enviados + 1, seq, bytes_leidos);
+
+        const char* payload = origen.mapeado ? datos : NULL;
+        int largo = comprimir_bloque(ses, datos, bytes_leidos, comprimido);
+        if (largo > 0) {
+            payload = comprimido;
+            pdu.seq_num |= V1_COMPRIMIDO;
+        } else {
+            largo = bytes_leidos;
+        }
         
-        if (send_and_wait(socket, &pdu, seq,bytes_leidos) != 0) {
-            fclose(file);
+        int res = send_and_wait(ses, &pdu, payload, seq, largo, NULL);
+        // con MSG_ZEROCOPY el header de pdu no se puede reescribir hasta que el kernel lo suelte
+        if (res != 0 || zc_esperar(&ses->zc, ses->socket, 0) != 0) {
+            zc_esperar(&ses->zc, ses->socket, -1);
+            origen_cerrar(&origen);
             return -1;
         }
 
@@ -172,101 +616,1709 @@ int fase_data(int socket, const char* filepath, uint8_t* last_seq_out) {
         seq = (seq == 0) ? 1 : 0; // se alterna el numero de secuencia. if seq==0 -> seq=1, else -> seq=0
     }
     
-    fclose(file);
-    printf("\nTransferencia completada: %d paquetes enviados\n", paquetes_enviados);
+    *digest = origen.digest;
+    origen_cerrar(&origen);
+    LOG(LOG_INFO, "\nTransferencia completada: %d paquetes enviados\n", paquetes_enviados);
     return 0;
 }
 
 
-int fase_fin(int socket, const char* filename, int last_seq) {
-    printf("\n===== FASE 4: FIN =====\n");
+int fase_fin(Sesion* ses, int last_seq, uint32_t digest) {
+    LOG(LOG_INFO, "\n===== FASE 4: FIN =====\n");
     
     App_PDU pdu;
     memset(&pdu, 0, sizeof(App_PDU));
     pdu.type = FIN;
     int seq = (last_seq == 0) ? 1 : 0;       // aca se define el seq del FIN dependiendo de cómo termino el seq en fase DATA
     pdu.seq_num = seq;
-    // strncpy(pdu.data, filename, MAX_DATA_SIZE - 1);     // por aviso en campus debe ser vacio el campo data en el FIN
+    // por aviso en campus debe ser vacio el campo data en el FIN (no lleva el nombre)
+    // el digest va detrás de un '\0': como string el data sigue vacío
+    int data_size = fin_con_digest(pdu.data, MAX_DATA_SIZE, digest);
+    LOG(LOG_INFO, "Digest del archivo: %08x\n", digest);
     
-    return send_and_wait(socket, &pdu, seq,0);
+    return send_and_wait(ses, &pdu, NULL, seq, data_size, NULL);
 }
 
 
-int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        fprintf(stderr, "Uso: %s <IP_SERVIDOR> <ARCHIVO_LOCAL> <ARCHIVO_REMOTO>\n", argv[0]);
-        fprintf(stderr, "Ejemplo: %s 127.0.0.1 test.txt a.txt\n", argv[0]);
-        return 1;
+// estado de envío de cada PDU en vuelo del modo ventana
+typedef struct {
+    PDU_v2 pdu;            // ya sellado: las retransmisiones reenvían los mismos bytes
+    const char* payload;   // lectura, el bloque dentro del archivo mapeado, comprimido o su receta
+    int len;               // largo del payload
+    char* lectura;         // ses->bloque bytes para fread (NULL si el archivo está mapeado)
+    char* codificado;      // y para el bloque comprimido o su receta delta (NULL sin -c ni -D)
+    uint64_t enviado_us;   // momento del último (re)envío
+    uint64_t vence_us;     // timer propio del PDU
+    uint32_t siguiente;    // next_seq cuando se (re)envió: lo enviado desde ahí es posterior
+    int intentos;
+    int confirmado;
+} SlotEnvio;
+
+
+// recibe un ACK v2 de esta sesión. Devuelve el largo de su payload (> 0 = mensaje
+// de error del servidor) o -1 si no había nada o el datagrama no es un ACK válido.
+// Un payload que empieza con '\0' son opciones, no un error: devuelve 0
+int recibir_ack_v2(Sesion* ses, PDU_v2* ack, int flags) {
+    int received = recv(ses->socket, ack, sizeof(PDU_v2), flags);
+    if (received < 0) {
+        return -1;
     }
-    
-    const char* server_ip = argv[1];
-    const char* local_file = argv[2];
-    const char* remote_name = argv[3];
-    
-    printf("\n*========================================*\n");
-    printf("|  CLIENTE STOP & WAIT                   |\n");
-    printf("*========================================*\n");
-    printf("|  Servidor: %-27s |\n", server_ip);
-    printf("|  Archivo:  %-27s |\n", local_file);
-    printf("*========================================*\n");
 
-    int s;
-    struct addrinfo hints, *servinfo;
-    
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
-    
-    int status = getaddrinfo(server_ip, SERVER_PORT, &hints, &servinfo);
-    if (status != 0) {
-        fprintf(stderr, "Error en getaddrinfo(): %s\n", gai_strerror(status));
-        return 1;
+    int len = v2_verificar(ack, received);
+    if (len < 0 || ack->type != ACK || ntohl(ack->sesion) != ses->sesion) {
+        return -1;
     }
-    
-    s = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
-    if (s < 0) {
-        perror("Error en socket()");
-        freeaddrinfo(servinfo);
-        return 1;
+    if (len > 0 && ack->data[0] == '\0') {
+        return 0;
     }
-    
-    if (connect(s, servinfo->ai_addr, servinfo->ai_addrlen) < 0) {
-        perror("Error en connect()");
-        close(s);
-        freeaddrinfo(servinfo);
-        return 1;
+    if (len > 0) {
+        LOG(LOG_ERROR, "Servidor dice: %.*s\n", len, ack->data);
+        snprintf(ses->rechazo, sizeof(ses->rechazo), "%.*s", len, ack->data);
     }
-    
-    printf("Conectado al servidor\n");
-    freeaddrinfo(servinfo);
+    return len;
+}
 
-    if (fase_hello(s, "g23-889d") != 0) {
-        fprintf(stderr, "Fallo en FASE 1 (HELLO)\n");
-        close(s);
-        return 1;
+
+// marca un slot confirmado (si no lo estaba) y se lo cuenta al control de
+// congestión. *mayor = el seq más alto confirmado
+void confirmar_slot(Sesion* ses, SlotEnvio* slot, uint32_t seq, uint64_t muestra, uint32_t* mayor) {
+    if (slot->confirmado) {
+        return;
     }
-    
-    if (fase_wrq(s, remote_name) != 0) {
-        fprintf(stderr, "Fallo en FASE 2 (WRQ)\n");
-        close(s);
-        return 1;
+    slot->confirmado = 1;
+    cc_ack(&ses->cc, seq, muestra);
+    if ((int32_t)(seq - *mayor) > 0) {
+        *mayor = seq;
     }
-    
-    uint8_t last_data_seq = 0;
-    if (fase_data(s, local_file,&last_data_seq) != 0) {
-        fprintf(stderr, "Fallo en FASE 3 (DATA)\n");
-        close(s);
-        return 1;
+}
+
+
+// OPT_SACK de un ACK: todo lo anterior a la base del servidor y los bits del
+// mapa están confirmados, aunque sus propios ACK se hayan perdido
+void procesar_sack(Sesion* ses, SlotEnvio* slots, uint16_t ventana, uint32_t base, uint32_t next_seq,
+                   const uint8_t* sack, int largo, uint32_t* mayor) {
+    uint32_t base_servidor;
+    memcpy(&base_servidor, sack, 4);
+    base_servidor = ntohl(base_servidor);
+    if (base_servidor - base > next_seq - base) {
+        return;     // de una ventana anterior (ACK atrasado)
     }
-    
-    if (fase_fin(s, remote_name, last_data_seq) != 0) {  // el seq depende del último DATA
-        fprintf(stderr, "Fallo en FASE 4 (FIN)\n");
-        close(s);
-        return 1;
+    for (uint32_t seq = base; seq != base_servidor; seq++) {
+        confirmar_slot(ses, &slots[seq % ventana], seq, 0, mayor);
+    }
+    for (int i = 0; i < (largo - 4) * 8; i++) {
+        uint32_t seq = base_servidor + 1 + i;
+        if (seq - base >= next_seq - base) {
+            break;
+        }
+        if (sack[4 + i / 8] & (1 << (i % 8))) {
+            confirmar_slot(ses, &slots[seq % ventana], seq, 0, mayor);
+        }
+    }
+}
+
+
+// lee todos los ACKs disponibles sin bloquear y marca los slots confirmados.
+// los PDUs que se enviaron una sola vez aportan una muestra de RTT (regla de Karn),
+// que también recibe el control de congestión. Con SACK cada ACK confirma además
+// lo que el servidor ya tiene. *mayor = el seq más alto confirmado.
+// Devuelve -2 si el servidor respondió con un error
+int procesar_acks_ventana(Sesion* ses, SlotEnvio* slots, uint16_t ventana,
+                          uint32_t base, uint32_t next_seq, uint32_t* mayor) {
+    PDU_v2 ack;
+
+    while (1) {
+        errno = 0;
+        int len = recibir_ack_v2(ses, &ack, MSG_DONTWAIT);
+        if (len > 0) {
+            return -2;
+        }
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            continue;
+        }
+
+        uint32_t seq = ntohl(ack.seq);
+        if (seq == V2_SEQ_WRQ) {
+            ses->wrq = NULL;        // sesión sin HELLO: el WRQ que salió con el primer DATA
+            continue;
+        }
+        if (seq - base < next_seq - base && !slots[seq % ventana].confirmado) {
+            SlotEnvio* slot = &slots[seq % ventana];
+            uint64_t muestra = 0;
+            if (slot->intentos == 0) {
+                muestra = get_monotonic_us() - slot->enviado_us;
+                rtt_muestra(&ses->rtt, muestra);
+            }
+            confirmar_slot(ses, slot, seq, muestra, mayor);
+        }
+
+        int largo;
+        const uint8_t* sack = (ses->sack && ntohs(ack.len) > 1)
+                              ? opt_buscar_variable(ack.data + 1, ntohs(ack.len) - 1, OPT_SACK, &largo) : NULL;
+        if (sack && largo >= 4) {
+            procesar_sack(ses, slots, ventana, base, next_seq, sack, largo, mayor);
+        }
+    }
+}
+
+
+// envía un PDU v2 suelto (WRQ o FIN) ya sellado y espera el ACK de su seq.
+// si respuesta != NULL se copia ahí el ACK (para leer sus opciones). Con
+// ya_enviado el primer envío se saltea (el WRQ que fue dentro del HELLO)
+int send_and_wait_v2(Sesion* ses, PDU_v2* pdu, int total, PDU_v2* respuesta, int ya_enviado) {
+    uint32_t seq = ntohl(pdu->seq);
+    struct pollfd pfd;
+    pfd.fd = ses->socket;
+    pfd.events = POLLIN;
+
+    for (int attempts = 0; attempts < MAX_RETRIES; attempts++) {
+        if ((attempts > 0 || !ya_enviado) && send(ses->socket, pdu, total, 0) < 0) {
+            perror("Error en send()");
+            return -1;
+        }
+
+        uint64_t enviado = get_monotonic_us();
+        uint64_t limite = enviado + ses->rtt.rto_us;
+        uint64_t ahora;
+        while ((ahora = get_monotonic_us()) < limite) {
+            int poll_res = poll(&pfd, 1, (limite - ahora + 999) / 1000);
+            if (poll_res < 0) {
+                perror("Error en poll()");
+                return -1;
+            }
+            if (poll_res == 0) {
+                break;
+            }
+
+            PDU_v2 ack;
+            int len = recibir_ack_v2(ses, &ack, 0);
+            if (len < 0 || ntohl(ack.seq) != seq) {
+                continue;
+            }
+            if (len > 0) {
+                return -2;
+            }
+            if (attempts == 0 && !ya_enviado) {
+                rtt_muestra(&ses->rtt, get_monotonic_us() - enviado);
+            }
+            if (respuesta) {
+                *respuesta = ack;
+            }
+            return 0;
+        }
+        rtt_backoff(&ses->rtt);
+        ses->retransmisiones++;
+        LOG(LOG_AVISO, "TIMEOUT - Reintento %d/%d (RTO=%d ms)\n", attempts + 1, MAX_RETRIES, rtt_rto_ms(&ses->rtt));
+    }
+
+    LOG(LOG_ERROR, "FALLO después de %d intentos\n", MAX_RETRIES);
+    return -1;
+}
+
+
+// descubre el bloque más grande que llega al servidor, hasta ses->bloque_max
+// y max_datagrama. Con DF (IP_PMTUDISC_DO) el kernel rechaza con EMSGSIZE lo
+// que no entra en la MTU que ya conoce del camino; lo que pasa de ahí se mide:
+// se mandan juntas SONDA de tamaños crecientes (MTUs comunes: IPv6 mínimo,
+// Ethernet, jumbo... y el tope) y el servidor confirma cada una que le llega.
+// Las que no vuelven en un RTO se reenvían una vez. Gana la más grande
+// confirmada; sin ninguna se queda V2_DATA_SIZE, como sin sondeo
+void sondear_bloque(Sesion* ses, int max_datagrama) {
+    static const int mtus[] = {1280, 1500, 9000, 16384, 32768, 65535};
+    int tope = ses->bloque_max + V2_HEADER_SIZE;
+    tope = (tope < max_datagrama) ? tope : max_datagrama;
+
+    int df = IP_PMTUDISC_DO, previo;
+    socklen_t largo = sizeof(previo);
+    if (getsockopt(ses->socket, IPPROTO_IP, IP_MTU_DISCOVER, &previo, &largo) < 0 ||
+        setsockopt(ses->socket, IPPROTO_IP, IP_MTU_DISCOVER, &df, sizeof(df)) < 0) {
+        perror("setsockopt(IP_MTU_DISCOVER)");
+        return;
+    }
+    int mtu;
+    largo = sizeof(mtu);
+    if (getsockopt(ses->socket, IPPROTO_IP, IP_MTU, &mtu, &largo) == 0 && mtu - 28 < tope) {
+        tope = mtu - 28;    // headers IPv4 + UDP
+    }
+    if (tope < V2_HEADER_SIZE + V2_BLOQUE_MIN) {
+        setsockopt(ses->socket, IPPROTO_IP, IP_MTU_DISCOVER, &previo, sizeof(previo));
+        return;
+    }
+
+    int tam[sizeof(mtus) / sizeof(mtus[0]) + 1];
+    int confirmado[sizeof(mtus) / sizeof(mtus[0]) + 1];
+    int n = 0;
+    for (size_t i = 0; i < sizeof(mtus) / sizeof(mtus[0]) && mtus[i] - 28 < tope; i++) {
+        tam[n++] = mtus[i] - 28;
+    }
+    tam[n++] = tope;
+    memset(confirmado, 0, sizeof(confirmado));
+
+    char* ceros = calloc(1, tope);
+    if (!ceros) {
+        perror("Error en calloc()");
+        setsockopt(ses->socket, IPPROTO_IP, IP_MTU_DISCOVER, &previo, sizeof(previo));
+        return;
+    }
+    struct pollfd pfd;
+    pfd.fd = ses->socket;
+    pfd.events = POLLIN;
+
+    for (int ronda = 0; ronda < SONDA_RONDAS && n > 0 && !confirmado[n - 1]; ronda++) {
+        for (int i = 0; i < n; i++) {
+            if (confirmado[i]) {
+                continue;
+            }
+            PDU_v2 sonda;
+            v2_sellar_flags(&sonda, SONDA, 0, ses->sesion, V2_SEQ_SONDA | tam[i], ceros, tam[i] - V2_HEADER_SIZE);
+            if (enviar(ses, &sonda, V2_HEADER_SIZE, ceros, tam[i] - V2_HEADER_SIZE, -1) < 0) {
+                if (errno != EMSGSIZE) {
+                    perror("Error en send()");
+                }
+                n = i;      // ni esta ni las más grandes entran en el camino
+                break;
+            }
+        }
+
+        uint64_t limite = get_monotonic_us() + ses->rtt.rto_us;
+        uint64_t ahora;
+        int faltan = 0;
+        for (int i = 0; i < n; i++) {
+            faltan += !confirmado[i];
+        }
+        while (faltan > 0 && (ahora = get_monotonic_us()) < limite &&
+               poll(&pfd, 1, (limite - ahora + 999) / 1000) > 0) {
+            PDU_v2 ack;
+            if (recibir_ack_v2(ses, &ack, 0) != 0) {
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                if (!confirmado[i] && ntohl(ack.seq) == (V2_SEQ_SONDA | tam[i])) {
+                    confirmado[i] = 1;
+                    faltan--;
+                }
+            }
+        }
+    }
+    free(ceros);
+    setsockopt(ses->socket, IPPROTO_IP, IP_MTU_DISCOVER, &previo, sizeof(previo));
+
+    for (int i = n - 1; i >= 0; i--) {
+        if (confirmado[i]) {
+            ses->bloque = tam[i] - V2_HEADER_SIZE;
+            break;
+        }
+    }
+    LOG(LOG_INFO, "Sondeo del camino: datagramas de hasta %d bytes (bloque de %d)\n",
+           ses->bloque + V2_HEADER_SIZE, ses->bloque);
+}
+
+
+// payload del WRQ v2: nombre '\0' + opciones (tamaño, rango, reanudable,
+// bloque si no es V2_DATA_SIZE, delta y, en una sesión sin HELLO, el ticket).
+// -1 si no entra en max
+int armar_wrq(char* buf, int max, const char* filename, uint64_t tamano, const OptRango* rango,
+              uint64_t id_reanudar, int delta, int bloque, const uint8_t* ticket) {
+    int largo = strnlen(filename, max - 1) + 1;
+    memcpy(buf, filename, largo - 1);
+    buf[largo - 1] = '\0';
+
+    uint64_t tam_be = htobe64(tamano);
+    largo = opt_agregar(buf, largo, max, OPT_TAMANO, &tam_be, sizeof(tam_be));
+    if (largo > 0 && rango) {
+        largo = opt_agregar(buf, largo, max, OPT_RANGO, rango, sizeof(OptRango));
+    }
+    if (largo > 0) {
+        largo = opt_reanudar(buf, largo, max, id_reanudar);
+    }
+    if (largo > 0 && bloque != V2_DATA_SIZE) {
+        uint16_t b = htons(bloque);
+        largo = opt_agregar(buf, largo, max, OPT_BLOQUE, &b, 2);
+    }
+    if (largo > 0 && delta) {
+        uint8_t uno = 1;
+        largo = opt_agregar(buf, largo, max, OPT_DELTA, &uno, 1);
+    }
+    if (largo > 0 && ticket) {
+        largo = opt_agregar(buf, largo, max, OPT_TICKET, ticket, TICKET_LARGO);
+    }
+    return largo;
+}
+
+
+// WRQ v2 de la sesión, sellado. Devuelve el largo del PDU o -1 si no entra
+int sellar_wrq(Sesion* ses, PDU_v2* pdu, const char* filename, uint64_t tamano, const OptRango* rango,
+               uint64_t id_reanudar, int delta) {
+    memset(pdu, 0, sizeof(PDU_v2));
+    int data_size = armar_wrq(pdu->data, V2_DATA_SIZE, filename, tamano, rango, id_reanudar, delta,
+                              ses->bloque, ses->sin_hello ? ses->ticket : NULL);
+    if (data_size < 0) {
+        fprintf(stderr, "Nombre demasiado largo para el WRQ\n");
+        return -1;
     }
+    return v2_sellar(pdu, WRQ, ses->sesion, V2_SEQ_WRQ, data_size);
+}
+
+
+// WRQ v2: mismo payload que en v1 (nombre + '\0' + opciones). rango != NULL
+// en cada sesión de una subida en paralelo; id_reanudar y desde como en fase_wrq.
+// Con delta != NULL pide una subida delta: si el servidor ya tiene el archivo
+// contesta con el bloque de firma y el tamaño (delta->bloque queda en 0 si no)
+int fase_wrq_v2(Sesion* ses, const char* filename, uint64_t tamano, const OptRango* rango,
+                uint64_t id_reanudar, uint64_t* desde, Delta* delta) {
+    LOG(LOG_INFO, "\n===== FASE 2: WRQ (v2) =====\n");
+
+    PDU_v2 pdu;
+    int total = sellar_wrq(ses, &pdu, filename, tamano, rango, id_reanudar, delta != NULL);
+    if (total < 0) {
+        return -1;
+    }
+    PDU_v2 ack;
+    int res = send_and_wait_v2(ses, &pdu, total, &ack, ses->wrq_en_hello);
+    ses->wrq_en_hello = 0;
+    if (res != 0) {
+        return res;
+    }
+    *desde = leer_desde(ack.data + 1, (int)ntohs(ack.len) - 1, tamano);
+    const uint8_t* d = opt_buscar(ack.data + 1, (int)ntohs(ack.len) - 1, OPT_DELTA, 12);
+    if (delta && d) {
+        uint32_t bloque;
+        memcpy(&bloque, d, 4);
+        memcpy(&delta->tam_viejo, d + 4, 8);
+        delta->bloque = ntohl(bloque);
+        delta->tam_viejo = be64toh(delta->tam_viejo);
+        if (delta->bloque < DELTA_FIRMA_MIN || delta->bloque > DELTA_FIRMA_MAX || delta->tam_viejo == 0) {
+            fprintf(stderr, "El ACK del WRQ trae un bloque de firma inválido\n");
+            return -1;
+        }
+        LOG(LOG_INFO, "Subida delta: el servidor tiene %llu bytes, firmas cada %u\n",
+               (unsigned long long)delta->tam_viejo, delta->bloque);
+    } else if (delta) {
+        LOG(LOG_INFO, "Subida delta: el servidor no tiene el archivo o no la soporta, se sube entero\n");
+    }
+    return 0;
+}
+
+
+// manda las PARIDAD del grupo en curso: no llevan ACK ni ocupan slots de la
+// ventana, si se pierden el DATA se recupera igual con su timer o por SACK
+int enviar_paridades(Sesion* ses, FecEmisor* fec, uint32_t grupo) {
+    for (int j = 0; j < fec->m; j++) {
+        int len;
+        const uint8_t* payload = fec_emisor_paridad(fec, j, &len);
+        PDU_v2 header;
+        v2_sellar_flags(&header, PARIDAD, ses->wrq ? V2_TEMPRANO : 0, ses->sesion, grupo, payload, len);
+        if (enviar(ses, &header, V2_HEADER_SIZE, payload, len, -1) < 0) {
+            return -1;
+        }
+        pacer_consumir(&ses->pacer, V2_HEADER_SIZE + len);
+        fec->paridades++;
+    }
+    return 0;
+}
+
+
+// FASE 3 en modo ventana (Selective Repeat): hasta `ventana` DATA en vuelo,
+// cada uno con su propio timer de retransmisión. La ventana avanza cuando
+// se confirma el PDU más viejo. Al final envía el FIN con seq = total de PDUs.
+// Con -g los PDUs nuevos de cada vuelta se envían juntos en lotes con
+// UDP_SEGMENT; las retransmisiones salen de a una.
+// Un PDU sin confirmar se da por perdido y se reenvía sin esperar su timer
+// cuando ya se confirmaron SACK_UMBRAL PDUs enviados después de él (huecos
+// que muestran los ACK y su SACK); el timer queda para cuando no hay nada
+// posterior que confirme (la cola de la subida, una ráfaga entera perdida).
+// Cuántos de los `ventana` slots se usan lo decide el control de congestión
+// (cwnd) y los PDUs nuevos salen espaciados por el pacer a la tasa que calcula
+// (congestion.h, pacing.h); las retransmisiones no esperan al pacer pero
+// descuentan sus tokens.
+// Con FEC (-F k:m) cada k DATA nuevos salen m PARIDAD del grupo (fec.h), y
+// el servidor reconstruye hasta m DATA perdidos del grupo sin esperar reenvíos.
+// Sube los bytes [desde, desde + largo) del archivo (seq 0 = byte desde). El
+// digest del FIN arranca en digest_previo (el de los bytes anteriores a desde al
+// reanudar, 0 en un rango de una subida en paralelo).
+// En una sesión sin HELLO (ses->wrq) el WRQ sale en el mismo vuelo que el
+// primer DATA y tiene su propio timer; hasta su ACK no sale ningún otro DATA.
+// Devuelve -2 si el servidor rechaza ese WRQ (el ticket ya no sirve)
+int fase_data_ventana(Sesion* ses, const char* filepath, uint16_t ventana,
+                      uint64_t desde, uint64_t largo, uint32_t digest_previo) {
+    LOG(LOG_INFO, "\n===== FASE 3: DATA (ventana=%d) =====\n", ventana);
+
+    int rechazado = 0;
+    Origen origen;
+    if (origen_abrir(&origen, filepath, ses->mapear) != 0) {
+        return -1;
+    }
+    if (origen_rango(&origen, desde, largo) != 0) {
+        origen_cerrar(&origen);
+        return -1;
+    }
+    origen.digest = digest_previo;
+
+    // los buffers de todos los slots van juntos: el bloque negociado puede
+    // llegar a ~64 KB y solo hacen falta sin mapa (lectura) o con -c o -D
+    SlotEnvio* slots = calloc(ventana, sizeof(SlotEnvio));
+    int codificar = (ses->comprimir || ses->delta);
+    size_t por_slot = (size_t)ses->bloque * (!origen.mapeado + codificar);
+    char* buffers = malloc(ventana * por_slot + 1);
+    if (!slots || !buffers) {
+        perror("Error en calloc()");
+        free(slots);
+        free(buffers);
+        origen_cerrar(&origen);
+        return -1;
+    }
+    for (int i = 0; i < ventana; i++) {
+        char* propios = buffers + i * por_slot;
+        slots[i].lectura = origen.mapeado ? NULL : propios;
+        slots[i].codificado = codificar ? propios + (origen.mapeado ? 0 : ses->bloque) : NULL;
+    }
+
+    Traza traza;
+    if (traza_abrir(&traza, ses->traza) != 0) {
+        free(slots);
+        free(buffers);
+        origen_cerrar(&origen);
+        return -1;
+    }
+    FecEmisor fec;
+    memset(&fec, 0, sizeof(fec));
+    if (ses->fec_k && fec_emisor_init(&fec, ses->fec_k, ses->fec_m, ses->bloque) != 0) {
+        perror("Error en calloc()");
+        goto error;
+    }
+    int datagrama = V2_HEADER_SIZE + ses->bloque;
+    cc_init(&ses->cc, ses->algoritmo_cc, ventana);
+    pacer_init(&ses->pacer);
+
+    uint32_t base = 0;       // PDU más viejo sin confirmar
+    uint32_t next_seq = 0;   // próximo seq a enviar
+    uint32_t mayor = base - 1;   // seq más alto confirmado
+    int eof = 0;
+    LoteGSO lote;
+    lote.n = 0;
+    long long bytes_totales = 0;
+    uint64_t inicio = get_monotonic_us();
+
+    struct pollfd pfd;
+    pfd.fd = ses->socket;
+    pfd.events = POLLIN;
+
+    uint64_t wrq_vence = 0;
+    int wrq_intentos = 0;
+    if (ses->wrq) {
+        if (send(ses->socket, ses->wrq, ses->wrq_len, 0) < 0) {
+            perror("Error en send()");
+            goto error;
+        }
+        wrq_vence = get_monotonic_us() + ses->rtt.rto_us;
+    }
+
+    while (!eof || base != next_seq || ses->wrq) {
+        double tasa = cc_tasa(&ses->cc, ses->rtt.con_muestras ? ses->rtt.srtt_us : 0, datagrama);
+        pacer_tasa(&ses->pacer, tasa, datagrama);
+
+        // llenar la ventana con PDUs nuevos, mientras lo permitan cwnd y el pacer
+        uint64_t espera_pacing = 0;
+        while (!eof && next_seq - base < cc_ventana(&ses->cc) && !(ses->wrq && next_seq > 0)) {
+            espera_pacing = pacer_espera_us(&ses->pacer, datagrama, get_monotonic_us());
+            if (espera_pacing > 0) {
+                ses->pacer.esperas++;
+                break;
+            }
+            int indice = next_seq % ventana;
+            SlotEnvio* slot = &slots[indice];
+
+            // el slot quedó libre por ACK, pero con MSG_ZEROCOPY el kernel puede
+            // seguir leyendo su header (y su payload) de algún envío anterior
+            if (zc_esperar(&ses->zc, ses->socket, indice) != 0) {
+                goto error;
+            }
+
+            int bytes_leidos = origen_leer(&origen, slot->lectura, ses->bloque, &slot->payload);
+            if (bytes_leidos == 0) {
+                eof = 1;
+                break;
+            }
+
+            uint8_t flags = 0;
+            if ((slot->len = delta_bloque(ses, desde + (uint64_t)next_seq * ses->bloque, slot->payload,
+                                          bytes_leidos, slot->codificado)) > 0) {
+                flags = V2_DELTA;
+            } else if ((slot->len = comprimir_bloque(ses, slot->payload, bytes_leidos, slot->codificado)) > 0) {
+                flags = V2_COMPRIMIDO;
+            }
+            if (slot->len > 0) {
+                slot->payload = slot->codificado;
+            } else {
+                slot->len = bytes_leidos;
+            }
+            v2_sellar_flags(&slot->pdu, DATA, flags | (ses->wrq ? V2_TEMPRANO : 0), ses->sesion, next_seq,
+                            slot->payload, slot->len);
+            slot->intentos = 0;
+            slot->confirmado = 0;
+
+            if (ses->gso) {
+                int res = gso_agregar(&lote, &slot->pdu, V2_HEADER_SIZE, slot->payload, slot->len, indice);
+                if (res < 0) {
+                    if (enviar_lote(ses, &lote, ventana) < 0) {
+                        perror("Error en send()");
+                        goto error;
+                    }
+                    res = gso_agregar(&lote, &slot->pdu, V2_HEADER_SIZE, slot->payload, slot->len, indice);
+                }
+                if (res > 0 && enviar_lote(ses, &lote, ventana) < 0) {
+                    perror("Error en send()");
+                    goto error;
+                }
+            } else if (enviar(ses, &slot->pdu, V2_HEADER_SIZE, slot->payload, slot->len, indice) < 0) {
+                perror("Error en send()");
+                goto error;
+            }
+            slot->enviado_us = get_monotonic_us();
+            slot->vence_us = slot->enviado_us + ses->rtt.rto_us;
+            pacer_consumir(&ses->pacer, V2_HEADER_SIZE + slot->len);
+            bytes_totales += bytes_leidos;
+
+            // grupo completo: sus PARIDAD van detrás de los DATA que cubren
+            if (fec.filas && fec_emisor_agregar(&fec, next_seq, flags, slot->payload, slot->len)) {
+                if (lote.n > 0 && enviar_lote(ses, &lote, ventana) < 0) {
+                    perror("Error en send()");
+                    goto error;
+                }
+                if (enviar_paridades(ses, &fec, next_seq / fec.k) < 0) {
+                    perror("Error en send()");
+                    goto error;
+                }
+            }
+            next_seq++;
+            slot->siguiente = next_seq;
+            ses->cc.next_seq = next_seq;
+        }
+        if (lote.n > 0 && enviar_lote(ses, &lote, ventana) < 0) {
+            perror("Error en send()");
+            goto error;
+        }
+        // el último grupo queda incompleto: la paridad dice cuántos DATA tiene
+        if (eof && fec.filas && fec.n > 0 && fec.n < fec.k) {
+            if (enviar_paridades(ses, &fec, (next_seq - 1) / fec.k) < 0) {
+                perror("Error en send()");
+                goto error;
+            }
+            fec.n = 0;
+        }
+
+        if (base == next_seq && espera_pacing == 0 && !ses->wrq) {
+            continue;
+        }
+
+        // esperar hasta el vencimiento más próximo de los PDUs sin confirmar o
+        // hasta que el pacer deje salir el siguiente, lo que llegue antes
+        uint64_t ahora = get_monotonic_us();
+        uint64_t proximo = (espera_pacing > 0) ? ahora + espera_pacing : UINT64_MAX;
+        if (ses->wrq && wrq_vence < proximo) {
+            proximo = wrq_vence;
+        }
+        for (uint32_t seq = base; seq != next_seq; seq++) {
+            SlotEnvio* slot = &slots[seq % ventana];
+            if (!slot->confirmado && slot->vence_us < proximo) {
+                proximo = slot->vence_us;
+            }
+        }
+
+        int poll_res = poll_us(&pfd, 1, (proximo > ahora) ? proximo - ahora : 0);
+        if (poll_res < 0) {
+            perror("Error en ppoll()");
+            goto error;
+        }
+        if ((pfd.revents & POLLERR) && zc_procesar(&ses->zc, ses->socket) < 0) {
+            perror("Error en el socket del servidor");
+            goto error;
+        }
+        if (pfd.revents & (POLLHUP | POLLNVAL)) {
+            LOG(LOG_ERROR, "Error en el socket del servidor\n");
+            goto error;
+        }
+        if ((pfd.revents & POLLIN) && procesar_acks_ventana(ses, slots, ventana, base, next_seq, &mayor) != 0) {
+            rechazado = (ses->wrq != NULL);
+            goto error;
+        }
+        if (pfd.revents & POLLIN) {
+            traza_anotar(&traza, "ack", &ses->cc, next_seq - base, ses->rtt.srtt_us, tasa);
+        }
+
+        // deslizar la ventana sobre los PDUs confirmados en orden
+        while (base != next_seq && slots[base % ventana].confirmado) {
+            base++;
+        }
+
+        // reenviar ya los huecos: PDUs con SACK_UMBRAL posteriores confirmados y
+        // más de un RTT (con margen para reordenamientos) desde su envío
+        ahora = get_monotonic_us();
+        uint64_t reorden_us = ses->rtt.srtt_us + ses->rtt.srtt_us / 4;
+        for (uint32_t seq = base; seq != next_seq && (int32_t)(mayor - seq) >= SACK_UMBRAL; seq++) {
+            SlotEnvio* slot = &slots[seq % ventana];
+            if (slot->confirmado || (int32_t)(mayor - slot->siguiente) < SACK_UMBRAL - 1 ||
+                ahora - slot->enviado_us < reorden_us) {
+                continue;
+            }
+            cc_perdida(&ses->cc, seq, 0);
+            traza_anotar(&traza, "sack", &ses->cc, next_seq - base, ses->rtt.srtt_us, tasa);
+            if (++slot->intentos >= MAX_RETRIES) {
+                LOG(LOG_ERROR, "FALLO: seq=%u sin ACK después de %d intentos\n", seq, MAX_RETRIES);
+                goto error;
+            }
+            LOG(LOG_DETALLE, "HUECO seq=%u - Reintento %d/%d sin esperar el timer\n", seq, slot->intentos, MAX_RETRIES);
+            if (enviar(ses, &slot->pdu, V2_HEADER_SIZE, slot->payload, slot->len, seq % ventana) < 0) {
+                perror("Error en send()");
+                goto error;
+            }
+            slot->enviado_us = ahora;
+            slot->vence_us = ahora + ses->rtt.rto_us;
+            slot->siguiente = next_seq;
+            pacer_consumir(&ses->pacer, V2_HEADER_SIZE + slot->len);
+            ses->retransmisiones++;
+            ses->rapidas++;
+        }
+
+        // retransmitir los PDUs cuyo timer venció. El backoff se aplica una vez
+        // por ronda de vencimientos, no una vez por cada PDU perdido de la misma ráfaga
+        ahora = get_monotonic_us();
+        int hubo_timeout = 0;
+        for (uint32_t seq = base; seq != next_seq; seq++) {
+            SlotEnvio* slot = &slots[seq % ventana];
+            if (slot->confirmado || ahora < slot->vence_us) {
+                continue;
+            }
+            if (!hubo_timeout) {
+                rtt_backoff(&ses->rtt);
+                hubo_timeout = 1;
+            }
+            cc_perdida(&ses->cc, seq, slot->intentos > 0);
+            traza_anotar(&traza, (slot->intentos > 0) ? "timeout" : "perdida", &ses->cc,
+                         next_seq - base, ses->rtt.srtt_us, tasa);
+            if (++slot->intentos >= MAX_RETRIES) {
+                LOG(LOG_ERROR, "FALLO: seq=%u sin ACK después de %d intentos\n", seq, MAX_RETRIES);
+                goto error;
+            }
+            LOG(LOG_AVISO, "TIMEOUT seq=%u - Reintento %d/%d (RTO=%d ms)\n",
+                    seq, slot->intentos, MAX_RETRIES, rtt_rto_ms(&ses->rtt));
+            if (enviar(ses, &slot->pdu, V2_HEADER_SIZE, slot->payload, slot->len, seq % ventana) < 0) {
+                perror("Error en send()");
+                goto error;
+            }
+            slot->enviado_us = ahora;
+            slot->vence_us = ahora + ses->rtt.rto_us;
+            slot->siguiente = next_seq;
+            pacer_consumir(&ses->pacer, V2_HEADER_SIZE + slot->len);
+            ses->retransmisiones++;
+        }
+        if (ses->wrq && ahora >= wrq_vence) {
+            if (!hubo_timeout) {
+                rtt_backoff(&ses->rtt);
+            }
+            if (++wrq_intentos >= MAX_RETRIES) {
+                LOG(LOG_ERROR, "FALLO: WRQ sin ACK después de %d intentos\n", MAX_RETRIES);
+                goto error;
+            }
+            LOG(LOG_AVISO, "TIMEOUT WRQ - Reintento %d/%d (RTO=%d ms)\n", wrq_intentos, MAX_RETRIES, rtt_rto_ms(&ses->rtt));
+            if (send(ses->socket, ses->wrq, ses->wrq_len, 0) < 0) {
+                perror("Error en send()");
+                goto error;
+            }
+            wrq_vence = ahora + ses->rtt.rto_us;
+            ses->retransmisiones++;
+        }
+    }
+
+    // el mapa no se puede soltar mientras el kernel tenga envíos sin terminar
+    zc_esperar(&ses->zc, ses->socket, -1);
+    traza_anotar(&traza, "fin", &ses->cc, 0, ses->rtt.srtt_us, ses->pacer.tasa * 1e6);
+    traza_cerrar(&traza);
+    uint32_t digest = origen.digest;
+    origen_cerrar(&origen);
+    free(slots);
+    free(buffers);
+    ses->paridades = fec.paridades;
+    fec_emisor_free(&fec);
+
+    double segundos = (get_monotonic_us() - inicio) / 1e6;
+    LOG(LOG_INFO, "\nTransferencia completada: %u paquetes, %lld bytes, %d retransmisiones\n",
+            next_seq, bytes_totales, ses->retransmisiones);
+    if (segundos > 0) {
+        LOG(LOG_INFO, "Tiempo: %.3f s (%.1f KB/s)\n", segundos, bytes_totales / 1024.0 / segundos);
+    }
+
+    LOG(LOG_INFO, "\n===== FASE 4: FIN =====\n");
+    LOG(LOG_INFO, "Digest: %08x\n", digest);
+    PDU_v2 fin;
+    int total = v2_sellar(&fin, FIN, ses->sesion, next_seq, fin_con_digest(fin.data, V2_DATA_SIZE, digest));
+    return send_and_wait_v2(ses, &fin, total, NULL, 0);
+
+error:
+    zc_esperar(&ses->zc, ses->socket, -1);
+    traza_cerrar(&traza);
+    origen_cerrar(&origen);
+    free(slots);
+    free(buffers);
+    fec_emisor_free(&fec);
+    return rechazado ? -2 : -1;
+}
+
+
+// ACK v2 de la descarga: solo el header, o un mensaje de error que corta la descarga
+int enviar_ack_v2(Sesion* ses, uint32_t seq, const char* error) {
+    PDU_v2 ack;
+    int len = error ? strlen(error) : 0;
+    memcpy(ack.data, error ? error : "", len);
+    return send(ses->socket, &ack, v2_sellar(&ack, ACK, ses->sesion, seq, len), 0);
+}
+
+
+// recibe los DATA de una descarga de tamano bytes hasta su FIN y los deja en
+// fd, cada uno con pwrite en su offset, o en memoria si no es NULL. Devuelve 0
+// con el FIN confirmado (el digest coincide); *fin = cuándo llegó. Con
+// despedida se queda un rato re-ACKeando el FIN por si el servidor no recibió
+// el ACK; sin ella vuelve enseguida (firmas de una subida delta: al servidor
+// le alcanza con el primer DATA de la subida)
+int recibir_descarga(Sesion* ses, uint16_t bloque, uint16_t ventana, uint64_t tamano, int fd, char* memoria,
+                     int despedida, int* duplicados, uint64_t* fin) {
+    uint32_t total = (tamano + bloque - 1) / bloque;
+    Reensamblado reasm;
+    char* buf = malloc(V2_HEADER_SIZE + bloque);
+    if (reensamblado_init(&reasm, ventana, bloque) != 0 || !buf) {
+        perror("Error en calloc()");
+        reensamblado_free(&reasm);
+        free(buf);
+        return -1;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = ses->socket;
+    pfd.events = POLLIN;
+    int resultado = -1;
+    int fin_confirmado = 0;
+
+    // hasta confirmar el FIN espera INACTIVIDAD_MS; después, 2 RTO sin FIN repetidos
+    while (1) {
+        int espera = fin_confirmado ? 2 * rtt_rto_ms(&ses->rtt) : INACTIVIDAD_MS;
+        int poll_res = poll(&pfd, 1, espera);
+        if (poll_res < 0) {
+            perror("Error en poll()");
+            break;
+        }
+        if (poll_res == 0) {
+            if (fin_confirmado) {
+                resultado = 0;
+            } else {
+                LOG(LOG_ERROR, "FALLO: %d s sin noticias del servidor\n", INACTIVIDAD_MS / 1000);
+            }
+            break;
+        }
+
+        int received = recv(ses->socket, buf, V2_HEADER_SIZE + bloque, 0);
+        if (received < 0) {
+            perror("Error en recv()");
+            break;
+        }
+        PDU_v2* rx = (PDU_v2*)buf;
+        int len = v2_verificar(rx, received);
+        if (len < 0 || ntohl(rx->sesion) != ses->sesion) {
+            continue;
+        }
+        uint32_t seq = ntohl(rx->seq);
+
+        if (rx->type == DATA && !fin_confirmado) {
+            // todos los bloques llenos salvo el último
+            uint64_t esperado = (seq + 1 == total) ? tamano - (uint64_t)seq * bloque : bloque;
+            if (seq >= total || (uint64_t)len != esperado) {
+                LOG(LOG_AVISO, "DATA seq=%u de %d bytes inesperado - descartando\n", seq, len);
+                continue;
+            }
+            int res = reensamblado_recibir(&reasm, seq);
+            if (res < 0) {
+                continue;
+            }
+            if (res == 1) {
+                if (memoria) {
+                    memcpy(memoria + (uint64_t)seq * bloque, rx->data, len);
+                } else if (pwrite(fd, rx->data, len, (off_t)seq * bloque) != len) {
+                    perror("Error en pwrite()");
+                    enviar_ack_v2(ses, seq, "Error escribiendo archivo");
+                    break;
+                }
+                reensamblado_anotar(&reasm, seq, rx->data, len);
+                reensamblado_completar(&reasm, seq);
+            } else {
+                (*duplicados)++;
+            }
+            enviar_ack_v2(ses, seq, NULL);
+
+        } else if (rx->type == FIN && seq == total && reasm.base == total) {
+            uint32_t digest;
+            if (!fin_confirmado && fin_digest(rx->data, len, &digest) && digest != reasm.digest) {
+                LOG(LOG_ERROR, "Digest no coincide (servidor %08x, recibido %08x)\n", digest, reasm.digest);
+                enviar_ack_v2(ses, seq, "Digest del archivo incorrecto");
+                break;
+            }
+            if (!fin_confirmado) {
+                *fin = get_monotonic_us();
+                LOG(LOG_INFO, "%sDigest %08x verificado\n", despedida ? "\n===== FASE 4: FIN =====\n" : "",
+                       reasm.digest);
+            }
+            enviar_ack_v2(ses, seq, NULL);
+            fin_confirmado = 1;
+            if (!despedida) {
+                resultado = 0;
+                break;
+            }
+        }
+    }
+    reensamblado_free(&reasm);
+    free(buf);
+    return resultado;
+}
+
+
+// FASE 2b de una subida delta: las firmas del archivo que ya tiene el servidor
+// llegan como una descarga detrás del ACK del WRQ. Se buscan sus bloques en el
+// archivo local; lo que esté viaja como referencia al archivo viejo (delta.h)
+int fase_firmas(Sesion* ses, const char* local_file, uint16_t ventana, Delta* delta) {
+    LOG(LOG_INFO, "\n===== FASE 2b: FIRMAS (delta) =====\n");
+
+    uint64_t largo = (delta->tam_viejo + delta->bloque - 1) / delta->bloque * DELTA_FIRMA;
+    char* firmas = malloc(largo);
+    if (!firmas) {
+        perror("Error en malloc()");
+        return -1;
+    }
+    agrandar_buffer_rx(ses->socket);
+    int duplicados = 0;
+    uint64_t fin;
+    if (recibir_descarga(ses, ses->bloque, ventana, largo, -1, firmas, 0, &duplicados, &fin) != 0) {
+        free(firmas);
+        return -1;
+    }
+
+    int fd = open(local_file, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Error en open()");
+        if (fd >= 0) {
+            close(fd);
+        }
+        free(firmas);
+        return -1;
+    }
+    const char* mapa = NULL;
+    if (st.st_size > 0) {
+        void* m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        mapa = (m == MAP_FAILED) ? NULL : m;
+    }
+    close(fd);
+    if (st.st_size > 0 && !mapa) {
+        perror("Error en mmap()");
+        free(firmas);
+        return -1;
+    }
+
+    uint64_t inicio = get_monotonic_us();
+    int res = delta_buscar(delta, mapa, st.st_size, firmas);
+    if (res != 0) {
+        perror("Error en malloc()");
+    } else {
+        LOG(LOG_INFO, "Firmas: %llu bytes, %llu de %llu bytes locales ya están en el servidor (%zu tramos, %.3f s)\n",
+               (unsigned long long)largo, (unsigned long long)delta->coincidentes, (unsigned long long)st.st_size,
+               delta->n, (get_monotonic_us() - inicio) / 1e6);
+    }
+    if (mapa) {
+        munmap((void*)mapa, st.st_size);
+    }
+    free(firmas);
+    return res;
+}
+
+
+// descarga (v2): RRQ con el bloque que confirmó el sondeo (se asume el camino
+// simétrico) y que entra en el buffer de recepción con la ventana en vuelo.
+// El ACK trae el tamaño y detrás el servidor manda los DATA, hasta `ventana`
+// en vuelo: cada uno se escribe en su offset y se confirma con un ACK de su
+// seq, y los repetidos se vuelven a confirmar (el ACK anterior se perdió).
+// El FIN trae el digest del archivo, que se compara con el de lo recibido
+// antes de confirmarlo. Después se espera un rato re-ACKeando el FIN por si
+// el servidor no recibió el ACK. Se escribe en un temporal al lado del
+// archivo local, que recién con el digest verificado lo reemplaza: una
+// descarga fallida no pisa lo que ya había
+int fase_descarga(Sesion* ses, const char* remote_name, const char* local_file, uint16_t ventana) {
+    LOG(LOG_INFO, "\n===== FASE 2: RRQ (v2) =====\n");
+
+    uint16_t bloque = bloque_aceptado(ses->bloque, ses->bloque, agrandar_buffer_rx(ses->socket), ventana);
+    PDU_v2 pdu;
+    memset(&pdu, 0, sizeof(PDU_v2));
+    strncpy(pdu.data, remote_name, V2_DATA_SIZE - 1);
+    int data_size = strlen(pdu.data) + 1;
+    if (bloque != V2_DATA_SIZE) {
+        uint16_t b = htons(bloque);
+        data_size = opt_agregar(pdu.data, data_size, V2_DATA_SIZE, OPT_BLOQUE, &b, 2);
+    }
+
+    PDU_v2 ack;
+    int total_rrq = v2_sellar(&pdu, RRQ, ses->sesion, V2_SEQ_WRQ, data_size);
+    if (send_and_wait_v2(ses, &pdu, total_rrq, &ack, 0) != 0) {
+        return -1;
+    }
+    const uint8_t* t = opt_buscar(ack.data + 1, (int)ntohs(ack.len) - 1, OPT_TAMANO, 8);
+    if (!t) {
+        fprintf(stderr, "El ACK del RRQ no trae el tamaño del archivo\n");
+        return -1;
+    }
+    uint64_t tamano;
+    memcpy(&tamano, t, 8);
+    tamano = be64toh(tamano);
+    uint32_t total = (tamano + bloque - 1) / bloque;
+    LOG(LOG_INFO, "Archivo remoto: %llu bytes en %u paquetes de %u\n", (unsigned long long)tamano, total, bloque);
+
+    LOG(LOG_INFO, "\n===== FASE 3: DATA (ventana=%d) =====\n", ventana);
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", local_file, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("Error en open()");
+        return -1;
+    }
+    if (ftruncate(fd, tamano) < 0) {
+        perror("Error en ftruncate()");
+    }
+
+    int duplicados = 0;
+    uint64_t inicio = get_monotonic_us();
+    uint64_t fin = 0;
+    int resultado = recibir_descarga(ses, bloque, ventana, tamano, fd, NULL, 1, &duplicados, &fin);
+
+    if (close(fd) < 0) {
+        perror("Error en close()");
+        resultado = -1;
+    }
+    if (resultado == 0 && rename(tmp, local_file) < 0) {
+        perror("Error en rename()");
+        resultado = -1;
+    }
+    if (resultado != 0) {
+        unlink(tmp);
+    }
+    double segundos = (fin - inicio) / 1e6;
+    if (resultado == 0) {
+        LOG(LOG_INFO, "\nDescarga completada: %u paquetes, %llu bytes, %d duplicados\n",
+                total, (unsigned long long)tamano, duplicados);
+        if (segundos > 0) {
+            LOG(LOG_INFO, "Tiempo: %.3f s (%.1f KB/s)\n", segundos, tamano / 1024.0 / segundos);
+        }
+    }
+    return resultado;
+}
+
+
+// socket UDP conectado al servidor, -1 si falla
+int conectar(const char* server_ip, const char* server_port) {
+    struct addrinfo hints, *servinfo;
+    
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    
+    int status = getaddrinfo(server_ip, server_port, &hints, &servinfo);
+    if (status != 0) {
+        fprintf(stderr, "Error en getaddrinfo(): %s\n", gai_strerror(status));
+        return -1;
+    }
+    
+    int s = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+    if (s < 0) {
+        perror("Error en socket()");
+        freeaddrinfo(servinfo);
+        return -1;
+    }
+    
+    if (connect(s, servinfo->ai_addr, servinfo->ai_addrlen) < 0) {
+        perror("Error en connect()");
+        close(s);
+        freeaddrinfo(servinfo);
+        return -1;
+    }
+    
+    LOG(LOG_INFO, "Conectado al servidor\n");
+    freeaddrinfo(servinfo);
+    return s;
+}
+
+
+// lo que sigue al HELLO (o al ticket) en toda sesión: MSG_ZEROCOPY y GSO
+void preparar_envios(Sesion* ses, int s, int zerocopy, int gso, uint16_t ventana) {
+    // un slot de MSG_ZEROCOPY por PDU que puede estar en vuelo
+    if (zerocopy && zc_init(&ses->zc, s, ses->v2 ? ventana : 1) != 0) {
+        fprintf(stderr, "MSG_ZEROCOPY no disponible, se sigue con -z\n");
+        zc_free(&ses->zc);
+    }
+
+    // los lotes solo se forman con varios PDUs en vuelo
+    if (gso && ses->v2 && ventana > 1) {
+        ses->gso = (gso_disponible(s) == 0);
+        if (!ses->gso) {
+            fprintf(stderr, "UDP_SEGMENT no disponible, se envía de a un PDU\n");
+        }
+    }
+}
+
+
+// HELLO sobre un socket ya conectado (y sondeo del bloque v2, hasta
+// max_datagrama, si sondear). *ventana entra con la pedida y sale con la
+// aceptada. pedir_ticket, wrq y wrq_len como en fase_hello: un WRQ que va en
+// el HELLO se armó con V2_DATA_SIZE, así que con él no se sondea
+int iniciar_sesion(Sesion* ses, int s, int pedir_v2, int mapear, int zerocopy, int comprimir, int gso,
+                   int max_datagrama, const uint8_t* fec, int sondear, int pedir_ticket,
+                   const char* wrq, int wrq_len, uint16_t* ventana) {
+    memset(ses, 0, sizeof(Sesion));
+    ses->socket = s;
+    ses->mapear = mapear;
+    ses->bloque = V2_DATA_SIZE;
+    rtt_init(&ses->rtt);
+
+    if (fase_hello(ses, "g23-889d", pedir_v2, comprimir, max_datagrama, fec, pedir_ticket,
+                   wrq, wrq_len, ventana) != 0) {
+        fprintf(stderr, "Fallo en FASE 1 (HELLO)\n");
+        return -1;
+    }
+    if (sondear && ses->v2 && ses->bloque_max > 0) {
+        sondear_bloque(ses, max_datagrama);
+    }
+
+    // la PARIDAD lleva FEC_CABECERA bytes más que un DATA: tiene que entrar en
+    // el datagrama sondeado (o en el tamaño fijo)
+    if (ses->fec_k && ses->bloque - FEC_CABECERA >= V2_BLOQUE_MIN) {
+        ses->bloque -= FEC_CABECERA;
+    } else {
+        ses->fec_k = 0;
+    }
+
+    preparar_envios(ses, s, zerocopy, gso, *ventana);
+    return 0;
+}
+
+
+// lo que un cliente -k guarda de un HELLO con ticket: lo negociado, el bloque
+// y el ticket. Solo se usa con el mismo servidor y las mismas opciones
+// pedidas; vence (hora del cliente) es una cota, el servidor decide con la suya
+#define TICKET_FORMATO 1
+
+typedef struct {
+    uint32_t formato;
+    char servidor[64];       // "ip:puerto"
+    int32_t pedido[5];       // -w, -m, -c, k y m de -F (0 = sin FEC)
+    int64_t vence;
+    uint32_t sesion;         // la del HELLO: su byte bajo es el worker
+    uint16_t ventana;
+    uint8_t comprimir;
+    uint8_t sack;
+    uint8_t fec_k;
+    uint8_t fec_m;
+    uint8_t sondeado;        // bloque sale del sondeo (o no había nada que sondear)
+    int32_t bloque;
+    int32_t bloque_max;
+    uint8_t ticket[TICKET_LARGO];
+} TicketGuardado;
+
+
+int ticket_cargar(const char* ruta, const char* servidor, const int32_t pedido[5], TicketGuardado* g) {
+    FILE* f = fopen(ruta, "rb");
+    if (!f) {
+        return -1;
+    }
+    int leido = fread(g, sizeof(TicketGuardado), 1, f);
+    fclose(f);
+    if (leido != 1 || g->formato != TICKET_FORMATO || strncmp(g->servidor, servidor, sizeof(g->servidor)) != 0 ||
+        memcmp(g->pedido, pedido, sizeof(g->pedido)) != 0 || g->vence <= time(NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+
+// se escribe aparte y se renombra: dos clientes a la vez no dejan un archivo a medias
+int ticket_guardar(const char* ruta, const TicketGuardado* g) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%d", ruta, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("Error en open() del ticket");
+        return -1;
+    }
+    int ok = (write(fd, g, sizeof(TicketGuardado)) == (ssize_t)sizeof(TicketGuardado));
+    if (close(fd) != 0 || !ok || rename(tmp, ruta) != 0) {
+        perror("Error al guardar el ticket");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+
+// sesión v2 sin HELLO, con lo que dejó guardado uno anterior: el id lo elige
+// el cliente, con el byte bajo (el worker que emitió el ticket) del de aquella
+// sesión. Nada va por la red hasta el WRQ, que lleva el ticket
+void retomar_sesion(Sesion* ses, int s, const TicketGuardado* g, int mapear, int zerocopy, int gso,
+                    uint16_t* ventana) {
+    memset(ses, 0, sizeof(Sesion));
+    ses->socket = s;
+    ses->mapear = mapear;
+    rtt_init(&ses->rtt);
+
+    uint32_t azar;
+    if (getrandom(&azar, sizeof(azar), 0) != sizeof(azar)) {
+        azar = (uint32_t)get_monotonic_us() ^ (uint32_t)getpid();
+    }
+    ses->v2 = 1;
+    ses->sesion = (azar << 8) | (g->sesion & 0xFF);
+    if (ses->sesion == 0) {
+        ses->sesion = 1 << 8;
+    }
+    ses->bloque = g->bloque;
+    ses->bloque_max = g->bloque_max;
+    ses->comprimir = g->comprimir;
+    ses->sack = g->sack;
+    ses->fec_k = g->fec_k;
+    ses->fec_m = g->fec_m;
+    ses->sin_hello = 1;
+    memcpy(ses->ticket, g->ticket, TICKET_LARGO);
+    *ventana = g->ventana;
+
+    LOG(LOG_INFO, "\n===== FASE 1: ticket (sin HELLO) =====\n");
+    LOG(LOG_INFO, "Sesión %08x con el ticket guardado, %d PDUs en vuelo\n", ses->sesion, *ventana);
+    preparar_envios(ses, s, zerocopy, gso, *ventana);
+}
+
+
+// el servidor rechazó el WRQ de una sesión sin HELLO. Si el id que se eligió
+// ya era de otra sesión se prueba con otro (hasta TICKET_REINTENTOS veces);
+// si el ticket no sirve se vuelve al HELLO. Devuelve 1 para seguir con el ticket
+int ticket_reintentar(Sesion* ses, int* intentos) {
+    zc_free(&ses->zc);
+    if (strcmp(ses->rechazo, TICKET_ID_EN_USO) == 0 && ++*intentos < TICKET_REINTENTOS) {
+        LOG(LOG_AVISO, "Id de sesión %08x en uso: se prueba con otro\n", ses->sesion);
+        return 1;
+    }
+    LOG(LOG_AVISO, "El servidor rechazó el WRQ con ticket: sesión nueva con HELLO\n");
+    return 0;
+}
+
+
+// el reporte va con printf: antes se escribe lo que quedó en el log
+void reporte_sesion(Sesion* ses) {
+    log_vaciar();
+    rtt_reporte(&ses->rtt);
+    printf("Retransmisiones: %d\n", ses->retransmisiones);
+    if (ses->rapidas > 0) {
+        printf("Reenviados por huecos (sin esperar el timer): %llu\n", (unsigned long long)ses->rapidas);
+    }
+    if (ses->v2 && ses->bloque != V2_DATA_SIZE) {
+        printf("Bloque: %d bytes por DATA\n", ses->bloque);
+    }
+    if (ses->cc.algoritmo) {
+        printf("Congestión (%s): cwnd final %.1f de %u, ssthresh %.1f, %llu reducciones, %llu timeouts\n",
+                ses->cc.algoritmo->nombre, ses->cc.cwnd, ses->cc.maximo, ses->cc.ssthresh,
+                (unsigned long long)ses->cc.reducciones, (unsigned long long)ses->cc.timeouts);
+        if (ses->pacer.tasa > 0) {
+            printf("Pacing: %.1f MB/s al final, %llu esperas\n", ses->pacer.tasa * 1e6 / 1048576,
+                    (unsigned long long)ses->pacer.esperas);
+        }
+    }
+    if (ses->fec_k) {
+        printf("FEC: %llu paridades (%d cada %d DATA)\n", (unsigned long long)ses->paridades,
+                ses->fec_m, ses->fec_k);
+    }
+    if (ses->zc.activo) {
+        printf("MSG_ZEROCOPY: %llu envíos, %llu copiados igual por el kernel%s\n",
+                (unsigned long long)ses->zc.envios, (unsigned long long)ses->zc.copiados,
+                ses->zc.copiando ? " (se siguió copiando)" : "");
+    }
+    if (ses->envios_gso > 0) {
+        printf("GSO: %llu PDUs en %llu envíos (%.1f por envío)\n",
+                (unsigned long long)ses->pdus_gso, (unsigned long long)ses->envios_gso,
+                (double)ses->pdus_gso / ses->envios_gso);
+    }
+    if (ses->delta && ses->bloques_delta > 0) {
+        printf("Delta: %llu bytes ya estaban en el servidor; %u bloques con receta, %llu bytes en %llu (%.1fx)\n",
+                (unsigned long long)ses->delta->coincidentes, ses->bloques_delta,
+                (unsigned long long)ses->delta_datos, (unsigned long long)ses->delta_cable,
+                (double)ses->delta_datos / ses->delta_cable);
+    } else if (ses->delta) {
+        printf("Delta: nada del archivo previo (%llu bytes) sirvió, se subió entero\n",
+                (unsigned long long)ses->delta->tam_viejo);
+    }
+    if (ses->sin_hello) {
+        printf("Handshake: ninguno, ticket de una sesión anterior\n");
+    }
+    if (ses->comprimir && ses->bytes_datos > 0) {
+        printf("Compresión: %u bloques comprimidos, %llu bytes del archivo en %llu (%.2fx)\n",
+                ses->bloques_comprimidos, (unsigned long long)ses->bytes_datos,
+                (unsigned long long)ses->bytes_cable, (double)ses->bytes_datos / ses->bytes_cable);
+    }
+    printf("\n");
+}
+
+
+// una sesión de una subida en paralelo (-P): su propio socket (otro puerto
+// de origen, otro flujo para la red), su propio RTT y su propia ventana
+typedef struct {
+    Sesion ses;
+    int lista;               // el HELLO ya se hizo (la primera sesión es la del main)
+    pthread_t hilo;
+    const char* server_ip;
+    const char* server_port;
+    const char* local_file;
+    const char* remote_name;
+    uint16_t ventana;
+    int zerocopy;
+    int gso;
+    int max_datagrama;       // el que confirmó la primera sesión: es el mismo camino
+    uint64_t tamano;         // del archivo entero
+    OptRango rango;          // tal como va en el WRQ (network order)
+    uint64_t desde;
+    uint64_t largo;
+    char traza[PATH_MAX];    // -T archivo.N, una traza por rango
+    uint8_t fec[2];          // k y m que aceptó la primera sesión (0 = sin FEC)
+    int resultado;
+} Stream;
+
+
+void* hilo_stream(void* arg) {
+    Stream* st = arg;
+    st->resultado = -1;
+
+    if (!st->lista) {
+        int s = conectar(st->server_ip, st->server_port);
+        if (s < 0) {
+            return NULL;
+        }
+        const AlgoritmoCC* algoritmo_cc = st->ses.algoritmo_cc;
+        if (iniciar_sesion(&st->ses, s, 1, st->ses.mapear, st->zerocopy, st->ses.comprimir, st->gso,
+                           st->max_datagrama, st->fec[0] ? st->fec : NULL, 1, 0, NULL, 0, &st->ventana) != 0) {
+            close(s);
+            return NULL;
+        }
+        st->ses.algoritmo_cc = algoritmo_cc;
+        st->ses.traza = st->traza[0] ? st->traza : NULL;
+        if (!st->ses.v2) {
+            fprintf(stderr, "El servidor no aceptó v2 en la sesión %u\n", ntohs(st->rango.indice));
+            close(s);
+            return NULL;
+        }
+    }
+
+    uint64_t desde;
+    if (fase_wrq_v2(&st->ses, st->remote_name, st->tamano, &st->rango, 0, &desde, NULL) != 0) {
+        fprintf(stderr, "Fallo en FASE 2 (WRQ) del rango %u\n", ntohs(st->rango.indice));
+    } else if (fase_data_ventana(&st->ses, st->local_file, st->ventana, st->desde, st->largo, 0) != 0) {
+        fprintf(stderr, "Fallo en FASE 3/4 (DATA + FIN) del rango %u\n", ntohs(st->rango.indice));
+    } else {
+        st->resultado = 0;
+    }
+    close(st->ses.socket);
+    return NULL;
+}
+
+
+// parte el archivo en n rangos de bloques enteros (del bloque de la primera
+// sesión) y los sube a la vez, un hilo por rango. `primera` es la sesión ya
+// abierta por el main: la usa el rango 0
+int subida_paralela(Sesion* primera, uint16_t ventana, int n, int zerocopy,
+                    const char* server_ip, const char* server_port,
+                    const char* local_file, const char* remote_name, uint64_t tamano) {
+    uint64_t bloque = primera->bloque;
+    uint64_t bloques = (tamano + bloque - 1) / bloque;
+    if ((uint64_t)n > bloques) {
+        n = bloques;
+    }
+
+    Stream* streams = calloc(n, sizeof(Stream));
+    if (!streams) {
+        perror("Error en calloc()");
+        return -1;
+    }
+
+    uint32_t grupo;
+    if (getrandom(&grupo, sizeof(grupo), 0) != sizeof(grupo)) {
+        grupo = (uint32_t)get_monotonic_us() ^ (uint32_t)getpid();
+    }
+    LOG(LOG_INFO, "\n===== SUBIDA EN PARALELO: %d rangos (grupo %08x) =====\n", n, grupo);
+
+    uint64_t inicio = get_monotonic_us();
+    for (int i = 0; i < n; i++) {
+        Stream* st = &streams[i];
+        uint64_t primer_bloque = bloques * i / n;
+        uint64_t ultimo_bloque = bloques * (i + 1) / n;
+
+        st->server_ip = server_ip;
+        st->server_port = server_port;
+        st->local_file = local_file;
+        st->remote_name = remote_name;
+        st->zerocopy = zerocopy;
+        st->tamano = tamano;
+        st->desde = primer_bloque * bloque;
+        st->largo = ((ultimo_bloque * bloque < tamano) ? ultimo_bloque * bloque : tamano) - st->desde;
+        st->rango.grupo = htonl(grupo);
+        st->rango.indice = htons(i);
+        st->rango.total = htons(n);
+        st->rango.desde = htobe64(st->desde);
+        if (i == 0) {
+            st->ses = *primera;
+            st->lista = 1;
+            st->ventana = ventana;
+        } else {
+            st->ses.mapear = primera->mapear;
+            st->ses.comprimir = primera->comprimir;
+            st->gso = primera->gso;
+            st->ses.algoritmo_cc = primera->algoritmo_cc;
+            st->max_datagrama = primera->bloque + V2_HEADER_SIZE + (primera->fec_k ? FEC_CABECERA : 0);
+            st->fec[0] = primera->fec_k;
+            st->fec[1] = primera->fec_m;
+            st->ventana = ventana;      // se pide la misma que aceptó la primera sesión
+        }
+        if (primera->traza) {
+            snprintf(st->traza, sizeof(st->traza), "%s.%d", primera->traza, i);
+            st->ses.traza = st->traza;
+        }
+
+        if (pthread_create(&st->hilo, NULL, hilo_stream, st) != 0) {
+            perror("Error en pthread_create()");
+            n = i;
+            break;
+        }
+    }
+
+    int resultado = (n > 0) ? 0 : -1;
+    int retransmisiones = 0;
+    for (int i = 0; i < n; i++) {
+        pthread_join(streams[i].hilo, NULL);
+        if (streams[i].resultado != 0) {
+            resultado = -1;
+        }
+    }
+    double segundos = (get_monotonic_us() - inicio) / 1e6;
+
+    log_vaciar();
+    for (int i = 0; i < n; i++) {
+        printf("--- Rango %d: bytes %llu-%llu ---\n", i, (unsigned long long)streams[i].desde,
+               (unsigned long long)(streams[i].desde + streams[i].largo));
+        reporte_sesion(&streams[i].ses);
+        retransmisiones += streams[i].ses.retransmisiones;
+        zc_free(&streams[i].ses.zc);
+    }
+    printf("Total: %llu bytes en %d rangos, %d retransmisiones\n",
+           (unsigned long long)tamano, n, retransmisiones);
+    if (segundos > 0) {
+        printf("Tiempo: %.3f s (%.1f KB/s)\n", segundos, tamano / 1024.0 / segundos);
+    }
+
+    free(streams);
+    return resultado;
+}
+
+
+// id de una subida reanudable: el mismo archivo local (mismo inodo, tamaño y
+// mtime) subido con el mismo nombre da el mismo id en la próxima ejecución.
+// FNV-1a de 64 bits
+uint64_t id_transferencia(const struct stat* st, const char* remote_name) {
+    uint64_t campos[5] = { st->st_dev, st->st_ino, st->st_size,
+                           st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+    uint64_t h = 0xCBF29CE484222325ULL;
+    const uint8_t* p = (const uint8_t*)campos;
+    for (size_t i = 0; i < sizeof(campos); i++) {
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    }
+    for (p = (const uint8_t*)remote_name; *p; p++) {
+        h = (h ^ *p) * 0x100000001B3ULL;
+    }
+    return h ? h : 1;       // 0 = no reanudable
+}
+
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Uso: %s [-w ventana] [-P sesiones] [-p puerto] [-1] [-r] [-d] [-z | -Z] [-c] [-g] [-m datagrama] [-C algoritmo] [-T traza.csv] [-F k[:m]] [-D] [-k ticket] [-v nivel] <IP_SERVIDOR> <ARCHIVO_LOCAL> <ARCHIVO_REMOTO>\n", prog);
+    fprintf(stderr, "  -w: PDUs en vuelo con protocolo v2 (se negocia con el servidor, default 1)\n");
+    fprintf(stderr, "  -P: partir el archivo en N rangos y subirlos a la vez, cada uno en su sesión (v2, servidorN)\n");
+    fprintf(stderr, "  -1: forzar protocolo v1 (stop & wait, ignora -w y -P)\n");
+    fprintf(stderr, "  -r: subida reanudable: si una ejecución anterior se cortó, sigue desde lo que el servidor ya tiene\n");
+    fprintf(stderr, "  -d: descargar ARCHIVO_REMOTO del servidor en ARCHIVO_LOCAL (v2, servidorN; no va con -1, -P ni -r)\n");
+    fprintf(stderr, "  -z: enviar los DATA directo del archivo mapeado (mmap + sendmsg, sin copias)\n");
+    fprintf(stderr, "  -Z: como -z y además MSG_ZEROCOPY (el kernel tampoco copia; no aplica en loopback)\n");
+    fprintf(stderr, "  -c: comprimir cada DATA que achique (se negocia con el servidor)\n");
+    fprintf(stderr, "  -g: con -w/-P, enviar los DATA en lotes con UDP_SEGMENT (GSO: un sendmsg por lote)\n");
+    fprintf(stderr, "  -m: datagrama v2 más grande a sondear (default %d; %d = tamaño fijo de v1, sin sondeo)\n",
+            DATAGRAMA_MAX, V2_HEADER_SIZE + V2_DATA_SIZE);
+    fprintf(stderr, "  -C: control de congestión del modo ventana: reno (default), vegas o fijo (ventana entera, sin pacing)\n");
+    fprintf(stderr, "  -T: escribir en un CSV la evolución de cwnd y de la tasa de pacing (con -P, uno por rango: archivo.N)\n");
+    fprintf(stderr, "  -F: con -w/-P, m PDUs de paridad (1-%d, default 1 = XOR) cada k DATA (1-%d): el servidor\n"
+                    "      reconstruye hasta m DATA perdidos del grupo sin retransmisión (servidorN)\n", FEC_M_MAX, FEC_K_MAX);
+    fprintf(stderr, "  -D: subida delta: si el servidor ya tiene ARCHIVO_REMOTO solo viaja lo que cambió\n"
+                    "      (v2, servidorN; no va con -1, -P, -r ni -d)\n");
+    fprintf(stderr, "  -k: guardar en un archivo el ticket de sesión que da el servidor y usarlo en las próximas\n"
+                    "      subidas: sin HELLO, el WRQ y el primer DATA van juntos (v2, servidorN; no va con -P ni -d)\n");
+    fprintf(stderr, "  -v: detalle del log: 0 errores, 1 avisos, 2 progreso (default), 3 cada PDU\n");
+    fprintf(stderr, "  -p: puerto del servidor (default %s, otro para pasar por el proxy)\n", SERVER_PORT);
+    fprintf(stderr, "Ejemplo: %s 127.0.0.1 test.txt a.txt\n", prog);
+}
+
+
+int main(int argc, char* argv[]) {
+    int ventana_pedida = 0;
+    int paralelos = 1;
+    int reanudar = 0;
+    int descargar = 0;
+    int pedir_v2 = 1;
+    int mapear = 0;
+    int zerocopy = 0;
+    int comprimir = 0;
+    int gso = 0;
+    int delta = 0;
+    int max_datagrama = DATAGRAMA_MAX;
+    uint8_t fec[2] = {0, 0};
+    int fec_k = 0, fec_m = 1;
+    const AlgoritmoCC* algoritmo_cc = &cc_reno;
+    const char* traza = NULL;
+    const char* ruta_ticket = NULL;
+    const char* server_port = SERVER_PORT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:P:p:1rdzZcgDm:C:T:F:k:v:")) != -1) {
+        switch (opt) {
+            case 'w': ventana_pedida = atoi(optarg); break;
+            case 'P': paralelos = atoi(optarg); break;
+            case 'p': server_port = optarg; break;
+            case '1': pedir_v2 = 0; break;
+            case 'r': reanudar = 1; break;
+            case 'd': descargar = 1; break;
+            case 'z': mapear = 1; break;
+            case 'Z': mapear = 1; zerocopy = 1; break;
+            case 'c': comprimir = 1; break;
+            case 'g': gso = 1; break;
+            case 'D': delta = 1; break;
+            case 'm': max_datagrama = atoi(optarg); break;
+            case 'C': algoritmo_cc = cc_buscar(optarg); break;
+            case 'T': traza = optarg; break;
+            case 'F': if (sscanf(optarg, "%d:%d", &fec_k, &fec_m) < 1) fec_k = -1; break;
+            case 'k': ruta_ticket = optarg; break;
+            case 'v': log_nivel = atoi(optarg); break;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    if (argc - optind < 3 || !algoritmo_cc || fec_k < 0 || fec_k > FEC_K_MAX || fec_m < 1 || fec_m > FEC_M_MAX ||
+        ventana_pedida < 0 || ventana_pedida > VENTANA_MAX ||
+        paralelos < 1 || paralelos > 0xFFFF || (reanudar && paralelos > 1) ||
+        (descargar && (reanudar || paralelos > 1 || !pedir_v2)) ||
+        (delta && (reanudar || paralelos > 1 || descargar || !pedir_v2)) ||
+        (ruta_ticket && (paralelos > 1 || descargar || !pedir_v2)) ||
+        max_datagrama < V2_HEADER_SIZE + V2_BLOQUE_MIN || max_datagrama > DATAGRAMA_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    fec[0] = fec_k;
+    fec[1] = fec_m;
+    const char* server_ip = argv[optind];
+    const char* local_file = argv[optind + 1];
+    const char* remote_name = argv[optind + 2];
+    
+    printf("\n*========================================*\n");
+    printf("|  CLIENTE STOP & WAIT                   |\n");
+    printf("*========================================*\n");
+    printf("|  Servidor: %-27s |\n", server_ip);
+    printf("|  Archivo:  %-27s |\n", local_file);
+    printf("*========================================*\n");
+    log_iniciar();
+    atexit(log_cerrar);
+
+    struct stat st;
+    if (!descargar && stat(local_file, &st) != 0) {
+        perror("Error en stat()");
+        return 1;
+    }
+
+    int s = conectar(server_ip, server_port);
+    if (s < 0) {
+        return 1;
+    }
+
+    // una subida chica no espera el sondeo del bloque: si además va en una
+    // sola sesión sin FEC, el WRQ sale dentro del HELLO (con V2_DATA_SIZE, que
+    // sin sondeo es el bloque). Con un ticket guardado no hay HELLO: sirve si
+    // su bloque salió de un sondeo o si no hace falta sondear
+    uint64_t id_reanudar = (reanudar && !descargar) ? id_transferencia(&st, remote_name) : 0;
+    int chica = !descargar && st.st_size <= SUBIDA_CHICA;
+    char servidor[64];
+    snprintf(servidor, sizeof(servidor), "%s:%s", server_ip, server_port);
+    int32_t pedido[5] = { ventana_pedida, max_datagrama, comprimir, fec[0], fec[0] ? fec[1] : 0 };
+    TicketGuardado guardado;
+    int usar_ticket = ruta_ticket && ticket_cargar(ruta_ticket, servidor, pedido, &guardado) == 0 &&
+                      (guardado.sondeado || chica);
+
+    char wrq_hello[0x100];
+    int wrq_hello_len = -1;
+    if (pedir_v2 && !descargar && paralelos == 1 && !fec[0] &&
+        (chica || max_datagrama == V2_HEADER_SIZE + V2_DATA_SIZE)) {
+        wrq_hello_len = armar_wrq(wrq_hello, sizeof(wrq_hello) - 1, remote_name, st.st_size, NULL,
+                                  id_reanudar, delta, V2_DATA_SIZE, NULL);
+    }
+    int sondear = (wrq_hello_len < 0);
+
+    Sesion ses;
+    uint16_t ventana;
+    int intentos_ticket = 0;
+sesion:
+    ventana = ventana_pedida;
+    if (usar_ticket) {
+        retomar_sesion(&ses, s, &guardado, mapear, zerocopy, gso, &ventana);
+    } else if (iniciar_sesion(&ses, s, pedir_v2, mapear, zerocopy, comprimir, gso, max_datagrama,
+                              fec[0] ? fec : NULL, sondear, ruta_ticket != NULL,
+                              (wrq_hello_len > 0) ? wrq_hello : NULL, wrq_hello_len, &ventana) != 0) {
+        close(s);
+        return 1;
+    }
+    ses.algoritmo_cc = algoritmo_cc;
+    ses.traza = traza;
+
+    if (ses.con_ticket) {
+        memset(&guardado, 0, sizeof(guardado));
+        guardado.formato = TICKET_FORMATO;
+        memcpy(guardado.servidor, servidor, sizeof(servidor));
+        memcpy(guardado.pedido, pedido, sizeof(pedido));
+        guardado.vence = time(NULL) + TICKET_VIDA_SEG;
+        guardado.sesion = ses.sesion;
+        guardado.ventana = ventana;
+        guardado.comprimir = ses.comprimir;
+        guardado.sack = ses.sack;
+        guardado.fec_k = ses.fec_k;
+        guardado.fec_m = ses.fec_m;
+        guardado.sondeado = (ses.bloque_max == 0 || sondear);
+        guardado.bloque = ses.bloque;
+        guardado.bloque_max = ses.bloque_max;
+        memcpy(guardado.ticket, ses.ticket, TICKET_LARGO);
+        if (ticket_guardar(ruta_ticket, &guardado) == 0) {
+            LOG(LOG_INFO, "Ticket de sesión guardado en %s\n", ruta_ticket);
+        }
+    }
+
+    if (descargar) {
+        int res = -1;
+        if (!ses.v2) {
+            fprintf(stderr, "El servidor no soporta v2: no hay descargas\n");
+        } else if ((res = fase_descarga(&ses, remote_name, local_file, ventana)) != 0) {
+            fprintf(stderr, "Fallo en la descarga\n");
+        } else {
+            reporte_sesion(&ses);
+            LOG(LOG_INFO, "TRANSFERENCIA COMPLETADA\n");
+        }
+        zc_free(&ses.zc);
+        close(s);
+        return res ? 1 : 0;
+    }
+
+    if (paralelos > 1 && !ses.v2) {
+        LOG(LOG_INFO, "Servidor v1: se sube en una sola sesión\n");
+    } else if (paralelos > 1 && st.st_size > ses.bloque) {
+        // las sesiones cierran sus sockets (incluido s)
+        if (subida_paralela(&ses, ventana, paralelos, zerocopy, server_ip, server_port,
+                            local_file, remote_name, st.st_size) != 0) {
+            fprintf(stderr, "Fallo en la subida en paralelo\n");
+            return 1;
+        }
+        LOG(LOG_INFO, "TRANSFERENCIA COMPLETADA\n");
+        return 0;
+    }
+
+    uint64_t desde = 0;
+    Delta coincidencias;
+    memset(&coincidencias, 0, sizeof(coincidencias));
+    if (delta && !ses.v2) {
+        LOG(LOG_INFO, "Servidor v1: sin subida delta, se sube entero\n");
+    }
+    // con ticket y sin nada que leer del ACK del WRQ (desde, firmas), el WRQ
+    // sale junto con el primer DATA
+    PDU_v2 wrq_ticket;
+    int wrq;
+    if (ses.sin_hello && !reanudar && !delta) {
+        ses.wrq_len = sellar_wrq(&ses, &wrq_ticket, remote_name, st.st_size, NULL, 0, 0);
+        ses.wrq = (ses.wrq_len > 0) ? &wrq_ticket : NULL;
+        wrq = (ses.wrq_len > 0) ? 0 : -1;
+    } else if (ses.v2) {
+        wrq = fase_wrq_v2(&ses, remote_name, st.st_size, NULL, id_reanudar, &desde,
+                          delta ? &coincidencias : NULL);
+    } else {
+        wrq = fase_wrq(&ses, remote_name, st.st_size, id_reanudar, &desde);
+    }
+    if (wrq == -2 && ses.sin_hello) {
+        usar_ticket = ticket_reintentar(&ses, &intentos_ticket);
+        goto sesion;
+    }
+    if (wrq != 0) {
+        fprintf(stderr, "Fallo en FASE 2 (WRQ)\n");
+        close(s);
+        return 1;
+    }
+    if (coincidencias.bloque > 0) {
+        if (fase_firmas(&ses, local_file, ventana, &coincidencias) != 0) {
+            fprintf(stderr, "Fallo en FASE 2b (firmas de la subida delta)\n");
+            delta_free(&coincidencias);
+            close(s);
+            return 1;
+        }
+        ses.delta = &coincidencias;
+    }
+
+    uint32_t digest = 0;
+    if (desde > 0 && digest_prefijo(local_file, desde, &digest) != 0) {
+        fprintf(stderr, "No se pudo leer el archivo hasta el byte %llu\n", (unsigned long long)desde);
+        close(s);
+        return 1;
+    }
+    
+    if (ses.v2) {
+        // en modo ventana el FIN se envía al final de la fase DATA
+        int res = fase_data_ventana(&ses, local_file, ventana, desde, st.st_size - desde, digest);
+        if (res == -2 && ses.sin_hello) {
+            usar_ticket = ticket_reintentar(&ses, &intentos_ticket);
+            goto sesion;
+        }
+        if (res != 0) {
+            fprintf(stderr, "Fallo en FASE 3/4 (DATA + FIN, ventana)%s\n",
+                    reanudar ? ": se puede reanudar volviendo a ejecutar con -r" : "");
+            close(s);
+            return 1;
+        }
+    } else {
+        uint8_t last_data_seq = 0;
+        if (fase_data(&ses, local_file, desde, &digest, &last_data_seq) != 0) {
+            fprintf(stderr, "Fallo en FASE 3 (DATA)%s\n",
+                    reanudar ? ": se puede reanudar volviendo a ejecutar con -r" : "");
+            close(s);
+            return 1;
+        }
+        
+        if (fase_fin(&ses, last_data_seq, digest) != 0) {  // el seq depende del último DATA
+            fprintf(stderr, "Fallo en FASE 4 (FIN)\n");
+            close(s);
+            return 1;
+        }
+    }
+
+    reporte_sesion(&ses);
+    zc_free(&ses.zc);
+    delta_free(&coincidencias);
     
-    printf("TRANSFERENCIA COMPLETADA\n");
+    LOG(LOG_INFO, "TRANSFERENCIA COMPLETADA\n");
     close(s);
-    printf("Socket cerrado\n");
+    LOG(LOG_INFO, "Socket cerrado\n");
     return 0;
 }
@@ -1,4 +1,17 @@
+#define _GNU_SOURCE     // fallocate()
+#include <poll.h>
+#include <getopt.h>
 #include "../include/common.h"
+#include "../include/ventana.h"
+#include "../include/escritor.h"
+#include "../include/diario.h"
+#include "../include/lz.h"
+#include "../include/gso.h"
+
+
+#define HILOS_ESCRITURA 2        // hilos del pipeline de escritura a disco (-e)
+#define BUFFERS_ESCRITURA 1024   // DATA en vuelo hacia el disco (-b)
+#define MEMORIA_ESCRITURA (64 << 20)  // tope de esos buffers con bloques v2 grandes
 
 
 typedef struct {
@@ -7,138 +20,870 @@ typedef struct {
     int autenticado;
     int wrq_recibido;
     char filename[256];
-    FILE* file;
+    int fd;                  // -1 = sin archivo abierto
+    uint64_t offset;         // próximo offset a escribir en stop & wait
+    uint32_t digest;         // CRC32C de lo recibido en stop & wait (en v2 lo arma reasm)
+    uint64_t base;           // offset desde el que se reanudó (0 si no)
+    int diario;              // subida reanudable: fd del diario (-1 si no)
+    uint64_t id_reanudar;
+    uint64_t tamano;         // anunciado en el WRQ
+    uint64_t checkpoint;     // offset del último checkpoint encolado
+    uint64_t tam_final;      // fin del último byte recibido: se trunca ahí al cerrar
+    int pendientes;          // escrituras encoladas que todavía no volvieron
+    int ack_pendiente;       // stop & wait con ACK durable: el último DATA se está escribiendo
+    int fin_pendiente;       // FIN recibido, se confirma cuando pendientes llegue a 0
+    uint32_t fin_seq;
+    int error_escritura;
     uint8_t last_seq;
+    uint8_t version;         // protocolo negociado en el HELLO (1 o V2_VERSION)
+    uint32_t sesion;         // id de sesión v2
+    uint16_t ventana;        // PDUs en vuelo en v2 (0 en v1)
+    uint16_t bloque;         // payload de un DATA v2 lleno (OPT_BLOQUE del WRQ)
+    int sack;                // OPT_SACK aceptado en el HELLO: los ACK de DATA llevan el mapa
+    Reensamblado reasm;
 } ClientState;
 
 
+// pipeline de escritura: el loop nunca llama a write(), solo encola y
+// procesa lo que vuelve por la cola de completados
+Escritor escritor;
+PoolTrabajos pool;
+Completados completados;
+int ack_durable = 0;        // 1 = ACK recién cuando el DATA está en disco (-d)
+int gro = 0;                // recepción agrupada con UDP_GRO (-g)
+int datagrama_max = DATAGRAMA_MAX;      // datagrama más grande que se acepta (-m)
+uint16_t bloque_max = V2_BLOQUE_MAX;    // y el bloque v2 que entra en él
+int buffer_rx;                          // SO_RCVBUF efectivo del socket
+
+
 void send_ack(int socket, struct sockaddr_in* client_addr, socklen_t addr_len, 
                 uint8_t seq_num,const char* mensaje_error) {
     App_PDU ack;
     memset(&ack, 0, sizeof(App_PDU));
     ack.type = ACK;
     ack.seq_num = seq_num;
+
+    int data_len = 0;
     if (mensaje_error) {
         strncpy(ack.data, mensaje_error, MAX_DATA_SIZE - 1);
+        data_len = strlen(ack.data) + 1;
     }
     
-    sendto(socket, &ack, sizeof(App_PDU), 0, 
+    // solo el header (y el mensaje de error si hay): un cliente v1 ve el resto como ceros
+    sendto(socket, &ack, PDU_HEADER_SIZE + data_len, 0, 
             (struct sockaddr*)client_addr, addr_len);
     
-    printf("ACK enviado (seq=%d)\n", seq_num);
+    LOG(LOG_DETALLE, "ACK enviado (seq=%d)\n", seq_num);
+}
+
+
+// ACK v2: solo el header, salvo que lleve un mensaje de error como payload
+void send_ack_v2(int socket, ClientState* client, uint32_t seq, const char* mensaje_error) {
+    PDU_v2 ack;
+    int len = 0;
+    if (mensaje_error) {
+        len = strlen(mensaje_error);
+        memcpy(ack.data, mensaje_error, len);
+    }
+    int total = v2_sellar(&ack, ACK, client->sesion, seq, len);
+
+    sendto(socket, &ack, total, 0, (struct sockaddr*)&client->addr, client->addr_len);
+}
+
+
+// ACK con opciones (HELLO, WRQ reanudable): data = '\0' + lista TLV.
+// el '\0' inicial hace que un cliente v1 lo vea como un ACK sin mensaje de error
+void send_ack_opciones(int socket, ClientState* client, uint8_t seq_num, const char* opciones, int largo) {
+    App_PDU ack;
+    memset(&ack, 0, sizeof(App_PDU));
+    ack.type = ACK;
+    ack.seq_num = seq_num;
+    memcpy(ack.data + 1, opciones, largo);
+
+    sendto(socket, &ack, PDU_HEADER_SIZE + 1 + largo, 0,
+            (struct sockaddr*)&client->addr, client->addr_len);
+
+    LOG(LOG_DETALLE, "ACK enviado (seq=%d) con %d bytes de opciones\n", seq_num, largo);
+}
+
+
+// ACK v2 con opciones: payload = '\0' + lista TLV (no es un mensaje de error)
+void send_ack_v2_opciones(int socket, ClientState* client, uint32_t seq, const char* opciones, int largo) {
+    PDU_v2 ack;
+    ack.data[0] = '\0';
+    memcpy(ack.data + 1, opciones, largo);
+    int total = v2_sellar(&ack, ACK, client->sesion, seq, 1 + largo);
+
+    sendto(socket, &ack, total, 0, (struct sockaddr*)&client->addr, client->addr_len);
+}
+
+
+// ACK de un DATA v2: con OPT_SACK aceptado lleva el estado de la ventana
+void send_ack_data(int socket, ClientState* client, uint32_t seq) {
+    if (!client->sack) {
+        send_ack_v2(socket, client, seq, NULL);
+        return;
+    }
+    uint8_t sack[4 + SACK_MAPA_MAX];
+    char opciones[2 + sizeof(sack)];
+    int largo = opt_agregar(opciones, 0, sizeof(opciones), OPT_SACK, sack, reensamblado_sack(&client->reasm, sack));
+    send_ack_v2_opciones(socket, client, seq, opciones, largo);
+}
+
+
+// ACK de un WRQ aceptado. En una subida reanudable lleva OPT_DESDE: desde dónde sigue el cliente
+void send_ack_wrq(int socket, ClientState* client, uint32_t seq) {
+    if (client->diario < 0) {
+        if (client->version == V2_VERSION) {
+            send_ack_v2(socket, client, seq, NULL);
+        } else {
+            send_ack(socket, &client->addr, client->addr_len, seq, NULL);
+        }
+        return;
+    }
+
+    char opciones[16];
+    uint64_t desde = htobe64(client->base);
+    int largo = opt_agregar(opciones, 0, sizeof(opciones), OPT_DESDE, &desde, 8);
+    if (client->version == V2_VERSION) {
+        send_ack_v2_opciones(socket, client, seq, opciones, largo);
+    } else {
+        send_ack_opciones(socket, client, seq, opciones, largo);
+    }
 }
 
 
-int handle_hello(int socket, App_PDU* pdu, ClientState* client) {
-    printf("│ HELLO recibido              │\n");
+int handle_hello(int socket, App_PDU* pdu, ClientState* client, int bytes_recibidos) {
+    LOG(LOG_INFO, "│ HELLO recibido              │\n");
     
-    printf("Credencial: %s\n", pdu->data);
+    LOG(LOG_INFO, "Credencial: %s\n", pdu->data);
     
     // Validar credencial (simplificado)
     if (strcmp(pdu->data, "g23-889d") == 0) {
-        printf("Credencial válida\n");
+        LOG(LOG_INFO, "Credencial válida\n");
         client->autenticado = 1;
         client->last_seq = 0;
-        send_ack(socket, &client->addr, client->addr_len, 0,NULL);
+        client->ventana = 0;
+        client->version = 1;
+        client->sack = 0;
+
+        // opciones TLV detrás del '\0' de la credencial
+        int cred_len = strnlen(pdu->data, MAX_DATA_SIZE) + 1;
+        int opts_len = bytes_recibidos - PDU_HEADER_SIZE - cred_len;
+        const char* opts = pdu->data + cred_len;
+        const uint8_t* version = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_VERSION, 1) : NULL;
+        const uint8_t* codec = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_COMPRESION, 1) : NULL;
+
+        // la compresión se acepta igual en v1 y v2: los DATA la marcan uno por uno
+        char opciones[32];
+        int largo = 0;
+        if (codec && *codec == COMPRESION_LZ) {
+            uint8_t aceptado = COMPRESION_LZ;
+            largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_COMPRESION, &aceptado, 1);
+            LOG(LOG_INFO, "DATA comprimidos (LZ)\n");
+        }
+
+        if (!version || *version < V2_VERSION) {
+            if (largo > 0) {
+                send_ack_opciones(socket, client, 0, opciones, largo);
+            } else {
+                send_ack(socket, &client->addr, client->addr_len, 0,NULL);
+            }
+            return 0;
+        }
+
+        // v2: ventana pedida (1 = stop & wait con seq de 32 bits) e id de sesión nuevo
+        uint16_t pedida = 1;
+        const uint8_t* v = opt_buscar(opts, opts_len, OPT_VENTANA, 2);
+        if (v) {
+            memcpy(&pedida, v, 2);
+            pedida = ntohs(pedida);
+        }
+        do {
+            if (id_sesion_aleatorio(&client->sesion) != 0) {
+                perror("getrandom");
+                client->sesion = 0;
+                send_ack(socket, &client->addr, client->addr_len, 0, "Sin id de sesion");
+                return 0;
+            }
+        } while (client->sesion == 0);
+        client->version = V2_VERSION;
+        client->ventana = (pedida == 0) ? 1 : (pedida > VENTANA_MAX) ? VENTANA_MAX : pedida;
+        LOG(LOG_INFO, "Protocolo v2: sesión %08x, ventana %d PDUs\n", client->sesion, client->ventana);
+
+        uint8_t version_aceptada = V2_VERSION;
+        uint32_t id = htonl(client->sesion);
+        uint16_t aceptada = htons(client->ventana);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_VERSION, &version_aceptada, 1);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_SESION, &id, 4);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_VENTANA, &aceptada, 2);
+
+        // bloque máximo: el pedido, si entra en los buffers de escritura y en el del socket
+        const uint8_t* b = opt_buscar(opts, opts_len, OPT_BLOQUE, 2);
+        if (b) {
+            uint16_t bloque;
+            memcpy(&bloque, b, 2);
+            bloque = htons(bloque_aceptado(ntohs(bloque), bloque_max, buffer_rx, client->ventana));
+            largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_BLOQUE, &bloque, 2);
+        }
+        if (opt_buscar(opts, opts_len, OPT_SACK, 1)) {
+            uint8_t aceptado = 1;
+            client->sack = 1;
+            largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_SACK, &aceptado, 1);
+        }
+        send_ack_opciones(socket, client, 0, opciones, largo);
         return 0;
     } else {
-        printf("Credencial inválida\n");
+        LOG(LOG_ERROR, "Credencial inválida\n");
         send_ack(socket, &client->addr, client->addr_len, 0, "Credencial inválida"); // se le avisa al cliente
         return -1;
     }
 }
 
 
-int handle_wrq(int socket, App_PDU* pdu, ClientState* client) {
-    printf("│ WRQ recibido                │\n");
+// abre (y preasigna) el archivo destino de un WRQ v1 o v2. datos = nombre + '\0'
+// + opciones TLV. Devuelve NULL si quedó abierto o el motivo del rechazo
+const char* abrir_archivo(ClientState* client, const char* datos, int largo) {
+    size_t len = strnlen(datos, largo);
+    if (len < 4 || len > 10) {
+        LOG(LOG_ERROR, "Filename inválido (debe tener 4-10 caracteres)\n");  // por enunciado
+        return "Filename invalido (4-10 chars)";
+    }
+
+    // un rango de una subida en paralelo: este servidor atiende una sola sesión
+    int opts_len = largo - (int)len - 1;
+    if (opts_len > 0 && opt_buscar(datos + len + 1, opts_len, OPT_RANGO, sizeof(OptRango))) {
+        LOG(LOG_ERROR, "Subida en paralelo no soportada (usar servidorN)\n");
+        return "Subida en paralelo no soportada";
+    }
     
-    if (!client->autenticado) {
-        printf("Cliente no autenticado, descartando WRQ silenciosamente\n"); // silenciosamente = sin avisarle al cliente
-        return -1;
+    // tamaño anunciado por el cliente e id de una subida reanudable
+    const uint8_t* t = (opts_len > 0) ? opt_buscar(datos + len + 1, opts_len, OPT_TAMANO, 8) : NULL;
+    const uint8_t* id = (opts_len > 0) ? opt_buscar(datos + len + 1, opts_len, OPT_REANUDAR, 8) : NULL;
+    const uint8_t* b = (opts_len > 0) ? opt_buscar(datos + len + 1, opts_len, OPT_BLOQUE, 2) : NULL;
+    uint64_t tam = 0;
+    if (t) {
+        memcpy(&tam, t, 8);
+        tam = be64toh(tam);
+        LOG(LOG_INFO, "Tamaño anunciado: %llu bytes\n", (unsigned long long)tam);
+    }
+    uint16_t bloque = V2_DATA_SIZE;
+    if (b) {
+        memcpy(&bloque, b, 2);
+        bloque = ntohs(bloque);
+    }
+    if (client->ventana > 0 && (bloque < V2_BLOQUE_MIN || bloque > bloque_max)) {
+        LOG(LOG_ERROR, "Bloque de %u bytes fuera de rango\n", bloque);
+        return "Bloque invalido";
+    }
+    if (bloque != V2_DATA_SIZE) {
+        LOG(LOG_INFO, "Bloque negociado: %u bytes\n", bloque);
+    }
+    client->bloque = bloque;
+
+    if (client->fd >= 0) {
+        close(client->fd);      // WRQ repetido: el ACK anterior se perdió
+    }
+    diario_cerrar(client->diario, client->filename, 0);
+    client->diario = -1;
+    client->digest = 0;
+    memcpy(client->filename, datos, len);
+    client->filename[len] = '\0';
+    client->base = 0;
+    if (id && t) {
+        memcpy(&client->id_reanudar, id, 8);
+        client->id_reanudar = be64toh(client->id_reanudar);
+        client->tamano = tam;
+        client->fd = abrir_reanudable(client->filename, client->id_reanudar, tam,
+                                      &client->base, &client->digest, &client->diario);
+        client->checkpoint = client->base;
+    } else {
+        client->fd = open(client->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    
+    if (client->fd < 0) {
+        perror("Error abriendo archivo");
+        return "Error abriendo archivo";
+    }
+    preasignar_archivo(client->fd, tam);
+    if (client->base > 0) {
+        LOG(LOG_INFO, "Reanudando desde el byte %llu\n", (unsigned long long)client->base);
     }
     
-    printf("Filename: %s\n", pdu->data);
+    if (client->ventana > 0) {
+        reensamblado_free(&client->reasm);
+        if (reensamblado_init(&client->reasm, client->ventana, client->bloque) != 0) {
+            perror("Error reservando ventana");
+            close(client->fd);
+            client->fd = -1;
+            return "Sin memoria para la ventana";
+        }
+        client->reasm.digest = client->digest;
+    }
+
+    LOG(LOG_INFO, "Archivo abierto: %s\n", client->filename);
+    client->wrq_recibido = 1;
+    client->offset = client->base;
+    client->tam_final = client->base;   // reanudada sin datos pendientes: el FIN no debe truncar
+    client->error_escritura = 0;
+    return NULL;
+}
+
+
+int handle_wrq(int socket, App_PDU* pdu, ClientState* client, int bytes_recibidos) {
+    LOG(LOG_INFO, "│ WRQ recibido                │\n");
     
-    size_t len = strlen(pdu->data);
-    if (len < 4 || len > 10) {
-        printf("Filename inválido (debe tener 4-10 caracteres)\n");  // por enunciado
+    if (!client->autenticado || client->version != 1) {
+        LOG(LOG_ERROR, "Cliente no autenticado, descartando WRQ silenciosamente\n"); // silenciosamente = sin avisarle al cliente
+        return -1;
+    }
+    if (client->pendientes > 0) {
+        LOG(LOG_AVISO, "WRQ con escrituras en curso, descartando\n");
         return -1;
     }
     
-    strncpy(client->filename, pdu->data, sizeof(client->filename) - 1);
-    client->file = fopen(client->filename, "wb");
+    LOG(LOG_INFO, "Filename: %s\n", pdu->data);
     
-    if (!client->file) {
-        perror("Error abriendo archivo");
+    if (abrir_archivo(client, pdu->data, bytes_recibidos - PDU_HEADER_SIZE) != NULL) {
         return -1;
     }
     
-    printf("Archivo abierto: %s\n", client->filename);
-    client->wrq_recibido = 1;
     client->last_seq = 1;
-    send_ack(socket, &client->addr, client->addr_len, 1,NULL);
+    send_ack_wrq(socket, client, 1);
     
     return 0;
 }
 
 
+int handle_wrq_v2(int socket, PDU_v2* pdu, ClientState* client, int data_len) {
+    LOG(LOG_INFO, "│ WRQ recibido (v2)           │\n");
+
+    if (!client->autenticado) {
+        LOG(LOG_ERROR, "Cliente no autenticado, descartando WRQ silenciosamente\n");
+        return -1;
+    }
+    if (client->pendientes > 0) {
+        LOG(LOG_AVISO, "WRQ con escrituras en curso, descartando\n");
+        return -1;
+    }
+
+    const char* error = abrir_archivo(client, pdu->data, data_len);
+    if (error) {
+        send_ack_v2(socket, client, V2_SEQ_WRQ, error);
+    } else {
+        send_ack_wrq(socket, client, V2_SEQ_WRQ);
+    }
+    return error ? -1 : 0;
+}
+
+
+// copia el payload a un buffer del pool (descomprimiéndolo ahí mismo si vino
+// comprimido) y lo encola en el pipeline de escritura. El digest se arma con
+// el bloque ya descomprimido. Devuelve los bytes a escribir o -1 si no hay
+// buffers (backpressure: no se ACKea) o el bloque comprimido no es válido
+int encolar_escritura(ClientState* client, const char* data, int len, int comprimido,
+                      uint64_t offset, uint32_t seq, int es_v2) {
+    Trabajo* t = pool_tomar(&pool);
+    if (!t) {
+        LOG(LOG_AVISO, "Sin buffers de escritura, descartando (el cliente retransmite)\n");
+        return -1;
+    }
+
+    if (comprimido) {
+        len = lz_descomprimir(data, len, t->buf, es_v2 ? client->bloque : MAX_DATA_SIZE);
+        if (len < 0) {
+            LOG(LOG_ERROR, "DATA comprimido inválido, descartando\n");
+            pool_devolver(&pool, t);
+            return -1;
+        }
+    } else {
+        memcpy(t->buf, data, len);
+    }
+    // antes de encolar: desde ahí el buffer es del escritor
+    if (es_v2) {
+        reensamblado_anotar(&client->reasm, seq, t->buf, len);
+    } else {
+        client->digest = crc32c(client->digest, t->buf, len);
+    }
+
+    t->fd = client->fd;
+    t->offset = offset;
+    t->len = len;
+    t->seq = seq;
+    t->es_v2 = es_v2;
+    t->sesion = client;
+    t->destino = &completados;
+    escritor_encolar(&escritor, t);
+
+    client->pendientes++;
+    if (offset + len > client->tam_final) {
+        client->tam_final = offset + len;
+    }
+    return len;
+}
+
+
 int handle_data(int socket, App_PDU* pdu, ClientState* client,int bytes_recibidos) {
-    printf("│ DATA recibido (seq=%d)      │\n", pdu->seq_num);
+    LOG(LOG_DETALLE, "│ DATA recibido (seq=%d)      │\n", pdu->seq_num);
     
-    if (!client->wrq_recibido) {
-        printf("WRQ no recibido, descartando DATA silenciosamente\n");  // silenciosamente = sin avisarle al cliente
+    if (!client->wrq_recibido || client->version != 1) {
+        LOG(LOG_ERROR, "WRQ no recibido, descartando DATA silenciosamente\n");  // silenciosamente = sin avisarle al cliente
         return -1;
     }
+    if (client->ack_pendiente) {
+        LOG(LOG_AVISO, "Retransmisión con la escritura en curso, el ACK sale al completarla\n");
+        return 0;
+    }
     
     uint8_t expected_seq = (client->last_seq == 0) ? 1 : 0;
+    uint8_t seq = pdu->seq_num & ~V1_COMPRIMIDO;
 
-    sleep(1);  // sleep por 1 segundo, solo para probar lo de la reanudación del timer del cliente.
-    
-    if (pdu->seq_num != expected_seq) {
-        printf("Seq incorrecto (esperaba %d, recibí %d)\n", 
-                expected_seq, pdu->seq_num);
+    if (seq != expected_seq) {
+        LOG(LOG_AVISO, "Seq incorrecto (esperaba %d, recibí %d)\n", 
+                expected_seq, seq);
         send_ack(socket, &client->addr, client->addr_len, client->last_seq,NULL);
         return 0;
     }
     
-    int data_len = bytes_recibidos - PDU_HEADER_SIZE;
-    size_t written = fwrite(pdu->data, 1, data_len, client->file);
+    int data_len = encolar_escritura(client, pdu->data, bytes_recibidos - PDU_HEADER_SIZE,
+                                     pdu->seq_num & V1_COMPRIMIDO, client->offset, seq, 0);
+    if (data_len < 0) {
+        return -1;
+    }
     
-    printf("Escritos %zu bytes en archivo\n", written);
+    LOG(LOG_DETALLE, "Encolados %d bytes en offset %llu\n", data_len, (unsigned long long)client->offset);
     
-    client->last_seq = pdu->seq_num;
-    send_ack(socket, &client->addr, client->addr_len, pdu->seq_num,NULL);
+    client->offset += data_len;
+    client->last_seq = seq;
+    if (ack_durable) {
+        client->ack_pendiente = 1;
+    } else {
+        send_ack(socket, &client->addr, client->addr_len, seq,NULL);
+    }
     
     return 0;
 }
 
 
-int handle_fin(int socket, App_PDU* pdu, ClientState* client) {
-    printf("│ FIN recibido                │\n");
-    
-    if (client->file) {
-        fclose(client->file);
-        printf("Archivo cerrado: %s\n", client->filename);
-        client->file = NULL;
+// DATA v2 (modo ventana): se escribe directo en su offset y se ACKea
+// individualmente (al encolar o, con -d, cuando el pipeline lo completa)
+int handle_data_v2(int socket, PDU_v2* pdu, ClientState* client, int data_len) {
+    uint32_t seq = ntohl(pdu->seq);
+
+    if (!client->wrq_recibido) {
+        LOG(LOG_ERROR, "DATA v2 sin WRQ, descartando\n");
+        return -1;
     }
-    
-    send_ack(socket, &client->addr, client->addr_len, pdu->seq_num,NULL);
-    
+
+    int res = reensamblado_recibir(&client->reasm, seq);
+
+    if (res < 0) {
+        LOG(LOG_AVISO, "DATA seq=%u fuera de ventana (base=%u), descartando\n", seq, client->reasm.base);
+        return 0;
+    }
+    if (res == 0) {
+        send_ack_data(socket, client, seq);
+        return 0;
+    }
+    if (res == 2) {
+        return 0;   // duplicado de uno que se está escribiendo
+    }
+
+    if (data_len > client->bloque) {
+        LOG(LOG_AVISO, "DATA seq=%u de %d bytes con bloque de %u, descartando\n", seq, data_len, client->bloque);
+        client->reasm.estado[seq % client->reasm.tam] = SLOT_LIBRE;
+        return 0;
+    }
+    uint64_t offset = client->base + (uint64_t)seq * client->bloque;
+    if (encolar_escritura(client, pdu->data, data_len, pdu->flags & V2_COMPRIMIDO, offset, seq, 1) < 0) {
+        client->reasm.estado[seq % client->reasm.tam] = SLOT_LIBRE;
+        return -1;
+    }
+
+    if (!ack_durable) {
+        reensamblado_completar(&client->reasm, seq);
+        send_ack_data(socket, client, seq);
+    }
+
+    return 0;
+}
+
+
+// FIN con todas las escrituras terminadas: se recorta lo que fallocate
+// reservó de más, se cierra el archivo y se confirma
+void cerrar_transferencia(int socket, ClientState* client) {
+    client->fin_pendiente = 0;
+
+    if (client->error_escritura) {
+        LOG(LOG_ERROR, "%s quedó incompleto por errores de escritura\n", client->filename);
+        if (client->version == V2_VERSION) {
+            send_ack_v2(socket, client, client->fin_seq, "Error escribiendo archivo");
+        } else {
+            send_ack(socket, &client->addr, client->addr_len, client->fin_seq, "Error escribiendo archivo");
+        }
+        return;
+    }
+
+    if (ftruncate(client->fd, client->tam_final) < 0) {
+        perror("Error en ftruncate()");
+    }
+    close(client->fd);
+    client->fd = -1;
+    diario_cerrar(client->diario, client->filename, 1);
+    client->diario = -1;
+
+    if (client->version == V2_VERSION) {
+        LOG(LOG_INFO, "Archivo cerrado: %s (%u paquetes)\n", client->filename, client->fin_seq);
+        send_ack_v2(socket, client, client->fin_seq, NULL);
+        reensamblado_free(&client->reasm);
+    } else {
+        LOG(LOG_INFO, "Archivo cerrado: %s\n", client->filename);
+        send_ack(socket, &client->addr, client->addr_len, client->fin_seq,NULL);
+    }
+
     client->autenticado = 0;
     client->wrq_recibido = 0;
+    client->ventana = 0;
+    LOG(LOG_INFO, "\nSesión completada\n");
+}
+
+
+// CRC32C de lo recibido en orden desde el inicio de la sesión
+uint32_t digest_recibido(ClientState* client) {
+    return (client->version == V2_VERSION) ? client->reasm.digest : client->digest;
+}
+
+
+// compara el digest del FIN (si lo trae: un cliente viejo no lo manda) con
+// el de lo recibido. Si no coincide el archivo no sirve: se borra el diario,
+// que lo daría por bueno al reanudar, y el FIN se rechaza (también si se repite)
+int digest_valido(ClientState* client, const char* datos, int largo) {
+    uint32_t esperado;
+    if (!fin_digest(datos, largo, &esperado)) {
+        return 1;
+    }
+
+    uint32_t calculado = digest_recibido(client);
+    if (esperado != calculado) {
+        LOG(LOG_ERROR, "Digest de %s no coincide (cliente %08x, recibido %08x)\n",
+               client->filename, esperado, calculado);
+        diario_cerrar(client->diario, client->filename, 1);
+        client->diario = -1;
+        return 0;
+    }
+    LOG(LOG_INFO, "Digest %08x verificado\n", calculado);
+    return 1;
+}
+
+
+int handle_fin_v2(int socket, PDU_v2* pdu, ClientState* client, int data_len) {
+    uint32_t seq = ntohl(pdu->seq);
+    LOG(LOG_INFO, "│ FIN recibido (v2, seq=%u)   │\n", seq);
+
+    // sesión ya cerrada (ACK del FIN perdido y el cliente reintenta): se vuelve a confirmar
+    if (!client->wrq_recibido) {
+        send_ack_v2(socket, client, seq, NULL);
+        return 0;
+    }
+
+    // con ACK durable base solo avanza sobre lo escrito: el FIN espera a
+    // que el pipeline devuelva todo (el cliente lo retransmite mientras tanto)
+    if (seq != client->reasm.base) {
+        LOG(LOG_AVISO, "FIN antes de completar los datos (base=%u), descartando\n", client->reasm.base);
+        return -1;
+    }
+    if (!digest_valido(client, pdu->data, data_len)) {
+        send_ack_v2(socket, client, seq, "Digest del archivo incorrecto");
+        return -1;
+    }
+
+    client->fin_seq = seq;
+    client->fin_pendiente = 1;
+    if (client->pendientes == 0) {
+        cerrar_transferencia(socket, client);
+    }
+    return 0;
+}
+
+
+int handle_fin(int socket, App_PDU* pdu, ClientState* client, int bytes_recibidos) {
+    LOG(LOG_INFO, "│ FIN recibido                │\n");
+    
+    if (client->fd < 0) {
+        send_ack(socket, &client->addr, client->addr_len, pdu->seq_num,NULL);
+        client->autenticado = 0;
+        client->wrq_recibido = 0;
+        return 0;
+    }
+    if (!digest_valido(client, pdu->data, bytes_recibidos - PDU_HEADER_SIZE)) {
+        send_ack(socket, &client->addr, client->addr_len, pdu->seq_num, "Digest del archivo incorrecto");
+        return -1;
+    }
     
-    printf("\nSesión completada\n");
+    client->fin_seq = pdu->seq_num;
+    client->fin_pendiente = 1;
+    if (client->pendientes == 0) {
+        cerrar_transferencia(socket, client);
+    }
     
     return 0;
 }
 
 
+// PDU v2: se valida el CRC y que sea de la sesión negociada en el HELLO
+void despachar_v2(int socket, PDU_v2* pdu, ClientState* client, int received) {
+    int data_len = v2_verificar(pdu, received);
+    if (data_len < 0) {
+        LOG(LOG_AVISO, "PDU v2 inválido (largo o CRC), descartando\n");
+        return;
+    }
+    if (client->version != V2_VERSION || ntohl(pdu->sesion) != client->sesion) {
+        LOG(LOG_AVISO, "PDU v2 de una sesión desconocida (%08x), descartando\n", ntohl(pdu->sesion));
+        return;
+    }
+
+    switch (pdu->type) {
+        case WRQ:
+            handle_wrq_v2(socket, pdu, client, data_len);
+            break;
+        case DATA:
+            handle_data_v2(socket, pdu, client, data_len);
+            break;
+        case FIN:
+            handle_fin_v2(socket, pdu, client, data_len);
+            break;
+        case SONDA:
+            send_ack_v2(socket, client, ntohl(pdu->seq), NULL);
+            break;
+        default:
+            LOG(LOG_ERROR, "Type v2 desconocido: %d\n", pdu->type);
+            break;
+    }
+}
+
+
+// encola un checkpoint del diario si la subida es reanudable, no tiene
+// escrituras en vuelo (todo lo encolado ya llegó al archivo) y avanzó
+// DIARIO_CADA bytes desde el último
+void encolar_checkpoint(ClientState* client) {
+    if (client->diario < 0 || client->pendientes > 0 || client->fin_pendiente) {
+        return;
+    }
+    uint64_t escrito = (client->version == V2_VERSION)
+                       ? client->base + (uint64_t)client->reasm.base * client->bloque
+                       : client->offset;
+    if (escrito > client->tamano) {
+        escrito = client->tamano;
+    }
+    if (escrito <= client->checkpoint || escrito - client->checkpoint < DIARIO_CADA) {
+        return;
+    }
+
+    Trabajo* t = pool_tomar(&pool);
+    if (!t) {
+        return;
+    }
+    diario_trabajo(t, client->fd, client->diario, client->id_reanudar, client->tamano, escrito,
+                   digest_recibido(client));
+    t->sesion = client;
+    t->destino = &completados;
+    escritor_encolar(&escritor, t);
+    client->pendientes++;
+    client->checkpoint = escrito;
+}
+
+
+// trabajos que devolvió el pipeline: con ACK durable recién ahora se confirman
+void procesar_completados(int socket, ClientState* client) {
+    Trabajo* t = completados_drenar(&completados);
+
+    while (t) {
+        Trabajo* sig = t->sig;
+        client->pendientes--;
+
+        if (t->diario >= 0) {
+            // checkpoint: no lleva ACK y si falló solo se pierde poder reanudar desde ahí
+            if (t->error) {
+                fprintf(stderr, "Error grabando el diario de %s: %s\n", client->filename, strerror(t->error));
+            }
+        } else {
+            if (t->error) {
+                fprintf(stderr, "Error escribiendo %s: %s\n", client->filename, strerror(t->error));
+                client->error_escritura = 1;
+            }
+
+            if (t->es_v2) {
+                if (ack_durable && !t->error) {
+                    reensamblado_completar(&client->reasm, t->seq);
+                    send_ack_data(socket, client, t->seq);
+                }
+            } else if (ack_durable) {
+                client->ack_pendiente = 0;
+                send_ack(socket, &client->addr, client->addr_len, t->seq, t->error ? "Error escribiendo archivo" : NULL);
+            }
+        }
+
+        pool_devolver(&pool, t);
+        t = sig;
+    }
+
+    if (client->fin_pendiente && client->pendientes == 0) {
+        cerrar_transferencia(socket, client);
+    } else {
+        encolar_checkpoint(client);
+    }
+}
+
+
+// despacha un datagrama recibido (payload terminado en '\0')
+void despachar(int s, App_PDU* pdu, ClientState* client, int received) {
+    if (LOG_ACTIVO(LOG_DETALLE)) {
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client->addr.sin_addr, client_ip, sizeof(client_ip));
+        LOG(LOG_DETALLE, "\nApp_PDU recibido de %s:%d\n", client_ip, ntohs(client->addr.sin_port));
+    }
+
+    // PDUs v2: se distinguen por V2_FLAG en el 2do byte
+    if (pdu->seq_num & V2_FLAG) {
+        despachar_v2(s, (PDU_v2*)pdu, client, received);
+        return;
+    }
+    if (received > (int)sizeof(App_PDU)) {
+        received = sizeof(App_PDU);     // v1 no tiene PDUs más largos
+        ((char*)pdu)[received] = '\0';
+    }
+
+    print_pdu("   ", pdu);
+    
+    switch (pdu->type) {
+        case HELLO:
+            handle_hello(s, pdu, client, received);
+            break;
+            
+        case WRQ:
+            handle_wrq(s, pdu, client, received);
+            break;
+            
+        case DATA:
+            handle_data(s, pdu, client,received);
+            break;
+            
+        case FIN:
+            handle_fin(s, pdu, client, received);
+            break;
+            
+        default:
+            LOG(LOG_ERROR, "Type desconocido: %d\n", pdu->type);
+            break;
+    }
+}
+
+
+// recibe un datagrama en buf (tam bytes, más uno para terminar el payload en
+// '\0') y lo despacha. Con -g pueden ser varios datagramas del cliente
+// seguidos, de `segmento` bytes cada uno (ver gso.h): se despachan de a uno
+// en el lugar, pisando mientras tanto el primer byte del siguiente
+int recibir(int s, ClientState* client, char* buf, int tam) {
+    struct iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = tam;
+    char control[CMSG_SPACE(sizeof(int))];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &client->addr;
+    msg.msg_namelen = sizeof(client->addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int received = recvmsg(s, &msg, 0);
+    if (received < 0) {
+        return -1;
+    }
+    client->addr_len = msg.msg_namelen;
+
+    int segmento = gro_segmento(&msg);
+    if (segmento == 0) {
+        segmento = received;
+    }
+    for (int off = 0; off < received; off += segmento) {
+        int largo = (received - off < segmento) ? received - off : segmento;
+        if (largo > datagrama_max) {
+            largo = datagrama_max;      // como lo truncaría un recv común
+        }
+        char* fin = buf + off + largo;
+        char pisado = *fin;
+        *fin = '\0';
+        despachar(s, (App_PDU*)(buf + off), client, largo);
+        *fin = pisado;
+    }
+    return received;
+}
+
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Uso: %s [-e hilos_escritura] [-b buffers] [-d] [-g] [-m datagrama] [-v nivel]\n", prog);
+    fprintf(stderr, "  -e: hilos que escriben a disco (default %d)\n", HILOS_ESCRITURA);
+    fprintf(stderr, "  -b: DATA en vuelo hacia el disco; si se llena se descartan (default %d,\n"
+                    "      o los que entren en %d MB con bloques v2 grandes)\n", BUFFERS_ESCRITURA, MEMORIA_ESCRITURA >> 20);
+    fprintf(stderr, "  -d: ACK durable, recién cuando el DATA está escrito y sincronizado (default: al encolar)\n");
+    fprintf(stderr, "  -g: recibir con UDP_GRO (el kernel agrupa los datagramas seguidos del cliente)\n");
+    fprintf(stderr, "  -m: datagrama v2 más grande que se acepta en bytes, tope del bloque que se negocia (default %d)\n", DATAGRAMA_MAX);
+    fprintf(stderr, "  -v: detalle del log: 0 errores, 1 avisos, 2 transferencias (default), 3 cada PDU\n");
+}
+
+
 int main(int argc, char* argv[]) {
+    int hilos_escritura = HILOS_ESCRITURA;
+    int buffers = BUFFERS_ESCRITURA;
+    int opt_c;
+
+    while ((opt_c = getopt(argc, argv, "e:b:dgm:v:")) != -1) {
+        switch (opt_c) {
+            case 'e': hilos_escritura = atoi(optarg); break;
+            case 'b': buffers = atoi(optarg); break;
+            case 'd': ack_durable = 1; break;
+            case 'g': gro = 1; break;
+            case 'm': datagrama_max = atoi(optarg); break;
+            case 'v': log_nivel = atoi(optarg); break;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (hilos_escritura < 1 || buffers < 0 ||
+        datagrama_max < V2_HEADER_SIZE + V2_BLOQUE_MIN || datagrama_max > DATAGRAMA_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // los buffers tienen que entrar además un PDU v1 entero
+    bloque_max = datagrama_max - V2_HEADER_SIZE;
+    if (datagrama_max < (int)sizeof(App_PDU)) {
+        datagrama_max = sizeof(App_PDU);
+    }
+    int tam_buffer = (bloque_max > MAX_DATA_SIZE) ? bloque_max : MAX_DATA_SIZE;
+    if (buffers == 0) {
+        buffers = MEMORIA_ESCRITURA / tam_buffer;
+        buffers = (buffers > BUFFERS_ESCRITURA) ? BUFFERS_ESCRITURA : buffers;
+    }
+
     printf("\n*========================================*\n");
     printf("|  SERVIDOR STOP & WAIT                  |\n");
     printf("*========================================*\n");
     printf("|  Puerto: %-29s |\n", SERVER_PORT);
+    printf("|  ACK: %-32s |\n", ack_durable ? "durable" : "al encolar");
+    printf("|  Bloque v2 max: %-22d |\n", bloque_max);
     printf("*========================================*\n");
+
+    if (pool_init(&pool, buffers, tam_buffer) != 0) {
+        perror("Error reservando buffers de escritura");
+        return 1;
+    }
+    if (completados_init(&completados) != 0 ||
+        escritor_init(&escritor, hilos_escritura, ack_durable) != 0) {
+        perror("Error iniciando el pipeline de escritura");
+        return 1;
+    }
     
     int s;
     struct addrinfo hints, *servinfo;
@@ -174,73 +919,54 @@ int main(int argc, char* argv[]) {
     
     printf("\nServidor escuchando en puerto %s\n", SERVER_PORT);
     freeaddrinfo(servinfo);
+    buffer_rx = agrandar_buffer_rx(s);
+
+    int tam_rx = (gro && gro_activar(s) == 0) ? GRO_BUFFER - 1 : datagrama_max;
+    char* rx = malloc(tam_rx + 1);
+    if (!rx) {
+        perror("Error en malloc()");
+        return 1;
+    }
     
     ClientState client;
     memset(&client, 0, sizeof(ClientState));
     client.addr_len = sizeof(client.addr);
+    client.fd = -1;
+    client.diario = -1;
+    log_iniciar();
     
-    App_PDU pdu;
-    
-    // configurar timeout para no bloquear indefinidamente
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    // se espera al socket o a que el pipeline devuelva escrituras terminadas
+    struct pollfd fds[2];
+    fds[0].fd = s;
+    fds[0].events = POLLIN;
+    fds[1].fd = completados.eventfd;
+    fds[1].events = POLLIN;
     
     while (1) {
-        memset(&pdu, 0, sizeof(App_PDU));
-        
-        int received = recvfrom(s, &pdu, sizeof(App_PDU), 0,
-                                (struct sockaddr*)&client.addr, 
-                                &client.addr_len);
-        
-        if (received < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                continue;
-            } else {
-                perror("Error en recvfrom()");
-                continue;
-            }
+        if (poll(fds, 2, -1) < 0) {
+            perror("Error en poll()");
+            continue;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            procesar_completados(s, &client);
         }
-        
-        if (received == 0) {
+        if (!(fds[0].revents & POLLIN)) {
             continue;
         }
-        
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client.addr.sin_addr, client_ip, sizeof(client_ip));
-        printf("\nApp_PDU recibido de %s:%d\n", 
-                client_ip, ntohs(client.addr.sin_port));
-        print_pdu("   ", &pdu);
-        
-        switch (pdu.type) {
-            case HELLO:
-                handle_hello(s, &pdu, &client);
-                break;
-                
-            case WRQ:
-                handle_wrq(s, &pdu, &client);
-                break;
-                
-            case DATA:
-                handle_data(s, &pdu, &client,received);
-                break;
-                
-            case FIN:
-                handle_fin(s, &pdu, &client);
-                break;
-                
-            default:
-                printf("Type desconocido: %d\n", pdu.type);
-                break;
-        }
-    }
-    
-    if (client.file) {
-        fclose(client.file);
+
+        if (recibir(s, &client, rx, tam_rx) < 0 && errno != EAGAIN && errno != EINTR) {
+            perror("Error en recvmsg()");
+        }
+    }
+    
+    if (client.fd >= 0) {
+        close(client.fd);
     }
+    free(rx);
     
     close(s);
+    log_cerrar();
     printf("\nSocket y archivo destino cerrados\n");
     
     return 0;
@@ -1,183 +1,1521 @@
+#define _GNU_SOURCE     // recvmmsg() / sendmmsg() / fallocate()
 #include <poll.h>
+#include <linux/filter.h>
+#include <sys/random.h>
+#include <getopt.h>
+#include <pthread.h>
 #include "../include/common.h"
+#include "../include/ventana.h"
+#include "../include/sesiones.h"
+#include "../include/escritor.h"
+#include "../include/descarga.h"
+#include "../include/metricas.h"
+#include "../include/grupos.h"
+#include "../include/diario.h"
+#include "../include/lz.h"
+#include "../include/gso.h"
+#include "../include/fec.h"
+#include "../include/delta.h"
+#include "../include/slab.h"
+#include "../include/ticket.h"
 
 
-#define MAX_CLIENTS 10
+#define MAX_SESIONES 200000      // límite default de sesiones simultáneas (-c)
+#define IDLE_TIMEOUT_SEG 30      // una sesión sin tráfico se expira a los 30 s (-i)
+#define TICK_MS 500              // resolución de la rueda de timers
+#define RUEDA_SLOTS 256          // 256 * 500 ms = 128 s por vuelta
+#define MAX_WORKERS 256
+#define LOTE 64                  // datagramas por recvmmsg() / sendmmsg()
+#define HILOS_ESCRITURA 2        // hilos del pipeline de escritura a disco (-e)
+#define BUFFERS_ESCRITURA 4096   // DATA en vuelo hacia el disco por worker (-b)
+#define MEMORIA_ESCRITURA (64 << 20)    // tope del pool por worker si -b no se da (bloques grandes)
+#define PLAZOS_INICIAL 64        // descargas con timers por worker antes de agrandar el heap
+#define TAM_TX ((sizeof(App_PDU) + LINEA_CACHE - 1) & ~(LINEA_CACHE - 1))   // buffer del lote de salida
 
 
+struct Worker;
+
+
+// los campos se agrupan por uso: primero los que toca cada DATA o ACK (en
+// las primeras líneas de cache del objeto, ver slab.h), después los que solo
+// se leen al abrir o cerrar la transferencia
 typedef struct {
-    int activo;
+    // --- calientes: despacho de cada datagrama ---
     struct sockaddr_in addr;
     socklen_t addr_len;
-    int autenticado;
-    int wrq_recibido;
-    char filename[256];
-    FILE* file;
+    uint32_t sesion;         // id de sesión v2 (byte bajo = worker dueño), 0 en v1
+    struct Worker* worker;   // worker dueño de la sesión
+    uint64_t ultimo_tick;    // tick de la rueda del último datagrama recibido
+    uint8_t version;         // protocolo negociado en el HELLO (1 o V2_VERSION)
     uint8_t last_seq;
+    uint16_t bloque;         // payload de un DATA v2 lleno (OPT_BLOQUE del WRQ)
+    uint16_t ventana;        // PDUs en vuelo en v2 (0 en v1)
+    uint8_t autenticado;
+    uint8_t wrq_recibido;
+    int sack;                // OPT_SACK aceptado en el HELLO: los ACK de DATA llevan el mapa
+    int fd;                  // -1 = sin archivo abierto
+    int pendientes;          // escrituras encoladas que todavía no volvieron
+    int ack_pendiente;       // stop & wait con ACK durable: el último DATA se está escribiendo
+    int fin_pendiente;       // FIN recibido, se confirma cuando pendientes llegue a 0
+    int error_escritura;
+    uint32_t digest;         // CRC32C de lo recibido en stop & wait (en v2 lo arma reasm)
+    uint64_t base;           // offset del rango en el archivo, o desde donde se reanudó
+    uint64_t offset;         // próximo offset a escribir en stop & wait
+    uint64_t tam_final;      // fin del último byte recibido: se trunca ahí al cerrar
+    Reensamblado reasm;
+    FecReceptor* fec;        // paridades de los grupos abiertos (desde el WRQ)
+    Descarga* descarga;      // RRQ: archivo mapeado y ventana de envío (NULL si es una subida),
+                             // o en una subida delta las firmas hasta que llega el primer DATA
+    ArchivoPrevio* previo;   // subida delta: el destino anterior (se escribe en previo->temporal)
+
+    // --- fríos: apertura, checkpoints, cierre y expiración ---
+    NodoRueda timer;         // vencimiento por inactividad
+    Grupo* grupo;            // subida en paralelo: el fd es del grupo (NULL si no)
+    uint16_t rango;          // índice de esta sesión en el grupo
+    uint8_t fec_k;           // OPT_FEC aceptado en el HELLO (0 = sin FEC)
+    uint8_t fec_m;
+    uint32_t fin_seq;
+    int diario;              // subida reanudable: fd del diario (-1 si no)
+    uint64_t id_reanudar;
+    uint64_t tamano;         // anunciado en el WRQ
+    uint64_t checkpoint;     // offset del último checkpoint encolado
+    uint64_t ticket;         // MAC del ticket que abrió la sesión (0 = se abrió con HELLO)
+    char filename[256];
 } ClientState;
 
 
-ClientState clients[MAX_CLIENTS];
+// cada worker es un hilo con su propio socket SO_REUSEPORT. El kernel reparte
+// los datagramas entre los sockets por hash del 4-tupla, así que todos los
+// datagramas de un cliente caen siempre en el mismo worker y su tabla de
+// sesiones y su rueda de timers no se comparten: no hace falta ningún lock.
+// Los PDU v2 se reparten por el id de sesión (ver filtro_reuseport), así un
+// cliente que cambia de IP/puerto (NAT) sigue llegando a su worker
+//
+// la E/S es por lotes: un recvmmsg() trae hasta LOTE datagramas a buffers
+// preasignados, se despachan todos y los ACKs que generan se acumulan en el
+// lote de salida, que se envía con un solo sendmmsg(). Cada buffer entra el
+// datagrama más grande que se acepta (-m) o, con -g (UDP_GRO), GRO_BUFFER
+// bytes que pueden traer varios datagramas seguidos
+//
+// los DATA no se escriben en el worker: se copian a un buffer de su pool y
+// se encolan al pipeline de escritura (una vez por lote). Los trabajos
+// terminados vuelven por la cola de completados, que el worker vigila con poll
+//
+// las descargas (RRQ) las maneja el mismo worker: sus DATA salen en el lote
+// de salida con el payload apuntando al archivo mapeado, y sus timers de
+// retransmisión están en un heap (plazos) que también acota la espera del poll
+
+
+typedef struct Worker {
+    int id;
+    int socket;
+    pthread_t hilo;
+    TablaSesiones tabla;
+    Rueda rueda;
+    uint32_t n_sesiones;     // la tabla tiene además una entrada por id de las sesiones v2
+    Slab sesiones;           // los ClientState
+
+    char* rx;                // LOTE buffers de tam_rx bytes (+1 para terminar el payload en '\0'),
+    int tam_rx;              // cada uno alineado a una línea de cache
+    struct sockaddr_in rx_addr[LOTE];
+    struct iovec rx_iov[LOTE];
+    struct mmsghdr rx_msgs[LOTE];
+    char rx_control[LOTE][CMSG_SPACE(sizeof(int))];
+    uint64_t rx_reloj;       // metricas_reloj() al recibir el lote actual
+
+    char tx_buf[LOTE][TAM_TX] __attribute__((aligned(LINEA_CACHE)));
+    struct sockaddr_in tx_addr[LOTE];
+    struct iovec tx_iov[LOTE][2];   // header y, en un DATA de una descarga, el payload
+    struct mmsghdr tx_msgs[LOTE];
+    uint64_t tx_origen[LOTE];    // ACK de un DATA: cuándo llegó ese DATA (0 = otro ACK)
+    int tx_n;
+
+    PoolTrabajos pool;
+    Completados completados;
+    Trabajo* a_escribir;     // trabajos del lote actual, se encolan juntos al final
+    Plazos plazos;           // vencimientos de las descargas
+} Worker;
+
+
+uint32_t max_sesiones = MAX_SESIONES;    // por worker
+uint64_t idle_ticks = IDLE_TIMEOUT_SEG * 1000 / TICK_MS;
+Escritor escritor;
+RegistroGrupos grupos;
+int ack_durable = 0;                     // 1 = ACK recién cuando el DATA está en disco (-d)
+int gro = 0;                             // recepción agrupada con UDP_GRO (-g)
+int datagrama_max = DATAGRAMA_MAX;       // datagrama más grande que se acepta (-m)
+uint16_t bloque_max = V2_BLOQUE_MAX;     // y el bloque v2 que entra en él
+int buffer_rx;                           // SO_RCVBUF efectivo de los sockets (el mismo en todos)
+uint8_t clave_tickets[16];               // sella los tickets de sesión: aleatoria al arrancar
+
+
+ClientState* find_or_create_client(Worker* w, struct sockaddr_in* addr, socklen_t addr_len) {
+    uint64_t clave = clave_sesion(addr);
+    ClientState* client = tabla_buscar(&w->tabla, clave);
+
+    if (client) {
+        client->ultimo_tick = w->rueda.tick_actual;
+        return client;
+    }
+
+    if (w->n_sesiones >= max_sesiones) {
+        return NULL;
+    }
+
+    client = slab_tomar(&w->sesiones);
+    if (!client) {
+        return NULL;
+    }
+    if (tabla_insertar(&w->tabla, clave, client) != 0) {
+        slab_devolver(&w->sesiones, client);
+        return NULL;
+    }
+    w->n_sesiones++;
+    metrica_sumar(M_SESIONES_ABIERTAS, 1);
+    client->addr = *addr;
+    client->addr_len = addr_len;
+    client->fd = -1;
+    client->diario = -1;
+    client->worker = w;
+    client->ultimo_tick = w->rueda.tick_actual;
+    client->timer.dueno = client;
+    rueda_agregar(&w->rueda, &client->timer, w->rueda.tick_actual + idle_ticks);
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+    LOG(LOG_INFO, "[NUEVO] Cliente %s:%d en worker %d (%u sesiones activas)\n", 
+           ip, ntohs(addr->sin_port), w->id, w->n_sesiones);
+
+    return client;
+}
+
+
+void tx_flush(Worker* w);
+
+
+void soltar_descarga(ClientState* client) {
+    plazos_quitar(&client->worker->plazos, client->descarga);
+    tx_flush(client->worker);       // el lote puede tener DATA que apuntan al mapa
+    descarga_free(client->descarga);
+    client->descarga = NULL;
+}
+
+
+// la sesión no debe tener escrituras pendientes: los trabajos apuntan a ella
+void release_client(ClientState* client) {
+    if (client->grupo) {
+        grupo_soltar(&grupos, client->grupo);
+        client->grupo = NULL;
+        client->fd = -1;
+    }
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    diario_cerrar(client->diario, client->filename, 0);
+    reensamblado_free(&client->reasm);
+    fec_receptor_free(client->fec);
+    rueda_quitar(&client->timer);
+    if (client->descarga) {
+        soltar_descarga(client);
+    }
+    previo_cerrar(client->previo, client->filename, 0);     // subida delta sin terminar
+
+    // la entrada por dirección puede ser de otra sesión si esta cambió de dirección
+    TablaSesiones* tabla = &client->worker->tabla;
+    if (tabla_buscar(tabla, clave_sesion(&client->addr)) == client) {
+        tabla_borrar(tabla, clave_sesion(&client->addr));
+    }
+    if (client->sesion) {
+        tabla_borrar(tabla, clave_id_sesion(client->sesion));
+    }
+    client->worker->n_sesiones--;
+    metrica_sumar(M_SESIONES_CERRADAS, 1);
+    slab_devolver(&client->worker->sesiones, client);
+}
+
+
+// hasta dónde está el archivo escrito sin huecos. Vale con la sesión sin
+// escrituras en vuelo: ahí todo lo encolado ya llegó al archivo
+uint64_t escrito_contiguo(ClientState* client) {
+    uint64_t escrito = (client->version == V2_VERSION)
+                       ? client->base + (uint64_t)client->reasm.base * client->bloque
+                       : client->offset;
+    return (escrito < client->tamano) ? escrito : client->tamano;
+}
+
+
+// CRC32C de lo recibido en orden desde el inicio de la sesión
+uint32_t digest_recibido(ClientState* client) {
+    return (client->version == V2_VERSION) ? client->reasm.digest : client->digest;
+}
+
+
+// encola un checkpoint del diario si la sesión es reanudable, no tiene
+// escrituras en vuelo y avanzó DIARIO_CADA bytes desde el último (o algo,
+// si forzar). Devuelve 1 si lo encoló
+int encolar_checkpoint(Worker* w, ClientState* client, int forzar) {
+    if (client->diario < 0 || client->pendientes > 0 || client->fin_pendiente) {
+        return 0;
+    }
+    uint64_t escrito = escrito_contiguo(client);
+    if (escrito <= client->checkpoint || (!forzar && escrito - client->checkpoint < DIARIO_CADA)) {
+        return 0;
+    }
+
+    Trabajo* t = pool_tomar(&w->pool);
+    if (!t) {
+        return 0;
+    }
+    diario_trabajo(t, client->fd, client->diario, client->id_reanudar, client->tamano, escrito,
+                   digest_recibido(client));
+    t->sesion = client;
+    t->destino = &w->completados;
+    t->sig = w->a_escribir;
+    w->a_escribir = t;
+    client->pendientes++;
+    client->checkpoint = escrito;
+    return 1;
+}
+
+
+// callback de la rueda: si la sesión tuvo tráfico desde que se programó (o
+// tiene escrituras en vuelo) se reprograma, si no se cierra su archivo y se
+// libera (cliente caído o abandonado)
+void expirar_client(void* dueno, void* ctx) {
+    ClientState* client = dueno;
+    Worker* w = ctx;
+
+    if (client->ultimo_tick + idle_ticks > w->rueda.tick_actual || client->pendientes > 0) {
+        rueda_agregar(&w->rueda, &client->timer, client->ultimo_tick + idle_ticks);
+        return;
+    }
+
+    // subida reanudable abandonada: antes de soltarla se graba hasta dónde llegó
+    if (encolar_checkpoint(w, client, 1)) {
+        rueda_agregar(&w->rueda, &client->timer, w->rueda.tick_actual + 1);
+        return;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client->addr.sin_addr, ip, sizeof(ip));
+    LOG(LOG_INFO, "[EXPIRADO] Cliente %s:%d inactivo%s%s\n", ip, ntohs(client->addr.sin_port),
+           client->fd >= 0 ? ", cerrando " : "", client->fd >= 0 ? client->filename : "");
+    release_client(client);
+}
+
+
+// envía todo el lote de salida. Si el buffer del socket se llena, lo que
+// queda se descarta: son ACKs y el cliente retransmite por timeout
+void tx_flush(Worker* w) {
+    int enviados = 0;
+
+    while (enviados < w->tx_n) {
+        int n = sendmmsg(w->socket, &w->tx_msgs[enviados], w->tx_n - enviados, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            break;
+        }
+        enviados += n;
+    }
+
+    uint64_t ahora = metricas_reloj();
+    for (int i = 0; ahora && i < w->tx_n; i++) {
+        if (w->tx_origen[i]) {
+            metrica_observar(H_LATENCIA_ACK, ahora - w->tx_origen[i]);
+        }
+    }
+    w->tx_n = 0;
+}
+
+
+// buffer libre del lote de salida; si el lote está lleno se envía antes
+char* tx_siguiente(Worker* w) {
+    if (w->tx_n == LOTE) {
+        tx_flush(w);
+    }
+    return w->tx_buf[w->tx_n];
+}
+
+
+// agrega al lote el buffer que devolvió tx_siguiente(). La dirección se copia:
+// la sesión puede liberarse (FIN) antes de que el lote salga
+void tx_agregar(Worker* w, int len, const struct sockaddr_in* addr, socklen_t addr_len) {
+    int i = w->tx_n++;
+
+    w->tx_origen[i] = 0;
+    w->tx_addr[i] = *addr;
+    w->tx_iov[i][0].iov_len = len;
+    w->tx_msgs[i].msg_hdr.msg_namelen = addr_len;
+    w->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+
+// igual, con el payload en un segundo iovec: un DATA de una descarga, que
+// sale directo del archivo mapeado (el mapa no se suelta con el lote sin enviar)
+void tx_agregar_payload(Worker* w, int len, const void* payload, int largo_payload,
+                        const struct sockaddr_in* addr, socklen_t addr_len) {
+    tx_agregar(w, len, addr, addr_len);
+    int i = w->tx_n - 1;
+    w->tx_iov[i][1].iov_base = (void*)payload;
+    w->tx_iov[i][1].iov_len = largo_payload;
+    w->tx_msgs[i].msg_hdr.msg_iovlen = 2;
+}
+
+
+// el último ACK agregado confirma un DATA que llegó en `recibido`: se mide
+// su latencia cuando sale el lote
+void tx_marcar_ack(Worker* w, uint64_t recibido) {
+    w->tx_origen[w->tx_n - 1] = recibido;
+}
+
+
+void send_ack(Worker* w, ClientState* client, uint8_t seq_num, const char* error_msg) {
+    App_PDU* ack = (App_PDU*)tx_siguiente(w);
+    ack->type = ACK;
+    ack->seq_num = seq_num;
+    
+    int data_len = 0;
+    if (error_msg) {
+        strncpy(ack->data, error_msg, MAX_DATA_SIZE - 1);
+        data_len = strlen(error_msg) + 1;
+    }
+    
+    tx_agregar(w, PDU_HEADER_SIZE + data_len, &client->addr, client->addr_len);
+    
+    LOG(LOG_DETALLE, "  -> ACK enviado (seq=%d)\n", seq_num);
+}
+
+
+// ACK con opciones (HELLO, WRQ reanudable): data = '\0' + lista TLV.
+// el '\0' inicial hace que un cliente v1 lo vea como un ACK sin mensaje de error
+void send_ack_opciones(Worker* w, ClientState* client, uint8_t seq_num, const char* opciones, int largo) {
+    App_PDU* ack = (App_PDU*)tx_siguiente(w);
+    ack->type = ACK;
+    ack->seq_num = seq_num;
+    ack->data[0] = '\0';
+    memcpy(ack->data + 1, opciones, largo);
+
+    tx_agregar(w, PDU_HEADER_SIZE + 1 + largo, &client->addr, client->addr_len);
+
+    LOG(LOG_DETALLE, "  -> ACK enviado (seq=%d, %d bytes de opciones)\n", seq_num, largo);
+}
+
+
+// ACK v2: solo el header, salvo que lleve un mensaje de error como payload
+void send_ack_v2(Worker* w, const struct sockaddr_in* addr, socklen_t addr_len,
+                 uint32_t sesion, uint32_t seq, const char* error_msg) {
+    PDU_v2* ack = (PDU_v2*)tx_siguiente(w);
+    int len = 0;
+    if (error_msg) {
+        len = strlen(error_msg);
+        memcpy(ack->data, error_msg, len);
+    }
+    tx_agregar(w, v2_sellar(ack, ACK, sesion, seq, len), addr, addr_len);
+}
+
+
+// ACK v2 con opciones: payload = '\0' + lista TLV (no es un mensaje de error)
+void send_ack_v2_opciones(Worker* w, ClientState* client, uint32_t seq, const char* opciones, int largo) {
+    PDU_v2* ack = (PDU_v2*)tx_siguiente(w);
+    ack->data[0] = '\0';
+    memcpy(ack->data + 1, opciones, largo);
+    tx_agregar(w, v2_sellar(ack, ACK, client->sesion, seq, 1 + largo), &client->addr, client->addr_len);
+}
+
+
+// ACK de un DATA v2: con OPT_SACK aceptado lleva el estado de la ventana
+void send_ack_data(Worker* w, ClientState* client, uint32_t seq) {
+    if (!client->sack) {
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, seq, NULL);
+        return;
+    }
+    uint8_t sack[4 + SACK_MAPA_MAX];
+    char opciones[2 + sizeof(sack)];
+    int largo = opt_agregar(opciones, 0, sizeof(opciones), OPT_SACK, sack, reensamblado_sack(&client->reasm, sack));
+    send_ack_v2_opciones(w, client, seq, opciones, largo);
+}
+
+
+// ACK del WRQ. En una subida reanudable lleva OPT_DESDE: desde dónde sigue el
+// cliente. En una delta, OPT_DELTA: bloque de firma y tamaño del archivo previo
+void send_ack_wrq(Worker* w, ClientState* client, uint32_t seq, const char* error) {
+    int delta = (client->previo && client->descarga);
+    if (error || (client->diario < 0 && !delta)) {
+        if (client->version == V2_VERSION) {
+            send_ack_v2(w, &client->addr, client->addr_len, client->sesion, seq, error);
+        } else {
+            send_ack(w, client, seq, error);
+        }
+        return;
+    }
+
+    char opciones[32];
+    int largo = 0;
+    if (client->diario >= 0) {
+        uint64_t desde = htobe64(client->base);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_DESDE, &desde, 8);
+    }
+    if (delta) {
+        char valor[12];
+        uint32_t bloque = htonl(client->previo->bloque);
+        uint64_t tam = htobe64(client->previo->tam);
+        memcpy(valor, &bloque, 4);
+        memcpy(valor + 4, &tam, 8);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_DELTA, valor, sizeof(valor));
+    }
+    if (client->version == V2_VERSION) {
+        send_ack_v2_opciones(w, client, seq, opciones, largo);
+    } else {
+        send_ack_opciones(w, client, seq, opciones, largo);
+    }
+}
+
+
+// id de sesión v2 nuevo: aleatorio (no se puede adivinar el de otro cliente)
+// con el id del worker en el byte bajo, que es lo que mira el filtro de
+// SO_REUSEPORT. 0 si getrandom falla
+uint32_t nuevo_id_sesion(Worker* w) {
+    uint32_t id;
+    do {
+        if (id_sesion_aleatorio(&id) != 0) {
+            perror("getrandom");
+            return 0;
+        }
+        id = (id & ~0xFFu) | (uint32_t)w->id;
+    } while (id == 0 || tabla_buscar(&w->tabla, clave_id_sesion(id)));
+    return id;
+}
+
+
+void procesar_wrq_v2(Worker* w, ClientState* client, const char* datos, int data_len);
+
+
+void handle_hello(Worker* w, App_PDU* pdu, ClientState* client, int bytes_recv) {
+    LOG(LOG_INFO, "  [HELLO] Credencial: %s\n", pdu->data);
+    
+    if (strcmp(pdu->data, "g23-889d") != 0) {
+        LOG(LOG_ERROR, "  [ERROR] Credencial invalida\n");
+        send_ack(w, client, 0, "Credencial invalida");
+        return;
+    }
+
+    LOG(LOG_INFO, "  [OK] Credencial valida\n");
+    client->autenticado = 1;
+    client->last_seq = 0;
+    client->ventana = 0;
+    client->version = 1;
+    client->sack = 0;
+    client->fec_k = 0;
+
+    // opciones TLV detrás del '\0' de la credencial
+    int cred_len = strnlen(pdu->data, MAX_DATA_SIZE) + 1;
+    int opts_len = bytes_recv - PDU_HEADER_SIZE - cred_len;
+    const char* opts = pdu->data + cred_len;
+    const uint8_t* version = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_VERSION, 1) : NULL;
+    const uint8_t* codec = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_COMPRESION, 1) : NULL;
+
+    // la compresión se acepta igual en v1 y v2: los DATA la marcan uno por uno
+    char opciones[64];
+    int largo = 0;
+    if (codec && *codec == COMPRESION_LZ) {
+        uint8_t aceptado = COMPRESION_LZ;
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_COMPRESION, &aceptado, 1);
+        LOG(LOG_INFO, "  [OK] DATA comprimidos\n");
+    }
+
+    if (!version || *version < V2_VERSION) {
+        if (largo > 0) {
+            send_ack_opciones(w, client, 0, opciones, largo);
+        } else {
+            send_ack(w, client, 0, NULL);
+        }
+        return;
+    }
+
+    // v2: ventana pedida (1 = stop & wait con seq de 32 bits). Si el HELLO es
+    // una retransmisión la sesión conserva su id
+    uint16_t pedida = 1;
+    const uint8_t* v = opt_buscar(opts, opts_len, OPT_VENTANA, 2);
+    if (v) {
+        memcpy(&pedida, v, 2);
+        pedida = ntohs(pedida);
+    }
+    if (!client->sesion) {
+        client->sesion = nuevo_id_sesion(w);
+        if (client->sesion == 0) {
+            send_ack(w, client, 0, "Sin id de sesion");
+            return;
+        }
+        if (tabla_insertar(&w->tabla, clave_id_sesion(client->sesion), client) != 0) {
+            client->sesion = 0;
+            send_ack(w, client, 0, "Servidor sin memoria");
+            return;
+        }
+    }
+    client->version = V2_VERSION;
+    client->ventana = (pedida == 0) ? 1 : (pedida > VENTANA_MAX) ? VENTANA_MAX : pedida;
+    LOG(LOG_INFO, "  [OK] Protocolo v2: sesion %08x, ventana %d PDUs\n", client->sesion, client->ventana);
+
+    uint8_t version_aceptada = V2_VERSION;
+    uint32_t id = htonl(client->sesion);
+    uint16_t aceptada = htons(client->ventana);
+    largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_VERSION, &version_aceptada, 1);
+    largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_SESION, &id, 4);
+    largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_VENTANA, &aceptada, 2);
+
+    // bloque máximo: el pedido, si entra en los buffers de escritura y en el del socket
+    const uint8_t* b = opt_buscar(opts, opts_len, OPT_BLOQUE, 2);
+    if (b) {
+        uint16_t bloque;
+        memcpy(&bloque, b, 2);
+        bloque = htons(bloque_aceptado(ntohs(bloque), bloque_max, buffer_rx, client->ventana));
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_BLOQUE, &bloque, 2);
+    }
+    if (opt_buscar(opts, opts_len, OPT_SACK, 1)) {
+        uint8_t aceptado = 1;
+        client->sack = 1;
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_SACK, &aceptado, 1);
+    }
+    const uint8_t* fec = opt_buscar(opts, opts_len, OPT_FEC, 2);
+    if (fec && fec[0] > 0 && fec[1] > 0) {
+        uint8_t km[2] = { (fec[0] > FEC_K_MAX) ? FEC_K_MAX : fec[0], (fec[1] > FEC_M_MAX) ? FEC_M_MAX : fec[1] };
+        client->fec_k = km[0];
+        client->fec_m = km[1];
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_FEC, km, 2);
+        LOG(LOG_INFO, "  [OK] FEC: %d paridades cada %d DATA\n", km[1], km[0]);
+    }
+
+    // con el ticket las próximas subidas no pasan por el HELLO (ver ticket.h)
+    if (opt_buscar(opts, opts_len, OPT_TICKET, 1)) {
+        Ticket t = { time(NULL) + TICKET_VIDA_SEG, client->ventana, client->sack, client->fec_k, client->fec_m };
+        uint8_t ticket[TICKET_LARGO];
+        ticket_emitir(clave_tickets, &t, ticket);
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_TICKET, ticket, TICKET_LARGO);
+    }
+
+    // WRQ en el mismo datagrama: su ACK sale detrás del del HELLO
+    int largo_wrq;
+    const uint8_t* wrq = opt_buscar_variable(opts, opts_len, OPT_WRQ, &largo_wrq);
+    if (wrq) {
+        uint8_t tomado = 1;
+        largo = opt_agregar(opciones, largo, sizeof(opciones), OPT_WRQ, &tomado, 1);
+    }
+    send_ack_opciones(w, client, 0, opciones, largo);
+    if (wrq) {
+        procesar_wrq_v2(w, client, (const char*)wrq, largo_wrq);
+    }
+}
+
+
+// abre (y preasigna) el archivo destino de un WRQ v1 o v2. datos = nombre + '\0'
+// + opciones TLV. Con OPT_RANGO la sesión se une a su grupo, que tiene el
+// archivo abierto. Con OPT_DELTA y un destino que ya existe se mapea el
+// anterior y se escribe en un temporal (ver delta.h). Devuelve NULL si quedó
+// abierto o el motivo del rechazo
+const char* abrir_archivo(ClientState* client, const char* datos, int largo) {
+    size_t len = strnlen(datos, largo);
+    if (len < 4 || len > 10) {
+        LOG(LOG_ERROR, "  [ERROR] Filename debe tener 4-10 caracteres\n");
+        return "Filename invalido (4-10 chars)";
+    }
+
+    // opciones detrás del '\0' del nombre: tamaño anunciado y rango
+    int opts_len = largo - (int)len - 1;
+    const char* opts = datos + len + 1;
+    const uint8_t* t = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_TAMANO, 8) : NULL;
+    const uint8_t* r = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_RANGO, sizeof(OptRango)) : NULL;
+    const uint8_t* id = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_REANUDAR, 8) : NULL;
+    const uint8_t* b = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_BLOQUE, 2) : NULL;
+    const uint8_t* delta = (opts_len > 0) ? opt_buscar(opts, opts_len, OPT_DELTA, 1) : NULL;
+    uint64_t tam = 0;
+    if (t) {
+        memcpy(&tam, t, 8);
+        tam = be64toh(tam);
+    }
+    uint16_t bloque = V2_DATA_SIZE;
+    if (b) {
+        memcpy(&bloque, b, 2);
+        bloque = ntohs(bloque);
+    }
+    if (client->ventana > 0 && (bloque < V2_BLOQUE_MIN || bloque > bloque_max)) {
+        LOG(LOG_ERROR, "  [ERROR] Bloque de %u bytes fuera de rango\n", bloque);
+        return "Bloque invalido";
+    }
+    client->bloque = bloque;
+    diario_cerrar(client->diario, client->filename, 0);     // WRQ repetido
+    client->diario = -1;
+    client->digest = 0;
+
+    if (r && client->grupo) {
+        // WRQ repetido de un rango: la sesión ya está en su grupo
+    } else if (r) {
+        if (client->fd >= 0) {
+            close(client->fd);
+            client->fd = -1;
+        }
+        OptRango rango;
+        memcpy(&rango, r, sizeof(OptRango));
+        memcpy(client->filename, datos, len);
+        client->filename[len] = '\0';
+
+        const char* error = NULL;
+        client->grupo = grupo_unirse(&grupos, &rango, client->filename, tam, &error);
+        if (!client->grupo) {
+            LOG(LOG_ERROR, "  [ERROR] %s\n", error);
+            return error;
+        }
+        client->fd = client->grupo->fd;
+        client->rango = ntohs(rango.indice);
+        client->base = be64toh(rango.desde);
+        LOG(LOG_INFO, "  [OK] Rango %u/%u desde el byte %llu\n", client->rango + 1, client->grupo->total,
+               (unsigned long long)client->base);
+    } else if (client->grupo) {
+        LOG(LOG_ERROR, "  [ERROR] WRQ sin rango en una sesion en paralelo\n");
+        return "Rango invalido";
+    } else {
+        if (client->fd >= 0) {
+            close(client->fd);      // WRQ repetido: el ACK anterior se perdió
+        }
+        previo_cerrar(client->previo, client->filename, 0);
+        client->previo = NULL;
+        memcpy(client->filename, datos, len);
+        client->filename[len] = '\0';
+        client->base = 0;
+        if (delta && !id && client->ventana > 0 && (client->previo = previo_abrir(client->filename))) {
+            client->fd = open(client->previo->temporal, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            LOG(LOG_INFO, "  [OK] Subida delta sobre %s (%llu bytes, firmas cada %u)\n", client->filename,
+                   (unsigned long long)client->previo->tam, client->previo->bloque);
+        } else if (id && t) {
+            memcpy(&client->id_reanudar, id, 8);
+            client->id_reanudar = be64toh(client->id_reanudar);
+            client->tamano = tam;
+            client->fd = abrir_reanudable(client->filename, client->id_reanudar, tam,
+                                          &client->base, &client->digest, &client->diario);
+            client->checkpoint = client->base;
+        } else {
+            client->fd = open(client->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+
+        if (client->fd < 0) {
+            perror("  [ERROR] open");
+            previo_cerrar(client->previo, client->filename, 0);
+            client->previo = NULL;
+            return "Error abriendo archivo";
+        }
+        preasignar_archivo(client->fd, tam);
+        if (client->base > 0) {
+            LOG(LOG_INFO, "  [OK] Reanudando %s desde el byte %llu\n", client->filename,
+                   (unsigned long long)client->base);
+        }
+    }
+    
+    if (client->ventana > 0) {
+        reensamblado_free(&client->reasm);
+        if (reensamblado_init(&client->reasm, client->ventana, client->bloque) != 0) {
+            perror("  [ERROR] reserva de ventana");
+            if (!client->grupo) {       // el fd del grupo se suelta al liberar la sesión
+                close(client->fd);
+                client->fd = -1;
+            }
+            return "Sin memoria para la ventana";
+        }
+        client->reasm.digest = client->digest;
+
+        fec_receptor_free(client->fec);
+        client->fec = NULL;
+        if (client->fec_k && !(client->fec = fec_receptor_nuevo(client->fec_k, client->fec_m,
+                                                               client->bloque, client->ventana))) {
+            LOG(LOG_AVISO, "  [WARN] Sin memoria para FEC: se sigue sin reconstruir\n");
+        }
+    }
+
+    LOG(LOG_INFO, "  [OK] Archivo abierto: %s\n", client->filename);
+    client->wrq_recibido = 1;
+    client->offset = client->base;
+    client->tam_final = client->base;   // reanudada sin datos pendientes: el FIN no debe truncar
+    client->error_escritura = 0;
+    return NULL;
+}
+
+
+void handle_wrq(Worker* w, App_PDU* pdu, ClientState* client, int bytes_recv) {
+    LOG(LOG_INFO, "  [WRQ] Filename: %s\n", pdu->data);
+    
+    if (!client->autenticado || client->version != 1) {
+        LOG(LOG_ERROR, "  [ERROR] Cliente no autenticado - descartando\n");
+        return;
+    }
+    if (client->pendientes > 0) {
+        LOG(LOG_AVISO, "  [WARN] WRQ con escrituras en curso - descartando\n");
+        return;
+    }
+    
+    const char* error = abrir_archivo(client, pdu->data, bytes_recv - PDU_HEADER_SIZE);
+    if (!error) {
+        client->last_seq = 1;
+    }
+    send_ack_wrq(w, client, 1, error);
+}
+
+
+// WRQ v2: el de un PDU o el que vino dentro del HELLO (OPT_WRQ)
+void procesar_wrq_v2(Worker* w, ClientState* client, const char* datos, int data_len) {
+    LOG(LOG_INFO, "  [WRQ] v2, sesion %08x\n", client->sesion);
+
+    if (!client->autenticado) {
+        LOG(LOG_ERROR, "  [ERROR] Cliente no autenticado - descartando\n");
+        return;
+    }
+    if (client->pendientes > 0) {
+        LOG(LOG_AVISO, "  [WARN] WRQ con escrituras en curso - descartando\n");
+        return;
+    }
+    if (client->descarga && client->wrq_recibido) {
+        send_ack_wrq(w, client, V2_SEQ_WRQ, NULL);      // WRQ delta repetido: las firmas ya salen
+        return;
+    }
+    if (client->wrq_recibido && client->tam_final > client->base) {
+        // repetido en una sesión con ticket, que manda DATA sin esperar el ACK
+        // del WRQ: si se reabriera se perdería lo ya confirmado
+        send_ack_wrq(w, client, V2_SEQ_WRQ, NULL);
+        return;
+    }
+    if (client->descarga) {
+        LOG(LOG_ERROR, "  [ERROR] WRQ en una sesion con una descarga en curso\n");
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, V2_SEQ_WRQ, "Descarga en curso");
+        return;
+    }
+
+    const char* error = abrir_archivo(client, datos, data_len);
+    if (error || !client->previo) {
+        send_ack_wrq(w, client, V2_SEQ_WRQ, error);
+        return;
+    }
+
+    // subida delta: el ACK sale cuando un escritor termine las firmas (firmas_listas)
+    Trabajo* t = pool_tomar(&w->pool);
+    if (!t) {
+        LOG(LOG_AVISO, "  [WARN] Sin buffers para las firmas de %s: se sube entero\n", client->filename);
+        send_ack_wrq(w, client, V2_SEQ_WRQ, NULL);
+        return;
+    }
+    t->calculo = delta_firmar;
+    t->arg = client->previo;
+    t->fd = -1;
+    t->len = 0;
+    t->sesion = client;
+    t->destino = &w->completados;
+    t->sig = w->a_escribir;
+    w->a_escribir = t;
+    client->pendientes++;
+}
+
+
+void handle_wrq_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    procesar_wrq_v2(w, client, pdu->data, data_len);
+}
+
+
+// copia el payload a un buffer del pool (descomprimiéndolo ahí mismo si vino
+// comprimido, o armándolo con el archivo previo si es una receta delta) y lo
+// deja listo para encolar al terminar el lote. El digest se arma con el
+// bloque ya armado. Devuelve los bytes a escribir o -1 si no hay buffers
+// (backpressure: no se ACKea) o el bloque comprimido o la receta no son válidos
+int encolar_escritura(Worker* w, ClientState* client, const char* data, int len, int flags,
+                      uint64_t offset, uint32_t seq, int es_v2) {
+    Trabajo* t = pool_tomar(&w->pool);
+    if (!t) {
+        LOG(LOG_AVISO, "  [WARN] Sin buffers de escritura - descartando (el cliente retransmite)\n");
+        metrica_sumar(M_SIN_BUFFERS, 1);
+        return -1;
+    }
+
+    if (flags & V2_DELTA) {
+        len = client->previo ? delta_aplicar(data, len, t->buf, client->bloque, client->previo) : -1;
+        if (len < 0) {
+            LOG(LOG_ERROR, "  [ERROR] DATA delta invalido - descartando\n");
+            pool_devolver(&w->pool, t);
+            return -1;
+        }
+    } else if (flags) {
+        len = lz_descomprimir(data, len, t->buf, es_v2 ? client->bloque : MAX_DATA_SIZE);
+        if (len < 0) {
+            LOG(LOG_ERROR, "  [ERROR] DATA comprimido invalido - descartando\n");
+            pool_devolver(&w->pool, t);
+            return -1;
+        }
+    } else {
+        memcpy(t->buf, data, len);
+    }
+    if (es_v2) {
+        reensamblado_anotar(&client->reasm, seq, t->buf, len);
+    } else {
+        client->digest = crc32c(client->digest, t->buf, len);
+    }
+
+    t->fd = client->fd;
+    t->offset = offset;
+    t->len = len;
+    t->seq = seq;
+    t->es_v2 = es_v2;
+    t->recibido = w->rx_reloj;
+    t->sesion = client;
+    t->destino = &w->completados;
+    t->sig = w->a_escribir;
+    w->a_escribir = t;
+
+    client->pendientes++;
+    if (offset + len > client->tam_final) {
+        client->tam_final = offset + len;
+    }
+    return len;
+}
+
+
+void handle_data(Worker* w, App_PDU* pdu, ClientState* client, int bytes_recv) {
+    LOG(LOG_DETALLE, "  [DATA] seq=%d, bytes=%d\n", pdu->seq_num, bytes_recv - PDU_HEADER_SIZE);
+    
+    if (!client->wrq_recibido || client->version != 1) {
+        LOG(LOG_ERROR, "  [ERROR] WRQ no recibido - descartando\n");
+        return;
+    }
+    if (client->ack_pendiente) {
+        LOG(LOG_AVISO, "  [WARN] Retransmision con la escritura en curso - el ACK sale al completarla\n");
+        metrica_sumar(M_DATA_DUPLICADOS, 1);
+        return;
+    }
+    
+    uint8_t expected_seq = (client->last_seq == 0) ? 1 : 0;
+    uint8_t seq = pdu->seq_num & ~V1_COMPRIMIDO;
+
+    if (seq != expected_seq) {
+        LOG(LOG_AVISO, "  [WARN] Seq incorrecto (esperaba %d) - reenviando ultimo ACK\n", expected_seq);
+        metrica_sumar(M_DATA_DUPLICADOS, 1);
+        send_ack(w, client, client->last_seq, NULL);
+        return;
+    }
+    
+    int data_len = encolar_escritura(w, client, pdu->data, bytes_recv - PDU_HEADER_SIZE,
+                                     pdu->seq_num & V1_COMPRIMIDO, client->offset, seq, 0);
+    if (data_len < 0) {
+        return;
+    }
+    client->offset += data_len;
+    client->last_seq = seq;
+
+    if (ack_durable) {
+        client->ack_pendiente = 1;
+    } else {
+        send_ack(w, client, seq, NULL);
+        tx_marcar_ack(w, w->rx_reloj);
+    }
+}
+
+
+// DATA v2 (modo ventana): se escribe directo en su offset y se ACKea
+// individualmente (al encolar o, con -d, cuando el pipeline lo completa).
+// data es el payload tal como viajó (comprimido si flags lo dice): del
+// datagrama o reconstruido por FEC
+void procesar_data_v2(Worker* w, ClientState* client, uint32_t seq, uint8_t flags, const char* data, int data_len) {
+    if (!client->wrq_recibido) {
+        LOG(LOG_ERROR, "  [ERROR] DATA v2 sin WRQ - descartando\n");
+        return;
+    }
+    if (client->descarga) {
+        soltar_descarga(client);    // el cliente ya tiene las firmas: vale por el ACK de su FIN
+    }
+
+    int res = reensamblado_recibir(&client->reasm, seq);
+    if (res < 0) {
+        LOG(LOG_AVISO, "  [WARN] seq=%u fuera de ventana (base=%u) - descartando\n", seq, client->reasm.base);
+        return;
+    }
+    if (res == 0 || res == 2) {
+        metrica_sumar(M_DATA_DUPLICADOS, 1);
+    }
+    if (res == 0) {
+        send_ack_data(w, client, seq);
+        return;
+    }
+    if (res == 2) {
+        return;     // duplicado de uno que se está escribiendo
+    }
+
+    if (data_len > client->bloque) {
+        LOG(LOG_AVISO, "  [WARN] DATA seq=%u de %d bytes con bloque de %u - descartando\n", seq, data_len, client->bloque);
+        client->reasm.estado[seq % client->reasm.tam] = SLOT_LIBRE;
+        return;
+    }
+    uint64_t offset = client->base + (uint64_t)seq * client->bloque;
+    if (encolar_escritura(w, client, data, data_len, flags & (V2_COMPRIMIDO | V2_DELTA), offset, seq, 1) < 0) {
+        client->reasm.estado[seq % client->reasm.tam] = SLOT_LIBRE;
+        return;
+    }
+    if (client->fec) {
+        fec_receptor_data(client->fec, seq, flags & (V2_COMPRIMIDO | V2_DELTA), data, data_len);
+    }
+
+    if (!ack_durable) {
+        reensamblado_completar(&client->reasm, seq);
+        send_ack_data(w, client, seq);
+        tx_marcar_ack(w, w->rx_reloj);
+    }
+}
+
+
+// si con lo recibido ya se puede, reconstruye los DATA que faltan del grupo
+// y los procesa como si hubieran llegado
+void fec_reconstruir(Worker* w, ClientState* client, uint32_t grupo) {
+    uint32_t seqs[FEC_M_MAX];
+    int n = fec_receptor_recuperar(client->fec, grupo, seqs);
+    for (int y = 0; y < n; y++) {
+        uint8_t flags;
+        int len;
+        const char* data = fec_recuperado(client->fec, y, &flags, &len);
+        if (data) {
+            LOG(LOG_DETALLE, "  [FEC] seq=%u reconstruido (%d bytes)\n", seqs[y], len);
+            metrica_sumar(M_FEC_RECUPERADOS, 1);
+            procesar_data_v2(w, client, seqs[y], flags, data, len);
+        }
+    }
+}
+
+
+void handle_data_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    uint32_t seq = ntohl(pdu->seq);
+    procesar_data_v2(w, client, seq, pdu->flags, pdu->data, data_len);
+    if (client->fec) {
+        fec_reconstruir(w, client, seq / client->fec->k);
+    }
+}
+
+
+// PARIDAD (FEC): se suma a su grupo, no lleva ACK
+void handle_paridad_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    if (!client->fec || !client->wrq_recibido) {
+        return;
+    }
+    if (fec_receptor_paridad(client->fec, ntohl(pdu->seq), (const uint8_t*)pdu->data, data_len) != 0) {
+        LOG(LOG_AVISO, "  [WARN] PARIDAD del grupo %u mal formada - descartando\n", ntohl(pdu->seq));
+        return;
+    }
+    fec_reconstruir(w, client, ntohl(pdu->seq));
+}
+
+
+// FIN con todas las escrituras terminadas: se recorta lo que fallocate
+// reservó de más, se cierra el archivo y se confirma. En una subida en
+// paralelo el recorte lo hace el grupo cuando termina el último rango
+void cerrar_transferencia(Worker* w, ClientState* client) {
+    client->fin_pendiente = 0;
+
+    if (client->error_escritura) {
+        LOG(LOG_ERROR, "  [ERROR] %s quedo incompleto por errores de escritura\n", client->filename);
+        if (client->version == V2_VERSION) {
+            send_ack_v2(w, &client->addr, client->addr_len, client->sesion, client->fin_seq,
+                        "Error escribiendo archivo");
+        } else {
+            send_ack(w, client, client->fin_seq, "Error escribiendo archivo");
+        }
+        return;
+    }
+
+    if (client->grupo) {
+        if (grupo_terminar(&grupos, client->grupo, client->rango, client->tam_final)) {
+            LOG(LOG_INFO, "  [OK] Archivo completo: %s (%u rangos)\n", client->filename, client->grupo->total);
+        } else {
+            LOG(LOG_INFO, "  [OK] Rango %u/%u de %s terminado\n", client->rango + 1, client->grupo->total,
+                   client->filename);
+        }
+    } else if (ftruncate(client->fd, client->tam_final) < 0) {
+        perror("  [ERROR] ftruncate");
+    }
+    previo_cerrar(client->previo, client->filename, 1);     // delta: el temporal pasa a ser el destino
+    client->previo = NULL;
+    diario_cerrar(client->diario, client->filename, 1);
+    client->diario = -1;
+
+    if (client->version == V2_VERSION) {
+        LOG(LOG_INFO, "  [OK] Archivo cerrado: %s (%u paquetes)\n", client->filename, client->fin_seq);
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, client->fin_seq, NULL);
+    } else {
+        LOG(LOG_INFO, "  [OK] Archivo cerrado: %s\n", client->filename);
+        send_ack(w, client, client->fin_seq, NULL);
+    }
+    LOG(LOG_INFO, "  [OK] Sesion completada\n");
+    release_client(client);
+}
+
+
+// compara el digest del FIN (si lo trae: un cliente viejo no lo manda) con
+// el de lo recibido. Si no coincide el archivo no sirve: se borra el diario,
+// que lo daría por bueno al reanudar, y el FIN se rechaza (también si se repite)
+int digest_valido(ClientState* client, const char* datos, int largo) {
+    uint32_t esperado;
+    if (!fin_digest(datos, largo, &esperado)) {
+        return 1;
+    }
+
+    uint32_t calculado = digest_recibido(client);
+    if (esperado != calculado) {
+        LOG(LOG_ERROR, "  [ERROR] Digest de %s no coincide (cliente %08x, recibido %08x)\n",
+               client->filename, esperado, calculado);
+        diario_cerrar(client->diario, client->filename, 1);
+        client->diario = -1;
+        return 0;
+    }
+    LOG(LOG_INFO, "  [OK] Digest %08x verificado\n", calculado);
+    return 1;
+}
+
+
+void handle_fin_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    uint32_t seq = ntohl(pdu->seq);
+    LOG(LOG_INFO, "  [FIN] v2, seq=%u\n", seq);
+
+    if (!client->wrq_recibido) {
+        LOG(LOG_ERROR, "  [ERROR] FIN v2 sin WRQ - descartando\n");
+        return;
+    }
+
+    // con ACK durable base solo avanza sobre lo escrito: el FIN espera a
+    // que el pipeline devuelva todo (el cliente lo retransmite mientras tanto)
+    if (seq != client->reasm.base) {
+        LOG(LOG_AVISO, "  [WARN] FIN antes de completar los datos (base=%u) - descartando\n", client->reasm.base);
+        return;
+    }
+    if (!digest_valido(client, pdu->data, data_len)) {
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, seq, "Digest del archivo incorrecto");
+        return;
+    }
+
+    client->fin_seq = seq;
+    client->fin_pendiente = 1;
+    if (client->pendientes == 0) {
+        cerrar_transferencia(w, client);
+    }
+}
+
+
+void handle_fin(Worker* w, App_PDU* pdu, ClientState* client, int bytes_recv) {
+    LOG(LOG_INFO, "  [FIN] seq=%d\n", pdu->seq_num);
+    
+    if (client->fd < 0) {
+        send_ack(w, client, pdu->seq_num, NULL);
+        release_client(client);
+        return;
+    }
+    if (!digest_valido(client, pdu->data, bytes_recv - PDU_HEADER_SIZE)) {
+        send_ack(w, client, pdu->seq_num, "Digest del archivo incorrecto");
+        return;
+    }
+    
+    client->fin_seq = pdu->seq_num;
+    client->fin_pendiente = 1;
+    if (client->pendientes == 0) {
+        cerrar_transferencia(w, client);
+    }
+}
+
+
+// ---------------------------------------------------------------------------
+// descargas (RRQ): el worker envía, el cliente confirma (ver descarga.h)
+// ---------------------------------------------------------------------------
+
+// mapea el archivo de un RRQ. datos = nombre + '\0' + opciones (OPT_BLOQUE).
+// Devuelve NULL si quedó abierto o el motivo del rechazo
+const char* abrir_descarga(ClientState* client, const char* datos, int largo) {
+    size_t len = strnlen(datos, largo);
+    if (len < 4 || len > 10 || memchr(datos, '/', len)) {
+        LOG(LOG_ERROR, "  [ERROR] Filename debe tener 4-10 caracteres y no ser una ruta\n");
+        return "Filename invalido (4-10 chars)";
+    }
+
+    int opts_len = largo - (int)len - 1;
+    const uint8_t* b = (opts_len > 0) ? opt_buscar(datos + len + 1, opts_len, OPT_BLOQUE, 2) : NULL;
+    uint16_t bloque = V2_DATA_SIZE;
+    if (b) {
+        memcpy(&bloque, b, 2);
+        bloque = ntohs(bloque);
+    }
+    if (bloque < V2_BLOQUE_MIN || bloque > bloque_max) {
+        LOG(LOG_ERROR, "  [ERROR] Bloque de %u bytes fuera de rango\n", bloque);
+        return "Bloque invalido";
+    }
+
+    memcpy(client->filename, datos, len);
+    client->filename[len] = '\0';
+    client->descarga = descarga_abrir(client->filename, bloque, client->ventana);
+    if (!client->descarga) {
+        int err = errno;
+        perror("  [ERROR] open");
+        return (err == ENOENT) ? "Archivo inexistente" : "Error abriendo archivo";
+    }
+    client->descarga->dueno = client;
+    client->bloque = bloque;
+    LOG(LOG_INFO, "  [OK] Descarga de %s: %llu bytes en %u paquetes de %u\n", client->filename,
+           (unsigned long long)client->descarga->tam, client->descarga->total, bloque);
+    return NULL;
+}
+
+
+// ACK del RRQ: '\0' + OPT_TAMANO
+void send_ack_rrq(Worker* w, ClientState* client) {
+    char opciones[16];
+    uint64_t tam = htobe64(client->descarga->tam);
+    int largo = opt_agregar(opciones, 0, sizeof(opciones), OPT_TAMANO, &tam, 8);
+    send_ack_v2_opciones(w, client, V2_SEQ_WRQ, opciones, largo);
+}
 
 
-ClientState* find_or_create_client(struct sockaddr_in* addr, socklen_t addr_len) {
-    int empty_slot = -1;
-    
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].activo) {
-            if (clients[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
-                clients[i].addr.sin_port == addr->sin_port) {
-                return &clients[i];
-            }
-        } else if (empty_slot == -1) {
-            empty_slot = i;
+// (re)envía el DATA seq: el header sellado se copia al lote (el slot se
+// puede volver a sellar antes de que el lote salga) y el payload va del mapa
+void descarga_enviar(Worker* w, ClientState* client, uint32_t seq, uint64_t ahora) {
+    Descarga* d = client->descarga;
+    SlotDescarga* s = &d->slots[seq % d->ventana];
+    int len;
+    const char* payload = descarga_bloque(d, seq, &len);
+
+    memcpy(tx_siguiente(w), s->header, V2_HEADER_SIZE);
+    tx_agregar_payload(w, V2_HEADER_SIZE, payload, len, &client->addr, client->addr_len);
+    s->intentos++;
+    s->diferido = 0;
+    s->siguiente = d->next_seq;
+    s->enviado_us = ahora;
+    s->vence_us = ahora + d->rtt.rto_us;
+    pacer_consumir(&d->pacer, V2_HEADER_SIZE + len);
+}
+
+
+void descarga_enviar_fin(Worker* w, ClientState* client, uint64_t ahora) {
+    Descarga* d = client->descarga;
+
+    memcpy(tx_siguiente(w), &d->fin_pdu, d->fin_len);
+    tx_agregar(w, d->fin_len, &client->addr, client->addr_len);
+    d->fin_slot.intentos++;
+    d->fin_slot.enviado_us = ahora;
+    d->fin_slot.vence_us = ahora + d->rtt.rto_us;
+}
+
+
+// llena la ventana con DATA nuevos, mientras lo permitan cwnd y el pacer, y,
+// con todo confirmado, envía el FIN con el digest. Lo nuevo vence después de
+// lo que ya estaba en vuelo: el plazo de la descarga solo cambia si no tenía
+// uno, o si el pacer pide volver antes
+void descarga_avanzar(Worker* w, ClientState* client) {
+    Descarga* d = client->descarga;
+    uint64_t ahora = get_monotonic_us();
+    uint64_t espera_pacing = 0;
+    int enviados = 0;
+
+    descarga_tasa(d);
+    while (d->next_seq != d->total && d->next_seq - d->base < cc_ventana(&d->cc)) {
+        espera_pacing = pacer_espera_us(&d->pacer, descarga_datagrama(d), ahora);
+        if (espera_pacing > 0) {
+            d->pacer.esperas++;
+            break;
         }
+        int len;
+        descarga_bloque(d, d->next_seq, &len);
+        descarga_sellar(d, client->sesion, d->next_seq);
+        descarga_enviar(w, client, d->next_seq, ahora);
+        metrica_sumar(M_BYTES_DESCARGADOS, len);
+        d->next_seq++;
+        d->cc.next_seq = d->next_seq;
+        enviados++;
     }
-    
-    if (empty_slot != -1) {
-        memset(&clients[empty_slot], 0, sizeof(ClientState));
-        clients[empty_slot].activo = 1;
-        clients[empty_slot].addr = *addr;
-        clients[empty_slot].addr_len = addr_len;
-        
-        char ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
-        printf("[NUEVO] Cliente %s:%d en slot %d\n", 
-               ip, ntohs(addr->sin_port), empty_slot);
-        
-        return &clients[empty_slot];
+
+    if (d->base == d->total && d->fin_len == 0) {
+        LOG(LOG_INFO, "  [FIN] Descarga de %s enviada, digest %08x\n", client->filename, d->digest);
+        d->fin_len = v2_sellar(&d->fin_pdu, FIN, client->sesion, d->total,
+                               fin_con_digest(d->fin_pdu.data, V2_DATA_SIZE, d->digest));
+        descarga_enviar_fin(w, client, ahora);
+        enviados++;
+    }
+
+    uint64_t vence = (espera_pacing > 0) ? ahora + espera_pacing : ahora + d->rtt.rto_us;
+    if ((enviados > 0 || espera_pacing > 0) && plazos_adelantar(&w->plazos, d, vence) != 0) {
+        LOG(LOG_ERROR, "  [ERROR] Sin memoria para el timer de %s (expira por inactividad)\n", client->filename);
     }
-    
-    return NULL;
 }
 
 
-void release_client(ClientState* client) {
-    if (client->file) {
-        fclose(client->file);
-        client->file = NULL;
+// RRQ v2: nombre + '\0' + opciones. La sesión queda dedicada a la descarga;
+// detrás del ACK (con el tamaño) salen los primeros DATA
+void handle_rrq_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    LOG(LOG_INFO, "  [RRQ] v2, sesion %08x: %.*s\n", client->sesion, data_len, pdu->data);
+
+    if (!client->autenticado) {
+        LOG(LOG_ERROR, "  [ERROR] Cliente no autenticado - descartando\n");
+        return;
+    }
+    if (client->descarga && !client->wrq_recibido) {
+        send_ack_rrq(w, client);    // RRQ repetido: el ACK anterior se perdió
+        return;
+    }
+    if (client->wrq_recibido || client->pendientes > 0) {
+        LOG(LOG_ERROR, "  [ERROR] RRQ en una sesion con una subida en curso\n");
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, V2_SEQ_WRQ, "Subida en curso");
+        return;
+    }
+
+    const char* error = abrir_descarga(client, pdu->data, data_len);
+    if (error) {
+        send_ack_v2(w, &client->addr, client->addr_len, client->sesion, V2_SEQ_WRQ, error);
+        return;
     }
-    memset(client, 0, sizeof(ClientState));
+    send_ack_rrq(w, client);
+    descarga_avanzar(w, client);
 }
 
 
-void send_ack(int socket, ClientState* client, uint8_t seq_num, const char* error_msg) {
-    App_PDU ack;
-    memset(&ack, 0, sizeof(App_PDU));
-    ack.type = ACK;
-    ack.seq_num = seq_num;
-    
-    int data_len = 0;
-    if (error_msg) {
-        strncpy(ack.data, error_msg, MAX_DATA_SIZE - 1);
-        data_len = strlen(error_msg) + 1;
+// las firmas del archivo previo están listas: sale el ACK del WRQ con
+// OPT_DELTA y detrás las firmas, con la maquinaria de las descargas. La
+// sesión sigue siendo una subida: el primer DATA da por terminada la descarga
+void firmas_listas(Worker* w, ClientState* client) {
+    ArchivoPrevio* p = client->previo;
+    client->descarga = descarga_memoria(p->firmas, p->largo, client->bloque, client->ventana);
+    if (!client->descarga) {
+        LOG(LOG_AVISO, "  [WARN] Sin memoria para enviar las firmas de %s: se sube entero\n", client->filename);
+        send_ack_wrq(w, client, V2_SEQ_WRQ, NULL);
+        return;
     }
-    
-    sendto(socket, &ack, PDU_HEADER_SIZE + data_len, 0,
-           (struct sockaddr*)&client->addr, client->addr_len);
-    
-    printf("  -> ACK enviado (seq=%d)\n", seq_num);
+    client->descarga->dueno = client;
+    LOG(LOG_INFO, "  [OK] Firmas de %s: %zu bytes en %u paquetes\n", client->filename, p->largo,
+           client->descarga->total);
+    send_ack_wrq(w, client, V2_SEQ_WRQ, NULL);
+    descarga_avanzar(w, client);
 }
 
 
-void handle_hello(int socket, App_PDU* pdu, ClientState* client) {
-    printf("  [HELLO] Credencial: %s\n", pdu->data);
-    
-    if (strcmp(pdu->data, "g23-889d") == 0) {
-        printf("  [OK] Credencial valida\n");
-        client->autenticado = 1;
-        client->last_seq = 0;
-        send_ack(socket, client, 0, NULL);
-    } else {
-        printf("  [ERROR] Credencial invalida\n");
-        send_ack(socket, client, 0, "Credencial invalida");
+// reenvía ya los huecos: DATA con DESCARGA_SACK_UMBRAL posteriores confirmados
+// y más de un RTT (con margen para reordenamientos) desde su envío. Devuelve
+// -1 si un PDU agotó los reintentos y la sesión se cerró
+int descarga_huecos(Worker* w, ClientState* client) {
+    Descarga* d = client->descarga;
+    uint64_t ahora = get_monotonic_us();
+    uint64_t reorden_us = d->rtt.srtt_us + d->rtt.srtt_us / 4;
+
+    for (uint32_t seq = d->base; seq != d->next_seq && (int32_t)(d->mayor - seq) >= DESCARGA_SACK_UMBRAL; seq++) {
+        SlotDescarga* s = &d->slots[seq % d->ventana];
+        if (s->confirmado || (int32_t)(d->mayor - s->siguiente) < DESCARGA_SACK_UMBRAL - 1 ||
+            ahora - s->enviado_us < reorden_us) {
+            continue;
+        }
+        if (s->intentos >= DESCARGA_REINTENTOS) {
+            LOG(LOG_ERROR, "  [ERROR] Descarga de %s: seq=%u sin ACK después de %d intentos - cerrando\n",
+                   client->filename, seq, DESCARGA_REINTENTOS);
+            release_client(client);
+            return -1;
+        }
+        cc_perdida(&d->cc, seq, 0);
+        LOG(LOG_DETALLE, "  [HUECO] %s seq=%u - reintento %d sin esperar el timer\n", client->filename, seq, s->intentos);
+        descarga_enviar(w, client, seq, ahora);
+        d->retransmisiones++;
+        metrica_sumar(M_RETRANSMISIONES, 1);
     }
+    return 0;
 }
 
 
-void handle_wrq(int socket, App_PDU* pdu, ClientState* client) {
-    printf("  [WRQ] Filename: %s\n", pdu->data);
-    
-    if (!client->autenticado) {
-        printf("  [ERROR] Cliente no autenticado - descartando\n");
+// ACK de un DATA o del FIN de la descarga. Con payload que no empieza con
+// '\0' es un error del cliente (no pudo escribir, digest incorrecto): se corta
+void handle_ack_v2(Worker* w, PDU_v2* pdu, ClientState* client, int data_len) {
+    Descarga* d = client->descarga;
+    uint32_t seq = ntohl(pdu->seq);
+
+    if (!d) {
+        LOG(LOG_AVISO, "  [WARN] ACK sin descarga en curso - descartando\n");
         return;
     }
-    
-    size_t len = strlen(pdu->data);
-    if (len < 4 || len > 10) {
-        printf("  [ERROR] Filename debe tener 4-10 caracteres\n");
-        send_ack(socket, client, 1, "Filename invalido (4-10 chars)");
+    if (data_len > 0 && pdu->data[0] != '\0') {
+        LOG(LOG_ERROR, "  [ERROR] El cliente corta la descarga de %s: %.*s\n", client->filename, data_len, pdu->data);
+        release_client(client);
         return;
     }
-    
-    strncpy(client->filename, pdu->data, sizeof(client->filename) - 1);
-    client->file = fopen(client->filename, "wb");
-    
-    if (!client->file) {
-        perror("  [ERROR] fopen");
-        send_ack(socket, client, 1, "Error abriendo archivo");
+
+    if (d->fin_len > 0 && seq == d->total && client->wrq_recibido) {
+        LOG(LOG_INFO, "  [OK] Firmas de %s entregadas (%d retransmisiones)\n", client->filename, d->retransmisiones);
+        soltar_descarga(client);
+        return;
+    }
+    if (d->fin_len > 0 && seq == d->total) {
+        double segundos = (get_monotonic_us() - d->inicio_us) / 1e6;
+        LOG(LOG_INFO, "  [OK] Descarga completa: %s (%u paquetes, %d retransmisiones, %.3f s)\n",
+               client->filename, d->total, d->retransmisiones, segundos);
+        LOG(LOG_INFO, "  [OK] Sesion completada\n");
+        release_client(client);
         return;
     }
-    
-    printf("  [OK] Archivo abierto: %s\n", client->filename);
-    client->wrq_recibido = 1;
-    client->last_seq = 1;
-    send_ack(socket, client, 1, NULL);
-}
-
 
-void handle_data(int socket, App_PDU* pdu, ClientState* client, int bytes_recv) {
-    printf("  [DATA] seq=%d, bytes=%d\n", pdu->seq_num, bytes_recv - PDU_HEADER_SIZE);
-    
-    if (!client->wrq_recibido) {
-        printf("  [ERROR] WRQ no recibido - descartando\n");
+    // fuera de [base, next_seq): un ACK repetido de algo ya deslizado
+    if (seq - d->base >= d->next_seq - d->base) {
         return;
     }
-    
-    uint8_t expected_seq = (client->last_seq == 0) ? 1 : 0;
+    SlotDescarga* s = &d->slots[seq % d->ventana];
+    if (s->confirmado) {
+        return;
+    }
+    uint64_t muestra = 0;
+    if (s->intentos == 1) {
+        muestra = get_monotonic_us() - s->enviado_us;   // regla de Karn
+        rtt_muestra(&d->rtt, muestra);
+    }
+    s->confirmado = 1;
+    s->diferido = 0;
+    cc_ack(&d->cc, seq, muestra);
+    if ((int32_t)(seq - d->mayor) > 0) {
+        d->mayor = seq;
+    }
 
-    sleep(1);
-    
-    if (pdu->seq_num != expected_seq) {
-        printf("  [WARN] Seq incorrecto (esperaba %d) - reenviando ultimo ACK\n", expected_seq);
-        send_ack(socket, client, client->last_seq, NULL);
+    while (d->base != d->next_seq && d->slots[d->base % d->ventana].confirmado) {
+        d->base++;
+    }
+    if (descarga_huecos(w, client) != 0) {
         return;
     }
-    
-    int data_len = bytes_recv - PDU_HEADER_SIZE;
-    size_t written = fwrite(pdu->data, 1, data_len, client->file);
-    printf("  [OK] Escritos %zu bytes\n", written);
-    
-    client->last_seq = pdu->seq_num;
-    send_ack(socket, client, pdu->seq_num, NULL);
+    descarga_avanzar(w, client);
 }
 
 
-void handle_fin(int socket, App_PDU* pdu, ClientState* client) {
-    printf("  [FIN] seq=%d\n", pdu->seq_num);
-    
-    if (client->file) {
-        fclose(client->file);
-        client->file = NULL;
-        printf("  [OK] Archivo cerrado: %s\n", client->filename);
+// venció el plazo de una descarga (ya fuera del heap): lo vencido se da por
+// perdido con un solo backoff por ronda, como en el cliente, y se reenvía de
+// a lo sumo cwnd PDUs y al ritmo del pacer. Lo que no entra queda diferido
+// (sin otro backoff) hasta que el pacer tenga tokens o, si se llegó al tope,
+// un RTT después. Si un PDU agota los reintentos el cliente se da por caído
+void descarga_vencida(Worker* w, Descarga* d, uint64_t ahora) {
+    ClientState* client = d->dueno;
+    int hubo_timeout = 0;
+
+    for (uint32_t seq = d->base; seq != d->next_seq; seq++) {
+        SlotDescarga* s = &d->slots[seq % d->ventana];
+        if (s->confirmado || s->diferido || ahora < s->vence_us) {
+            continue;
+        }
+        if (s->intentos >= DESCARGA_REINTENTOS) {
+            LOG(LOG_ERROR, "  [ERROR] Descarga de %s: seq=%u sin ACK después de %d intentos - cerrando\n",
+                   client->filename, seq, DESCARGA_REINTENTOS);
+            release_client(client);
+            return;
+        }
+        if (!hubo_timeout) {
+            rtt_backoff(&d->rtt);
+            hubo_timeout = 1;
+        }
+        cc_perdida(&d->cc, seq, s->intentos > 1);
+        s->diferido = 1;
+    }
+
+    descarga_tasa(d);
+    uint32_t tope = cc_ventana(&d->cc);
+    uint32_t reenviados = 0;
+    uint64_t espera_pacing = 0;
+    for (uint32_t seq = d->base; seq != d->next_seq; seq++) {
+        SlotDescarga* s = &d->slots[seq % d->ventana];
+        if (s->confirmado || !s->diferido || ahora < s->vence_us) {
+            continue;
+        }
+        if (reenviados < tope && espera_pacing == 0) {
+            espera_pacing = pacer_espera_us(&d->pacer, descarga_datagrama(d), ahora);
+        }
+        if (reenviados >= tope || espera_pacing > 0) {
+            uint64_t rtt_us = (uint64_t)(d->rtt.con_muestras ? d->rtt.srtt_us : d->rtt.rto_us);
+            s->vence_us = ahora + ((espera_pacing > 0) ? espera_pacing : rtt_us);
+            continue;
+        }
+        LOG(LOG_DETALLE, "  [TIMEOUT] %s seq=%u - reintento %d (RTO=%d ms)\n",
+               client->filename, seq, s->intentos, rtt_rto_ms(&d->rtt));
+        descarga_enviar(w, client, seq, ahora);
+        reenviados++;
+        d->retransmisiones++;
+        metrica_sumar(M_RETRANSMISIONES, 1);
+    }
+    if (espera_pacing > 0) {
+        d->pacer.esperas++;
+    }
+
+    if (d->fin_len > 0 && ahora >= d->fin_slot.vence_us) {
+        if (d->fin_slot.intentos >= DESCARGA_REINTENTOS) {
+            // el cliente ya tiene todo: solo se perdieron los ACK del FIN
+            LOG(LOG_AVISO, "  [WARN] FIN de %s sin ACK después de %d intentos - cerrando\n",
+                   client->filename, DESCARGA_REINTENTOS);
+            if (client->wrq_recibido) {
+                soltar_descarga(client);    // firmas de una subida delta: la subida sigue
+            } else {
+                release_client(client);
+            }
+            return;
+        }
+        if (!hubo_timeout) {
+            rtt_backoff(&d->rtt);
+        }
+        descarga_enviar_fin(w, client, ahora);
+        d->retransmisiones++;
+        metrica_sumar(M_RETRANSMISIONES, 1);
+    }
+
+    descarga_avanzar(w, client);    // el plazo también puede ser una espera del pacer
+    uint64_t proximo = descarga_proximo(d);
+    if (proximo != UINT64_MAX && plazos_adelantar(&w->plazos, d, proximo) != 0) {
+        LOG(LOG_ERROR, "  [ERROR] Sin memoria para el timer de %s (expira por inactividad)\n", client->filename);
     }
-    
-    send_ack(socket, client, pdu->seq_num, NULL);
-    printf("  [OK] Sesion completada\n");
-    release_client(client);
 }
 
 
-int main(int argc, char* argv[]) {
-    printf("\n*==========================================*\n");
-    printf("|  SERVIDOR STOP & WAIT                    |\n");
-    printf("*==========================================*\n");
-    printf("|  Puerto: %-30s |\n", SERVER_PORT);
-    printf("|  Max clientes: %-24d |\n", MAX_CLIENTS);
-    printf("*==========================================*\n");
-    
-    memset(clients, 0, sizeof(clients));
-    
+// trabajos que devolvió el pipeline: con ACK durable recién ahora se confirman
+void procesar_completados(Worker* w) {
+    Trabajo* t = completados_drenar(&w->completados);
+
+    while (t) {
+        Trabajo* sig = t->sig;
+        ClientState* client = t->sesion;
+        client->pendientes--;
+
+        if (t->calculo) {
+            firmas_listas(w, client);
+        } else if (t->diario >= 0) {
+            // checkpoint: no lleva ACK y si falló solo se pierde poder reanudar desde ahí
+            if (t->error) {
+                fprintf(stderr, "  [ERROR] diario de %s: %s\n", client->filename, strerror(t->error));
+            }
+        } else {
+            if (t->error) {
+                fprintf(stderr, "  [ERROR] pwrite %s: %s\n", client->filename, strerror(t->error));
+                client->error_escritura = 1;
+                metrica_sumar(M_ERRORES_ESCRITURA, 1);
+            } else {
+                metrica_sumar(M_BYTES_ESCRITOS, t->len);
+            }
+
+            if (t->es_v2) {
+                if (ack_durable && !t->error) {
+                    reensamblado_completar(&client->reasm, t->seq);
+                    send_ack_data(w, client, t->seq);
+                    tx_marcar_ack(w, t->recibido);
+                }
+            } else if (ack_durable) {
+                client->ack_pendiente = 0;
+                send_ack(w, client, t->seq, t->error ? "Error escribiendo archivo" : NULL);
+                tx_marcar_ack(w, t->recibido);
+            }
+        }
+
+        pool_devolver(&w->pool, t);
+        if (client->fin_pendiente && client->pendientes == 0) {
+            cerrar_transferencia(w, client);
+        } else {
+            encolar_checkpoint(w, client, 0);
+        }
+        t = sig;
+    }
+}
+
+
+// socket UDP del worker. Con más de un worker todos hacen bind al mismo
+// puerto con SO_REUSEPORT y el kernel balancea entre ellos
+int crear_socket(int reuseport) {
     int s;
     struct addrinfo hints, *servinfo;
     
@@ -188,88 +1526,509 @@ int main(int argc, char* argv[]) {
     
     if (getaddrinfo(NULL, SERVER_PORT, &hints, &servinfo) != 0) {
         perror("getaddrinfo");
-        return 1;
+        return -1;
     }
     
     s = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
     if (s < 0) {
         perror("socket");
         freeaddrinfo(servinfo);
-        return 1;
+        return -1;
     }
     
     int opt = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(s);
+        freeaddrinfo(servinfo);
+        return -1;
+    }
     
     if (bind(s, servinfo->ai_addr, servinfo->ai_addrlen) < 0) {
         perror("bind");
         close(s);
         freeaddrinfo(servinfo);
-        return 1;
+        return -1;
     }
     
-    printf("\nServidor escuchando en puerto %s\n\n", SERVER_PORT);
     freeaddrinfo(servinfo);
+    buffer_rx = agrandar_buffer_rx(s);
+    return s;
+}
+
+
+// programa BPF del grupo SO_REUSEPORT: un PDU v2 va al socket cuyo índice es
+// el byte bajo de su id de sesión (el worker que la creó), esté donde esté el
+// cliente. Para v1 devuelve un índice inválido y el kernel usa el hash del
+// 4-tupla de siempre. El programa ve el payload UDP desde el offset 0
+int filtro_reuseport(int socket) {
+    struct sock_filter codigo[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 1),                   // A = 2do byte
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, V2_FLAG, 0, 2),     // ¿V2_FLAG?
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 7),                   // A = byte bajo del id (network order)
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+    };
+    struct sock_fprog prog = { sizeof(codigo) / sizeof(codigo[0]), codigo };
+
+    if (setsockopt(socket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt(SO_ATTACH_REUSEPORT_CBPF)");
+        return -1;
+    }
+    return 0;
+}
+
+
+// WRQ de una sesión que no pasó por el HELLO: el id lo eligió el cliente y el
+// WRQ trae el ticket de un HELLO anterior con lo negociado. existente = la
+// sesión que ya tiene ese id. Devuelve la sesión (nueva, o existente si la
+// abrió este mismo ticket o el WRQ no trae ticket), o NULL con el error ya
+// en el lote de salida
+ClientState* sesion_con_ticket(Worker* w, PDU_v2* pdu, int data_len, struct sockaddr_in* client_addr,
+                               ClientState* existente) {
+    uint32_t id = ntohl(pdu->sesion);
+    size_t len = strnlen(pdu->data, data_len);
+    int opts_len = data_len - (int)len - 1;
+    const uint8_t* buf = (opts_len > 0) ? opt_buscar(pdu->data + len + 1, opts_len, OPT_TICKET, TICKET_LARGO) : NULL;
+    if (!buf) {
+        return existente;
+    }
+    uint64_t mac;
+    memcpy(&mac, buf + TICKET_DATOS, 8);
+    if (existente && existente->ticket == mac) {
+        return existente;       // WRQ repetido
+    }
+
+    Ticket t;
+    const char* error = NULL;
+    if (existente) {
+        error = TICKET_ID_EN_USO;       // el id que eligió el cliente es de otra sesión
+    } else if (ticket_verificar(clave_tickets, buf, time(NULL), &t) != 0) {
+        error = "Ticket invalido o vencido";
+    } else if (id == 0 || (id & 0xFF) != (uint32_t)w->id) {
+        error = "Id de sesion de otro worker";
+    }
+    if (!error && tabla_buscar(&w->tabla, clave_sesion(client_addr))) {
+        error = "Direccion con otra sesion";
+    }
+    ClientState* client = NULL;
+    if (!error && !(client = find_or_create_client(w, client_addr, sizeof(struct sockaddr_in)))) {
+        error = "Servidor lleno";
+    } else if (!error && tabla_insertar(&w->tabla, clave_id_sesion(id), client) != 0) {
+        release_client(client);
+        error = "Servidor sin memoria";
+    }
+    if (error) {
+        LOG(LOG_ERROR, "  [ERROR] WRQ con ticket, sesion %08x: %s\n", id, error);
+        metrica_sumar(M_TICKETS_RECHAZADOS, 1);
+        send_ack_v2(w, client_addr, sizeof(struct sockaddr_in), id, V2_SEQ_WRQ, error);
+        return NULL;
+    }
+
+    client->sesion = id;
+    client->ticket = mac;
+    client->autenticado = 1;
+    client->version = V2_VERSION;
+    client->ventana = (t.ventana == 0) ? 1 : (t.ventana > VENTANA_MAX) ? VENTANA_MAX : t.ventana;
+    client->sack = t.sack;
+    client->fec_k = (t.fec_k > FEC_K_MAX) ? FEC_K_MAX : t.fec_k;
+    client->fec_m = (t.fec_m > FEC_M_MAX) ? FEC_M_MAX : t.fec_m;
+    metrica_sumar(M_SESIONES_TICKET, 1);
+    LOG(LOG_INFO, "  [OK] Sesion %08x con ticket (sin HELLO), ventana %d PDUs\n", id, client->ventana);
+    return client;
+}
+
+
+// PDU v2: la sesión se busca por id, no por dirección. Si el cliente cambió
+// de IP/puerto (rebinding de NAT) se actualiza la dirección de la sesión
+void despachar_v2(Worker* w, PDU_v2* pdu, int received, struct sockaddr_in* client_addr) {
+    int data_len = v2_verificar(pdu, received);
+    if (data_len < 0) {
+        return;     // truncado o CRC inválido: se trata como pérdida
+    }
+
+    uint32_t id = ntohl(pdu->sesion);
+    ClientState* client = tabla_buscar(&w->tabla, clave_id_sesion(id));
+    if (pdu->type == WRQ) {
+        client = sesion_con_ticket(w, pdu, data_len, client_addr, client);
+    }
+    if (!client) {
+        // el ACK del FIN se perdió y la sesión ya se liberó: se vuelve a confirmar
+        if (pdu->type == FIN) {
+            send_ack_v2(w, client_addr, sizeof(struct sockaddr_in), id, ntohl(pdu->seq), NULL);
+        }
+        return;
+    }
+
+    if (clave_sesion(client_addr) != clave_sesion(&client->addr)) {
+        if (pdu->flags & V2_TEMPRANO) {
+            return;     // de un cliente con ticket que eligió el id de esta sesión (ver ticket.h)
+        }
+        TablaSesiones* t = &w->tabla;
+        if (tabla_buscar(t, clave_sesion(&client->addr)) == client) {
+            tabla_borrar(t, clave_sesion(&client->addr));
+        }
+        if (!tabla_buscar(t, clave_sesion(client_addr))) {
+            tabla_insertar(t, clave_sesion(client_addr), client);
+        }
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr->sin_addr, ip, sizeof(ip));
+        LOG(LOG_INFO, "[NAT] Sesion %08x ahora desde %s:%d\n", id, ip, ntohs(client_addr->sin_port));
+        client->addr = *client_addr;
+    }
+    client->ultimo_tick = w->rueda.tick_actual;
+
+    switch (pdu->type) {
+        case WRQ:
+            handle_wrq_v2(w, pdu, client, data_len);
+            break;
+        case DATA:
+            handle_data_v2(w, pdu, client, data_len);
+            break;
+        case PARIDAD:
+            handle_paridad_v2(w, pdu, client, data_len);
+            break;
+        case FIN:
+            handle_fin_v2(w, pdu, client, data_len);
+            break;
+        case SONDA:
+            send_ack_v2(w, client_addr, sizeof(struct sockaddr_in), id, ntohl(pdu->seq), NULL);
+            break;
+        case RRQ:
+            handle_rrq_v2(w, pdu, client, data_len);
+            break;
+        case ACK:
+            handle_ack_v2(w, pdu, client, data_len);
+            break;
+        default:
+            LOG(LOG_ERROR, "  [ERROR] Tipo v2 desconocido: %d\n", pdu->type);
+            break;
+    }
+}
+
+
+// despacha un datagrama recibido a la sesión que corresponde
+void despachar(Worker* w, App_PDU* pdu, int received, struct sockaddr_in* client_addr) {
+    metrica_sumar(M_DATAGRAMAS, 1);
+    if (received < PDU_HEADER_SIZE) {
+        return;
+    }
+
+    // PDUs v2: se distinguen por V2_FLAG en el 2do byte
+    if (pdu->seq_num & V2_FLAG) {
+        despachar_v2(w, (PDU_v2*)pdu, received, client_addr);
+        return;
+    }
+    if (received > (int)sizeof(App_PDU)) {
+        received = sizeof(App_PDU);     // v1 no tiene PDUs más largos
+        ((char*)pdu)[received] = '\0';
+    }
     
-    struct pollfd fds[1];
-    fds[0].fd = s;
-    fds[0].events = POLLIN;
+    ClientState* client = find_or_create_client(w, client_addr, sizeof(struct sockaddr_in));
+    if (!client) {
+        LOG(LOG_ERROR, "  [ERROR] Servidor lleno\n");
+        metrica_sumar(M_SERVIDOR_LLENO, 1);
+        return;
+    }
+
+    if (LOG_ACTIVO(LOG_DETALLE)) {
+        char client_ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_addr->sin_addr, client_ip, sizeof(client_ip));
+        LOG(LOG_DETALLE, "\n[RECV] %s:%d - Type=%s, Seq=%d\n",
+            client_ip, ntohs(client_addr->sin_port), type_to_string(pdu->type), pdu->seq_num);
+    }
     
-    App_PDU pdu;
-    struct sockaddr_in client_addr;
-    socklen_t addr_len;
+    switch (pdu->type) {
+        case HELLO:
+            handle_hello(w, pdu, client, received);
+            break;
+        case WRQ:
+            handle_wrq(w, pdu, client, received);
+            break;
+        case DATA:
+            handle_data(w, pdu, client, received);
+            break;
+        case FIN:
+            handle_fin(w, pdu, client, received);
+            break;
+        default:
+            LOG(LOG_ERROR, "  [ERROR] Tipo desconocido: %d\n", pdu->type);
+            break;
+    }
+}
+
+
+// despacha lo que trajo un buffer del lote: un datagrama o, con UDP_GRO,
+// varios de `segmento` bytes uno detrás del otro (el último puede ser más
+// corto). Los handlers esperan el payload terminado en '\0': se pisa el primer
+// byte del siguiente mientras se despacha cada uno (los DATA se copian al
+// pool, nada queda apuntando al buffer). Un datagrama más largo que lo que
+// se acepta se trunca, como en un recv común
+void despachar_recibido(Worker* w, char* buf, int received, int segmento, struct sockaddr_in* client_addr) {
+    for (int off = 0; off < received; off += segmento) {
+        int largo = (received - off < segmento) ? received - off : segmento;
+        if (largo > datagrama_max) {
+            largo = datagrama_max;
+        }
+        char* fin = buf + off + largo;
+        char pisado = *fin;
+        *fin = '\0';
+        despachar(w, (App_PDU*)(buf + off), largo, client_addr);
+        *fin = pisado;
+    }
+}
+
+
+void* worker_loop(void* arg) {
+    Worker* w = arg;
+
+    // los iovec de los lotes apuntan siempre a los mismos buffers: los msghdr
+    // se arman una vez acá y por datagrama solo se tocan los largos
+    for (int i = 0; i < LOTE; i++) {
+        w->rx_iov[i].iov_base = w->rx + (size_t)i * linea_redondear(w->tam_rx + 1);
+        w->rx_iov[i].iov_len = w->tam_rx;
+        memset(&w->rx_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        w->rx_msgs[i].msg_hdr.msg_name = &w->rx_addr[i];
+        w->rx_msgs[i].msg_hdr.msg_iov = &w->rx_iov[i];
+        w->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+
+        w->tx_iov[i][0].iov_base = w->tx_buf[i];
+        memset(&w->tx_msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        w->tx_msgs[i].msg_hdr.msg_name = &w->tx_addr[i];
+        w->tx_msgs[i].msg_hdr.msg_iov = w->tx_iov[i];
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = w->socket;
+    fds[0].events = POLLIN;
+    fds[1].fd = w->completados.eventfd;
+    fds[1].events = POLLIN;
+    int lote_lleno = 0;
     
     while (1) {
-        int poll_result = poll(fds, 1, -1);
+        // el timeout de poll es el próximo tick de la rueda de inactividad, o
+        // antes si vence el timer de alguna descarga. Si el último lote vino
+        // lleno probablemente haya más esperando: no se bloquea
+        int espera = lote_lleno ? 0 : rueda_espera_ms(&w->rueda);
+        if (espera > 0 && w->plazos.n > 0) {
+            espera = plazos_espera_ms(&w->plazos, get_monotonic_us(), espera);
+        }
+        int poll_result = poll(fds, 2, espera);
         
         if (poll_result < 0) {
             perror("poll");
             continue;
         }
-        
-        if (fds[0].revents & POLLIN) {
-            memset(&pdu, 0, sizeof(App_PDU));
-            addr_len = sizeof(client_addr);
-            
-            int received = recvfrom(s, &pdu, sizeof(App_PDU), 0,
-                                   (struct sockaddr*)&client_addr, &addr_len);
-            
-            if (received < PDU_HEADER_SIZE) {
-                continue;
-            }
-            
-            char client_ip[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-            printf("\n[RECV] %s:%d - Type=%s, Seq=%d\n",
-                   client_ip, ntohs(client_addr.sin_port),
-                   type_to_string(pdu.type), pdu.seq_num);
-            
-            ClientState* client = find_or_create_client(&client_addr, addr_len);
-            if (!client) {
-                printf("  [ERROR] Servidor lleno\n");
-                continue;
+
+        // primero los completados: liberan buffers del pool para el lote que sigue
+        if (fds[1].revents & POLLIN) {
+            procesar_completados(w);
+        }
+
+        rueda_avanzar(&w->rueda, expirar_client, w);
+        if (w->plazos.n > 0) {
+            uint64_t ahora = get_monotonic_us();
+            Descarga* d;
+            while ((d = plazos_vencido(&w->plazos, ahora)) != NULL) {
+                descarga_vencida(w, d, ahora);
             }
-            
-            switch (pdu.type) {
-                case HELLO:
-                    handle_hello(s, &pdu, client);
-                    break;
-                case WRQ:
-                    handle_wrq(s, &pdu, client);
-                    break;
-                case DATA:
-                    handle_data(s, &pdu, client, received);
-                    break;
-                case FIN:
-                    handle_fin(s, &pdu, client);
-                    break;
-                default:
-                    printf("  [ERROR] Tipo desconocido: %d\n", pdu.type);
-                    break;
+        }
+        lote_lleno = 0;
+        
+        if (!(fds[0].revents & POLLIN)) {
+            escritor_encolar(&escritor, w->a_escribir);     // checkpoints de los completados
+            w->a_escribir = NULL;
+            tx_flush(w);
+            continue;
+        }
+
+        for (int i = 0; i < LOTE; i++) {
+            w->rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            w->rx_msgs[i].msg_hdr.msg_control = w->rx_control[i];
+            w->rx_msgs[i].msg_hdr.msg_controllen = sizeof(w->rx_control[i]);
+        }
+
+        int n = recvmmsg(w->socket, w->rx_msgs, LOTE, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                perror("recvmmsg");
             }
+            continue;
+        }
+
+        w->rx_reloj = metricas_reloj();
+        for (int i = 0; i < n; i++) {
+            int received = w->rx_msgs[i].msg_len;
+            int segmento = gro_segmento(&w->rx_msgs[i].msg_hdr);
+            despachar_recibido(w, w->rx_iov[i].iov_base, received,
+                               segmento > 0 ? segmento : received, &w->rx_addr[i]);
+        }
+
+        escritor_encolar(&escritor, w->a_escribir);
+        w->a_escribir = NULL;
+        tx_flush(w);
+        lote_lleno = (n == LOTE);
+    }
+    
+    return NULL;
+}
+
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Uso: %s [-t workers] [-c max_sesiones] [-i timeout_inactividad_seg] "
+                    "[-e hilos_escritura] [-b buffers] [-d] [-g] [-m datagrama] [-v nivel] [-M archivo]\n", prog);
+    fprintf(stderr, "  -t: hilos worker con su propio socket SO_REUSEPORT (0 = uno por core, default 1)\n");
+    fprintf(stderr, "  -c: sesiones simultáneas máximas (default %d, se reparten entre los workers)\n", MAX_SESIONES);
+    fprintf(stderr, "  -i: segundos sin tráfico para expirar una sesión (default %d)\n", IDLE_TIMEOUT_SEG);
+    fprintf(stderr, "  -e: hilos que escriben a disco (default %d)\n", HILOS_ESCRITURA);
+    fprintf(stderr, "  -b: DATA en vuelo hacia el disco por worker; si se llena se descartan (default %d,\n"
+                    "      o los que entren en %d MB con bloques v2 grandes)\n", BUFFERS_ESCRITURA, MEMORIA_ESCRITURA >> 20);
+    fprintf(stderr, "  -d: ACK durable, recién cuando el DATA está escrito y sincronizado (default: al encolar)\n");
+    fprintf(stderr, "  -g: recibir con UDP_GRO (el kernel agrupa los datagramas seguidos de cada flujo)\n");
+    fprintf(stderr, "  -m: datagrama v2 más grande que se acepta en bytes, tope del bloque que se negocia (default %d)\n", DATAGRAMA_MAX);
+    fprintf(stderr, "  -v: detalle del log: 0 errores, 1 avisos, 2 sesiones (default), 3 cada PDU\n");
+    fprintf(stderr, "  -M: reescribir cada %d ms las métricas en este archivo (formato de texto de Prometheus)\n",
+            METRICAS_INTERVALO_MS);
+}
+
+
+int main(int argc, char* argv[]) {
+    int idle_seg = IDLE_TIMEOUT_SEG;
+    int n_workers = 1;
+    int hilos_escritura = HILOS_ESCRITURA;
+    int buffers = 0;
+    const char* ruta_metricas = NULL;
+    int opt_c;
+
+    while ((opt_c = getopt(argc, argv, "t:c:i:e:b:dgm:v:M:")) != -1) {
+        switch (opt_c) {
+            case 't': n_workers = atoi(optarg); break;
+            case 'c': max_sesiones = atoi(optarg); break;
+            case 'i': idle_seg = atoi(optarg); break;
+            case 'e': hilos_escritura = atoi(optarg); break;
+            case 'b': buffers = atoi(optarg); break;
+            case 'd': ack_durable = 1; break;
+            case 'g': gro = 1; break;
+            case 'm': datagrama_max = atoi(optarg); break;
+            case 'v': log_nivel = atoi(optarg); break;
+            case 'M': ruta_metricas = optarg; break;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+    if (n_workers == 0) {
+        n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (max_sesiones == 0 || idle_seg <= 0 || n_workers < 1 || n_workers > MAX_WORKERS ||
+        hilos_escritura < 1 || buffers < 0 ||
+        datagrama_max < V2_HEADER_SIZE + V2_BLOQUE_MIN || datagrama_max > DATAGRAMA_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // los buffers tienen que entrar además un PDU v1 entero
+    bloque_max = datagrama_max - V2_HEADER_SIZE;
+    if (datagrama_max < (int)sizeof(App_PDU)) {
+        datagrama_max = sizeof(App_PDU);
+    }
+    int tam_buffer = (bloque_max > MAX_DATA_SIZE) ? bloque_max : MAX_DATA_SIZE;
+    if (buffers == 0) {
+        buffers = MEMORIA_ESCRITURA / tam_buffer;
+        buffers = (buffers > BUFFERS_ESCRITURA) ? BUFFERS_ESCRITURA : buffers;
+    }
+    idle_ticks = (uint64_t)idle_seg * 1000 / TICK_MS;
+    grupos_init(&grupos, (uint64_t)idle_seg * 1000000);
+
+    printf("\n*==========================================*\n");
+    printf("|  SERVIDOR STOP & WAIT                    |\n");
+    printf("*==========================================*\n");
+    printf("|  Puerto: %-30s |\n", SERVER_PORT);
+    printf("|  Max sesiones: %-24u |\n", max_sesiones);
+    printf("|  Inactividad: %-22d s |\n", idle_seg);
+    printf("|  Workers: %-29d |\n", n_workers);
+    printf("|  Bloque v2 max: %-23d |\n", bloque_max);
+    printf("|  Escritura: %-2d hilos, ACK %-11s |\n", hilos_escritura, ack_durable ? "durable" : "al encolar");
+    printf("*==========================================*\n");
+
+    max_sesiones = (max_sesiones + n_workers - 1) / n_workers;
+    if (getrandom(clave_tickets, sizeof(clave_tickets), 0) != sizeof(clave_tickets)) {
+        perror("getrandom");    // sin clave impredecible no se emiten tickets que valgan
+        return 1;
+    }
+
+    // alineados a línea: cada hilo escribe solo en el suyo y dos workers
+    // vecinos no comparten ninguna
+    Worker* workers = linea_alloc((size_t)n_workers * sizeof(Worker));
+    if (!workers) {
+        perror("aligned_alloc");
+        return 1;
+    }
+    memset(workers, 0, (size_t)n_workers * sizeof(Worker));
+
+    // todos los sockets se crean antes de arrancar los hilos: si el grupo
+    // SO_REUSEPORT cambiara con tráfico en curso, un cliente podría cambiar de worker
+    for (int i = 0; i < n_workers; i++) {
+        workers[i].id = i;
+        slab_init(&workers[i].sesiones, sizeof(ClientState));
+        workers[i].socket = crear_socket(n_workers > 1);
+        if (workers[i].socket < 0) {
+            return 1;
         }
+        if (tabla_init(&workers[i].tabla, 1024) != 0 ||
+            rueda_init(&workers[i].rueda, RUEDA_SLOTS, TICK_MS) != 0 ||
+            pool_init(&workers[i].pool, buffers, tam_buffer) != 0 ||
+            plazos_init(&workers[i].plazos, PLAZOS_INICIAL) != 0) {
+            perror("malloc");
+            return 1;
+        }
+        if (completados_init(&workers[i].completados) != 0) {
+            perror("eventfd");
+            return 1;
+        }
+        workers[i].tam_rx = (gro && gro_activar(workers[i].socket) == 0) ? GRO_BUFFER - 1 : datagrama_max;
+        workers[i].rx = linea_alloc((size_t)LOTE * linea_redondear(workers[i].tam_rx + 1));
+        if (!workers[i].rx) {
+            perror("malloc");
+            return 1;
+        }
+    }
+
+    // sin el filtro todo funciona igual, pero una sesión v2 que cambia de
+    // dirección puede caer en otro worker y se pierde
+    if (n_workers > 1 && filtro_reuseport(workers[0].socket) != 0) {
+        fprintf(stderr, "Aviso: sin reparto por id de sesión entre workers\n");
+    }
+
+    // antes de los escritores: miden sus pwrite desde el primero
+    if (ruta_metricas && metricas_iniciar(ruta_metricas) != 0) {
+        return 1;
+    }
+    if (escritor_init(&escritor, hilos_escritura, ack_durable) != 0) {
+        perror("pthread_create");
+        return 1;
     }
     
-    close(s);
+    printf("\nServidor escuchando en puerto %s\n\n", SERVER_PORT);
+    log_iniciar();      // desde acá los workers solo encolan sus mensajes
+
+    for (int i = 1; i < n_workers; i++) {
+        if (pthread_create(&workers[i].hilo, NULL, worker_loop, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    worker_loop(&workers[0]);   // el hilo principal es el worker 0
+
+    for (int i = 0; i < n_workers; i++) {
+        tabla_free(&workers[i].tabla);
+        rueda_free(&workers[i].rueda);
+        pool_free(&workers[i].pool);
+        plazos_free(&workers[i].plazos);
+        free(workers[i].rx);
+        slab_free(&workers[i].sesiones);
+        close(workers[i].completados.eventfd);
+        close(workers[i].socket);
+    }
+    free(workers);
     return 0;
 }
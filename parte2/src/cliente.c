@@ -7,6 +7,7 @@ void print_usage(const char* prog) {
     fprintf(stderr, "  -a: IP del servidor\n");
     fprintf(stderr, "  -d: intervalo entre envíos en milisegundos\n");
     fprintf(stderr, "  -N: duración total de la prueba en segundos\n");
+    fprintf(stderr, "  -p: puerto del servidor (default %s, otro para pasar por el proxy)\n", SERVER_PORT);
     fprintf(stderr, "Ejemplo: %s -h 192.168.1.100 -d 50 -N 10\n", prog);
 }
 
@@ -15,13 +16,15 @@ int main(int argc, char* argv[]) {
     char* server_ip = NULL;
     int interval_ms = 0;
     int duration_sec = 0;
+    const char* server_port = SERVER_PORT;
     int opt;
 
-    while ((opt = getopt(argc, argv, "a:d:N:s:")) != -1) {
+    while ((opt = getopt(argc, argv, "a:d:N:s:p:")) != -1) {
         switch (opt) {
             case 'a': server_ip = optarg; break;
             case 'd': interval_ms = atoi(optarg); break;
             case 'N': duration_sec = atoi(optarg); break;
+            case 'p': server_port = optarg; break;
             default: print_usage(argv[0]); return 1;
         }
     }
@@ -44,7 +47,7 @@ int main(int argc, char* argv[]) {
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
 
-    int status = getaddrinfo(server_ip, SERVER_PORT, &hints, &servinfo);
+    int status = getaddrinfo(server_ip, server_port, &hints, &servinfo);
     if (status != 0) {
         fprintf(stderr, "Error en getaddrinfo(): %s\n", gai_strerror(status));
         return 1;
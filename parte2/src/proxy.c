@@ -0,0 +1,759 @@
+// relay UDP/TCP con degradación de red configurable (reemplazo local de WANem).
+// se ubica entre el cliente y el servidor:
+//
+//   cliente -p 20253  --->  proxy -l 20253 -s 127.0.0.1 (puerto 20252)  --->  servidor
+//
+// a cada paquete (UDP) o bloque de bytes (TCP) le aplica, en ambos sentidos:
+//   - limitación de tasa (-B): el enlace se modela como una cola FIFO que se
+//     "serializa" a B kbit/s; si la cola supera -Q ms de backlog se descarta (tail drop)
+//   - retardo fijo (-D) más jitter uniforme en [-J, +J] ms
+//   - pérdida (-L), duplicación (-U) y reordenamiento (-R: el paquete se demora -O ms extra)
+// todas las decisiones salen de un RNG con semilla (-S), uno por sentido, así
+// dos corridas con la misma semilla y el mismo tráfico degradan los mismos paquetes.
+//
+// en TCP no se pueden perder ni reordenar bytes sin romper el stream: una "pérdida"
+// se modela como la demora de una retransmisión (-T ms) y la entrega es siempre FIFO.
+//
+// en UDP los sockets piden buffers grandes (-b): con datagramas de hasta 64 KB el
+// default del kernel (~200 KB) se llena con tres y lo demás se descarta antes de
+// que el proxy lo vea, así que lo que se mide no es la degradación configurada.
+// Esos descartes del kernel se leen con SO_RXQ_OVFL y salen en las estadísticas
+// al lado de los propios.
+
+#define _GNU_SOURCE     // ppoll()
+#include <poll.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include "../include/common.h"
+
+
+#define MAX_FLUJOS 256          // clientes UDP / conexiones TCP simultáneas
+#define MAX_DATAGRAMA 65535
+#define FLUJO_IDLE_SEG 60       // un flujo UDP sin tráfico se libera a los 60 s
+#define BUFFER_SOCKET_KB 8192   // SO_RCVBUF/SO_SNDBUF de los sockets UDP (-b), como los servidores
+
+#define IDA    0                // cliente -> servidor
+#define VUELTA 1                // servidor -> cliente
+
+
+typedef struct {
+    double perdida;             // probabilidad [0, 1]
+    double duplicacion;
+    double reorden;
+    uint64_t retardo_us;
+    uint64_t jitter_us;
+    uint64_t extra_reorden_us;
+    uint64_t penalidad_tcp_us;  // demora de una "pérdida" en TCP
+    uint64_t tasa_bps;          // 0 = sin límite
+    uint64_t cola_max_us;       // backlog máximo del enlace limitado
+} Config;
+
+
+typedef struct {
+    uint64_t rng;
+    uint64_t enlace_libre_us;   // cuándo termina de serializarse lo ya encolado
+
+    uint64_t recibidos;
+    uint64_t entregados;
+    uint64_t bytes;
+    uint64_t perdidos;
+    uint64_t duplicados;
+    uint64_t reordenados;
+    uint64_t descartes_cola;
+    uint64_t descartes_kernel;  // buffer de recepción lleno (SO_RXQ_OVFL)
+} Sentido;
+
+
+typedef struct {
+    int activo;
+    int fd_cliente;             // TCP: socket aceptado. UDP: no se usa (se responde por el de escucha)
+    int fd_servidor;            // socket conectado al servidor
+    uint32_t ovfl_servidor;     // UDP: último contador SO_RXQ_OVFL de fd_servidor
+    struct sockaddr_in cliente;
+    uint64_t ultimo_uso_us;
+    uint64_t ultima_entrega_us[2];   // TCP: las entregas de un sentido nunca se adelantan entre sí
+    int fin_leido[2];           // TCP: ese sentido ya devolvió fin de stream (no se lee más)
+    int cerrado[2];             // TCP: ya se propagó el fin de stream de ese sentido
+    int pendientes;             // paquetes agendados que referencian este flujo
+} Flujo;
+
+
+typedef struct {
+    uint64_t t_us;              // momento de entrega
+    uint64_t orden;             // desempate: a igual tiempo se respeta el orden de llegada
+    Flujo* flujo;
+    int dir;
+    int len;                    // TCP: 0 = fin de stream
+    uint8_t* datos;
+} Paquete;
+
+
+// heap de mínimos por (t_us, orden) con los paquetes en tránsito
+typedef struct {
+    Paquete* v;
+    int n;
+    int cap;
+} Heap;
+
+
+Config cfg;
+Sentido sentidos[2];
+Flujo flujos[MAX_FLUJOS];
+Heap agenda;
+uint64_t orden_llegada = 0;
+int modo_tcp = 0;
+int fd_escucha = -1;
+uint32_t ovfl_escucha = 0;      // último contador SO_RXQ_OVFL de fd_escucha
+int buffer_socket = BUFFER_SOCKET_KB * 1024;
+struct sockaddr_in servidor_addr;
+volatile sig_atomic_t terminar = 0;
+
+
+// xorshift64*: rápido y reproducible, suficiente para decidir degradaciones
+uint64_t rng_next(uint64_t* s) {
+    uint64_t x = *s;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *s = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+// uniforme en [0, 1)
+double rng_unif(uint64_t* s) {
+    return (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+uint64_t ahora_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+
+int paquete_menor(const Paquete* a, const Paquete* b) {
+    return a->t_us < b->t_us || (a->t_us == b->t_us && a->orden < b->orden);
+}
+
+
+int heap_push(Heap* h, Paquete p) {
+    if (h->n == h->cap) {
+        int cap = h->cap ? h->cap * 2 : 1024;
+        Paquete* v = realloc(h->v, cap * sizeof(Paquete));
+        if (!v) {
+            return -1;
+        }
+        h->v = v;
+        h->cap = cap;
+    }
+
+    int i = h->n++;
+    while (i > 0 && paquete_menor(&p, &h->v[(i - 1) / 2])) {
+        h->v[i] = h->v[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->v[i] = p;
+    return 0;
+}
+
+
+Paquete heap_pop(Heap* h) {
+    Paquete top = h->v[0];
+    Paquete ultimo = h->v[--h->n];
+    int i = 0;
+
+    while (1) {
+        int hijo = 2 * i + 1;
+        if (hijo >= h->n) {
+            break;
+        }
+        if (hijo + 1 < h->n && paquete_menor(&h->v[hijo + 1], &h->v[hijo])) {
+            hijo++;
+        }
+        if (!paquete_menor(&h->v[hijo], &ultimo)) {
+            break;
+        }
+        h->v[i] = h->v[hijo];
+        i = hijo;
+    }
+    if (h->n > 0) {
+        h->v[i] = ultimo;
+    }
+    return top;
+}
+
+
+void liberar_flujo(Flujo* f) {
+    if (f->fd_servidor >= 0) close(f->fd_servidor);
+    if (modo_tcp && f->fd_cliente >= 0) close(f->fd_cliente);
+    memset(f, 0, sizeof(Flujo));
+    f->fd_cliente = -1;
+    f->fd_servidor = -1;
+}
+
+
+// buffers de envío y recepción de un socket UDP y el contador de descartes del
+// kernel. Sin CAP_NET_ADMIN el tamaño queda limitado por net.core.rmem_max/wmem_max
+void preparar_socket_udp(int fd) {
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_socket, sizeof(buffer_socket)) < 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_socket, sizeof(buffer_socket)) < 0) {
+        perror("setsockopt(SO_RCVBUF)");
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &buffer_socket, sizeof(buffer_socket)) < 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_socket, sizeof(buffer_socket)) < 0) {
+        perror("setsockopt(SO_SNDBUF)");
+    }
+    int uno = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &uno, sizeof(uno)) < 0) {
+        perror("setsockopt(SO_RXQ_OVFL)");
+    }
+}
+
+
+// recvfrom que además suma al sentido dir los datagramas que el kernel descartó
+// en ese socket desde la lectura anterior (*ovfl: el contador acumulado)
+int recibir_udp(int fd, uint8_t* buffer, struct sockaddr_in* addr, int dir, uint32_t* ovfl) {
+    struct iovec iov = { buffer, MAX_DATAGRAMA };
+    char control[CMSG_SPACE(sizeof(uint32_t))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = addr;
+    msg.msg_namelen = addr ? sizeof(*addr) : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int n = recvmsg(fd, &msg, 0);
+    if (n < 0) {
+        return n;
+    }
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t total;
+            memcpy(&total, CMSG_DATA(c), sizeof(total));
+            sentidos[dir].descartes_kernel += (uint32_t)(total - *ovfl);
+            *ovfl = total;
+        }
+    }
+    return n;
+}
+
+
+int conectar_servidor() {
+    int fd = socket(AF_INET, modo_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("Error en socket()");
+        return -1;
+    }
+    if (!modo_tcp) {
+        preparar_socket_udp(fd);
+    }
+    if (connect(fd, (struct sockaddr*)&servidor_addr, sizeof(servidor_addr)) < 0) {
+        perror("Error en connect() al servidor");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// decide qué le pasa a lo que acaba de llegar en el sentido dir y lo agenda
+void encolar(Flujo* f, int dir, const uint8_t* datos, int len) {
+    Sentido* sd = &sentidos[dir];
+    uint64_t ahora = ahora_us();
+
+    sd->recibidos++;
+
+    // limitación de tasa: la salida del enlace es FIFO
+    uint64_t salida = ahora;
+    if (cfg.tasa_bps > 0) {
+        uint64_t inicio = (sd->enlace_libre_us > ahora) ? sd->enlace_libre_us : ahora;
+        if (inicio - ahora > cfg.cola_max_us && len > 0) {
+            sd->descartes_cola++;
+            if (!modo_tcp) {
+                return;
+            }
+            // en TCP no se puede descartar: el backlog sigue creciendo
+        }
+        salida = inicio + (uint64_t)len * 8 * 1000000ULL / cfg.tasa_bps;
+        sd->enlace_libre_us = salida;
+    }
+
+    uint64_t demora = cfg.retardo_us;
+    if (cfg.jitter_us > 0) {
+        int64_t j = (int64_t)(rng_unif(&sd->rng) * (2 * cfg.jitter_us + 1)) - (int64_t)cfg.jitter_us;
+        demora = ((int64_t)demora + j > 0) ? demora + j : 0;
+    }
+
+    int copias = 1;
+    if (len > 0 && rng_unif(&sd->rng) < cfg.perdida) {
+        sd->perdidos++;
+        if (!modo_tcp) {
+            return;
+        }
+        demora += cfg.penalidad_tcp_us;
+    }
+    if (!modo_tcp && rng_unif(&sd->rng) < cfg.duplicacion) {
+        sd->duplicados++;
+        copias = 2;
+    }
+    if (!modo_tcp && rng_unif(&sd->rng) < cfg.reorden) {
+        sd->reordenados++;
+        demora += cfg.extra_reorden_us;
+    }
+
+    uint64_t entrega = salida + demora;
+    if (modo_tcp) {
+        if (entrega < f->ultima_entrega_us[dir]) {
+            entrega = f->ultima_entrega_us[dir];
+        }
+        f->ultima_entrega_us[dir] = entrega;
+    }
+
+    for (int i = 0; i < copias; i++) {
+        Paquete p;
+        p.t_us = entrega;
+        p.orden = orden_llegada++;
+        p.flujo = f;
+        p.dir = dir;
+        p.len = len;
+        p.datos = NULL;
+        if (len > 0) {
+            p.datos = malloc(len);
+            if (!p.datos) {
+                perror("Error en malloc()");
+                return;
+            }
+            memcpy(p.datos, datos, len);
+        }
+        if (heap_push(&agenda, p) < 0) {
+            perror("Error en realloc()");
+            free(p.datos);
+            return;
+        }
+        f->pendientes++;
+    }
+}
+
+
+void entregar(Paquete* p) {
+    Flujo* f = p->flujo;
+    Sentido* sd = &sentidos[p->dir];
+
+    f->pendientes--;
+
+    if (!f->activo) {
+        // el flujo se cerró mientras el paquete estaba en tránsito
+    } else if (modo_tcp) {
+        int destino = (p->dir == IDA) ? f->fd_servidor : f->fd_cliente;
+        if (p->len == 0) {
+            shutdown(destino, SHUT_WR);
+            f->cerrado[p->dir] = 1;
+        } else {
+            int off = 0;
+            while (off < p->len) {
+                ssize_t n = send(destino, p->datos + off, p->len - off, MSG_NOSIGNAL);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    perror("Error en send()");
+                    f->activo = 0;
+                    break;
+                }
+                off += n;
+            }
+            sd->entregados++;
+            sd->bytes += p->len;
+        }
+        if (f->cerrado[IDA] && f->cerrado[VUELTA]) {
+            f->activo = 0;
+        }
+    } else {
+        ssize_t n;
+        if (p->dir == IDA) {
+            n = send(f->fd_servidor, p->datos, p->len, 0);
+        } else {
+            n = sendto(fd_escucha, p->datos, p->len, 0, (struct sockaddr*)&f->cliente, sizeof(f->cliente));
+        }
+        if (n >= 0) {
+            sd->entregados++;
+            sd->bytes += p->len;
+        }
+    }
+
+    free(p->datos);
+
+    // el slot se reutiliza recién cuando no queda nada en tránsito que lo apunte
+    if (!f->activo && f->pendientes == 0 && (f->fd_servidor >= 0 || f->fd_cliente >= 0)) {
+        liberar_flujo(f);
+    }
+}
+
+
+Flujo* buscar_flujo_udp(struct sockaddr_in* addr) {
+    Flujo* libre = NULL;
+
+    for (int i = 0; i < MAX_FLUJOS; i++) {
+        Flujo* f = &flujos[i];
+        if (f->activo) {
+            if (f->cliente.sin_addr.s_addr == addr->sin_addr.s_addr &&
+                f->cliente.sin_port == addr->sin_port) {
+                return f;
+            }
+        } else if (!libre && f->pendientes == 0) {
+            libre = f;
+        }
+    }
+
+    if (!libre) {
+        return NULL;
+    }
+
+    int fd = conectar_servidor();
+    if (fd < 0) {
+        return NULL;
+    }
+    memset(libre, 0, sizeof(Flujo));
+    libre->activo = 1;
+    libre->fd_cliente = -1;
+    libre->fd_servidor = fd;
+    libre->cliente = *addr;
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip));
+    printf("[NUEVO] Flujo UDP %s:%d\n", ip, ntohs(addr->sin_port));
+    return libre;
+}
+
+
+void aceptar_tcp() {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept(fd_escucha, (struct sockaddr*)&addr, &addr_len);
+    if (fd < 0) {
+        perror("Error en accept()");
+        return;
+    }
+
+    Flujo* libre = NULL;
+    for (int i = 0; i < MAX_FLUJOS && !libre; i++) {
+        if (!flujos[i].activo && flujos[i].pendientes == 0) {
+            libre = &flujos[i];
+        }
+    }
+    int up = libre ? conectar_servidor() : -1;
+    if (up < 0) {
+        printf("[ERROR] Sin lugar o sin servidor, cerrando conexión\n");
+        close(fd);
+        return;
+    }
+
+    memset(libre, 0, sizeof(Flujo));
+    libre->activo = 1;
+    libre->fd_cliente = fd;
+    libre->fd_servidor = up;
+    libre->cliente = addr;
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    printf("[NUEVO] Conexión TCP %s:%d\n", ip, ntohs(addr.sin_port));
+}
+
+
+void imprimir_estadisticas() {
+    const char* nombres[2] = { "cliente->servidor", "servidor->cliente" };
+
+    printf("\n----- Estadísticas -----\n");
+    for (int d = 0; d < 2; d++) {
+        Sentido* sd = &sentidos[d];
+        printf("%s: recibidos=%llu entregados=%llu bytes=%llu perdidos=%llu duplicados=%llu "
+               "reordenados=%llu descartes_cola=%llu descartes_kernel=%llu\n",
+               nombres[d],
+               (unsigned long long)sd->recibidos, (unsigned long long)sd->entregados,
+               (unsigned long long)sd->bytes, (unsigned long long)sd->perdidos,
+               (unsigned long long)sd->duplicados, (unsigned long long)sd->reordenados,
+               (unsigned long long)sd->descartes_cola, (unsigned long long)sd->descartes_kernel);
+    }
+}
+
+
+void handle_signal(int sig) {
+    (void)sig;
+    terminar = 1;
+}
+
+
+void print_usage(const char* prog) {
+    fprintf(stderr, "Uso: %s (-u | -t) -l <puerto_local> -s <IP_SERVIDOR> [opciones]\n", prog);
+    fprintf(stderr, "  -u / -t: relay UDP (parte1) o TCP (parte2)\n");
+    fprintf(stderr, "  -l: puerto donde escucha el proxy\n");
+    fprintf(stderr, "  -s: IP del servidor, -p: puerto del servidor (default %s)\n", SERVER_PORT);
+    fprintf(stderr, "  -L: pérdida %%          -U: duplicación %%     -R: reordenamiento %%\n");
+    fprintf(stderr, "  -D: retardo ms         -J: jitter ms         -O: demora extra de un reordenado (default 10 ms)\n");
+    fprintf(stderr, "  -B: tasa kbit/s        -Q: backlog máximo de la cola ms (default 1000)\n");
+    fprintf(stderr, "  -T: demora de una pérdida en TCP ms (default 200)\n");
+    fprintf(stderr, "  -S: semilla del RNG (default 1)\n");
+    fprintf(stderr, "  -b: buffers de envío y recepción de los sockets UDP en KB (default %d)\n", BUFFER_SOCKET_KB);
+    fprintf(stderr, "Ejemplo: %s -u -l 20253 -s 127.0.0.1 -L 5 -D 50 -J 40 -S 7\n", prog);
+}
+
+
+int main(int argc, char* argv[]) {
+    const char* server_ip = NULL;
+    const char* server_port = SERVER_PORT;
+    const char* local_port = NULL;
+    int modo_udp = 0;
+    uint64_t semilla = 1;
+    int opt;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.extra_reorden_us = 10 * 1000;
+    cfg.penalidad_tcp_us = 200 * 1000;
+    cfg.cola_max_us = 1000 * 1000;
+
+    while ((opt = getopt(argc, argv, "utl:s:p:L:U:R:D:J:O:B:Q:T:S:b:")) != -1) {
+        switch (opt) {
+            case 'u': modo_udp = 1; break;
+            case 't': modo_tcp = 1; break;
+            case 'l': local_port = optarg; break;
+            case 's': server_ip = optarg; break;
+            case 'p': server_port = optarg; break;
+            case 'L': cfg.perdida = atof(optarg) / 100.0; break;
+            case 'U': cfg.duplicacion = atof(optarg) / 100.0; break;
+            case 'R': cfg.reorden = atof(optarg) / 100.0; break;
+            case 'D': cfg.retardo_us = atof(optarg) * 1000; break;
+            case 'J': cfg.jitter_us = atof(optarg) * 1000; break;
+            case 'O': cfg.extra_reorden_us = atof(optarg) * 1000; break;
+            case 'B': cfg.tasa_bps = atof(optarg) * 1000; break;
+            case 'Q': cfg.cola_max_us = atof(optarg) * 1000; break;
+            case 'T': cfg.penalidad_tcp_us = atof(optarg) * 1000; break;
+            case 'S': semilla = strtoull(optarg, NULL, 10); break;
+            case 'b': buffer_socket = atoi(optarg) * 1024; break;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    if (modo_udp == modo_tcp || !local_port || !server_ip || buffer_socket <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    printf("\n*========================================*\n");
+    printf("|  PROXY %s - DEGRADACIÓN DE RED        |\n", modo_tcp ? "TCP" : "UDP");
+    printf("*========================================*\n");
+    printf("|  Escucha: %-28s |\n", local_port);
+    printf("|  Servidor: %-19s:%-7s |\n", server_ip, server_port);
+    printf("|  Pérdida: %5.1f %%  Dup: %5.1f %%        |\n", cfg.perdida * 100, cfg.duplicacion * 100);
+    printf("|  Retardo: %5llu ms  Jitter: %5llu ms   |\n",
+           (unsigned long long)cfg.retardo_us / 1000, (unsigned long long)cfg.jitter_us / 1000);
+    printf("|  Reorden: %5.1f %%  Tasa: %8llu kbps |\n", cfg.reorden * 100,
+           (unsigned long long)cfg.tasa_bps / 1000);
+    printf("|  Semilla: %-28llu |\n", (unsigned long long)semilla);
+    printf("*========================================*\n");
+
+    // un RNG por sentido, derivados de la semilla (nunca en 0: xorshift se quedaría en 0)
+    sentidos[IDA].rng = semilla * 0x9E3779B97F4A7C15ULL + 1;
+    sentidos[VUELTA].rng = (semilla ^ 0xD1B54A32D192ED03ULL) * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (int i = 0; i < MAX_FLUJOS; i++) {
+        flujos[i].fd_cliente = -1;
+        flujos[i].fd_servidor = -1;
+    }
+
+    struct addrinfo hints, *servinfo;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = modo_tcp ? SOCK_STREAM : SOCK_DGRAM;
+
+    int status = getaddrinfo(server_ip, server_port, &hints, &servinfo);
+    if (status != 0) {
+        fprintf(stderr, "Error en getaddrinfo(): %s\n", gai_strerror(status));
+        return 1;
+    }
+    memcpy(&servidor_addr, servinfo->ai_addr, sizeof(servidor_addr));
+    freeaddrinfo(servinfo);
+
+    hints.ai_flags = AI_PASSIVE;
+    status = getaddrinfo(NULL, local_port, &hints, &servinfo);
+    if (status != 0) {
+        fprintf(stderr, "Error en getaddrinfo(): %s\n", gai_strerror(status));
+        return 1;
+    }
+
+    fd_escucha = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+    if (fd_escucha < 0) {
+        perror("Error en socket()");
+        freeaddrinfo(servinfo);
+        return 1;
+    }
+
+    int opt_val = 1;
+    setsockopt(fd_escucha, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val));
+    if (!modo_tcp) {
+        preparar_socket_udp(fd_escucha);
+        int rcv = 0, snd = 0;
+        socklen_t largo = sizeof(int);
+        getsockopt(fd_escucha, SOL_SOCKET, SO_RCVBUF, &rcv, &largo);
+        largo = sizeof(int);
+        getsockopt(fd_escucha, SOL_SOCKET, SO_SNDBUF, &snd, &largo);
+        printf("Buffers UDP: recepción %d KB, envío %d KB (efectivos)\n", rcv / 1024, snd / 1024);
+    }
+
+    if (bind(fd_escucha, servinfo->ai_addr, servinfo->ai_addrlen) < 0) {
+        perror("Error en bind()");
+        close(fd_escucha);
+        freeaddrinfo(servinfo);
+        return 1;
+    }
+    freeaddrinfo(servinfo);
+
+    if (modo_tcp && listen(fd_escucha, 16) < 0) {
+        perror("Error en listen()");
+        close(fd_escucha);
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    printf("\nProxy escuchando en puerto %s\n", local_port);
+
+    uint8_t* buffer = malloc(MAX_DATAGRAMA);
+    struct pollfd fds[1 + 2 * MAX_FLUJOS];
+    Flujo* fd_flujo[1 + 2 * MAX_FLUJOS];
+    int fd_dir[1 + 2 * MAX_FLUJOS];
+
+    if (!buffer) {
+        perror("Error en malloc()");
+        close(fd_escucha);
+        return 1;
+    }
+
+    while (!terminar) {
+
+        // armar el conjunto de sockets a vigilar
+        int nfds = 0;
+        fds[nfds].fd = fd_escucha;
+        fds[nfds].events = POLLIN;
+        fd_flujo[nfds] = NULL;
+        nfds++;
+
+        uint64_t ahora = ahora_us();
+        for (int i = 0; i < MAX_FLUJOS; i++) {
+            Flujo* f = &flujos[i];
+            if (!f->activo) {
+                continue;
+            }
+            if (!modo_tcp && f->pendientes == 0 && ahora - f->ultimo_uso_us > FLUJO_IDLE_SEG * 1000000ULL) {
+                liberar_flujo(f);
+                continue;
+            }
+            if (!modo_tcp || !f->fin_leido[VUELTA]) {
+                fds[nfds].fd = f->fd_servidor;
+                fds[nfds].events = POLLIN;
+                fd_flujo[nfds] = f;
+                fd_dir[nfds] = VUELTA;
+                nfds++;
+            }
+            if (modo_tcp && !f->fin_leido[IDA]) {
+                fds[nfds].fd = f->fd_cliente;
+                fds[nfds].events = POLLIN;
+                fd_flujo[nfds] = f;
+                fd_dir[nfds] = IDA;
+                nfds++;
+            }
+        }
+
+        // dormir hasta el próximo paquete agendado (o hasta que llegue algo).
+        // ppoll() en vez de poll() para no redondear los retardos a milisegundos
+        uint64_t espera_us = 1000000;
+        if (agenda.n > 0) {
+            uint64_t t = agenda.v[0].t_us;
+            espera_us = (t > ahora) ? t - ahora : 0;
+            if (espera_us > 1000000) espera_us = 1000000;
+        }
+        struct timespec espera;
+        espera.tv_sec = espera_us / 1000000;
+        espera.tv_nsec = (espera_us % 1000000) * 1000;
+
+        int res = ppoll(fds, nfds, &espera, NULL);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            perror("Error en poll()");
+            break;
+        }
+
+        for (int i = 0; i < nfds && res > 0; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            if (i == 0) {
+                if (modo_tcp) {
+                    aceptar_tcp();
+                    continue;
+                }
+                struct sockaddr_in addr;
+                int n = recibir_udp(fd_escucha, buffer, &addr, IDA, &ovfl_escucha);
+                if (n < 0) {
+                    continue;
+                }
+                Flujo* f = buscar_flujo_udp(&addr);
+                if (!f) {
+                    printf("[ERROR] Sin lugar para un flujo nuevo\n");
+                    continue;
+                }
+                f->ultimo_uso_us = ahora_us();
+                encolar(f, IDA, buffer, n);
+                continue;
+            }
+
+            Flujo* f = fd_flujo[i];
+            int n = modo_tcp ? recv(fds[i].fd, buffer, MAX_DATAGRAMA, 0)
+                             : recibir_udp(fds[i].fd, buffer, NULL, VUELTA, &f->ovfl_servidor);
+            if (n < 0) {
+                if (modo_tcp) {
+                    n = 0;       // error en la conexión: se propaga como fin de stream
+                } else {
+                    continue;    // p.ej. ICMP port unreachable del servidor
+                }
+            }
+            if (modo_tcp && n == 0) {
+                // el fin de stream viaja con el mismo retardo que los datos
+                f->fin_leido[fd_dir[i]] = 1;
+                encolar(f, fd_dir[i], NULL, 0);
+                continue;
+            }
+            f->ultimo_uso_us = ahora_us();
+            encolar(f, fd_dir[i], buffer, n);
+        }
+
+        // entregar todo lo que ya venció
+        ahora = ahora_us();
+        while (agenda.n > 0 && agenda.v[0].t_us <= ahora) {
+            Paquete p = heap_pop(&agenda);
+            entregar(&p);
+        }
+    }
+
+    imprimir_estadisticas();
+
+    while (agenda.n > 0) {
+        Paquete p = heap_pop(&agenda);
+        free(p.datos);
+    }
+    free(agenda.v);
+    free(buffer);
+    for (int i = 0; i < MAX_FLUJOS; i++) {
+        if (flujos[i].fd_servidor >= 0 || flujos[i].fd_cliente >= 0) {
+            liberar_flujo(&flujos[i]);
+        }
+    }
+    close(fd_escucha);
+    printf("\nProxy cerrado\n");
+
+    return 0;
+}